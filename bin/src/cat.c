@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -205,6 +206,18 @@ static int fastcat(FILE * file)
         return 1;
     }
 
+    /*
+     * Try to move the data inside the kernel first and fallback to read()
+     * and write() if the files don't support it.
+     */
+    do {
+        n = sendfile(fileno(stdout), fd, NULL, buffsize);
+    } while (n > 0);
+    if (n == 0) {
+        free(buff);
+        return 0;
+    }
+
     /*
      * Note that on some systems (V7), very large writes to a pipe
      * return less than the requested size of the write.
@@ -6,6 +6,7 @@
  */
 
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,6 +26,7 @@ static char * argv0;
 
 static int copy(char * from, char * to);
 static int rcopy(char * from, char * to);
+static int rwcopy(int fold, int fnew, char * from, char * to);
 static int setimes(char * path, struct stat * statp);
 static void cp_perror(const char * s);
 
@@ -87,7 +89,6 @@ static int copy(char * from, char * to)
 {
     int fold, fnew, n, exists;
     char * destname = NULL;
-    char * buf = NULL;
     struct stat stfrom, stto;
     int retval = 0;
 
@@ -186,36 +187,57 @@ static int copy(char * from, char * to)
     if (exists && pflag)
         (void)fchmod(fnew, stfrom.st_mode & 07777);
 
-    buf = malloc(MAXBSIZE);
-    for (;;) {
-        n = read(fold, buf, sizeof(buf));
-        if (n == 0)
-            break;
-        if (n < 0) {
+    /*
+     * Try to copy inside the kernel without bouncing the data via user space
+     * and fallback to read() and write() if the files don't support it.
+     */
+    do {
+        n = sendfile(fnew, fold, NULL, MAXBSIZE);
+    } while (n > 0);
+    if (n < 0) {
+        if (errno == EINVAL || errno == EOPNOTSUPP) {
+            retval = rwcopy(fold, fnew, from, to);
+        } else {
             cp_perror(from);
-            (void)close(fold);
-            (void)close(fnew);
             retval = 1;
-            goto out;
-        }
-        if (write(fnew, buf, n) != n) {
-            cp_perror(to);
-            (void)close(fold);
-            (void)close(fnew);
-            retval = 1;
-            goto out;
         }
     }
     (void)close(fold);
     (void)close(fnew);
-    if (pflag)
+    if (!retval && pflag)
         retval = setimes(to, &stfrom);
 out:
     free(destname);
-    free(buf);
     return retval;
 }
 
+static int rwcopy(int fold, int fnew, char * from, char * to)
+{
+    char * buf;
+    int n;
+
+    buf = malloc(MAXBSIZE);
+    if (!buf) {
+        cp_perror(from);
+        return 1;
+    }
+
+    while ((n = read(fold, buf, MAXBSIZE)) > 0) {
+        if (write(fnew, buf, n) != n) {
+            cp_perror(to);
+            free(buf);
+            return 1;
+        }
+    }
+    free(buf);
+    if (n < 0) {
+        cp_perror(from);
+        return 1;
+    }
+
+    return 0;
+}
+
 static int rcopy(char * from, char * to)
 {
     DIR *fold = opendir(from);
@@ -76,6 +76,7 @@ int main(int argc, char * argv[], char * envp[])
     struct kinfo_vmentry * vmmap;
     struct kinfo_vmentry * entry;
     size_t n;
+    size_t rss_shared = 0, rss_private = 0;
 
     if (argc < 2 || sscanf(argv[1], "%d", &pid) != 1) {
         fprintf(stderr, "usage: %s PID\n", argv[0]);
@@ -90,17 +91,25 @@ int main(int argc, char * argv[], char * envp[])
         return EX_NOINPUT;
     }
 
-    printf("START      END        PADDR      FLAGS     UAP\n");
+    printf("START      END        PADDR      FLAGS     UAP  RSS(kB) S\n");
     entry = vmmap;
     for (size_t i = 0; i < n; i++) {
-        printf("0x%08x 0x%08x 0x%08x 0x%07x %s\n",
+        printf("0x%08x 0x%08x 0x%08x 0x%07x %s %7u %c\n",
                entry->reg_start,
                entry->reg_end,
                entry->paddr,
                entry->flags,
-               entry->uap);
+               entry->uap,
+               (unsigned)(entry->rss / 1024),
+               entry->shared ? 'S' : 'P');
+        if (entry->shared)
+            rss_shared += entry->rss;
+        else
+            rss_private += entry->rss;
         entry++;
     }
+    printf("Resident: %u kB shared, %u kB private\n",
+           (unsigned)(rss_shared / 1024), (unsigned)(rss_private / 1024));
 
     free(vmmap);
     return EX_OK;
@@ -43,6 +43,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types/_ssize_t.h>
 
 #ifndef _MODE_T_DECLARED
 typedef int mode_t; /*!< Used for some file attributes. */
@@ -150,6 +151,11 @@ typedef int pid_t; /*!< Process ID. */
 #define AT_SYMLINK_FOLLOW   0x40 /*!< Follow symbolic link. */
 #define AT_REMOVEDIR        0x80 /*!< Remove directory instead of file. */
 
+/* splice() flags */
+#define SPLICE_F_MOVE       0x01 /*!< Move pages instead of copying, a hint. */
+#define SPLICE_F_NONBLOCK   0x02 /*!< Don't block on pipe I/O. */
+#define SPLICE_F_MORE       0x04 /*!< More data will be spliced, a hint. */
+
 /**
  * File lock.
  */
@@ -188,6 +194,21 @@ struct _fs_open_args {
     mode_t mode;
 };
 
+#define _SPLICE_F_OFF_IN    0x100 /*!< off_in is set. */
+#define _SPLICE_F_OFF_OUT   0x200 /*!< off_out is set. */
+
+/**
+ * Arguments for SYSCALL_FS_SPLICE, SYSCALL_FS_TEE and SYSCALL_FS_SENDFILE.
+ */
+struct _fs_splice_args {
+    int fd_in;
+    off_t off_in;   /*!< Input and return value if _SPLICE_F_OFF_IN. */
+    int fd_out;
+    off_t off_out;  /*!< Input and return value if _SPLICE_F_OFF_OUT. */
+    size_t len;
+    unsigned flags;
+};
+
 #endif
 
 #ifndef KERNEL_INTERNAL
@@ -209,6 +230,48 @@ int creat(const char *, mode_t);
  */
 int fcntl(int fd, int cmd, ... /* arg */);
 
+/**
+ * Move data between two file descriptors without copying it through the
+ * user space.
+ * At least one of the file descriptors must refer to a pipe.
+ * @param fd_in     is the source file descriptor.
+ * @param off_in    is an optional offset to read from; Updated on return.
+ *                  Must be NULL if fd_in is a pipe.
+ * @param fd_out    is the destination file descriptor.
+ * @param off_out   is an optional offset to write to; Updated on return.
+ *                  Must be NULL if fd_out is a pipe.
+ * @param len       is the maximum number of bytes to move.
+ * @param flags     is a bitwise or of SPLICE_F_ flags.
+ * @return Returns the number of bytes moved, 0 on EOF;
+ *         Otherwise -1 is returned and errno is set.
+ */
+ssize_t splice(int fd_in, off_t * off_in, int fd_out, off_t * off_out,
+               size_t len, unsigned flags);
+
+/**
+ * Duplicate data from a pipe to another pipe without consuming it.
+ * @param fd_in     is the source pipe.
+ * @param fd_out    is the destination pipe.
+ * @param len       is the maximum number of bytes to duplicate.
+ * @param flags     is a bitwise or of SPLICE_F_ flags.
+ * @return Returns the number of bytes duplicated;
+ *         Otherwise -1 is returned and errno is set.
+ */
+ssize_t tee(int fd_in, int fd_out, size_t len, unsigned flags);
+
+/**
+ * Transfer data between two file descriptors inside the kernel.
+ * @param out_fd    is the destination file descriptor.
+ * @param in_fd     is the source file descriptor.
+ * @param offset    is an optional offset to read from; If set the file
+ *                  offset of in_fd is not changed and offset is updated
+ *                  to point to the byte following the last byte read.
+ * @param count     is the maximum number of bytes to transfer.
+ * @return Returns the number of bytes transferred;
+ *         Otherwise -1 is returned and errno is set.
+ */
+ssize_t sendfile(int out_fd, int in_fd, off_t * offset, size_t count);
+
 /**
  * @}
  */
@@ -57,7 +57,8 @@
 #define PATH_MAX        4096        /*!< Maximum path length. */
 #define NGROUPS_MAX     16
 
-/* TODO PIPE_BUF */
+#define PIPE_BUF        512         /*!< Maximum number of bytes written
+                                     *   atomically to a pipe. */
 
 
 /* Runtime Increasable Values */
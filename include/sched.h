@@ -53,7 +53,13 @@ struct sched_param {
 /* Scheduling policies */
 #define SCHED_FIFO  0
 #define SCHED_RR    1
-#define SCHED_OTHER 1
+#define SCHED_FAIR  2 /*!< Proportional share. */
+/**
+ * The default policy.
+ * Ordinary threads share the CPU in proportion to their nice values and
+ * SCHED_FIFO and SCHED_RR threads are always selected before them.
+ */
+#define SCHED_OTHER SCHED_FAIR
 
 #define NICE_MAX    20
 /* Default: NZERO */
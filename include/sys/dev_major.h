@@ -43,6 +43,7 @@
 #define VDEV_MJNR_UART       4
 #define VDEV_MJNR_PTY        5
 #define VDEV_MJNR_EMMC       8
+#define VDEV_MJNR_MD        20
 #define VDEV_MJNR_FB        29
 #define VDEV_MJNR_FBMM      30
 
@@ -67,6 +67,9 @@
 #define IOCTL_FLSBLKBUF    24 /*1< Flush block device buffers. */
 /* pty */
 #define IOCTL_PTY_CREAT    50 /*!< Create a new pty master-slave pair. */
+/* md */
+#define IOCTL_MD_CREAT     61 /*!< Create a new memory disk. */
+#define IOCTL_MD_DESTROY   62 /*!< Destroy a memory disk. */
 /* dev/fb */
 #define IOCTL_FB_GETRES   101 /*!< Get the frame buffer resolution. */
 #define IOCTL_FB_SETRES   102 /*!< Change the framebuffer resolution. */
@@ -0,0 +1,59 @@
+/**
+ *******************************************************************************
+ * @file    sys/md.h
+ * @author  Olli Vanhoja
+ * @brief   Memory disk interface.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/**
+ * @addtogroup LIBC
+ * @{
+ */
+
+#ifndef SYS_MD_H
+#define SYS_MD_H
+
+#include <stddef.h>
+
+#define MD_BLOCK_SIZE   512 /*!< Block size of memory disks. */
+
+/**
+ * Arguments for IOCTL_MD_CREAT on /dev/mdctl.
+ */
+struct md_ioctl {
+    size_t md_size;         /*!< Size in bytes, rounded up to a block. */
+    unsigned md_lat_us;     /*!< Injected latency per transfer in us. */
+    unsigned md_blk_us;     /*!< Injected latency per block in us. */
+    int md_unit;            /*!< Returns the unit number of the new device. */
+};
+
+#endif /* SYS_MD_H */
+
+/**
+ * @}
+ */
@@ -71,6 +71,8 @@ struct kinfo_vmentry {
     uintptr_t reg_end;
     unsigned long flags;
     char uap[5];
+    size_t rss;         /*!< Resident size of the region in bytes. */
+    int shared;         /*!< The resident pages are shared with others. */
 };
 
 #endif /* _SYS_PROC_H_ */
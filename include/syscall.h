@@ -158,6 +158,9 @@
 #define SYSCALL_FS_UMASK            SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x14)
 #define SYSCALL_FS_MOUNT            SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x15)
 #define SYSCALL_FS_UMOUNT           SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x16)
+#define SYSCALL_FS_SPLICE           SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x17)
+#define SYSCALL_FS_TEE              SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x18)
+#define SYSCALL_FS_SENDFILE         SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x19)
 #define SYSCALL_IOCTL_GETSET        SYSCALL_MMTOTYPE(SYSCALL_GROUP_IOCTL, 0x00)
 #define SYSCALL_SHMEM_MMAP          SYSCALL_MMTOTYPE(SYSCALL_GROUP_SHMEM, 0x00)
 #define SYSCALL_SHMEM_MUNMAP        SYSCALL_MMTOTYPE(SYSCALL_GROUP_SHMEM, 0x01)
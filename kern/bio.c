@@ -35,51 +35,455 @@
 #include <idle.h>
 #include <kstring.h>
 #include <sys/linker_set.h>
-#include <sys/tree.h>
+#include <sys/sysctl.h>
 #include <sys/types.h>
 #include <buf.h>
+#include <fs/blkq.h>
 #include <fs/devfs.h>
 #include <kerror.h>
+#include <kinit.h>
 #include <kmalloc.h>
+#include <libkern.h>
+#include <thread.h>
+#include <waitq.h>
 
 /*
- * Used to protect access caching data structures and synchronizing access
- * to some functions.
+ * Used to protect the LRU list of released buffers and the cache size
+ * accounting.
  *
  * TODO We'd like to use MTX_TYPE_TICKET here but bio_clean() makes it
  * impossible right now.
  */
 static mtx_t cache_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_SLEEP |
                                                          MTX_OPT_PRICEIL);
+/*
+ * Released buffers in LRU order, the least recently used buffer is the first
+ * one in the list.
+ */
 static TAILQ_HEAD(bio_relse_list_head, buf) relse_list =
      TAILQ_HEAD_INITIALIZER(relse_list);
 
+/*
+ * Global (vnode, blkno) hash of cached buffers.
+ */
+#define BIO_HASH_BITS 8
+#define BIO_HASH_SIZE (1 << BIO_HASH_BITS)
+
+static struct bio_bucket {
+    mtx_t lock;
+    LIST_HEAD(bio_bucket_head, buf) head;
+} bio_hashtbl[BIO_HASH_SIZE] = {
+    [0 ... BIO_HASH_SIZE - 1] = {
+        .lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DEFAULT),
+        .head = LIST_HEAD_INITIALIZER(head),
+    },
+};
+
+/*
+ * Asynchronous I/O queue served by the bio worker thread.
+ */
+static mtx_t ioq_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DINT);
+static TAILQ_HEAD(bio_ioq_head, buf) ioq = TAILQ_HEAD_INITIALIZER(ioq);
+static pthread_t bio_worker_tid = -1;
+
+static struct waitq ioq_waitq = WAITQ_INITIALIZER(ioq_waitq);
+
+/*
+ * Threads sleeping in biowait(), hashed by the buffer address.
+ */
+#define BIO_WAITQ_SIZE 16
+static struct waitq bio_waitqs[BIO_WAITQ_SIZE];
+
+static unsigned bio_readahead = 2;
+static unsigned bio_maxbytes = configBIO_MAXSIZE * 1024;
+static unsigned bio_cached_bytes; /* Protected by cache_lock. */
+static atomic_t bio_dirty_bytes;
+static atomic_t bio_hits;
+static atomic_t bio_misses;
+static atomic_t bio_evictions;
+static atomic_t bio_clustered;
+
+SYSCTL_DECL(_vfs_bio);
+SYSCTL_NODE(_vfs, OID_AUTO, bio, CTLFLAG_RW, 0,
+            "Buffer cache");
+
+SYSCTL_UINT(_vfs_bio, OID_AUTO, readahead, CTLFLAG_RW,
+            &bio_readahead, 0,
+            "Number of blocks read ahead on sequential access");
+SYSCTL_UINT(_vfs_bio, OID_AUTO, maxbytes, CTLFLAG_RW,
+            &bio_maxbytes, 0, "Buffer cache size limit");
+SYSCTL_UINT(_vfs_bio, OID_AUTO, bytes, CTLFLAG_RD,
+            &bio_cached_bytes, 0, "Buffer cache size");
+SYSCTL_INT(_vfs_bio, OID_AUTO, dirty_bytes, CTLFLAG_RD,
+           &bio_dirty_bytes, 0, "Bytes waiting for a delayed write");
+SYSCTL_INT(_vfs_bio, OID_AUTO, hits, CTLFLAG_RD,
+           &bio_hits, 0, "Buffer cache hits");
+SYSCTL_INT(_vfs_bio, OID_AUTO, misses, CTLFLAG_RD,
+           &bio_misses, 0, "Buffer cache misses");
+SYSCTL_INT(_vfs_bio, OID_AUTO, evictions, CTLFLAG_RD,
+           &bio_evictions, 0, "Buffers evicted from the cache");
+SYSCTL_INT(_vfs_bio, OID_AUTO, clustered, CTLFLAG_RD,
+           &bio_clustered, 0, "Delayed writes merged to an adjacent write");
+
+/*
+ * Max number of delayed writes collected at once by bio_clean().
+ */
+#define BIO_CLEAN_BATCH 32
+
 static void _bio_readin(struct buf * bp);
+static file_t * bio_iofile(struct buf * bp);
 static void _bio_writeout(struct buf * bp);
 static void bl_brelse(struct buf * bp);
+static void bl_biodone(struct buf * bp);
 static int biowait_timo(struct buf * bp, long timeout);
 static void bio_clean(uintptr_t freebufs);
 
-SPLAY_GENERATE(bufhd_splay, buf, sentry_, biobuf_compar);
-
 /* Init bio, called by vralloc_init() */
 void _bio_init(void)
 {
     cache_lock.pri.p_lock = NICE_MIN;
+
+    for (size_t i = 0; i < num_elem(bio_waitqs); i++) {
+        waitq_init(&bio_waitqs[i]);
+    }
 }
 
-/*
- * Comparator for buffer splay trees.
+static struct bio_bucket * bio_hash(vnode_t * vnode, size_t blkno)
+{
+    uint32_t h;
+
+    /* blkno is a byte offset, so the lowest bits are mostly zero. */
+    h = ((uintptr_t)vnode / sizeof(vnode_t)) ^ (blkno >> 9);
+    h *= 0x9E3779B1; /* Fibonacci hashing */
+
+    return &bio_hashtbl[h >> (32 - BIO_HASH_BITS)];
+}
+
+static struct buf * bl_incore(struct bio_bucket * bucket, vnode_t * vnode,
+                              size_t blkno)
+{
+    struct buf * bp;
+
+    LIST_FOREACH(bp, &bucket->head, hash_entry_) {
+        if (bp->b_file.vnode == vnode && bp->b_blkno == blkno)
+            return bp;
+    }
+
+    return NULL;
+}
+
+static void bl_set_delwri(struct buf * bp)
+{
+    if (!(bp->b_flags & B_DELWRI)) {
+        bp->b_flags |= B_DELWRI;
+        atomic_add(&bio_dirty_bytes, bp->b_bcount);
+    }
+}
+
+static void bl_clr_delwri(struct buf * bp)
+{
+    if (bp->b_flags & B_DELWRI) {
+        bp->b_flags &= ~B_DELWRI;
+        atomic_sub(&bio_dirty_bytes, bp->b_bcount);
+    }
+}
+
+/**
+ * Remove a buffer from the hash and the vnode buffer list.
+ * The buffer must be locked.
+ * @param trylock tells if the vnode lock should be only tried.
+ * @return 0 if succeed; -EWOULDBLOCK if trylock was set and the vnode lock
+ *         couldn't be acquired.
  */
-int biobuf_compar(struct buf * a, struct buf * b)
+static int bl_bio_unhash(struct buf * bp, int trylock)
 {
-    KASSERT(a->b_file.vnode == b->b_file.vnode,
-            "vnodes differ in the same tree");
+    vnode_t * vnode = bp->b_file.vnode;
+    struct bio_bucket * bucket = bio_hash(vnode, bp->b_blkno);
+
+    if (bp->vnode_entry_.le_prev) {
+        if (trylock) {
+            if (VN_TRYLOCK(vnode))
+                return -EWOULDBLOCK;
+        } else {
+            VN_LOCK(vnode);
+        }
+        LIST_REMOVE(bp, vnode_entry_);
+        bp->vnode_entry_.le_prev = NULL;
+        VN_UNLOCK(vnode);
+    }
+
+    if (bp->hash_entry_.le_prev) {
+        mtx_lock(&bucket->lock);
+        LIST_REMOVE(bp, hash_entry_);
+        bp->hash_entry_.le_prev = NULL;
+        mtx_unlock(&bucket->lock);
+    }
 
-    return (a->b_blkno - b->b_blkno);
+    return 0;
+}
+
+/**
+ * Remove bp from the cache size accounting.
+ * Buffers allocated with geteblk() were never counted.
+ * cache_lock and the buffer lock must be held by the caller.
+ */
+static void bl_bio_uncount(struct buf * bp)
+{
+    if (bp->b_flags & B_CACHED) {
+        bp->b_flags &= ~B_CACHED;
+        bio_cached_bytes -= bp->b_bufsize;
+    }
+}
+
+/**
+ * Evict least recently used buffers until need bytes fits in the cache.
+ * Buffers that are busy, locked in memory or waiting for a delayed write
+ * are skipped.
+ * cache_lock must be held by the caller.
+ */
+static void bl_bio_evict(size_t need)
+{
+    struct buf * bp;
+    struct buf * bp_tmp;
+
+    TAILQ_FOREACH_SAFE(bp, &relse_list, relse_entry_, bp_tmp) {
+        if (bio_cached_bytes + need <= bio_maxbytes)
+            break;
+
+        if (mtx_trylock(&bp->lock))
+            continue;
+        if ((bp->b_flags & (B_BUSY | B_LOCKED | B_DELWRI)) ||
+            !(bp->b_flags & B_DONE) ||
+            bl_bio_unhash(bp, 1)) {
+            BUF_UNLOCK(bp);
+            continue;
+        }
+
+        TAILQ_REMOVE(&relse_list, bp, relse_entry_);
+        bp->relse_entry_.tqe_prev = NULL;
+        bl_bio_uncount(bp);
+        atomic_inc(&bio_evictions);
+        BUF_UNLOCK(bp);
+        vrfree(bp);
+    }
+}
+
+/**
+ * Queue I/O for the bio worker.
+ * The buffer must be locked and marked busy. If the worker isn't running
+ * the I/O is done synchronously.
+ */
+static void bl_bio_queue(struct buf * bp)
+{
+    KASSERT(mtx_test(&bp->lock), "bp should be locked\n");
+
+    if (bio_worker_tid < 0 || current_thread->id == bio_worker_tid) {
+        if (bp->b_flags & B_READ)
+            _bio_readin(bp);
+        else
+            _bio_writeout(bp);
+        return;
+    }
+
+    bp->b_flags &= ~B_DONE;
+    mtx_lock(&ioq_lock);
+    TAILQ_INSERT_TAIL(&ioq, bp, ioq_entry_);
+    mtx_unlock(&ioq_lock);
+
+    waitq_wakeup_one(&ioq_waitq);
+}
+
+static struct buf * bio_ioq_pop(void)
+{
+    struct buf * bp;
+
+    mtx_lock(&ioq_lock);
+    bp = TAILQ_FIRST(&ioq);
+    if (bp)
+        TAILQ_REMOVE(&ioq, bp, ioq_entry_);
+    mtx_unlock(&ioq_lock);
+
+    return bp;
+}
+
+static void * bio_worker(void * arg)
+{
+    struct waitq_entry we;
+
+    while (1) {
+        struct buf * bp;
+
+        /* Wait until bl_bio_queue() wakes us up. */
+        waitq_prepare(&ioq_waitq, &we);
+        while (!(bp = bio_ioq_pop())) {
+            waitq_sleep(&ioq_waitq, &we);
+        }
+        waitq_finish(&ioq_waitq, &we);
+
+        BUF_LOCK(bp);
+        if (bp->b_flags & B_READ)
+            _bio_readin(bp);
+        else
+            _bio_writeout(bp);
+        BUF_UNLOCK(bp);
+    }
+}
+
+int __kinit__ bio_init(void)
+{
+    SUBSYS_DEP(sched_init);
+    SUBSYS_INIT("bio");
+
+    struct sched_param param = {
+        .sched_policy = SCHED_FIFO,
+        .sched_priority = NICE_MIN,
+    };
+    pthread_t tid;
+
+    tid = kthread_create("bio", &param, 0, bio_worker, NULL);
+    if (tid < 0) {
+        KERROR(KERROR_ERR, "Failed to create a thread for async I/O");
+        return tid;
+    }
+    bio_worker_tid = tid;
+
+    return 0;
+}
+
+/**
+ * Get the device of vnode if it has a request queue.
+ */
+static struct dev_info * bio_blkq_dev(vnode_t * vnode)
+{
+    struct dev_info * dev;
+
+    if (!vnode || !S_ISBLK(vnode->vn_mode))
+        return NULL;
+
+    dev = (struct dev_info *)vnode->vn_specinfo;
+
+    return (dev && dev->blkq) ? dev : NULL;
+}
+
+static void bio_blkq_done(struct blk_req * req)
+{
+    struct buf * bp = (struct buf *)req->br_arg;
+
+    BUF_LOCK(bp);
+    if (req->br_result < 0) {
+        bp->b_flags |= B_ERROR;
+        bp->b_error = req->br_result;
+    }
+    bl_biodone(bp);
+    BUF_UNLOCK(bp);
+}
+
+/**
+ * Submit an asynchronous read of bp to the request queue of dev.
+ * The request may be dispatched by the current thread, so bp must not be
+ * locked by the caller.
+ */
+static void bio_blkq_readin(struct dev_info * dev, struct buf * bp)
+{
+    file_t * file = bio_iofile(bp);
+    struct blk_req * req = &bp->b_blkreq;
+
+    BUF_LOCK(bp);
+    bp->b_flags &= ~B_DONE;
+    /* The driver may translate the offset. */
+    file->vnode->vnode_ops->lseek(file, bp->b_blkno, SEEK_SET);
+    *req = (struct blk_req){
+        .br_dev = dev,
+        .br_blkno = file->seek_pos,
+        .br_buf = (uint8_t *)bp->b_data,
+        .br_bcount = bp->b_bcount,
+        .br_flags = BLK_REQ_READ,
+        .br_oflags = file->oflags,
+        .br_done = bio_blkq_done,
+        .br_arg = bp,
+    };
+    BUF_UNLOCK(bp);
+
+    blkq_submit(req);
+}
+
+/**
+ * Start an asynchronous read-ahead of a block.
+ * Nothing is done if the block is already cached.
+ */
+static void bio_readahead_blk(vnode_t * vnode, size_t blkno, int size)
+{
+    struct dev_info * dev;
+    struct buf * bp;
+
+    if (incore(vnode, blkno))
+        return;
+
+    bp = getblk(vnode, blkno, size, 0);
+    if (!bp)
+        return;
+
+    BUF_LOCK(bp);
+    bp->b_bcount = size;
+    bp->b_flags |= B_ASYNC | B_READ;
+    dev = bio_blkq_dev(bio_iofile(bp)->vnode);
+    if (!dev)
+        bl_bio_queue(bp);
+    BUF_UNLOCK(bp);
+
+    if (dev)
+        bio_blkq_readin(dev, bp);
+}
+
+/**
+ * Get the size of the addressing unit of vnode.
+ * Block devices are addressed by block number, other vnodes by bytes.
+ */
+static size_t bio_blksize(vnode_t * vnode)
+{
+    if (vnode && S_ISBLK(vnode->vn_mode)) {
+        struct dev_info * dev = (struct dev_info *)vnode->vn_specinfo;
+
+        if (dev && dev->block_size > 1)
+            return dev->block_size;
+    }
+
+    return 1;
 }
 
 int bread(vnode_t * vnode, size_t blkno, int size, struct buf ** bpp)
+{
+    struct bufhd * bf;
+    size_t rablks[BIO_MAXRA];
+    int rasizes[BIO_MAXRA];
+    unsigned nrablks = 0;
+    size_t step;
+
+    if (!vnode)
+        return -EINVAL;
+
+    step = max(size / bio_blksize(vnode), 1);
+
+    /*
+     * Start read-ahead if the access seems to be sequential.
+     * ra_next is only a hint so no locking is required.
+     */
+    bf = &vnode->vn_bpo;
+    if (blkno == bf->ra_next && blkno != 0) {
+        const unsigned n = min(bio_readahead, BIO_MAXRA);
+
+        for (nrablks = 0; nrablks < n; nrablks++) {
+            rablks[nrablks] = blkno + (nrablks + 1) * step;
+            rasizes[nrablks] = size;
+        }
+    }
+    bf->ra_next = blkno + step;
+
+    return breadn(vnode, blkno, size, rablks, rasizes, nrablks, bpp);
+}
+
+int breadn(vnode_t * vnode, size_t blkno, int size, size_t rablks[],
+           int rasizes[], int nrablks, struct buf ** bpp)
 {
     struct buf * bp;
 
@@ -88,22 +492,31 @@ int bread(vnode_t * vnode, size_t blkno, int size, struct buf ** bpp)
         return -ENOMEM;
 
     BUF_LOCK(bp);
+    bp->b_bcount = size;
     _bio_readin(bp);
     BUF_UNLOCK(bp);
 
-    bp->b_bcount = size;
+    if (nrablks > 0) {
+        struct dev_info * dev = bio_blkq_dev(vnode);
+
+        /*
+         * Hold the read-ahead requests in the device queue until all of
+         * them are queued so they are merged into one transfer.
+         */
+        if (dev)
+            blkq_plug(dev);
+        for (int i = 0; i < nrablks; i++) {
+            bio_readahead_blk(vnode, rablks[i], rasizes[i]);
+        }
+        if (dev)
+            blkq_unplug(dev);
+    }
+
     *bpp = bp;
 
     return 0;
 }
 
-int  breadn(vnode_t * vnode, size_t blkno, int size, size_t rablks[],
-            int rasizes[], int nrablks, struct buf ** bpp)
-{
-    /* TODO */
-    return -ENOTSUP;
-}
-
 void bio_readin(struct buf * bp)
 {
     BUF_LOCK(bp);
@@ -116,6 +529,7 @@ static void _bio_readin(struct buf * bp)
     file_t * file;
     vnode_t * vnode;
     struct uio uio;
+    ssize_t retval;
 
     KASSERT(mtx_test(&bp->lock), "bp should be locked\n");
 
@@ -133,13 +547,19 @@ static void _bio_readin(struct buf * bp)
     bp->b_flags &= ~B_DONE;
 
     if (uio_buf2kuio(bp, &uio)) {
-        /* TODO Error handling */
-        return;
+        bp->b_flags |= B_ERROR;
+        bp->b_error = -EINVAL;
+        goto out;
     }
     vnode->vnode_ops->lseek(file, bp->b_blkno, SEEK_SET);
-    vnode->vnode_ops->read(file, &uio, bp->b_bcount);
+    retval = vnode->vnode_ops->read(file, &uio, bp->b_bcount);
+    if (retval < 0) {
+        bp->b_flags |= B_ERROR;
+        bp->b_error = retval;
+    }
 
-    bp->b_flags |= B_DONE;
+out:
+    bl_biodone(bp);
 }
 
 void bio_writeout(struct buf * bp)
@@ -149,6 +569,78 @@ void bio_writeout(struct buf * bp)
     BUF_UNLOCK(bp);
 }
 
+/*
+ * Get the file used for I/O on bp.
+ * If we have a separate device file associated with the buffer we should
+ * use it.
+ */
+static file_t * bio_iofile(struct buf * bp)
+{
+    return (bp->b_devfile.vnode) ? &bp->b_devfile : &bp->b_file;
+}
+
+/*
+ * Get the range of bp that needs to be written out.
+ * The dirty range is rounded to sectors, or to device blocks on a block
+ * device, a buffer without a dirty range is written out as a whole.
+ */
+static void bl_dirty_range(struct buf * bp, size_t * off, size_t * len)
+{
+    const size_t blksize = bio_blksize(bio_iofile(bp)->vnode);
+    const size_t secsize = (blksize > 1) ? blksize : BIO_SECSIZE;
+    size_t start = 0;
+    size_t end = bp->b_bcount;
+
+    if (bp->b_dirtyend > bp->b_dirtyoff) {
+        start = bp->b_dirtyoff - bp->b_dirtyoff % secsize;
+        end = bp->b_dirtyend + secsize - 1;
+        end = min(end - end % secsize, bp->b_bcount);
+    }
+
+    *off = start;
+    *len = end - start;
+}
+
+/*
+ * Extend the dirty range of bp to cover [off, off + len).
+ * bp must be locked.
+ */
+static void bl_markdirty(struct buf * bp, size_t off, size_t len)
+{
+    size_t end;
+
+    KASSERT(mtx_test(&bp->lock), "bp should be locked\n");
+
+    end = min(off + len, bp->b_bcount);
+    if (off >= end)
+        return;
+
+    if (bp->b_dirtyend > bp->b_dirtyoff) {
+        bp->b_dirtyoff = min(bp->b_dirtyoff, off);
+        bp->b_dirtyend = max(bp->b_dirtyend, end);
+    } else {
+        bp->b_dirtyoff = off;
+        bp->b_dirtyend = end;
+    }
+}
+
+/*
+ * A write without a previously marked dirty range dirties the whole buffer.
+ * bp must be locked.
+ */
+static void bl_markdirty_all(struct buf * bp)
+{
+    if (bp->b_dirtyend <= bp->b_dirtyoff)
+        bl_markdirty(bp, 0, bp->b_bcount);
+}
+
+void bio_markdirty(struct buf * bp, size_t off, size_t len)
+{
+    BUF_LOCK(bp);
+    bl_markdirty(bp, off, len);
+    BUF_UNLOCK(bp);
+}
+
 /*
  * It's a good idea to have lock on bp before calling this function.
  */
@@ -157,38 +649,50 @@ static void _bio_writeout(struct buf * bp)
     file_t * file;
     vnode_t * vnode;
     struct uio uio;
+    size_t off, len;
+    ssize_t retval;
 
     KASSERT(mtx_test(&bp->lock), "bp should be locked\n");
 
+    bp->b_flags &= ~B_DONE;
+
     if (bp->b_flags & B_NOSYNC)
         goto out;
 
-    /*
-     * If we have a separate device file associated with the buffer we should
-     * use it.
-     */
-    if (bp->b_devfile.vnode) {
-        file = &bp->b_devfile;
-    } else {
-        file = &bp->b_file;
-    }
+    file = bio_iofile(bp);
     vnode = file->vnode;
 
     if (uio_buf2kuio(bp, &uio)) {
-        /* TODO Error handling */
-        return;
+        bp->b_flags |= B_ERROR;
+        bp->b_error = -EINVAL;
+        goto out;
+    }
+
+    /* Only write the dirty sectors. */
+    bl_dirty_range(bp, &off, &len);
+    if (len == 0)
+        goto out;
+    uio_init_kbuf(&uio, (__kernel void *)(bp->b_data + off), len);
+
+    vnode->vnode_ops->lseek(file, bp->b_blkno + off / bio_blksize(vnode),
+                            SEEK_SET);
+    retval = vnode->vnode_ops->write(file, &uio, len);
+    if (retval < 0) {
+        bp->b_flags |= B_ERROR;
+        bp->b_error = retval;
     }
-    vnode->vnode_ops->lseek(file, bp->b_blkno, SEEK_SET);
-    vnode->vnode_ops->write(file, &uio, bp->b_bcount);
 
 out:
-    bp->b_flags |= B_DONE;
+    bp->b_dirtyoff = 0;
+    bp->b_dirtyend = 0;
+    bl_biodone(bp);
 }
 
 int bwrite(struct buf * bp)
 {
     unsigned flags;
     vnode_t * vnode;
+    int err;
 
     KASSERT(bp, "bp != NULL\n");
 
@@ -206,24 +710,27 @@ int bwrite(struct buf * bp)
 
     BUF_LOCK(bp);
     flags = bp->b_flags;
-    bp->b_flags &= ~(B_DONE | B_ERROR | B_ASYNC | B_DELWRI);
+    bl_markdirty_all(bp);
+    bl_clr_delwri(bp);
+    bp->b_flags &= ~(B_DONE | B_ERROR | B_ASYNC | B_READ);
     bp->b_flags |= B_BUSY;
     bp->b_error = 0;
-    BUF_UNLOCK(bp);
 
-    /* TODO Use dirty offsets */
     if (flags & B_ASYNC) {
-        /* TODO */
+        /* The buffer is released by biodone() when the write completes. */
+        bp->b_flags |= B_ASYNC;
+        bl_bio_queue(bp);
+        BUF_UNLOCK(bp);
 
         return 0;
-    } else {
-        BUF_LOCK(bp);
-        _bio_writeout(bp);
-        bp->b_flags &= ~B_BUSY;
-        BUF_UNLOCK(bp);
     }
 
-    return 0;
+    _bio_writeout(bp);
+    bp->b_flags &= ~B_BUSY;
+    err = bp->b_error;
+    BUF_UNLOCK(bp);
+
+    return err;
 }
 
 void bawrite(struct buf * bp)
@@ -237,7 +744,8 @@ void bawrite(struct buf * bp)
 void bdwrite(struct buf * bp)
 {
     BUF_LOCK(bp);
-    bp->b_flags |= B_DELWRI;
+    bl_markdirty_all(bp);
+    bl_set_delwri(bp);
     BUF_UNLOCK(bp);
 }
 
@@ -247,16 +755,18 @@ void bio_clrbuf(struct buf * bp)
 
     KASSERT(bp, "bp != NULL\n");
 
+    /* Wait for any async I/O to complete. */
+    biowait(bp);
+
     BUF_LOCK(bp);
 
     flags = bp->b_flags;
 
     if (flags & B_DELWRI) {
         _bio_writeout(bp);
-    } else if (flags & B_ASYNC) {
-        biowait(bp);
     }
-    bp->b_flags &= ~(B_DELWRI | B_ERROR);
+    bl_clr_delwri(bp);
+    bp->b_flags &= ~B_ERROR;
     bp->b_flags |= B_BUSY;
     BUF_UNLOCK(bp);
 
@@ -270,8 +780,16 @@ void bio_clrbuf(struct buf * bp)
 static struct buf * create_blk(vnode_t * vnode, size_t blkno, size_t size,
                                int slptimeo)
 {
-    struct buf * bp = geteblk(size);
+    struct bio_bucket * bucket = bio_hash(vnode, blkno);
+    struct buf * bp;
+    struct buf * old;
 
+    /* Make room for the new buffer. */
+    mtx_lock(&cache_lock);
+    bl_bio_evict(size);
+    mtx_unlock(&cache_lock);
+
+    bp = geteblk(size);
     if (!bp)
         return NULL;
 
@@ -298,54 +816,100 @@ static struct buf * create_blk(vnode_t * vnode, size_t blkno, size_t size,
     bp->b_flags &= ~B_BUSY; /* Unbusy for now */
 
     VN_LOCK(vnode);
+    mtx_lock(&bucket->lock);
+
+    /* Someone else might have created the same buffer meanwhile. */
+    old = bl_incore(bucket, vnode, blkno);
+    if (old && !kobj_ref(&old->b_obj)) {
+        mtx_unlock(&bucket->lock);
+        VN_UNLOCK(vnode);
+        vrfree(bp);
+
+        return old;
+    }
 
-    /* Put to the buffer splay tree of the vnode. */
-    if (SPLAY_INSERT(bufhd_splay, &vnode->vn_bpo.sroot, bp))
-        panic("Double insert");
+    if (kobj_ref(&bp->b_obj))
+        panic("Can't ref a new buffer");
+    bp->b_flags |= B_CACHED;
+    LIST_INSERT_HEAD(&bucket->head, bp, hash_entry_);
+    LIST_INSERT_HEAD(&vnode->vn_bpo.bh_list, bp, vnode_entry_);
 
+    mtx_unlock(&bucket->lock);
     VN_UNLOCK(vnode);
 
+    mtx_lock(&cache_lock);
+    bio_cached_bytes += bp->b_bufsize;
+    mtx_unlock(&cache_lock);
+
     return bp;
 }
 
 struct buf * getblk(vnode_t * vnode, size_t blkno, size_t size, int slptimeo)
 {
+    struct bio_bucket * bucket;
     struct buf * bp;
+    size_t oldsize;
 
     if (!vnode)
         return NULL;
 
-    /* For now we want to synchronize access to this function. */
-    mtx_lock(&cache_lock);
+    bucket = bio_hash(vnode, blkno);
+
+lookup:
+    mtx_lock(&bucket->lock);
+    bp = bl_incore(bucket, vnode, blkno);
+    if (bp && kobj_ref(&bp->b_obj)) {
+        /* The buffer is being freed. */
+        mtx_unlock(&bucket->lock);
+        goto lookup;
+    }
+    mtx_unlock(&bucket->lock);
 
-    bp = incore(vnode, blkno);
-    if (!bp) { /* Not found, create a new buffer. */
+    if (bp) {
+        atomic_inc(&bio_hits);
+    } else { /* Not found, create a new buffer. */
+        atomic_inc(&bio_misses);
         bp = create_blk(vnode, blkno, size, slptimeo);
         if (!bp)
-            goto fail;
+            return NULL;
     }
 
-    /* Found */
-retry:
-    biowait(bp); /* Wait until I/O has completed. */
-
     /*
-     * Wait until the buffer is released. It is possible that we don't get it
-     * locked for us on first try, so we just keep trying until it's not set
-     * busy by some other thread.
+     * Wait until I/O has completed and the buffer is released by the
+     * previous user. cache_lock can't be held here because completion of
+     * async I/O releases the buffer.
      */
-    while (bp->b_flags & B_BUSY)
-        thread_yield(THREAD_YIELD_LAZY);
     BUF_LOCK(bp);
-    if (bp->b_flags & B_BUSY) {
+    while (!(bp->b_flags & B_DONE) || (bp->b_flags & B_BUSY)) {
+        const int iodone = bp->b_flags & B_DONE;
+
         BUF_UNLOCK(bp);
-        goto retry;
+        if (!iodone)
+            biowait(bp);
+        else
+            thread_yield(THREAD_YIELD_LAZY);
+        BUF_LOCK(bp);
+    }
+
+    if (!bp->hash_entry_.le_prev) {
+        /* The buffer was evicted while we were waiting. */
+        BUF_UNLOCK(bp);
+        kobj_unref(&bp->b_obj);
+        goto lookup;
     }
+
     bp->b_flags |= B_BUSY;
     /* Remove from the released list. */
-    TAILQ_REMOVE(&relse_list, bp, relse_entry_);
+    mtx_lock(&cache_lock);
+    if (bp->relse_entry_.tqe_prev) {
+        TAILQ_REMOVE(&relse_list, bp, relse_entry_);
+        bp->relse_entry_.tqe_prev = NULL;
+    }
+    mtx_unlock(&cache_lock);
     BUF_UNLOCK(bp);
+    kobj_unref(&bp->b_obj);
 
+    oldsize = bp->b_bufsize;
     allocbuf(bp, size); /* Resize if necessary */
 
     BUF_LOCK(bp);
@@ -353,29 +917,28 @@ retry:
     bp->b_error = 0;
     BUF_UNLOCK(bp);
 
-fail:
-    mtx_unlock(&cache_lock);
+    if (bp->b_bufsize != oldsize && (bp->b_flags & B_CACHED)) {
+        mtx_lock(&cache_lock);
+        bio_cached_bytes += bp->b_bufsize - oldsize;
+        mtx_unlock(&cache_lock);
+    }
 
     return bp;
 }
 
 struct buf * incore(vnode_t * vnode, size_t blkno)
 {
-    struct bufhd * bf;
+    struct bio_bucket * bucket;
     struct buf * bp;
-    struct buf find;
 
     if (!vnode)
         return NULL;
 
-    bf = &vnode->vn_bpo;
+    bucket = bio_hash(vnode, blkno);
 
-    if (SPLAY_EMPTY(&bf->sroot))
-        return NULL;
-
-    find.b_file.vnode = vnode;
-    find.b_blkno = blkno;
-    bp = SPLAY_FIND(bufhd_splay, &bf->sroot, &find);
+    mtx_lock(&bucket->lock);
+    bp = bl_incore(bucket, vnode, blkno);
+    mtx_unlock(&bucket->lock);
 
     return bp;
 }
@@ -387,7 +950,8 @@ static void bl_brelse(struct buf * bp)
     bp->b_flags &= ~B_BUSY;
 
     mtx_lock(&cache_lock);
-    TAILQ_INSERT_TAIL(&relse_list, bp, relse_entry_);
+    if (!bp->relse_entry_.tqe_prev)
+        TAILQ_INSERT_TAIL(&relse_list, bp, relse_entry_);
     mtx_unlock(&cache_lock);
 }
 
@@ -398,25 +962,58 @@ void brelse(struct buf * bp)
     BUF_UNLOCK(bp);
 }
 
-void biodone(struct buf * bp)
+static struct waitq * bio_waitq(struct buf * bp)
 {
-    BUF_LOCK(bp);
+    return &bio_waitqs[((uintptr_t)bp / sizeof(struct buf)) %
+                       BIO_WAITQ_SIZE];
+}
 
-    KASSERT(bp->b_flags & B_DONE, "dup biodone");
+/**
+ * Wakeup threads waiting for I/O on bp.
+ */
+static void bio_wakeup(struct buf * bp)
+{
+    waitq_wakeup_all(bio_waitq(bp));
+}
+
+static void bl_biodone(struct buf * bp)
+{
+    KASSERT(mtx_test(&bp->lock), "Lock is required.");
+    KASSERT(!(bp->b_flags & B_DONE), "dup biodone");
 
+    bp->b_flags &= ~B_READ;
     bp->b_flags |= B_DONE;
 
-    if (bp->b_flags & B_ASYNC)
+    if (bp->b_flags & B_ASYNC) {
+        bp->b_flags &= ~B_ASYNC;
         bl_brelse(bp);
+    }
 
+    bio_wakeup(bp);
+}
+
+void biodone(struct buf * bp)
+{
+    BUF_LOCK(bp);
+    bl_biodone(bp);
     BUF_UNLOCK(bp);
 }
 
 static int biowait_timo(struct buf * bp, long timeout)
 {
+    struct waitq * wq = bio_waitq(bp);
+    struct waitq_entry we;
+
     /* TODO timeout */
 
-    while (!(bp->b_flags & B_DONE));
+    if (bp->b_flags & B_DONE)
+        return bp->b_error;
+
+    waitq_prepare(wq, &we);
+    while (!(bp->b_flags & B_DONE)) {
+        waitq_sleep(wq, &we);
+    }
+    waitq_finish(wq, &we);
 
     return bp->b_error;
 }
@@ -426,46 +1023,278 @@ int biowait(struct buf * bp)
     return biowait_timo(bp, 0);
 }
 
-/**
- * Cleanup released buffers.
- * @param freebufs  tells if released buffers should be freed after write out.
- */
-static void bio_clean(uintptr_t freebufs)
+void bio_vnode_cleanup(vnode_t * vnode)
 {
     struct buf * bp;
-    struct buf * bp_tmp;
 
-    if (mtx_trylock(&cache_lock))
-        return; /* Don't enter if we don't get exclusive access. */
-
-    TAILQ_FOREACH_SAFE(bp, &relse_list, relse_entry_, bp_tmp) {
-        file_t * file;
-
-        /* Skip if already locked or BUSY */
-        if (mtx_trylock(&bp->lock) || (bp->b_flags & B_BUSY))
+    while (1) {
+        VN_LOCK(vnode);
+        bp = LIST_FIRST(&vnode->vn_bpo.bh_list);
+        if (bp && kobj_ref(&bp->b_obj)) {
+            /* Being freed by someone else. */
+            VN_UNLOCK(vnode);
+            thread_yield(THREAD_YIELD_LAZY);
             continue;
+        }
+        VN_UNLOCK(vnode);
+        if (!bp)
+            break;
 
-        file = &bp->b_file;
+        BUF_LOCK(bp);
+        if (!bp->vnode_entry_.le_prev) {
+            /* Evicted meanwhile. */
+            BUF_UNLOCK(bp);
+            kobj_unref(&bp->b_obj);
+            continue;
+        }
+        bl_bio_unhash(bp, 0);
 
-        /* Write out if delayed write was set. */
         if (bp->b_flags & B_DELWRI) {
             bp->b_flags |= B_BUSY;
             bp->b_flags &= ~B_ASYNC;
-
+            bl_clr_delwri(bp);
             _bio_writeout(bp);
+            bp->b_flags &= ~B_BUSY;
         }
 
-        if (freebufs &&
-            !(bp->b_flags & B_LOCKED) &&
-            !VN_TRYLOCK(file->vnode)) {
-            SPLAY_REMOVE(bufhd_splay, &file->vnode->vn_bpo.sroot, bp);
+        if (bp->b_flags & B_BUSY) {
+            /*
+             * The buffer is still in use, it will be evicted after it has
+             * been released.
+             */
+            BUF_UNLOCK(bp);
+            kobj_unref(&bp->b_obj);
+            continue;
+        }
+
+        mtx_lock(&cache_lock);
+        if (bp->relse_entry_.tqe_prev) {
             TAILQ_REMOVE(&relse_list, bp, relse_entry_);
-            vrfree(bp);
-            VN_UNLOCK(file->vnode);
-        } else {
-            bp->b_flags &= ~B_BUSY;
+            bp->relse_entry_.tqe_prev = NULL;
+        }
+        bl_bio_uncount(bp);
+        mtx_unlock(&cache_lock);
+        BUF_UNLOCK(bp);
+        kobj_unref(&bp->b_obj);
+        vrfree(bp); /* The reference held by the cache. */
+    }
+}
+
+/*
+ * Device offsets of the range of bp to be written out.
+ * The offsets are in the addressing unit of the device.
+ */
+static void bio_dev_range(struct buf * bp, size_t * start, size_t * end)
+{
+    const size_t blksize = bio_blksize(bio_iofile(bp)->vnode);
+    size_t off, len;
+
+    bl_dirty_range(bp, &off, &len);
+    *start = bp->b_blkno + off / blksize;
+    *end = *start + (len + blksize - 1) / blksize;
+}
+
+/*
+ * Sort buffers by the I/O file and the device offset.
+ */
+static void bio_sort_batch(struct buf * batch[], size_t n)
+{
+    size_t i, j;
+
+    for (i = 1; i < n; i++) {
+        struct buf * bp = batch[i];
+        const uintptr_t vn = (uintptr_t)bio_iofile(bp)->vnode;
+        size_t start, end;
+
+        bio_dev_range(bp, &start, &end);
+        for (j = i; j > 0; j--) {
+            struct buf * prev = batch[j - 1];
+            const uintptr_t pvn = (uintptr_t)bio_iofile(prev)->vnode;
+            size_t pstart, pend;
+
+            bio_dev_range(prev, &pstart, &pend);
+            if (pvn < vn || (pvn == vn && pstart <= start))
+                break;
+            batch[j] = prev;
+        }
+        batch[j] = bp;
+    }
+}
+
+/*
+ * Test if the write of bp directly continues the write of prev.
+ */
+static int bio_adjacent(struct buf * prev, struct buf * bp)
+{
+    size_t pstart, pend, start, end, off, len;
+
+    if (bio_iofile(prev)->vnode != bio_iofile(bp)->vnode ||
+        ((prev->b_flags | bp->b_flags) & B_NOSYNC))
+        return 0;
+
+    bio_dev_range(prev, &pstart, &pend);
+    bio_dev_range(bp, &start, &end);
+    bl_dirty_range(prev, &off, &len);
+
+    /* A partial block at the end of prev can't be continued. */
+    return pend == start &&
+           (pend - pstart) * bio_blksize(bio_iofile(bp)->vnode) == len;
+}
+
+/*
+ * Write out busy buffers in cl as a single write.
+ * The buffers must be adjacent and sorted by the device offset. If a bounce
+ * buffer can't be allocated the buffers are written out one by one.
+ */
+static void bio_write_cluster(struct buf * cl[], size_t n)
+{
+    file_t * file;
+    vnode_t * vnode;
+    struct uio uio;
+    uint8_t * tmp = NULL;
+    size_t total = 0;
+    size_t start, end, off, len;
+    ssize_t retval;
+    size_t i;
+
+    if (n > 1) {
+        for (i = 0; i < n; i++) {
+            bl_dirty_range(cl[i], &off, &len);
+            total += len;
+        }
+        tmp = kmalloc(total);
+    }
+    if (!tmp) {
+        for (i = 0; i < n; i++) {
+            BUF_LOCK(cl[i]);
+            _bio_writeout(cl[i]);
+            BUF_UNLOCK(cl[i]);
+        }
+        return;
+    }
+
+    total = 0;
+    for (i = 0; i < n; i++) {
+        bl_dirty_range(cl[i], &off, &len);
+        memcpy(tmp + total, (void *)(cl[i]->b_data + off), len);
+        total += len;
+    }
+
+    file = bio_iofile(cl[0]);
+    vnode = file->vnode;
+    bio_dev_range(cl[0], &start, &end);
+
+    uio_init_kbuf(&uio, tmp, total);
+    vnode->vnode_ops->lseek(file, start, SEEK_SET);
+    retval = vnode->vnode_ops->write(file, &uio, total);
+    kfree(tmp);
+
+    for (i = 0; i < n; i++) {
+        struct buf * bp = cl[i];
+
+        BUF_LOCK(bp);
+        bp->b_flags &= ~B_DONE;
+        if (retval < 0) {
+            bp->b_flags |= B_ERROR;
+            bp->b_error = retval;
+        }
+        bp->b_dirtyoff = 0;
+        bp->b_dirtyend = 0;
+        bl_biodone(bp);
+        BUF_UNLOCK(bp);
+    }
+    atomic_add(&bio_clustered, n - 1);
+}
+
+/*
+ * Write out a batch of delayed writes collected by bio_clean().
+ * Writes to adjacent ranges of the same device are merged.
+ */
+static void bio_flush_batch(struct buf * batch[], size_t n)
+{
+    size_t first = 0;
+    size_t size = 0;
+    size_t i;
+
+    bio_sort_batch(batch, n);
+
+    for (i = 0; i < n; i++) {
+        size_t off, len;
+
+        bl_dirty_range(batch[i], &off, &len);
+        if (i > first &&
+            (!bio_adjacent(batch[i - 1], batch[i]) ||
+             size + len > BIO_MAXCLUSTER)) {
+            bio_write_cluster(batch + first, i - first);
+            first = i;
+            size = 0;
+        }
+        size += len;
+    }
+    if (n > first)
+        bio_write_cluster(batch + first, n - first);
+
+    for (i = 0; i < n; i++) {
+        struct buf * bp = batch[i];
+
+        BUF_LOCK(bp);
+        bp->b_flags &= ~B_BUSY;
+        BUF_UNLOCK(bp);
+        kobj_unref(&bp->b_obj);
+    }
+}
+
+/**
+ * Cleanup released buffers.
+ * Delayed writes are written out and the cache is trimmed to the size limit.
+ * @param freebufs  tells if all released buffers should be freed after
+ *                  write out.
+ */
+static void bio_clean(uintptr_t freebufs)
+{
+    struct buf * batch[BIO_CLEAN_BATCH];
+    size_t n;
+
+    do {
+        struct buf * bp;
+
+        n = 0;
+        if (mtx_trylock(&cache_lock))
+            return; /* Don't enter if we don't get exclusive access. */
+
+        TAILQ_FOREACH(bp, &relse_list, relse_entry_) {
+            if (n == BIO_CLEAN_BATCH)
+                break;
+
+            /* Skip if already locked or BUSY */
+            if (mtx_trylock(&bp->lock))
+                continue;
+            if (!(bp->b_flags & B_BUSY) && (bp->b_flags & B_DELWRI) &&
+                !kobj_ref(&bp->b_obj)) {
+                bp->b_flags |= B_BUSY;
+                bp->b_flags &= ~B_ASYNC;
+                bl_clr_delwri(bp);
+                batch[n++] = bp;
+            }
             BUF_UNLOCK(bp);
         }
+        mtx_unlock(&cache_lock);
+
+        /* Write out delayed writes without holding cache_lock. */
+        bio_flush_batch(batch, n);
+    } while (n == BIO_CLEAN_BATCH);
+
+    if (mtx_trylock(&cache_lock))
+        return;
+
+    if (freebufs) {
+        const unsigned maxbytes = bio_maxbytes;
+
+        bio_maxbytes = 0;
+        bl_bio_evict(0);
+        bio_maxbytes = maxbytes;
+    } else {
+        bl_bio_evict(0);
     }
 
     mtx_unlock(&cache_lock);
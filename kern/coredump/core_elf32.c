@@ -44,7 +44,8 @@
 #include <proc.h>
 
 #define SKIP_REGION(_region) \
-    ((!_region) || (_region)->b_flags & B_NOCORE || (_region)->b_data == 0 || \
+    ((!_region) || (_region)->b_flags & B_NOCORE || \
+     ((_region)->b_data == 0 && !(_region)->b_pages) || \
      (_region)->b_mmu.vaddr == 0)
 
 static off_t write2file(file_t * file, void * p, size_t size)
@@ -389,6 +390,48 @@ static int create_pheaders(const struct vm_mm_struct * mm, size_t notes_size,
     return phnum;
 }
 
+/**
+ * Dump a demand paged region page by page.
+ * Pages that are not faulted in are dumped as zeros.
+ */
+static off_t dump_pages(file_t * file, struct buf * region)
+{
+    kmalloc_autofree void * zero = NULL;
+    off_t off = 0;
+
+    for (size_t i = 0; i < region->b_mmu.num_pages; i++) {
+        struct buf * pg;
+        void * p;
+        off_t err;
+
+        mtx_lock(&region->lock);
+        pg = region->b_pages[i];
+        if (pg)
+            pg->vm_ops->rref(pg);
+        mtx_unlock(&region->lock);
+
+        if (pg) {
+            p = (void *)pg->b_data;
+        } else {
+            if (!zero) {
+                zero = kzalloc(MMU_PGSIZE_COARSE);
+                if (!zero)
+                    return -ENOMEM;
+            }
+            p = zero;
+        }
+
+        err = write2file(file, p, MMU_PGSIZE_COARSE);
+        if (pg)
+            pg->vm_ops->rfree(pg);
+        if (err != MMU_PGSIZE_COARSE)
+            return err;
+        off += err;
+    }
+
+    return off;
+}
+
 static off_t dump_regions(file_t * file, const struct vm_mm_struct * mm)
 {
     off_t err, off = 0;
@@ -399,7 +442,13 @@ static off_t dump_regions(file_t * file, const struct vm_mm_struct * mm)
         if (SKIP_REGION(region))
             continue;
 
-        err = write2file(file, (void *)region->b_data, region->b_bufsize);
+        err = vm_cow_finish(region);
+        if (err)
+            return err;
+        if (region->b_pages)
+            err = dump_pages(file, region);
+        else
+            err = write2file(file, (void *)region->b_data, region->b_bufsize);
         if (err != region->b_bufsize)
             return err;
         off += off;
@@ -47,6 +47,7 @@
 #include <proc.h>
 #include <thread.h>
 #include <vm/vm.h>
+#include <vm/vm_pgcache.h>
 
 /**
  * Elf parsing context.
@@ -212,36 +213,101 @@ static ssize_t read_section(struct elf_ctx * ctx, size_t sect_index,
     return vn->vnode_ops->read(ctx->file, &uio, size);
 }
 
+/**
+ * Create a demand paged memory region for a section.
+ * Read-only sections are mapped directly from the page cache of the file and
+ * writable sections get private pages that are filled from the file, or
+ * zeroed for .bss, on the first touch.
+ * @return Returns a pointer to the new region;
+ *         NULL if the section can't be demand paged.
+ */
+static struct buf * map_section(struct elf_ctx * ctx, size_t sect_index,
+                                int prot)
+{
+    vnode_t * vn = ctx->file->vnode;
+    struct elf32_phdr * phdr = &ctx->phdr[sect_index];
+    const uintptr_t vaddr = phdr->p_vaddr + ctx->rbase;
+    const uintptr_t start_vaddr = vaddr & ~(MMU_PGSIZE_COARSE - 1);
+    const size_t pgoff = vaddr - start_vaddr;
+    const size_t sectsize = pgoff + phdr->p_memsz;
+    struct vm_pgcache * pgc;
+    struct buf * sect;
+
+    if (!S_ISREG(vn->vn_mode) ||
+        (phdr->p_offset % MMU_PGSIZE_COARSE) != pgoff)
+        return NULL;
+
+    pgc = vm_pgcache_ref(vn, 1);
+    if (!pgc)
+        return NULL;
+
+    if ((prot & VM_PROT_WRITE) || phdr->p_memsz != phdr->p_filesz) {
+        sect = vm_pgcache_newpriv(pgc, phdr->p_offset / MMU_PGSIZE_COARSE,
+                                  sectsize, pgoff + phdr->p_filesz);
+    } else {
+        sect = vm_pgcache_newregion(pgc, phdr->p_offset / MMU_PGSIZE_COARSE,
+                                    sectsize);
+    }
+    vm_pgcache_unref(pgc);
+    if (!sect)
+        return NULL;
+
+    sect->b_uflags = prot & ~VM_PROT_COW;
+    sect->b_mmu.vaddr = start_vaddr;
+    vm_updateusr_ap(sect);
+
+    return sect;
+}
+
 /**
  * Create a memory region and load a section to it.
+ * Read-only sections are shared through the text cache.
  */
 static int load_section(struct elf_ctx * ctx, size_t sect_index,
                         struct buf ** region)
 {
+    vnode_t * vn = ctx->file->vnode;
     struct elf32_phdr * phdr = &ctx->phdr[sect_index];
+    const uintptr_t vaddr = phdr->p_vaddr + ctx->rbase;
     struct buf * sect;
     void * ldp;
-    int prot, err;
+    int prot, text, err;
 
     if (phdr->p_memsz < phdr->p_filesz) {
         return -ENOEXEC;
     }
 
     prot = p_flags2b_uflags(phdr->p_flags);
-    sect = vm_newsect(phdr->p_vaddr + ctx->rbase, phdr->p_memsz, prot);
-    if (!sect) {
-        return -ENOMEM;
+    text = !(prot & VM_PROT_WRITE) && phdr->p_memsz == phdr->p_filesz;
+    if (text) {
+        sect = exec_text_get(vn, phdr->p_offset, vaddr, phdr->p_memsz);
+        if (sect) {
+            *region = sect;
+            return 0;
+        }
     }
 
-    ldp = (void *)(sect->b_data + (phdr->p_vaddr - sect->b_mmu.vaddr));
-    err = read_section(ctx, sect_index, ldp, phdr->p_memsz);
-    if (err < 0) {
-        if (sect->vm_ops->rfree) {
-            sect->vm_ops->rfree(sect);
+    sect = map_section(ctx, sect_index, prot);
+    if (!sect) {
+        /* Fall back to loading the whole section now. */
+        sect = vm_newsect(vaddr, phdr->p_memsz, prot);
+        if (!sect) {
+            return -ENOMEM;
+        }
+
+        ldp = (void *)(sect->b_data + (vaddr - sect->b_mmu.vaddr));
+        err = read_section(ctx, sect_index, ldp, phdr->p_memsz);
+        if (err < 0) {
+            if (sect->vm_ops->rfree) {
+                sect->vm_ops->rfree(sect);
+            }
+            return -ENOEXEC;
         }
-        return -ENOEXEC;
     }
 
+    if (text)
+        exec_text_put(vn, phdr->p_offset, vaddr, phdr->p_memsz, sect);
+
     *region = sect;
     return 0;
 }
@@ -0,0 +1,286 @@
+/**
+ *******************************************************************************
+ * @file    exec_text.c
+ * @author  Olli Vanhoja
+ * @brief   Cache of loaded read-only text regions.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+#include <errno.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <buf.h>
+#include <exec.h>
+#include <fs/fs.h>
+#include <kerror.h>
+#include <klocks.h>
+#include <kmalloc.h>
+
+#define TEXT_CACHE_SIZE 16 /*!< Maximum number of cached text regions. */
+
+/**
+ * Text cache entry.
+ * An entry holds a reference to the vnode and to the region.
+ */
+struct text_entry {
+    TAILQ_ENTRY(text_entry) lru_entry_;
+    struct vnode * vnode;
+    struct timespec mtime;  /*!< mtime of the file when the region was loaded. */
+    off_t offset;           /*!< Offset of the section in the file. */
+    uintptr_t vaddr;        /*!< Load address of the section. */
+    size_t size;            /*!< Size of the section. */
+    struct buf * region;
+};
+
+static TAILQ_HEAD(text_lru_head, text_entry) text_lru =
+    TAILQ_HEAD_INITIALIZER(text_lru);
+static mtx_t text_lock = MTX_INITIALIZER(MTX_TYPE_TICKET, MTX_OPT_SLEEP);
+static unsigned text_nr_entries;
+
+static atomic_t text_hits = ATOMIC_INIT(0);
+static atomic_t text_misses = ATOMIC_INIT(0);
+
+SYSCTL_DECL(_kern_exec);
+SYSCTL_NODE(_kern, OID_AUTO, exec, CTLFLAG_RW, 0, "Exec");
+
+SYSCTL_UINT(_kern_exec, OID_AUTO, text_entries, CTLFLAG_RD,
+            &text_nr_entries, 0, "Number of cached text regions");
+SYSCTL_INT(_kern_exec, OID_AUTO, text_hits, CTLFLAG_RD,
+           &text_hits, 0, "Text cache hits");
+SYSCTL_INT(_kern_exec, OID_AUTO, text_misses, CTLFLAG_RD,
+           &text_misses, 0, "Text cache misses");
+
+/**
+ * Get the mtime of an executable.
+ * @return Returns 0 if succeed; -ENOENT if the file has been unlinked;
+ *         Otherwise a negative errno.
+ */
+static int text_getmtime(struct vnode * vnode, struct timespec * mtime)
+{
+    struct stat stat_buf;
+    int err;
+
+    err = vnode->vnode_ops->stat(vnode, &stat_buf);
+    if (err)
+        return err;
+    if (stat_buf.st_nlink == 0)
+        return -ENOENT;
+
+    *mtime = stat_buf.st_mtim;
+    return 0;
+}
+
+static void text_free(struct text_entry * tp)
+{
+    tp->region->vm_ops->rfree(tp->region);
+    vrele(tp->vnode);
+    kfree(tp);
+}
+
+/**
+ * Remove an entry from the cache.
+ * @note text_lock must be held.
+ */
+static void text_remove(struct text_entry * tp)
+{
+    TAILQ_REMOVE(&text_lru, tp, lru_entry_);
+    text_nr_entries--;
+}
+
+/**
+ * Find a cache entry.
+ * @note text_lock must be held.
+ */
+static struct text_entry * text_find(struct vnode * vnode, off_t offset,
+                                     uintptr_t vaddr, size_t size)
+{
+    struct text_entry * tp;
+
+    TAILQ_FOREACH(tp, &text_lru, lru_entry_) {
+        if (tp->vnode == vnode && tp->offset == offset &&
+            tp->vaddr == vaddr && tp->size == size)
+            break;
+    }
+
+    return tp;
+}
+
+struct buf * exec_text_get(struct vnode * vnode, off_t offset,
+                           uintptr_t vaddr, size_t size)
+{
+    struct timespec mtime;
+    struct text_entry * tp;
+    struct text_entry * stale = NULL;
+    struct buf * region = NULL;
+    int err;
+
+    err = text_getmtime(vnode, &mtime);
+    if (err && err != -ENOENT)
+        return NULL;
+
+    mtx_lock(&text_lock);
+    tp = text_find(vnode, offset, vaddr, size);
+    if (tp) {
+        if (err || tp->mtime.tv_sec != mtime.tv_sec ||
+            tp->mtime.tv_nsec != mtime.tv_nsec) {
+            /*
+             * The file was unlinked or modified after the region was
+             * loaded.
+             */
+            text_remove(tp);
+            stale = tp;
+        } else {
+            region = tp->region;
+            region->vm_ops->rref(region);
+            TAILQ_REMOVE(&text_lru, tp, lru_entry_);
+            TAILQ_INSERT_HEAD(&text_lru, tp, lru_entry_);
+        }
+    }
+    mtx_unlock(&text_lock);
+
+    if (stale)
+        text_free(stale);
+
+    if (region)
+        atomic_inc(&text_hits);
+    else
+        atomic_inc(&text_misses);
+
+    return region;
+}
+
+void exec_text_put(struct vnode * vnode, off_t offset, uintptr_t vaddr,
+                   size_t size, struct buf * region)
+{
+    struct text_entry * tp;
+    struct text_entry * old = NULL;
+
+    KASSERT(!(region->b_uflags & VM_PROT_WRITE), "text must be read-only");
+
+    tp = kzalloc(sizeof(struct text_entry));
+    if (!tp)
+        return;
+
+    if (text_getmtime(vnode, &tp->mtime) || vref(vnode)) {
+        kfree(tp);
+        return;
+    }
+    tp->vnode = vnode;
+    tp->offset = offset;
+    tp->vaddr = vaddr;
+    tp->size = size;
+    tp->region = region;
+    region->vm_ops->rref(region);
+
+    mtx_lock(&text_lock);
+    /*
+     * Another process may have loaded and cached the same section while we
+     * were loading it.
+     */
+    old = text_find(vnode, offset, vaddr, size);
+    if (old) {
+        if (old->mtime.tv_sec == tp->mtime.tv_sec &&
+            old->mtime.tv_nsec == tp->mtime.tv_nsec) {
+            mtx_unlock(&text_lock);
+            text_free(tp);
+            return;
+        }
+        text_remove(old);
+    } else if (text_nr_entries >= TEXT_CACHE_SIZE) {
+        old = TAILQ_LAST(&text_lru, text_lru_head);
+        text_remove(old);
+    }
+    TAILQ_INSERT_HEAD(&text_lru, tp, lru_entry_);
+    text_nr_entries++;
+    mtx_unlock(&text_lock);
+
+    if (old)
+        text_free(old);
+}
+
+int exec_text_cached(struct buf * region)
+{
+    struct text_entry * tp;
+    int found = 0;
+
+    mtx_lock(&text_lock);
+    TAILQ_FOREACH(tp, &text_lru, lru_entry_) {
+        if (tp->region == region) {
+            found = 1;
+            break;
+        }
+    }
+    mtx_unlock(&text_lock);
+
+    return found;
+}
+
+void exec_text_purge_sb(struct fs_superblock * sb)
+{
+    struct text_lru_head purged = TAILQ_HEAD_INITIALIZER(purged);
+    struct text_entry * tp;
+    struct text_entry * tmp;
+
+    mtx_lock(&text_lock);
+    TAILQ_FOREACH_SAFE(tp, &text_lru, lru_entry_, tmp) {
+        if (tp->vnode->sb == sb) {
+            text_remove(tp);
+            TAILQ_INSERT_TAIL(&purged, tp, lru_entry_);
+        }
+    }
+    mtx_unlock(&text_lock);
+
+    TAILQ_FOREACH_SAFE(tp, &purged, lru_entry_, tmp) {
+        text_free(tp);
+    }
+}
+
+void exec_text_purge_vnode(struct vnode * vnode)
+{
+    struct text_lru_head purged = TAILQ_HEAD_INITIALIZER(purged);
+    struct text_entry * tp;
+    struct text_entry * tmp;
+    struct timespec mtime;
+
+    /* Entries of a file that still has links are still valid. */
+    if (text_getmtime(vnode, &mtime) != -ENOENT)
+        return;
+
+    mtx_lock(&text_lock);
+    TAILQ_FOREACH_SAFE(tp, &text_lru, lru_entry_, tmp) {
+        if (tp->vnode == vnode) {
+            text_remove(tp);
+            TAILQ_INSERT_TAIL(&purged, tp, lru_entry_);
+        }
+    }
+    mtx_unlock(&text_lock);
+
+    TAILQ_FOREACH_SAFE(tp, &purged, lru_entry_, tmp) {
+        text_free(tp);
+    }
+}
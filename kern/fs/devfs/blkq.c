@@ -0,0 +1,620 @@
+/**
+ *******************************************************************************
+ * @file    blkq.c
+ * @author  Olli Vanhoja
+ * @brief   Block device request queues.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+#include <errno.h>
+#include <kstring.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#include <fs/blkq.h>
+#include <fs/devfs.h>
+#include <kerror.h>
+#include <kinit.h>
+#include <kmalloc.h>
+#include <libkern.h>
+#include <thread.h>
+
+/*
+ * All request queues, scanned by the worker.
+ */
+static mtx_t blkq_list_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+static SLIST_HEAD(blkq_list_head, blk_queue) blkq_list =
+    SLIST_HEAD_INITIALIZER(blkq_list);
+static pthread_t blkq_worker_tid = -1;
+static struct waitq blkq_worker_waitq = WAITQ_INITIALIZER(blkq_worker_waitq);
+
+SYSCTL_DECL(_vfs_blkq);
+SYSCTL_NODE(_vfs, OID_AUTO, blkq, CTLFLAG_RW, 0,
+            "Block device request queues");
+
+#define BLKQ_NBLOCKS(_q_, _bcount_) \
+    ((off_t)(((_bcount_) + (_q_)->bq_dev->block_size - 1) / \
+             (_q_)->bq_dev->block_size))
+
+/**
+ * Create the vfs.blkq.<dev_name> sysctl subtree for a queue.
+ */
+static void blkq_sysctl_register(struct blk_queue * q)
+{
+    struct sysctl_oid_list * children = &q->bq_sysctl_children;
+
+    q->bq_sysctl_node = sysctl_add_oid(&SYSCTL_NODE_CHILDREN(_vfs, blkq),
+                                       q->bq_dev->dev_name,
+                                       CTLTYPE_NODE | CTLFLAG_RD,
+                                       children, 0, NULL, "N",
+                                       "Request queue stats");
+    if (!q->bq_sysctl_node) {
+        KERROR(KERROR_WARN, "Failed to add sysctl node for blkq %s\n",
+               q->bq_dev->dev_name);
+        return;
+    }
+
+    (void)sysctl_add_oid(children, "depth", CTLTYPE_UINT | CTLFLAG_RD,
+                         &q->bq_depth, 0, sysctl_handle_int, "IU",
+                         "Number of pending requests.");
+    (void)sysctl_add_oid(children, "max_depth", CTLTYPE_UINT | CTLFLAG_RD,
+                         &q->bq_max_depth, 0, sysctl_handle_int, "IU",
+                         "Peak number of pending requests.");
+    (void)sysctl_add_oid(children, "requests", CTLTYPE_UINT | CTLFLAG_RD,
+                         &q->bq_nr_reqs, 0, sysctl_handle_int, "IU",
+                         "Number of requests submitted.");
+    (void)sysctl_add_oid(children, "merged", CTLTYPE_UINT | CTLFLAG_RD,
+                         &q->bq_nr_merged, 0, sysctl_handle_int, "IU",
+                         "Requests merged to an adjacent request.");
+    (void)sysctl_add_oid(children, "dispatched", CTLTYPE_UINT | CTLFLAG_RD,
+                         &q->bq_nr_dispatched, 0, sysctl_handle_int, "IU",
+                         "Number of transfers passed to the driver.");
+    (void)sysctl_add_oid(children, "lat_avg_us", CTLTYPE_UINT | CTLFLAG_RD,
+                         &q->bq_lat_avg_us, 0, sysctl_handle_int, "IU",
+                         "Average request latency in microseconds.");
+    (void)sysctl_add_oid(children, "lat_max_us", CTLTYPE_UINT | CTLFLAG_RD,
+                         &q->bq_lat_max_us, 0, sysctl_handle_int, "IU",
+                         "Max request latency in microseconds.");
+}
+
+static unsigned blkq_elapsed_us(const struct timespec * start)
+{
+    struct timespec now, diff;
+
+    nanotime(&now);
+    timespec_sub(&diff, &now, start);
+
+    return diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+}
+
+/**
+ * Pass a transfer to the driver.
+ * The transfer is split to single block calls if the driver doesn't support
+ * multi-block transfers.
+ */
+static ssize_t blkq_xfer(struct dev_info * dev, int flags, off_t blkno,
+                         uint8_t * buf, size_t bcount, int oflags)
+{
+    const uint32_t mb = (flags & BLK_REQ_READ) ? DEV_FLAGS_MB_READ
+                                               : DEV_FLAGS_MB_WRITE;
+    ssize_t (*fn)(struct dev_info * devnfo, off_t blkno,
+                  uint8_t * buf, size_t bcount, int oflags);
+    size_t off = 0;
+
+    fn = (flags & BLK_REQ_READ) ? dev->read : dev->write;
+    if (!fn)
+        return -EOPNOTSUPP;
+
+    if ((dev->flags & mb) || bcount <= dev->block_size)
+        return fn(dev, blkno, buf, bcount, oflags);
+
+    while (off < bcount) {
+        const size_t n = ulmin(bcount - off, dev->block_size);
+        ssize_t ret;
+
+        ret = fn(dev, blkno++, buf + off, n, oflags);
+        if (ret <= 0)
+            return (off > 0) ? (ssize_t)off : ret;
+        off += ret;
+        if ((size_t)ret < n)
+            break;
+    }
+
+    return off;
+}
+
+/**
+ * Test if a pending request accesses the same blocks as req and either one
+ * of them is a write.
+ * @note bq_lock must be held.
+ */
+static int blkq_overlaps(const struct blk_queue * q, const struct blk_req * req)
+{
+    const off_t end = req->br_blkno + BLKQ_NBLOCKS(q, req->br_bcount);
+    const struct blk_req * it;
+
+    TAILQ_FOREACH(it, &q->bq_reqs, br_entry_) {
+        if (it->br_blkno >= end)
+            break;
+        if (it->br_blkno + BLKQ_NBLOCKS(q, it->br_bcount) > req->br_blkno &&
+            ((it->br_flags | req->br_flags) & BLK_REQ_WRITE))
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Insert a request to the queue sorted by blkno.
+ * @note bq_lock must be held.
+ */
+static void blkq_insert(struct blk_queue * q, struct blk_req * req)
+{
+    struct blk_req * it;
+
+    /* Usually the new request goes near the tail. */
+    TAILQ_FOREACH_REVERSE(it, &q->bq_reqs, blk_req_list, br_entry_) {
+        if (it->br_blkno <= req->br_blkno)
+            break;
+    }
+    if (it)
+        TAILQ_INSERT_AFTER(&q->bq_reqs, it, req, br_entry_);
+    else
+        TAILQ_INSERT_HEAD(&q->bq_reqs, req, br_entry_);
+
+    q->bq_nr_reqs++;
+    if (++q->bq_depth > q->bq_max_depth)
+        q->bq_max_depth = q->bq_depth;
+}
+
+static int blkq_can_merge(const struct blk_queue * q,
+                          const struct blk_req * last,
+                          const struct blk_req * next, off_t nblocks)
+{
+    const struct dev_info * dev = q->bq_dev;
+    const uint32_t mb = (last->br_flags & BLK_REQ_READ) ? DEV_FLAGS_MB_READ
+                                                        : DEV_FLAGS_MB_WRITE;
+
+    return (dev->flags & mb) &&
+           !((last->br_flags ^ next->br_flags) &
+             (BLK_REQ_READ | BLK_REQ_WRITE)) &&
+           last->br_oflags == next->br_oflags &&
+           last->br_bcount % dev->block_size == 0 &&
+           last->br_blkno + BLKQ_NBLOCKS(q, last->br_bcount) ==
+                next->br_blkno &&
+           nblocks + BLKQ_NBLOCKS(q, next->br_bcount) <= BLKQ_MAX_MERGE;
+}
+
+/**
+ * Remove the next request from the queue.
+ * The request is selected in C-LOOK order and the following adjacent requests
+ * are chained to it through br_merged_.
+ * @note bq_lock must be held.
+ */
+static struct blk_req * blkq_pick(struct blk_queue * q)
+{
+    struct blk_req * req;
+    struct blk_req * last;
+    struct blk_req * next;
+    off_t nblocks;
+
+    TAILQ_FOREACH(req, &q->bq_reqs, br_entry_) {
+        if (req->br_blkno >= q->bq_pos)
+            break;
+    }
+    if (!req)
+        req = TAILQ_FIRST(&q->bq_reqs);
+    if (!req)
+        return NULL;
+
+    next = TAILQ_NEXT(req, br_entry_);
+    TAILQ_REMOVE(&q->bq_reqs, req, br_entry_);
+    q->bq_depth--;
+    req->br_merged_ = NULL;
+    last = req;
+    nblocks = BLKQ_NBLOCKS(q, req->br_bcount);
+
+    while (next && blkq_can_merge(q, last, next, nblocks)) {
+        struct blk_req * tmp = TAILQ_NEXT(next, br_entry_);
+
+        TAILQ_REMOVE(&q->bq_reqs, next, br_entry_);
+        q->bq_depth--;
+        q->bq_nr_merged++;
+        next->br_merged_ = NULL;
+        last->br_merged_ = next;
+        last = next;
+        nblocks += BLKQ_NBLOCKS(q, next->br_bcount);
+        next = tmp;
+    }
+
+    q->bq_pos = last->br_blkno + BLKQ_NBLOCKS(q, last->br_bcount);
+
+    return req;
+}
+
+/**
+ * Complete a chain of merged requests.
+ * @param ret is the return value of the transfer.
+ */
+static void blkq_complete(struct blk_queue * q, struct blk_req * req,
+                          ssize_t ret)
+{
+    while (req) {
+        struct blk_req * next = req->br_merged_;
+        blk_done_t * done = req->br_done;
+        unsigned lat = blkq_elapsed_us(&req->br_queued);
+
+        if (ret < 0) {
+            req->br_result = ret;
+        } else {
+            req->br_result = ulmin(ret, req->br_bcount);
+            ret -= req->br_result;
+        }
+
+        mtx_lock(&q->bq_lock);
+        q->bq_lat_avg_us = (q->bq_lat_avg_us * 7 + lat) / 8;
+        if (lat > q->bq_lat_max_us)
+            q->bq_lat_max_us = lat;
+        /* A synchronous waiter may return as soon as this is set. */
+        req->br_flags |= BLK_REQ_DONE;
+        mtx_unlock(&q->bq_lock);
+
+        if (done)
+            done(req);
+        req = next;
+    }
+
+    waitq_wakeup_all(&q->bq_waitq);
+}
+
+/**
+ * Transfer a chain of merged requests.
+ * A bounce buffer is used if the buffers of the requests are not adjacent.
+ */
+static void blkq_dispatch(struct blk_queue * q, struct blk_req * req)
+{
+    const int is_read = req->br_flags & BLK_REQ_READ;
+    struct blk_req * it;
+    uint8_t * buf = req->br_buf;
+    size_t total = 0;
+    int contig = 1;
+    ssize_t ret;
+
+    for (it = req; it; it = it->br_merged_) {
+        if (it->br_buf != req->br_buf + total)
+            contig = 0;
+        total += it->br_bcount;
+    }
+
+    if (!contig) {
+        struct blk_req * next;
+
+        buf = kmalloc(total);
+        if (!buf) {
+            /* Transfer the requests one by one. */
+            for (it = req; it; it = next) {
+                next = it->br_merged_;
+                it->br_merged_ = NULL;
+                blkq_dispatch(q, it);
+            }
+            return;
+        }
+
+        if (!is_read) {
+            size_t off = 0;
+
+            for (it = req; it; it = it->br_merged_) {
+                memcpy(buf + off, it->br_buf, it->br_bcount);
+                off += it->br_bcount;
+            }
+        }
+    }
+
+    mtx_lock(&q->bq_lock);
+    q->bq_nr_dispatched++;
+    mtx_unlock(&q->bq_lock);
+
+    ret = blkq_xfer(q->bq_dev, req->br_flags, req->br_blkno, buf, total,
+                    req->br_oflags);
+
+    if (!contig) {
+        if (is_read && ret > 0) {
+            size_t off = 0;
+
+            for (it = req; it && off < (size_t)ret; it = it->br_merged_) {
+                memcpy(it->br_buf, buf + off,
+                       ulmin(it->br_bcount, ret - off));
+                off += it->br_bcount;
+            }
+        }
+        kfree(buf);
+    }
+
+    blkq_complete(q, req, ret);
+}
+
+/**
+ * Dispatch pending requests of a queue.
+ * Only one thread dispatches at a time, if another thread is already
+ * dispatching it will also take the requests queued meanwhile.
+ * @param force dispatches the requests even if the queue is plugged.
+ */
+static void blkq_run(struct blk_queue * q, int force)
+{
+    struct blk_req * req;
+
+    mtx_lock(&q->bq_lock);
+    if (q->bq_active || (q->bq_plugged && !force)) {
+        mtx_unlock(&q->bq_lock);
+        return;
+    }
+    q->bq_active = 1;
+
+    while ((req = blkq_pick(q))) {
+        mtx_unlock(&q->bq_lock);
+        blkq_dispatch(q, req);
+        mtx_lock(&q->bq_lock);
+    }
+
+    q->bq_active = 0;
+    mtx_unlock(&q->bq_lock);
+}
+
+/**
+ * Queue a request.
+ * Requests accessing the same blocks are never reordered, so if the new
+ * request conflicts with a pending one we'll wait until it's dispatched.
+ */
+static void blkq_enqueue(struct blk_queue * q, struct blk_req * req)
+{
+    req->br_flags &= ~BLK_REQ_DONE;
+    req->br_merged_ = NULL;
+    nanotime(&req->br_queued);
+
+    mtx_lock(&q->bq_lock);
+    while (blkq_overlaps(q, req)) {
+        if (!q->bq_active) {
+            mtx_unlock(&q->bq_lock);
+            blkq_run(q, 1);
+            mtx_lock(&q->bq_lock);
+        } else {
+            waitq_sleep_mtx(&q->bq_waitq, &q->bq_lock);
+        }
+    }
+    blkq_insert(q, req);
+    mtx_unlock(&q->bq_lock);
+}
+
+/**
+ * Get the queue dispatched by the worker, or by the current thread if the
+ * worker isn't running yet.
+ */
+static void blkq_kick(struct blk_queue * q)
+{
+    if (blkq_worker_tid < 0 || current_thread->id == blkq_worker_tid) {
+        blkq_run(q, 0);
+        return;
+    }
+
+    mtx_lock(&blkq_list_lock);
+    q->bq_kicked = 1;
+    mtx_unlock(&blkq_list_lock);
+
+    waitq_wakeup_one(&blkq_worker_waitq);
+}
+
+int blkq_create(struct dev_info * dev)
+{
+    struct blk_queue * q;
+
+    if (dev->block_size == 0)
+        return -EINVAL;
+
+    q = kzalloc(sizeof(struct blk_queue));
+    if (!q)
+        return -ENOMEM;
+
+    q->bq_dev = dev;
+    mtx_init(&q->bq_lock, MTX_TYPE_TICKET, MTX_OPT_DEFAULT);
+    TAILQ_INIT(&q->bq_reqs);
+    waitq_init(&q->bq_waitq);
+    blkq_sysctl_register(q);
+
+    mtx_lock(&blkq_list_lock);
+    SLIST_INSERT_HEAD(&blkq_list, q, bq_link_);
+    mtx_unlock(&blkq_list_lock);
+
+    dev->blkq = q;
+
+    return 0;
+}
+
+void blkq_destroy(struct dev_info * dev)
+{
+    struct blk_queue * q = dev->blkq;
+
+    if (!q)
+        return;
+
+    KASSERT(TAILQ_EMPTY(&q->bq_reqs), "blkq should be empty");
+
+    mtx_lock(&blkq_list_lock);
+    SLIST_REMOVE(&blkq_list, q, blk_queue, bq_link_);
+    mtx_unlock(&blkq_list_lock);
+
+    if (q->bq_sysctl_node)
+        (void)sysctl_remove_oid(q->bq_sysctl_node, 1, 1);
+
+    dev->blkq = NULL;
+    kfree(q);
+}
+
+void blkq_submit(struct blk_req * req)
+{
+    struct blk_queue * q = req->br_dev->blkq;
+
+    if (!q) {
+        blk_done_t * done = req->br_done;
+
+        req->br_result = blkq_xfer(req->br_dev, req->br_flags, req->br_blkno,
+                                   req->br_buf, req->br_bcount,
+                                   req->br_oflags);
+        req->br_flags |= BLK_REQ_DONE;
+        if (done)
+            done(req);
+        return;
+    }
+
+    blkq_enqueue(q, req);
+    blkq_kick(q);
+}
+
+ssize_t blkq_wait(struct blk_req * req)
+{
+    struct blk_queue * q = req->br_dev->blkq;
+
+    if (q) {
+        mtx_lock(&q->bq_lock);
+        while (!(req->br_flags & BLK_REQ_DONE)) {
+            waitq_sleep_mtx(&q->bq_waitq, &q->bq_lock);
+        }
+        mtx_unlock(&q->bq_lock);
+    }
+
+    return req->br_result;
+}
+
+ssize_t blkq_rw(struct dev_info * dev, int flags, off_t blkno,
+                uint8_t * buf, size_t bcount, int oflags)
+{
+    struct blk_queue * q = dev->blkq;
+    struct blk_req req = {
+        .br_dev = dev,
+        .br_blkno = blkno,
+        .br_buf = buf,
+        .br_bcount = bcount,
+        .br_flags = flags,
+        .br_oflags = oflags,
+    };
+
+    if (!q)
+        return blkq_xfer(dev, flags, blkno, buf, bcount, oflags);
+
+    blkq_enqueue(q, &req);
+    /*
+     * Dispatch in this thread rather than waiting for the worker or an
+     * unplug, requests already in the queue are dispatched along.
+     */
+    blkq_run(q, 1);
+
+    return blkq_wait(&req);
+}
+
+void blkq_plug(struct dev_info * dev)
+{
+    struct blk_queue * q = dev->blkq;
+
+    if (!q)
+        return;
+
+    mtx_lock(&q->bq_lock);
+    q->bq_plugged++;
+    mtx_unlock(&q->bq_lock);
+}
+
+void blkq_unplug(struct dev_info * dev)
+{
+    struct blk_queue * q = dev->blkq;
+    int kick;
+
+    if (!q)
+        return;
+
+    mtx_lock(&q->bq_lock);
+    KASSERT(q->bq_plugged > 0, "blkq should be plugged");
+    kick = --q->bq_plugged == 0 && !TAILQ_EMPTY(&q->bq_reqs);
+    mtx_unlock(&q->bq_lock);
+
+    if (kick)
+        blkq_kick(q);
+}
+
+static struct blk_queue * blkq_next_kicked(void)
+{
+    struct blk_queue * q;
+
+    mtx_lock(&blkq_list_lock);
+    SLIST_FOREACH(q, &blkq_list, bq_link_) {
+        if (q->bq_kicked) {
+            q->bq_kicked = 0;
+            break;
+        }
+    }
+    mtx_unlock(&blkq_list_lock);
+
+    return q;
+}
+
+static void * blkq_worker(void * arg)
+{
+    struct waitq_entry we;
+
+    while (1) {
+        struct blk_queue * q;
+
+        /* Wait until blkq_kick() wakes us up. */
+        waitq_prepare(&blkq_worker_waitq, &we);
+        while (!(q = blkq_next_kicked())) {
+            waitq_sleep(&blkq_worker_waitq, &we);
+        }
+        waitq_finish(&blkq_worker_waitq, &we);
+
+        do {
+            blkq_run(q, 0);
+        } while ((q = blkq_next_kicked()));
+    }
+}
+
+int __kinit__ blkq_init(void)
+{
+    SUBSYS_DEP(sched_init);
+    SUBSYS_INIT("blkq");
+
+    struct sched_param param = {
+        .sched_policy = SCHED_FIFO,
+        .sched_priority = NICE_MIN,
+    };
+    pthread_t tid;
+
+    tid = kthread_create("blkq", &param, 0, blkq_worker, NULL);
+    if (tid < 0) {
+        KERROR(KERROR_ERR, "Failed to create a thread for blkq\n");
+        return tid;
+    }
+    blkq_worker_tid = tid;
+
+    return 0;
+}
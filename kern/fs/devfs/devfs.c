@@ -33,9 +33,11 @@
 #include <errno.h>
 #include <sys/dev_major.h>
 #include <sys/ioctl.h>
+#include <fs/blkq.h>
 #include <fs/devfs.h>
 #include <fs/fs.h>
 #include <fs/fs_util.h>
+#include <fs/namecache.h>
 #include <fs/ramfs.h>
 #include <hal/core.h>
 #include <kerror.h>
@@ -146,6 +148,8 @@ int make_dev(struct dev_info * devnfo, uid_t uid, gid_t gid, int perms,
         return -EEXIST;
 
     err = devfs_vnode_ops.mknod(vn_devfs, devnfo->dev_name, mode, devnfo, &vn);
+    namecache_purge(vn_devfs, devnfo->dev_name,
+                    strlenn(devnfo->dev_name, NAME_MAX + 1));
     if (err)
         return err;
 
@@ -166,6 +170,7 @@ void destroy_dev(vnode_t * vn)
 
     vn_devfs->vnode_ops->revlookup(vn_devfs, &vn->vn_num, name, sizeof(name));
     vn_devfs->vnode_ops->unlink(vn_devfs, name);
+    namecache_purge(vn_devfs, name, strlenn(name, sizeof(name)));
 }
 
 static int devfs_delete_vnode(vnode_t * vnode)
@@ -247,13 +252,19 @@ ssize_t dev_read(file_t * file, struct uio * uio, size_t bcount)
     if (!devnfo->read)
         return -EOPNOTSUPP;
 
-    err = uio_get_kaddr(uio, (void **)(&buf));
+    err = uio_kmap(uio, bcount, VM_PROT_WRITE, (void **)(&buf));
     if (err)
         return err;
 
+    if (devnfo->blkq) {
+        bytes_rd = blkq_rw(devnfo, BLK_REQ_READ, offset, buf, bcount, oflags);
+        goto unmap;
+    }
+
     if ((devnfo->flags & DEV_FLAGS_MB_READ) &&
             ((bcount / devnfo->block_size) > 1)) {
-        return devnfo->read(devnfo, offset, buf, bcount, oflags);
+        bytes_rd = devnfo->read(devnfo, offset, buf, bcount, oflags);
+        goto unmap;
     }
 
     buf_offset = 0;
@@ -283,6 +294,10 @@ ssize_t dev_read(file_t * file, struct uio * uio, size_t bcount)
     bytes_rd = buf_offset;
 out:
     file->seek_pos += bytes_rd;
+unmap:
+    err = uio_kunmap(uio, buf, (bytes_rd > 0) ? bytes_rd : 0);
+    if (err)
+        return err;
     return bytes_rd;
 }
 
@@ -301,13 +316,19 @@ ssize_t dev_write(file_t * file, struct uio * uio, size_t bcount)
     if (!devnfo->write)
         return -EOPNOTSUPP;
 
-    err = uio_get_kaddr(uio, (void **)(&buf));
+    err = uio_kmap(uio, bcount, VM_PROT_READ, (void **)(&buf));
     if (err)
         return err;
 
+    if (devnfo->blkq) {
+        bytes_wr = blkq_rw(devnfo, BLK_REQ_WRITE, offset, buf, bcount, oflags);
+        goto unmap;
+    }
+
     if ((devnfo->flags & DEV_FLAGS_MB_WRITE) &&
             ((bcount / devnfo->block_size) > 1)) {
-        return devnfo->write(devnfo, offset, buf, bcount, oflags);
+        bytes_wr = devnfo->write(devnfo, offset, buf, bcount, oflags);
+        goto unmap;
     }
 
     buf_offset = 0;
@@ -337,6 +358,8 @@ ssize_t dev_write(file_t * file, struct uio * uio, size_t bcount)
     bytes_wr = buf_offset;
 out:
     file->seek_pos += bytes_wr;
+unmap:
+    uio_kunmap(uio, buf, 0);
     return bytes_wr;
 }
 
@@ -51,9 +51,10 @@
 static int fatfs_mount(fs_t * fs, const char * source, uint32_t mode,
         const char * parm, int parm_len, struct fs_superblock ** sb);
 static int fatfs_umount(struct fs_superblock * fs_sb);
-static char * format_fpath(struct fatfs_inode * indir, const char * name);
 static int create_inode(struct fatfs_inode ** result, struct fatfs_sb * sb,
-                        char * fpath, size_t vn_hash, int oflags);
+                        const FF_ENT * ent, size_t vn_hash, int oflags);
+static int get_inode(struct fatfs_sb * sb, const FF_ENT * ent,
+                     vnode_t ** result);
 static void finalize_inode(vnode_t * vnode);
 static void destroy_vnode(vnode_t * vnode);
 static int fatfs_statfs(struct fs_superblock * sb, struct statvfs * st);
@@ -99,9 +100,22 @@ vnode_ops_t fatfs_vnode_ops = {
 static int fatfs_vncmp(struct vnode * vp, void * arg)
 {
     const struct fatfs_inode * const in = get_inode_of_vnode(vp);
-    const char * fpath = (char *)arg;
+    const FF_ENT * ent = (FF_ENT *)arg;
 
-    return strcmp(in->in_fpath, fpath);
+    /* A deleted entry may be reused by a new file. */
+    return !(vp->vn_len >= 0 &&
+             in->in_ent.dclust == ent->dclust &&
+             in->in_ent.index == ent->index);
+}
+
+/**
+ * Get the vfs_hash hash of a directory entry handle.
+ */
+static size_t ent_hash(const FF_ENT * ent)
+{
+    const uint32_t key[2] = { ent->dclust, ent->index };
+
+    return halfsiphash32(key, sizeof(key), fatfs_siphash_key);
 }
 
 int __kinit__ fatfs_init(void)
@@ -135,14 +149,11 @@ static vnode_t * create_raw_inode(const struct fs_superblock * sb)
 
 static vnode_t * create_root(struct fatfs_sb * fatfs_sb)
 {
-    char * rootpath = fatfs_sb->fpath_root;
-    size_t vn_hash;
+    const FF_ENT root_ent = { .dclust = 0, .index = FF_ENT_ROOT };
     struct fatfs_inode * in = NULL;
     int err;
 
-    rootpath[0] = '/';
-    vn_hash = halfsiphash32(rootpath, 1, fatfs_siphash_key);
-    err = create_inode(&in, fatfs_sb, rootpath, vn_hash,
+    err = create_inode(&in, fatfs_sb, &root_ent, ent_hash(&root_ent),
                        O_DIRECTORY | O_RDWR);
     if (err || unlikely(!in)) {
         KERROR(KERROR_ERR, "Failed to init a root vnode for fatfs (%d)\n", err);
@@ -153,7 +164,6 @@ static vnode_t * create_root(struct fatfs_sb * fatfs_sb)
      * Note that the refcount +2 should remain so that the root vnode won't be
      * ever freed from the dirty vnode list.
      */
-    in->in_fpath = rootpath;
     return &in->in_vnode;
 }
 
@@ -252,6 +262,7 @@ static int fatfs_mount(fs_t * fs, const char * source, uint32_t mode,
 
 fail:
     if (retval && fatfs_sb) {
+        fatfs_scache_destroy(&fatfs_sb->ff_fs);
         kfree(fatfs_sb);
     } else {
         *sb = &fatfs_sb->sb;
@@ -280,40 +291,16 @@ static int fatfs_umount(struct fs_superblock * fs_sb)
     return 0;
 }
 
-/**
- * Get kmalloc'd array for full path name.
- */
-static char * format_fpath(struct fatfs_inode * indir, const char * name)
-{
-    char * fpath;
-    size_t fpath_size;
-
-    KERROR_DBG("%s(indir \"%s\", name \"%s\")\n",
-               __func__, indir->in_fpath, name);
-
-    fpath_size = strlenn(name, NAME_MAX + 1) +
-                 strlenn(indir->in_fpath, NAME_MAX + 1) + 6;
-    fpath = kmalloc(fpath_size);
-    if (!fpath)
-        return NULL;
-
-    ksprintf(fpath, fpath_size, "%s/%s", indir->in_fpath, name);
-
-    KERROR_DBG("Formatted \"%s\" as \"%s\"\n", name, fpath);
-
-    return fpath;
-}
-
 /**
  * Create a inode.
- * @param fpath won't be duplicated.
- * @param oflags O_CREAT, O_DIRECTORY, O_RDONLY, O_WRONLY and O_RDWR
+ * @param ent is a handle to the directory entry of the node.
+ * @param oflags O_DIRECTORY, O_RDONLY, O_WRONLY and O_RDWR
  *               currently supported.
- *               O_WRONLY/O_RDWR creates in write mode if possible, so this
+ *               O_WRONLY/O_RDWR opens in write mode if possible, so this
  *               should be always verified with stat.
  */
 static int create_inode(struct fatfs_inode ** result, struct fatfs_sb * sb,
-                        char * fpath, size_t vn_hash, int oflags)
+                        const FF_ENT * ent, size_t vn_hash, int oflags)
 {
     struct fatfs_inode * in = NULL;
     FILINFO fno;
@@ -323,8 +310,9 @@ static int create_inode(struct fatfs_inode ** result, struct fatfs_sb * sb,
     ino_t inum;
     int err = 0, retval = 0;
 
-    KERROR_DBG("%s(fpath \"%s\", vn_hash %u)\n",
-               __func__, fpath, (uint32_t)vn_hash);
+    KERROR_DBG("%s(ent {%u, %u}, vn_hash %u)\n",
+               __func__, (unsigned)ent->dclust, (unsigned)ent->index,
+               (uint32_t)vn_hash);
 
     vn = inpool_get_next(&sb->inpool);
     if (!vn) {
@@ -332,7 +320,7 @@ static int create_inode(struct fatfs_inode ** result, struct fatfs_sb * sb,
         goto fail;
     }
     in = get_inode_of_vnode(vn);
-    in->in_fpath = fpath;
+    in->in_ent = *ent;
 
     in->open_count = ATOMIC_INIT(0);
 
@@ -342,11 +330,8 @@ static int create_inode(struct fatfs_inode ** result, struct fatfs_sb * sb,
         /* O_DIRECTORY was specified. */
         /* TODO Maybe get mp stat? */
         fno.fattrib = AM_DIR;
-    } else if (oflags & O_CREAT) {
-        if (sb->sb.mode_flags & MNT_RDONLY)
-            return -EROFS;
     } else {
-        err = f_stat(&sb->ff_fs, fpath, &fno);
+        err = f_stat(&sb->ff_fs, ent, &fno);
         if (err) {
             retval = fresult2errno(err);
             goto fail;
@@ -357,7 +342,7 @@ static int create_inode(struct fatfs_inode ** result, struct fatfs_sb * sb,
     if (fno.fattrib & AM_DIR) {
         /* it's a directory */
         vn_mode = S_IFDIR;
-        err = f_opendir(&in->dp, &sb->ff_fs, in->in_fpath);
+        err = f_opendir(&in->dp, &sb->ff_fs, ent);
         if (err) {
             KERROR_DBG("%s: Can't open a dir (err: %d)\n",
                        __func__, err);
@@ -369,7 +354,6 @@ static int create_inode(struct fatfs_inode ** result, struct fatfs_sb * sb,
         /* it's a file */
         unsigned char fomode = 0;
 
-        fomode |= (oflags & O_CREAT) ? FA_OPEN_ALWAYS : FA_OPEN_EXISTING;
         /* The kernel should always have RW if possible. */
         if (sb->sb.mode_flags & MNT_RDONLY) {
             fomode |= FA_READ;
@@ -378,7 +362,7 @@ static int create_inode(struct fatfs_inode ** result, struct fatfs_sb * sb,
         }
 
         vn_mode = S_IFREG;
-        err = f_open(&in->fp, &sb->ff_fs, in->in_fpath, fomode);
+        err = f_open(&in->fp, &sb->ff_fs, ent, fomode);
         if (err) {
 #ifdef configFATFS_DEBUG
             FS_KERROR_FS(KERROR_DEBUG, sb->sb.fs,
@@ -392,23 +376,21 @@ static int create_inode(struct fatfs_inode ** result, struct fatfs_sb * sb,
     }
 
 #ifdef configFATFS_DEBUG
-    if (oflags & O_CREAT)
-        FS_KERROR_FS(KERROR_DEBUG, sb->sb.fs, "Create & open ok\n");
-    else
-        FS_KERROR_FS(KERROR_DEBUG, sb->sb.fs, "Open ok\n");
+    FS_KERROR_FS(KERROR_DEBUG, sb->sb.fs, "Open ok\n");
 #endif
 
     init_fatfs_vnode(vn, inum, vn_mode, &sb->sb);
 
     /* Insert to the cache */
-    err = vfs_hash_insert(vfs_hash_ctx, vn, vn_hash, &xvp, fpath);
+    err = vfs_hash_insert(vfs_hash_ctx, vn, vn_hash, &xvp, &in->in_ent);
     if (err) {
         retval = -ENOMEM;
         goto fail;
     }
     if (xvp) {
-        FS_KERROR_FS(KERROR_ERR, sb->sb.fs, "Found it during insert: \"%s\"\n",
-                     fpath);
+        FS_KERROR_FS(KERROR_ERR, sb->sb.fs,
+                     "Found it during insert: {%u, %u}\n",
+                     (unsigned)ent->dclust, (unsigned)ent->index);
         retval = ENOTRECOVERABLE;
         goto fail;
     }
@@ -438,7 +420,7 @@ static void finalize_inode(vnode_t * vnode)
 {
     struct fatfs_inode * in = get_inode_of_vnode(vnode);
 
-    KERROR_DBG("%s(in %p), %s\n", __func__, in, in->in_fpath);
+    KERROR_DBG("%s(in %p)\n", __func__, in);
 
     vrele_nunlink(vnode); /* If called by inpool */
     vfs_hash_remove(vfs_hash_ctx, &in->in_vnode);
@@ -451,8 +433,9 @@ static void finalize_inode(vnode_t * vnode)
         if (!S_ISDIR(vnode->vn_mode))
             f_sync(&in->fp);
     }
+    if (S_ISREG(vnode->vn_mode))
+        f_release(&in->fp);
 
-    kfree(in->in_fpath);
     memset(in, 0, sizeof(*in));
 }
 
@@ -518,7 +501,8 @@ static int fatfs_delete_vnode(vnode_t * vnode)
     struct fatfs_sb * sb = get_ffsb_of_sb(vnode->sb);
 
 #ifdef configFATFS_DEBUG
-    FS_KERROR_VNODE(KERROR_DEBUG, vnode, "%s\n", in->in_fpath);
+    FS_KERROR_VNODE(KERROR_DEBUG, vnode, "{%u, %u}\n",
+                    (unsigned)in->in_ent.dclust, (unsigned)in->in_ent.index);
 #endif
 
     /*
@@ -561,86 +545,31 @@ static void fatfs_event_file_closed(struct proc_info * p, file_t * file)
 }
 
 /**
- * Lookup for a vnode (file/dir) in FatFs.
- * First lookup form vfs_hash and if not found then read it from ff which will
- * probably read it via devfs interface. After the vnode has been created it
- * will be added to the vfs hashmap. In ff terminology all files and directories
- * that are in hashmap are also open on a file/dir handle, thus we'll have to
- * make sure we don't have too many vnodes in cache that have no references, to
- * avoid hitting any ff hard limits.
+ * Get the vnode of a directory entry.
+ * First lookup form vfs_hash and if not found then create a new inode.
+ * @param ent is a handle to the directory entry.
+ * @param[out] result returns a referenced vnode.
  */
-static int fatfs_lookup(vnode_t * dir, const char * name, vnode_t ** result)
+static int get_inode(struct fatfs_sb * sb, const FF_ENT * ent,
+                     vnode_t ** result)
 {
-    struct fatfs_inode * indir = get_inode_of_vnode(dir);
-    struct fatfs_sb * sb = get_ffsb_of_sb(dir->sb);
-    char * in_fpath;
-    size_t in_fpath_len;
     size_t vn_hash;
     struct vnode * vn = NULL;
-    int retval = 0;
-
-    KASSERT(dir != NULL, "dir must be set");
-
-    /* Format full path */
-    in_fpath = format_fpath(indir, name);
-    if (!in_fpath)
-        return -ENOMEM;
-
-    in_fpath_len = strlenn(in_fpath, NAME_MAX + 1);
-
-    /*
-     * Emulate . and ..
-     */
-    if (name[0] == '.' && name[1] != '.') {
-#ifdef configFATFS_DEBUG
-        FS_KERROR_VNODE(KERROR_DEBUG, dir, "Lookup emulating \".\"\n");
-#endif
-        (void)vref(dir);
-        *result = dir;
-
-        kfree(in_fpath);
-        return 0;
-    } else if (name[0] == '.' && name[1] == '.' && name[2] != '.') {
-#ifdef configFATFS_DEBUG
-        FS_KERROR_VNODE(KERROR_DEBUG, dir, "Lookup emulating \"..\"\n");
-#endif
-        if (VN_IS_FSROOT(dir)) {
-            /*
-             * No ref is taken since we are returning an error and the caller
-             * has at least one ref anyway, so it's safe.
-             */
-            *result = dir;
-
-            kfree(in_fpath);
-            return -EDOM;
-        } else {
-            size_t i = in_fpath_len - 4;
-
-            while (in_fpath[i] != '/') {
-                i--;
-            }
-            in_fpath[i] = '\0';
-        }
-    }
+    int retval;
 
-    /* Short circuit for root */
-    if (in_fpath[0] == '/' && in_fpath[1] == '\0') {
-        kfree(in_fpath);
-        *result = dir->sb->root;
+    if (ent->index == FF_ENT_ROOT) {
+        *result = sb->sb.root;
         vref(*result);
 
         return 0;
     }
 
-    /*
-     * Lookup from vfs_hash cache
-     */
-    vn_hash = halfsiphash32(in_fpath, in_fpath_len, fatfs_siphash_key);
+    vn_hash = ent_hash(ent);
     retval = vfs_hash_get(vfs_hash_ctx,
-                          dir->sb,      /* FS superblock */
+                          &sb->sb,      /* FS superblock */
                           vn_hash,      /* Hash */
                           &vn,          /* Retval */
-                          in_fpath      /* Compared fpath */
+                          (void *)ent   /* Compared handle */
                          );
     if (retval) {
 #ifdef configFATFS_DEBUG
@@ -665,18 +594,73 @@ static int fatfs_lookup(vnode_t * dir, const char * name, vnode_t ** result)
          * Create a inode and fetch data from the device.
          * This also vrefs.
          */
-        retval = create_inode(&in, sb, in_fpath, vn_hash, O_RDWR);
+        retval = create_inode(&in, sb, ent, vn_hash, O_RDWR);
         if (!retval) {
             KASSERT(in != NULL, "in must be set");
-            in_fpath = NULL; /* shall not be freed. */
             *result = &in->in_vnode;
         }
     }
 
-    kfree(in_fpath);
     return retval;
 }
 
+/**
+ * Lookup for a vnode (file/dir) in FatFs.
+ * The name is searched from the directory pointed by the start cluster of
+ * dir, so only one directory is scanned per path component. The found
+ * directory entry is then used as a key to the vfs_hash. In ff terminology
+ * all files and directories that are in hashmap are also open on a file/dir
+ * handle, thus we'll have to make sure we don't have too many vnodes in cache
+ * that have no references, to avoid hitting any ff hard limits.
+ */
+static int fatfs_lookup(vnode_t * dir, const char * name, vnode_t ** result)
+{
+    struct fatfs_inode * indir = get_inode_of_vnode(dir);
+    struct fatfs_sb * sb = get_ffsb_of_sb(dir->sb);
+    FF_ENT ent;
+    FRESULT fres;
+
+    KASSERT(dir != NULL, "dir must be set");
+
+    if (!S_ISDIR(dir->vn_mode))
+        return -ENOTDIR;
+
+    /*
+     * Emulate . and ..
+     */
+    if (name[0] == '.' && name[1] == '\0') {
+#ifdef configFATFS_DEBUG
+        FS_KERROR_VNODE(KERROR_DEBUG, dir, "Lookup emulating \".\"\n");
+#endif
+        (void)vref(dir);
+        *result = dir;
+
+        return 0;
+    } else if (name[0] == '.' && name[1] == '.' && name[2] == '\0') {
+#ifdef configFATFS_DEBUG
+        FS_KERROR_VNODE(KERROR_DEBUG, dir, "Lookup emulating \"..\"\n");
+#endif
+        if (VN_IS_FSROOT(dir)) {
+            /*
+             * No ref is taken since we are returning an error and the caller
+             * has at least one ref anyway, so it's safe.
+             */
+            *result = dir;
+
+            return -EDOM;
+        }
+
+        /* The parent is the directory containing the entry of dir. */
+        fres = f_dirent(&sb->ff_fs, indir->in_ent.dclust, &ent);
+    } else {
+        fres = f_lookup(&sb->ff_fs, indir->dp.sclust, name, &ent, NULL);
+    }
+    if (fres)
+        return fresult2errno(fres);
+
+    return get_inode(sb, &ent, result);
+}
+
 ssize_t fatfs_read(file_t * file, struct uio * uio, size_t count)
 {
     void * buf;
@@ -687,17 +671,24 @@ ssize_t fatfs_read(file_t * file, struct uio * uio, size_t count)
     if (!S_ISREG(file->vnode->vn_mode))
         return -EOPNOTSUPP;
 
-    err = f_lseek(&in->fp, file->seek_pos);
-    if (err)
-        return -EIO;
+    if (f_tell(&in->fp) != file->seek_pos) {
+        err = f_lseek(&in->fp, file->seek_pos);
+        if (err)
+            return -EIO;
+    }
 
-    err = uio_get_kaddr(uio, &buf);
+    err = uio_kmap(uio, count, VM_PROT_WRITE, &buf);
     if (err)
         return err;
 
     err = f_read(&in->fp, buf, count, &count_out);
-    if (err)
+    if (err) {
+        uio_kunmap(uio, buf, 0);
         return fresult2errno(err);
+    }
+    err = uio_kunmap(uio, buf, count_out);
+    if (err)
+        return err;
 
     file->seek_pos = f_tell(&in->fp);
     return count_out;
@@ -713,15 +704,18 @@ ssize_t fatfs_write(file_t * file, struct uio * uio, size_t count)
     if (!S_ISREG(file->vnode->vn_mode))
         return -EOPNOTSUPP;
 
-    err = f_lseek(&in->fp, file->seek_pos);
-    if (err)
-        return -EIO;
+    if (f_tell(&in->fp) != file->seek_pos) {
+        err = f_lseek(&in->fp, file->seek_pos);
+        if (err)
+            return -EIO;
+    }
 
-    err = uio_get_kaddr(uio, &buf);
+    err = uio_kmap(uio, count, VM_PROT_READ, &buf);
     if (err)
         return err;
 
     err = f_write(&in->fp, buf, count, &count_out);
+    uio_kunmap(uio, buf, 0);
     if (err)
         return fresult2errno(err);
 
@@ -739,19 +733,13 @@ int fatfs_create(vnode_t * dir, const char * name, mode_t mode,
 int fatfs_unlink(vnode_t * dir, const char * name)
 {
     struct fatfs_inode * indir = get_inode_of_vnode(dir);
-    kmalloc_autofree char * in_fpath = NULL;
+    struct fatfs_sb * ffsb = get_ffsb_of_sb(dir->sb);
     vnode_autorele vnode_t * vnode = NULL;
-    struct fatfs_inode * in;
-    FATFS * fs;
     int retval;
 
     if (!S_ISDIR(dir->vn_mode))
         return -ENOTDIR;
 
-    in_fpath = format_fpath(indir, name);
-    if (!in_fpath)
-        return -ENOMEM;
-
     if (fatfs_lookup(dir, name, &vnode)) {
         retval = -ENOTDIR;
         goto out;
@@ -762,22 +750,20 @@ int fatfs_unlink(vnode_t * dir, const char * name)
         goto out;
     }
 
-    in = get_inode_of_vnode(vnode);
-    if (S_ISDIR(vnode->vn_mode)) {
-        fs = in->dp.fs;
-    } else {
-        fs = in->fp.fs;
-    }
-    retval = fresult2errno(f_unlink(fs, in->in_fpath));
+    retval = fresult2errno(f_unlink(&ffsb->ff_fs, indir->dp.sclust, name));
     if (retval)
         goto out;
 
     vnode->vn_len = -1; /* Mark deleted by setting len to a negative value. */
+    /*
+     * The directory entry slot may be reused for a new name, so the stale
+     * inode must not be found by the entry anymore.
+     */
+    vfs_hash_remove(vfs_hash_ctx, vnode);
     vrele_nunlink(vnode);
 
     retval = 0;
 out:
-    kfree(in_fpath);
     return retval;
 }
 
@@ -785,9 +771,9 @@ int fatfs_mknod(vnode_t * dir, const char * name, int mode, void * specinfo,
                 vnode_t ** result)
 {
     struct fatfs_inode * indir = get_inode_of_vnode(dir);
-    struct fatfs_inode * res = NULL;
-    char * in_fpath;
-    size_t in_fpath_len;
+    struct fatfs_sb * ffsb = get_ffsb_of_sb(dir->sb);
+    vnode_t * vn;
+    FF_ENT ent;
     int err;
 
     KERROR_DBG("%s(dir %p, name \"%s\", mode %u, specinfo %p, result %p)\n",
@@ -802,23 +788,22 @@ int fatfs_mknod(vnode_t * dir, const char * name, int mode, void * specinfo,
     if (specinfo)
         return -EINVAL; /* specinfo not supported. */
 
-    in_fpath = format_fpath(indir, name);
-    if (!in_fpath)
-        return -ENOMEM;
+    if (ffsb->sb.mode_flags & MNT_RDONLY)
+        return -EROFS;
 
-    in_fpath_len = strlenn(in_fpath, NAME_MAX + 1);
-    err = create_inode(&res, get_ffsb_of_sb(dir->sb), in_fpath,
-                       halfsiphash32(in_fpath, in_fpath_len, fatfs_siphash_key),
-                       O_CREAT);
-    if (err) {
-        kfree(in_fpath);
-        return fresult2errno(err);
-    }
-    KASSERT(res != NULL, "res must be set");
+    err = fresult2errno(f_create(&ffsb->ff_fs, indir->dp.sclust, name, &ent));
+    if (err)
+        return err;
+
+    err = get_inode(ffsb, &ent, &vn);
+    if (err)
+        return err;
 
+    fatfs_chmod(vn, mode);
     if (result)
-        *result = &res->in_vnode;
-    fatfs_chmod(&res->in_vnode, mode);
+        *result = vn;
+    else
+        vrele(vn);
 
 #ifdef configFATFS_DEBUG
     FS_KERROR_VNODE(KERROR_DEBUG, dir, "ok\n");
@@ -831,23 +816,11 @@ int fatfs_mkdir(vnode_t * dir,  const char * name, mode_t mode)
 {
     struct fatfs_sb * ffsb = get_ffsb_of_sb(dir->sb);
     struct fatfs_inode * indir = get_inode_of_vnode(dir);
-    char * in_fpath;
-    FRESULT err;
-    int retval = 0;
 
     if (!S_ISDIR(dir->vn_mode))
         return -ENOTDIR;
 
-    in_fpath = format_fpath(indir, name);
-    if (!in_fpath)
-        return -ENOMEM;
-
-    err = f_mkdir(&ffsb->ff_fs, in_fpath);
-    if (err)
-        retval = fresult2errno(err);
-
-    kfree(in_fpath);
-    return retval;
+    return fresult2errno(f_mkdir(&ffsb->ff_fs, indir->dp.sclust, name));
 }
 
 int fatfs_rmdir(vnode_t * dir,  const char * name)
@@ -962,11 +935,13 @@ int fatfs_stat(vnode_t * vnode, struct stat * buf)
     if (vnode == vnode->sb->root) {
         /* Can't stat FAT root */
         memcpy(buf, &mp_stat, sizeof(struct stat));
-    } else if (in->in_fpath[0] != '\0') {
-        err = f_stat(&ffsb->ff_fs, in->in_fpath, &fno);
+    } else if (in->in_ent.index != FF_ENT_ROOT) {
+        err = f_stat(&ffsb->ff_fs, &in->in_ent, &fno);
         if (err) {
-            KERROR_DBG("%s(fs %p, fpath \"%s\", fno %p) failed\n",
-                       __func__, &ffsb->ff_fs, in->in_fpath, &fno);
+            KERROR_DBG("%s(fs %p, ent {%u, %u}, fno %p) failed\n",
+                       __func__, &ffsb->ff_fs,
+                       (unsigned)in->in_ent.dclust,
+                       (unsigned)in->in_ent.index, &fno);
             return fresult2errno(err);
         }
 
@@ -1003,7 +978,7 @@ int fatfs_chmod(vnode_t * vnode, mode_t mode)
     if (!(mode & (S_IWUSR | S_IWGRP | S_IWOTH)))
         attr |= AM_RDO;
 
-    err = fresult2errno(f_chmod(&ffsb->ff_fs, in->in_fpath, attr, mask));
+    err = fresult2errno(f_chmod(&ffsb->ff_fs, &in->in_ent, attr, mask));
     if (!err)
         vnode->vn_mode = mode;
 
@@ -1031,7 +1006,7 @@ int fatfs_chflags(vnode_t * vnode, fflags_t flags)
     if (flags & UF_HIDDEN)
         attr |= AM_HID;
 
-    fresult = f_chmod(&ffsb->ff_fs, in->in_fpath, attr, mask);
+    fresult = f_chmod(&ffsb->ff_fs, &in->in_ent, attr, mask);
 
     return fresult2errno(fresult);
 }
@@ -43,6 +43,7 @@
 #ifndef FATFS_H
 #define FATFS_H
 
+#include <sys/queue.h>
 #include <fs/fs.h>
 #include <fs/inpool.h>
 #include <libkern.h>
@@ -52,7 +53,7 @@
 
 struct fatfs_inode {
     vnode_t in_vnode;   /*!< vnode for this inode. */
-    char * in_fpath;    /*!< Full path to this node from the sb root. */
+    FF_ENT in_ent;      /*!< Handle to the directory entry of this node. */
     atomic_t open_count;
 
     /**
@@ -64,6 +65,31 @@ struct fatfs_inode {
     };
 };
 
+#define FATFS_SCACHE_SIZE       configFATFS_SCACHE_SIZE
+#define FATFS_SCACHE_HASHSIZE   16 /*!< Number of hash buckets, a power of 2. */
+
+/**
+ * A cached sector.
+ */
+struct fatfs_scache_buf {
+    DWORD sect;                                 /*!< Sector number. */
+    unsigned flags;                             /*!< Buffer state flags. */
+    LIST_ENTRY(fatfs_scache_buf) hash_entry_;   /*!< Set if valid. */
+    TAILQ_ENTRY(fatfs_scache_buf) lru_entry_;
+    uint8_t * data;
+};
+
+/**
+ * Sector cache for FAT and directory sectors of a volume.
+ * Protected by the FATFS sync object.
+ */
+struct fatfs_scache {
+    struct fatfs_scache_buf * bufs;
+    uint8_t * data;
+    LIST_HEAD(fatfs_scache_hash, fatfs_scache_buf) hash[FATFS_SCACHE_HASHSIZE];
+    TAILQ_HEAD(fatfs_scache_lru, fatfs_scache_buf) lru; /*!< LRU first. */
+};
+
 /**
  * FatFs superblock.
  */
@@ -71,8 +97,8 @@ struct fatfs_sb {
     struct fs_superblock sb;    /*!< Superblock node. */
     inpool_t inpool;            /*!< inode pool. */
     file_t ff_devfile;          /*!< Fs device. */
+    struct fatfs_scache scache; /*!< Sector cache. */
     FATFS ff_fs;                /*!< ff descriptor. */
-    char fpath_root[2];         /*!< fpath for root. */
 };
 
 /**
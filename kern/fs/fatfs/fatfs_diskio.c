@@ -37,19 +37,20 @@
 #include <libkern.h>
 #include <hal/core.h>
 #include <kerror.h>
+#include <kmalloc.h>
 #include <fs/fs.h>
 #include <fs/devfs.h>
 #include "fatfs.h"
 
 /**
- * Read sector(s).
+ * Read sector(s) from the device.
  * @param buff      is a data buffer to store read data.
  * @param sector    is a sector address in LBA.
  * @param count     is the number of bytes to read.
  *
  */
-DRESULT fatfs_disk_read(FATFS * ff_fs, uint8_t * buff, DWORD sector,
-                        unsigned int count)
+static DRESULT devfile_read(FATFS * ff_fs, uint8_t * buff, DWORD sector,
+                            unsigned int count)
 {
     file_t * file = &get_ffsb_of_fffs(ff_fs)->ff_devfile;
     struct vnode_ops * vnops = file->vnode->vnode_ops;
@@ -68,7 +69,7 @@ DRESULT fatfs_disk_read(FATFS * ff_fs, uint8_t * buff, DWORD sector,
     retval = vnops->read(file, &uio, count);
     if (retval < 0) {
 #ifdef configFATFS_DEBUG
-        KERROR(KERROR_ERR, "fatfs_disk_read(): err %i\n", retval);
+        KERROR(KERROR_ERR, "%s(): err %i\n", __func__, retval);
 #endif
         return RES_ERROR;
     }
@@ -85,13 +86,13 @@ DRESULT fatfs_disk_read(FATFS * ff_fs, uint8_t * buff, DWORD sector,
 }
 
 /**
- * Write sector(s).
+ * Write sector(s) to the device.
  * @param buff      is the data buffer to be written.
  * @param sector    is a sector address in LBA.
  * @param count     is the number of bytes to write.
  */
-DRESULT fatfs_disk_write(FATFS * ff_fs, const uint8_t * buff, DWORD sector,
-                         unsigned int count)
+static DRESULT devfile_write(FATFS * ff_fs, const uint8_t * buff,
+                             DWORD sector, unsigned int count)
 {
     file_t * file = &get_ffsb_of_fffs(ff_fs)->ff_devfile;
     struct vnode_ops * vnops = file->vnode->vnode_ops;
@@ -121,6 +122,302 @@ DRESULT fatfs_disk_write(FATFS * ff_fs, const uint8_t * buff, DWORD sector,
     return 0;
 }
 
+#define SCACHE_VALID    0x01 /*!< The buffer contains a sector. */
+#define SCACHE_DIRTY    0x02 /*!< The sector must be written back. */
+
+static struct fatfs_scache * get_scache(FATFS * ff_fs)
+{
+    return &get_ffsb_of_fffs(ff_fs)->scache;
+}
+
+static struct fatfs_scache_hash * scache_bucket(struct fatfs_scache * sc,
+                                                DWORD sector)
+{
+    return &sc->hash[sector & (FATFS_SCACHE_HASHSIZE - 1)];
+}
+
+/**
+ * Allocate the cache buffers on the first use.
+ * The sector size is not known before the volume is being mounted.
+ * @return Returns 0 if the cache is usable; Otherwise -1.
+ */
+static int scache_init(FATFS * ff_fs, struct fatfs_scache * sc)
+{
+    if (sc->bufs)
+        return 0;
+
+    sc->bufs = kzalloc(FATFS_SCACHE_SIZE * sizeof(struct fatfs_scache_buf));
+    sc->data = kmalloc(FATFS_SCACHE_SIZE * ff_fs->ssize);
+    if (!sc->bufs || !sc->data) {
+        kfree(sc->bufs);
+        kfree(sc->data);
+        sc->bufs = NULL;
+        sc->data = NULL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < FATFS_SCACHE_HASHSIZE; i++) {
+        LIST_INIT(&sc->hash[i]);
+    }
+    TAILQ_INIT(&sc->lru);
+    for (size_t i = 0; i < FATFS_SCACHE_SIZE; i++) {
+        struct fatfs_scache_buf * buf = &sc->bufs[i];
+
+        buf->data = sc->data + i * ff_fs->ssize;
+        TAILQ_INSERT_TAIL(&sc->lru, buf, lru_entry_);
+    }
+
+    return 0;
+}
+
+static struct fatfs_scache_buf * scache_lookup(struct fatfs_scache * sc,
+                                               DWORD sector)
+{
+    struct fatfs_scache_buf * buf;
+
+    LIST_FOREACH(buf, scache_bucket(sc, sector), hash_entry_) {
+        if (buf->sect == sector)
+            return buf;
+    }
+
+    return NULL;
+}
+
+/**
+ * Mark a buffer as the most recently used.
+ */
+static void scache_touch(struct fatfs_scache * sc,
+                         struct fatfs_scache_buf * buf)
+{
+    TAILQ_REMOVE(&sc->lru, buf, lru_entry_);
+    TAILQ_INSERT_TAIL(&sc->lru, buf, lru_entry_);
+}
+
+/**
+ * Write back a dirty buffer.
+ * A sector in the FAT area is written to every FAT copy. The buffer is left
+ * dirty if any of the writes fails, so the write is retried later.
+ */
+static DRESULT scache_writeback(FATFS * ff_fs, struct fatfs_scache_buf * buf)
+{
+    DWORD wsect = buf->sect;
+    DRESULT res;
+
+    res = devfile_write(ff_fs, buf->data, wsect, ff_fs->ssize);
+    if (res)
+        return res;
+
+    if (wsect - ff_fs->fatbase < ff_fs->fsize) {
+        for (unsigned nf = ff_fs->n_fats; nf >= 2; nf--) {
+            DRESULT err;
+
+            wsect += ff_fs->fsize;
+            err = devfile_write(ff_fs, buf->data, wsect, ff_fs->ssize);
+            if (err)
+                res = err;
+        }
+    }
+    if (res)
+        return res;
+    buf->flags &= ~SCACHE_DIRTY;
+
+    return RES_OK;
+}
+
+static void scache_invalidate(struct fatfs_scache * sc,
+                              struct fatfs_scache_buf * buf)
+{
+    LIST_REMOVE(buf, hash_entry_);
+    buf->flags = 0;
+    TAILQ_REMOVE(&sc->lru, buf, lru_entry_);
+    TAILQ_INSERT_HEAD(&sc->lru, buf, lru_entry_);
+}
+
+/**
+ * Get a buffer for a sector that is not in the cache.
+ * The least recently used buffer is reused.
+ */
+static struct fatfs_scache_buf * scache_getblk(FATFS * ff_fs,
+                                               struct fatfs_scache * sc,
+                                               DWORD sector)
+{
+    struct fatfs_scache_buf * buf = TAILQ_FIRST(&sc->lru);
+
+    if (buf->flags & SCACHE_DIRTY) {
+        if (scache_writeback(ff_fs, buf))
+            return NULL;
+    }
+    if (buf->flags & SCACHE_VALID)
+        LIST_REMOVE(buf, hash_entry_);
+
+    buf->sect = sector;
+    buf->flags = SCACHE_VALID;
+    LIST_INSERT_HEAD(scache_bucket(sc, sector), buf, hash_entry_);
+    scache_touch(sc, buf);
+
+    return buf;
+}
+
+/**
+ * Read a sector through the sector cache.
+ */
+DRESULT fatfs_scache_read(FATFS * ff_fs, uint8_t * buff, DWORD sector)
+{
+    struct fatfs_scache * sc = get_scache(ff_fs);
+    struct fatfs_scache_buf * buf;
+    DRESULT res;
+
+    if (scache_init(ff_fs, sc))
+        return devfile_read(ff_fs, buff, sector, ff_fs->ssize);
+
+    buf = scache_lookup(sc, sector);
+    if (buf) {
+        scache_touch(sc, buf);
+        memcpy(buff, buf->data, ff_fs->ssize);
+        return RES_OK;
+    }
+
+    res = devfile_read(ff_fs, buff, sector, ff_fs->ssize);
+    if (res)
+        return res;
+
+    buf = scache_getblk(ff_fs, sc, sector);
+    if (buf)
+        memcpy(buf->data, buff, ff_fs->ssize);
+
+    return RES_OK;
+}
+
+/**
+ * Write a sector to the sector cache.
+ * The sector is written to the device when it's evicted from the cache or
+ * on fatfs_scache_sync().
+ */
+DRESULT fatfs_scache_write(FATFS * ff_fs, const uint8_t * buff, DWORD sector)
+{
+    struct fatfs_scache * sc = get_scache(ff_fs);
+    struct fatfs_scache_buf * buf;
+
+    if (scache_init(ff_fs, sc))
+        goto write_through;
+
+    buf = scache_lookup(sc, sector);
+    if (buf) {
+        scache_touch(sc, buf);
+    } else {
+        buf = scache_getblk(ff_fs, sc, sector);
+        if (!buf)
+            goto write_through;
+    }
+    memcpy(buf->data, buff, ff_fs->ssize);
+    buf->flags |= SCACHE_DIRTY;
+
+    return RES_OK;
+write_through:
+    {
+        struct fatfs_scache_buf tmp = {
+            .sect = sector,
+            .data = (uint8_t *)buff,
+        };
+
+        return scache_writeback(ff_fs, &tmp);
+    }
+}
+
+/**
+ * Write back all dirty sectors in the sector cache.
+ */
+DRESULT fatfs_scache_sync(FATFS * ff_fs)
+{
+    struct fatfs_scache * sc = get_scache(ff_fs);
+    DRESULT res = RES_OK;
+
+    if (!sc->bufs)
+        return RES_OK;
+
+    for (size_t i = 0; i < FATFS_SCACHE_SIZE; i++) {
+        struct fatfs_scache_buf * buf = &sc->bufs[i];
+
+        if (buf->flags & SCACHE_DIRTY) {
+            DRESULT err = scache_writeback(ff_fs, buf);
+
+            if (err)
+                res = err;
+        }
+    }
+
+    return res;
+}
+
+/**
+ * Free the sector cache without writing back dirty sectors.
+ */
+void fatfs_scache_destroy(FATFS * ff_fs)
+{
+    struct fatfs_scache * sc = get_scache(ff_fs);
+
+    kfree(sc->bufs);
+    kfree(sc->data);
+    sc->bufs = NULL;
+    sc->data = NULL;
+}
+
+/**
+ * Read sector(s) bypassing the sector cache.
+ * @param buff      is a data buffer to store read data.
+ * @param sector    is a sector address in LBA.
+ * @param count     is the number of bytes to read.
+ */
+DRESULT fatfs_disk_read(FATFS * ff_fs, uint8_t * buff, DWORD sector,
+                        unsigned int count)
+{
+    struct fatfs_scache * sc = get_scache(ff_fs);
+    DRESULT res;
+
+    res = devfile_read(ff_fs, buff, sector, count);
+    if (res || !sc->bufs)
+        return res;
+
+    /* Dirty cached sectors are newer than the device. */
+    for (size_t i = 0; i < FATFS_SCACHE_SIZE; i++) {
+        struct fatfs_scache_buf * buf = &sc->bufs[i];
+
+        if ((buf->flags & SCACHE_DIRTY) && buf->sect >= sector &&
+            buf->sect - sector < count / ff_fs->ssize) {
+            memcpy(buff + (buf->sect - sector) * ff_fs->ssize, buf->data,
+                   ff_fs->ssize);
+        }
+    }
+
+    return RES_OK;
+}
+
+/**
+ * Write sector(s) bypassing the sector cache.
+ * @param buff      is the data buffer to be written.
+ * @param sector    is a sector address in LBA.
+ * @param count     is the number of bytes to write.
+ */
+DRESULT fatfs_disk_write(FATFS * ff_fs, const uint8_t * buff, DWORD sector,
+                         unsigned int count)
+{
+    struct fatfs_scache * sc = get_scache(ff_fs);
+
+    /* The cached copies of the sectors are replaced by the write. */
+    if (sc->bufs) {
+        for (size_t i = 0; i < FATFS_SCACHE_SIZE; i++) {
+            struct fatfs_scache_buf * buf = &sc->bufs[i];
+
+            if ((buf->flags & SCACHE_VALID) && buf->sect >= sector &&
+                buf->sect - sector < count / ff_fs->ssize) {
+                scache_invalidate(sc, buf);
+            }
+        }
+    }
+
+    return devfile_write(ff_fs, buff, sector, count);
+}
+
 DRESULT fatfs_disk_ioctl(FATFS * ff_fs, unsigned cmd, void * buff, size_t bsize)
 {
     file_t * file = &get_ffsb_of_fffs(ff_fs)->ff_devfile;
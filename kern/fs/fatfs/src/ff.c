@@ -414,25 +414,16 @@ static void unlock_fs(FATFS * fs, FRESULT res)
 
 /**
  * Move/Flush disk access window in the file system object.
+ * The window is written to the sector cache, the cache writes FAT sectors
+ * to all FAT copies when the sector is written back.
  * @param fs File system object.
  */
 static FRESULT sync_window(FATFS * fs)
 {
-    DWORD wsect;
-    unsigned int nf;
-
     if (fs->wflag) {    /* Write back the sector if it is dirty */
-        wsect = fs->winsect;    /* Current sector number */
-        if (fatfs_disk_write(fs, fs->win, wsect, fs->ssize))
+        if (fatfs_scache_write(fs, fs->win, fs->winsect))
             return FR_DISK_ERR;
         fs->wflag = 0;
-        if (wsect - fs->fatbase < fs->fsize) { /* Is it in the FAT area? */
-            /* Reflect the change to all FAT copies */
-            for (nf = fs->n_fats; nf >= 2; nf--) {
-                wsect += fs->fsize;
-                fatfs_disk_write(fs, fs->win, wsect, fs->ssize);
-            }
-        }
     }
 
     return FR_OK;
@@ -446,7 +437,7 @@ static FRESULT move_window(FATFS * fs, DWORD sector)
 {
     if (sector != fs->winsect) {    /* Changed current window */
         if ((!(fs->opt & FATFS_READONLY) && sync_window(fs) != FR_OK) ||
-            fatfs_disk_read(fs, fs->win, sector, fs->ssize)) {
+            fatfs_scache_read(fs, fs->win, sector)) {
             return FR_DISK_ERR;
         }
         fs->winsect = sector;
@@ -484,6 +475,9 @@ static FRESULT sync_fs(FATFS * fs)
             fatfs_disk_write(fs, fs->win, fs->winsect, fs->ssize);
             fs->fsi_flag = 0;
         }
+        /* Write back the sector cache */
+        if (fatfs_scache_sync(fs) != RES_OK)
+            res = FR_DISK_ERR;
         /* Make sure that no pending write process in the physical drive */
         if (fatfs_disk_ioctl(fs, IOCTL_FLSBLKBUF, NULL, 0) != RES_OK)
             res = FR_DISK_ERR;
@@ -758,6 +752,237 @@ static DWORD clmt_clust(FF_FIL * fp, DWORD ofs)
 }
 #endif  /* _USE_FASTSEEK */
 
+/**
+ * Cluster map - Find the run containing a file relative cluster.
+ * @param fp Pointer to the file object.
+ * @param fcl File relative cluster index.
+ * @return Pointer to the run or NULL if fcl is not mapped.
+ */
+static struct ff_clrun * clmap_find(FF_FIL * fp, DWORD fcl)
+{
+    struct ff_clmap * map = &fp->clmap;
+    unsigned lo = 0, hi = map->nr_runs;
+
+    if (!map->valid || fcl >= map->nr_clust)
+        return NULL;
+
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        struct ff_clrun * run = &map->runs[mid];
+
+        if (fcl < run->fcl)
+            hi = mid;
+        else if (fcl >= run->fcl + run->len)
+            lo = mid + 1;
+        else
+            return run;
+    }
+
+    return NULL;
+}
+
+/**
+ * Cluster map - Convert a file relative cluster index into cluster#.
+ * @param fp Pointer to the file object.
+ * @param fcl File relative cluster index.
+ * @return 0:Not mapped; >=2:Cluster number.
+ */
+static DWORD clmap_clust(FF_FIL * fp, DWORD fcl)
+{
+    struct ff_clrun * run = clmap_find(fp, fcl);
+
+    return (run) ? run->clst + (fcl - run->fcl) : 0;
+}
+
+/**
+ * Cluster map - Append a cluster to the end of the map.
+ * The map is invalidated if the new cluster doesn't follow the last mapped
+ * cluster of the file or if the map can't be grown.
+ * @param fp Pointer to the file object.
+ * @param fcl File relative cluster index of the cluster.
+ * @param clst Cluster number.
+ */
+static void clmap_append(FF_FIL * fp, DWORD fcl, DWORD clst)
+{
+    struct ff_clmap * map = &fp->clmap;
+    struct ff_clrun * run;
+
+    if (!map->valid || fcl < map->nr_clust)
+        return;
+    if (fcl > map->nr_clust)
+        goto invalidate;
+
+    if (map->nr_runs > 0) {
+        run = &map->runs[map->nr_runs - 1];
+        if (run->clst + run->len == clst) {
+            run->len++;
+            map->nr_clust++;
+            return;
+        }
+    }
+
+    if (map->nr_runs == map->max_runs) {
+        unsigned max_runs = (map->max_runs) ? 2 * map->max_runs : 4;
+        struct ff_clrun * runs;
+
+        runs = krealloc(map->runs, max_runs * sizeof(struct ff_clrun));
+        if (!runs)
+            goto invalidate;
+        map->runs = runs;
+        map->max_runs = max_runs;
+    }
+
+    run = &map->runs[map->nr_runs++];
+    run->fcl = fcl;
+    run->clst = clst;
+    run->len = 1;
+    map->nr_clust++;
+    return;
+
+invalidate:
+    map->valid = 0;
+}
+
+/**
+ * Cluster map - Build the map by following the cluster chain on the FAT.
+ * @param fp Pointer to the file object.
+ */
+static FRESULT clmap_build(FF_FIL * fp)
+{
+    struct ff_clmap * map = &fp->clmap;
+    DWORD cl, fcl = 0;
+
+    if (map->valid)
+        return FR_OK;
+
+    map->nr_runs = 0;
+    map->nr_clust = 0;
+    map->valid = 1;
+
+    cl = fp->sclust;
+    if (cl == 0)
+        return FR_OK;
+
+    while (cl < fp->fs->n_fatent) {
+        clmap_append(fp, fcl++, cl);
+        if (!map->valid)
+            return FR_NOT_ENOUGH_CORE;
+
+        cl = get_fat(fp->fs, cl);
+        if (cl <= 1) {
+            map->valid = 0;
+            return FR_INT_ERR;
+        }
+        if (cl == 0xFFFFFFFF) {
+            map->valid = 0;
+            return FR_DISK_ERR;
+        }
+    }
+
+    return FR_OK;
+}
+
+/**
+ * Cluster map - Drop clusters removed from the end of the cluster chain.
+ * @param fp Pointer to the file object.
+ * @param nr_clust Number of clusters left in the chain.
+ */
+static void clmap_trim(FF_FIL * fp, DWORD nr_clust)
+{
+    struct ff_clmap * map = &fp->clmap;
+    struct ff_clrun * run;
+
+    if (nr_clust == 0) {
+        map->nr_runs = 0;
+        map->nr_clust = 0;
+        return;
+    }
+
+    run = clmap_find(fp, nr_clust - 1);
+    if (!run)
+        return;
+    run->len = nr_clust - run->fcl;
+    map->nr_runs = run - map->runs + 1;
+    map->nr_clust = nr_clust;
+}
+
+/**
+ * Cluster map - Stretch the cluster chain ahead of a large write.
+ * Clusters are allocated until the chain covers the cluster lfcl or the
+ * newly allocated cluster is not contiguous with the previous one. Errors
+ * are ignored here and caught by the regular stretching in f_write().
+ * @param fp Pointer to the file object.
+ * @param lfcl File relative index of the last cluster needed.
+ */
+static void clmap_stretch(FF_FIL * fp, DWORD lfcl)
+{
+    struct ff_clmap * map = &fp->clmap;
+
+    while (map->valid && map->nr_runs > 0 && map->nr_clust <= lfcl) {
+        struct ff_clrun * run = &map->runs[map->nr_runs - 1];
+        DWORD clst = run->clst + run->len - 1;
+        DWORD ncl;
+
+        ncl = create_chain(fp->fs, clst);
+        if (ncl < 2 || ncl == 0xFFFFFFFF)
+            break;
+        clmap_append(fp, map->nr_clust, ncl);
+        if (ncl != clst + 1)
+            break;
+    }
+}
+
+/**
+ * Cluster map - Release the clusters stretched ahead of a failed write.
+ * The chain is cut after the last cluster covering the file size or the
+ * current file pointer, whichever is larger.
+ * @param fp Pointer to the file object.
+ */
+static void clmap_unstretch(FF_FIL * fp)
+{
+    const DWORD bcs = (DWORD)fp->fs->csize * fp->fs->ssize;
+    const DWORD end = (fp->fptr > fp->fsize) ? fp->fptr : fp->fsize;
+    DWORD nr_clust = (end + bcs - 1) / bcs;
+    DWORD last, next;
+
+    if (nr_clust == 0)
+        nr_clust = 1;
+    if (!fp->clmap.valid || fp->clmap.nr_clust <= nr_clust)
+        return;
+
+    last = clmap_clust(fp, nr_clust - 1);
+    next = clmap_clust(fp, nr_clust);
+    if (last < 2 || next < 2)
+        return;
+
+    if (put_fat(fp->fs, last, 0x0FFFFFFF) == FR_OK)
+        remove_chain(fp->fs, next);
+    clmap_trim(fp, nr_clust);
+    fp->clust = last;
+}
+
+/**
+ * Cluster map - Clip a direct transfer to physically contiguous clusters.
+ * @param fp Pointer to the file object, fptr must be on a sector boundary.
+ * @param csect Sector offset in the current cluster.
+ * @param cc Number of sectors to be transferred.
+ * @return Number of sectors that can be transferred with a single request.
+ */
+static unsigned int clmap_clip(FF_FIL * fp, uint8_t csect, unsigned int cc)
+{
+    const DWORD bcs = (DWORD)fp->fs->csize * fp->fs->ssize;
+    const DWORD fcl = fp->fptr / bcs;
+    struct ff_clrun * run;
+    DWORD max;
+
+    max = fp->fs->csize - csect;
+    run = clmap_find(fp, fcl);
+    if (run && run->clst + (fcl - run->fcl) == fp->clust)
+        max += (run->len - (fcl - run->fcl) - 1) * fp->fs->csize;
+
+    return (cc > max) ? (unsigned int)max : cc;
+}
+
 /**
  * Directory handling - Set directory index.
  * @param dp Pointer to directory object.
@@ -1747,8 +1972,10 @@ static FRESULT create_name(FF_DIR * dp, const TCHAR ** path)
 
 /**
  * Follow a file path.
+ * A relative path is followed from the directory in dp->sclust and a path
+ * with a heading separator from the root directory.
  * @param dp Directory object to return last directory and found object.
- * @param path Full-path string to find a file or directory.
+ * @param path Path string to find a file or directory.
  * @return FR_OK(0): successful, !=0: error code.
  */
 static FRESULT follow_path(FF_DIR * dp, const TCHAR * path)
@@ -1757,9 +1984,10 @@ static FRESULT follow_path(FF_DIR * dp, const TCHAR * path)
     uint8_t * dir;
     FRESULT res;
 
-    if (*path == '/' || *path == '\\') /* Strip heading separator if exist */
+    if (*path == '/' || *path == '\\') { /* Strip heading separator */
         path++;
-    dp->sclust = 0; /* Always start from the root directory */
+        dp->sclust = 0; /* Start from the root directory */
+    }
 
     if ((unsigned int)*path < ' ') {
         /* Null path name is the origin directory itself */
@@ -1797,6 +2025,52 @@ static FRESULT follow_path(FF_DIR * dp, const TCHAR * path)
     return res;
 }
 
+/**
+ * Follow a directory entry handle.
+ * @param dp Directory object to return the found object.
+ * @param ent Pointer to the directory entry handle.
+ * @return FR_OK(0): successful, !=0: error code.
+ */
+static FRESULT follow_ent(FF_DIR * dp, const FF_ENT * ent)
+{
+    uint8_t * dir;
+    uint8_t a;
+    FRESULT res;
+
+    if (ent->index == FF_ENT_ROOT)
+        return FR_INVALID_NAME; /* The root directory has no entry */
+
+    dp->sclust = ent->dclust;
+    res = dir_sdi(dp, ent->index);
+    if (res == FR_OK)
+        res = move_window(dp->fs, dp->sect);
+    if (res != FR_OK)
+        return res;
+
+    dir = dp->dir;
+    a = dir[DIR_Attr] & AM_MASK;
+    if (dir[DIR_Name] == 0 || dir[DIR_Name] == DDE || a == AM_LFN ||
+        (a & AM_VOL)) {
+        return FR_NO_FILE; /* The entry is not used by an object */
+    }
+#if configFATFS_LFN
+    dp->lfn_idx = 0xFFFF; /* The LFN is not known */
+#endif
+
+    return FR_OK;
+}
+
+/**
+ * Get the handle of the object found by follow_path().
+ * @param dp Directory object pointing to the object.
+ * @param ent Pointer to the handle to be filled.
+ */
+static void get_ent(const FF_DIR * dp, FF_ENT * ent)
+{
+    ent->dclust = dp->sclust;
+    ent->index = dp->index;
+}
+
 /**
  * Load a sector and check if it is an FAT boot sector.
  * @param fs File system object.
@@ -2013,23 +2287,31 @@ FRESULT f_mount(FATFS * fs, uint8_t opt)
 
 FRESULT f_umount(FATFS * fs)
 {
+    FRESULT res = FR_OK;
+
+    if (fs->fs_type && !(fs->opt & FATFS_READONLY)) {
+        if (lock_fs(fs))
+            return FR_TIMEOUT;
+        res = sync_fs(fs);
+        unlock_fs(fs, res);
+    }
+    fatfs_scache_destroy(fs);
     memset(fs, 0, sizeof(*fs));
 
-    return FR_OK;
+    return res;
 }
 
 /**
- * Open or Create a File.
+ * Open a File.
  * @param fp Pointer to the blank file object.
- * @param path Pointer to the file name.
- * @param mode Access mode and file open mode flags.
+ * @param ent Pointer to the handle of the file.
+ * @param mode Access mode flags.
  */
-FRESULT f_open(FF_FIL * fp, FATFS * fs, const TCHAR * path, uint8_t mode)
+FRESULT f_open(FF_FIL * fp, FATFS * fs, const FF_ENT * ent, uint8_t mode)
 {
     FRESULT res;
     FF_DIR dj = { .fs = fs };
     uint8_t * dir;
-    DEF_NAMEBUF;
 
     if (!fp)
         return FR_INVALID_OBJECT;
@@ -2037,118 +2319,210 @@ FRESULT f_open(FF_FIL * fp, FATFS * fs, const TCHAR * path, uint8_t mode)
 
     if (lock_fs(dj.fs))
         return FR_TIMEOUT;
-    if (!(fs->opt & FATFS_READONLY)) {
-        mode &= FA_READ | FA_WRITE | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS |
-                FA_CREATE_NEW;
-    } else {
-        mode &= FA_READ;
-    }
+    mode &= (fs->opt & FATFS_READONLY) ? FA_READ : FA_READ | FA_WRITE;
     res = access_volume(dj.fs,
-                        ((mode & (FA_WRITE | FA_CREATE_ALWAYS |
-                          FA_CREATE_NEW)) != 0) ?  ACCVOL_WRITE : ACCVOL_READ);
+                        (mode & FA_WRITE) ? ACCVOL_WRITE : ACCVOL_READ);
+    if (res != FR_OK)
+        goto fail;
+
+    res = follow_ent(&dj, ent);
+    if (res != FR_OK)
+        goto fail;
+
+    dir = dj.dir;
+    if (dir[DIR_Attr] & AM_DIR) { /* It is a directory */
+        res = FR_NO_FILE;
+        goto fail;
+    }
+    /*
+     * NO RO check is needed because the actual check is done
+     * elsewhere.
+     */
+
+    /* Pointer to the directory entry */
+    fp->dir_sect = dj.fs->winsect;
+    fp->dir_ptr = dir;
+
+    fp->flag = mode;                    /* File access mode */
+    fp->err = 0;                        /* Clear error flag */
+    fp->ino = get_ino(&dj);
+    fp->sclust = ld_clust(dj.fs, dir);  /* File start cluster */
+    fp->fsize = LD_DWORD(dir + DIR_FileSize); /* File size */
+    fp->fptr = 0;                       /* File pointer */
+    fp->dsect = 0;
+#if _USE_FASTSEEK
+    fp->cltbl = 0;                      /* Normal seek mode */
+#endif
+    fp->clmap.valid = 0;                /* Build cluster map lazily */
+    fp->fs = dj.fs;                     /* Validate file object */
+
+fail:
+    return LEAVE_FF(dj.fs, res);
+}
+
+/**
+ * Create a File.
+ * An existing file with the same name is left untouched.
+ * @param dclust Start cluster of the directory (0:Root dir).
+ * @param path Pointer to the file name relative to the directory.
+ * @param ent Pointer to return the handle of the file.
+ */
+FRESULT f_create(FATFS * fs, DWORD dclust, const TCHAR * path, FF_ENT * ent)
+{
+    FRESULT res;
+    FF_DIR dj = { .fs = fs, .sclust = dclust };
+    uint8_t * dir;
+    DEF_NAMEBUF;
+
+    if (lock_fs(dj.fs))
+        return FR_TIMEOUT;
+
+    res = access_volume(dj.fs, ACCVOL_WRITE);
     if (res != FR_OK)
         goto fail;
 
     INIT_NAMEBUF(dj);
     res = follow_path(&dj, path);   /* Follow the file path */
-    dir = dj.dir;
-    if (!(fs->opt & FATFS_READONLY)) {
-        if (res == FR_OK) {
-            if (!dir) { /* Default directory itself */
-                res = FR_INVALID_NAME;
-            }
-        }
-        /* Create or Open a file */
-        if (mode & (FA_CREATE_ALWAYS | FA_OPEN_ALWAYS | FA_CREATE_NEW)) {
-            DWORD dw, cl;
-
-            if (res != FR_OK) { /* No file, create new */
-                if (res == FR_NO_FILE) {
-                    /* There is no file to open, create a new entry */
-                    res = dir_register(&dj);
-                }
-                mode |= FA_CREATE_ALWAYS;       /* File is created */
-                dir = dj.dir;                   /* New entry */
-            } else { /* Any object is already existing */
-                if (dir[DIR_Attr] & (AM_RDO | AM_DIR)) {
-                    /* Cannot overwrite it (R/O or DIR) */
-                    res = FR_DENIED;
-                } else {
-                    if (mode & FA_CREATE_NEW) {
-                        /* Cannot create as new file */
-                        res = FR_EXIST;
-                    }
-                }
-            }
-            /* Truncate it if overwrite mode */
-            if (res == FR_OK && (mode & FA_CREATE_ALWAYS)) {
-                uint32_t dt;
-
-                dt = fatfs_time_get_time();     /* Created time */
-                ST_WORD(dir + DIR_CrtTime, dt & 0xffff);
-                ST_WORD(dir + DIR_CrtDate, dt >> 16);
-
-                dir[DIR_Attr] = 0;              /* Reset attribute */
-                ST_DWORD(dir + DIR_FileSize, 0); /* size = 0 */
-                cl = ld_clust(dj.fs, dir);      /* Get start cluster */
-                st_clust(dir, 0);               /* cluster = 0 */
-                dj.fs->wflag = 1;
-                if (cl) {
-                    /* Remove the cluster chain if exist */
-                    dw = dj.fs->winsect;
-                    res = remove_chain(dj.fs, cl);
-                    if (res == FR_OK) {
-                        /* Reuse the cluster hole */
-                        dj.fs->last_clust = cl - 1;
-                        res = move_window(dj.fs, dw);
-                    }
-                }
-            }
-        } else if (res == FR_OK) {
-            /* Open an existing file if follow succeeded */
-            if (dir[DIR_Attr] & AM_DIR) {   /* It is a directory */
-                res = FR_NO_FILE;
-            }
-            /*
-             * NO RO check is needed because the actual check is done
-             * elsewhere.
-             */
+    if (res == FR_OK) {             /* Any object is already existing */
+        dir = dj.dir;
+        if (!dir) {
+            res = FR_INVALID_NAME;  /* The directory itself */
+        } else if (dir[DIR_Attr] & (AM_RDO | AM_DIR)) {
+            res = FR_DENIED;        /* Cannot overwrite it (R/O or DIR) */
         }
-
+    } else if (res == FR_NO_FILE) { /* No file, create new */
+        res = dir_register(&dj);
         if (res == FR_OK) {
-            if (mode & FA_CREATE_ALWAYS) {
-                /* Set file change flag if created or overwritten */
-                mode |= FA__WRITTEN;
-            }
-            /* Pointer to the directory entry */
-            fp->dir_sect = dj.fs->winsect;
-            fp->dir_ptr = dir;
-        }
-    } else if (res == FR_OK) { /* RO fs */
-        /* Follow succeeded */
-        dir = dj.dir;
-        if (!dir) {                     /* Current directory itself */
-            res = FR_INVALID_NAME;
-        } else if (dir[DIR_Attr] & AM_DIR) { /* It is a directory */
-            res = FR_NO_FILE;
+            uint32_t dt;
+
+            dir = dj.dir;
+            dt = fatfs_time_get_time(); /* Created time */
+            ST_WORD(dir + DIR_CrtTime, dt & 0xffff);
+            ST_WORD(dir + DIR_CrtDate, dt >> 16);
+            ST_WORD(dir + DIR_WrtTime, dt & 0xffff);
+            ST_WORD(dir + DIR_WrtDate, dt >> 16);
+            dir[DIR_Attr] = 0;              /* Reset attribute */
+            ST_DWORD(dir + DIR_FileSize, 0); /* size = 0 */
+            st_clust(dir, 0);               /* cluster = 0 */
+            dj.fs->wflag = 1;
+            res = sync_fs(dj.fs);
         }
     }
+    if (res == FR_OK)
+        get_ent(&dj, ent);
 
+fail:
     FREE_BUF();
 
-    if (res == FR_OK) {
-        fp->flag = mode;                    /* File access mode */
-        fp->err = 0;                        /* Clear error flag */
-        fp->ino = get_ino(&dj);
-        fp->sclust = ld_clust(dj.fs, dir);  /* File start cluster */
-        fp->fsize = LD_DWORD(dir + DIR_FileSize); /* File size */
-        fp->fptr = 0;                       /* File pointer */
-        fp->dsect = 0;
-#if _USE_FASTSEEK
-        fp->cltbl = 0;                      /* Normal seek mode */
-#endif
-        fp->fs = dj.fs;                     /* Validate file object */
+    return LEAVE_FF(dj.fs, res);
+}
+
+/**
+ * Lookup a File or Directory.
+ * @param dclust Start cluster of the directory (0:Root dir).
+ * @param path Pointer to the object name relative to the directory.
+ * @param ent Pointer to return the handle of the object.
+ * @param fno Pointer to file information to return, can be NULL.
+ */
+FRESULT f_lookup(FATFS * fs, DWORD dclust, const TCHAR * path, FF_ENT * ent,
+                 FILINFO * fno)
+{
+    FRESULT res;
+    FF_DIR dj = { .fs = fs, .sclust = dclust };
+    DEF_NAMEBUF;
+
+    if (lock_fs(dj.fs))
+        return FR_TIMEOUT;
+
+    res = access_volume(dj.fs, ACCVOL_READ);
+    if (res != FR_OK)
+        goto fail;
+
+    INIT_NAMEBUF(dj);
+    res = follow_path(&dj, path);   /* Follow the file path */
+    if (res != FR_OK)
+        goto fail;
+
+    if (dj.dir) {       /* Found an object */
+        get_ent(&dj, ent);
+        if (fno)
+            get_fileinfo(&dj, fno);
+    } else {            /* It is the directory itself */
+        res = FR_INVALID_NAME;
+    }
+
+fail:
+    FREE_BUF();
+
+    return LEAVE_FF(dj.fs, res);
+}
+
+/**
+ * Find the handle of a sub-directory.
+ * The parent directory is found by following the dot-dot entry of the
+ * sub-directory and then the entry of the sub-directory is searched by its
+ * start cluster.
+ * @param sclust Start cluster of the sub-directory (0:Root dir).
+ * @param ent Pointer to return the handle of the sub-directory.
+ */
+FRESULT f_dirent(FATFS * fs, DWORD sclust, FF_ENT * ent)
+{
+    FRESULT res;
+    FF_DIR dj = { .fs = fs };
+    uint8_t * dir;
+    uint8_t a, c;
+
+    if (lock_fs(dj.fs))
+        return FR_TIMEOUT;
+
+    res = access_volume(dj.fs, ACCVOL_READ);
+    if (res != FR_OK)
+        goto fail;
+
+    if (sclust == 0) { /* The root directory */
+        ent->dclust = 0;
+        ent->index = FF_ENT_ROOT;
+        goto fail;
+    }
+
+    /* Get the parent directory from the dot-dot entry */
+    dj.sclust = sclust;
+    res = dir_sdi(&dj, 1);
+    if (res == FR_OK)
+        res = move_window(dj.fs, dj.sect);
+    if (res != FR_OK)
+        goto fail;
+    dir = dj.dir;
+    if (dir[DIR_Name] != '.' || dir[DIR_Name + 1] != '.') {
+        res = FR_INT_ERR;
+        goto fail;
+    }
+    dj.sclust = ld_clust(dj.fs, dir);
+    if (dj.fs->fs_type == FS_FAT32 && dj.sclust == dj.fs->dirbase)
+        dj.sclust = 0;
+
+    /* Find the sub-directory entry by its start cluster */
+    res = dir_sdi(&dj, 0);
+    while (res == FR_OK) {
+        res = move_window(dj.fs, dj.sect);
+        if (res != FR_OK)
+            break;
+        dir = dj.dir;
+        c = dir[DIR_Name];
+        if (c == 0) {
+            res = FR_NO_FILE; /* Reached to end of table */
+            break;
+        }
+        a = dir[DIR_Attr] & AM_MASK;
+        if (c != DDE && c != '.' && a != AM_LFN && (a & AM_DIR) &&
+            ld_clust(dj.fs, dir) == sclust) {
+            get_ent(&dj, ent);
+            break;
+        }
+        res = dir_next(&dj, 0);
     }
+    if (res == FR_NO_FILE)
+        res = FR_NO_PATH;
 
 fail:
     return LEAVE_FF(dj.fs, res);
@@ -2163,10 +2537,11 @@ fail:
  */
 FRESULT f_read(FF_FIL * fp, void * buff, unsigned int btr, unsigned int * br)
 {
-    DWORD clst, sect, remain;
+    DWORD clst, sect, remain, bcs;
     unsigned int rcnt, cc;
     uint8_t csect;
     uint8_t * rbuff = (uint8_t *)buff;
+    FRESULT res;
 
     *br = 0;    /* Clear read byte counter */
 
@@ -2180,6 +2555,10 @@ FRESULT f_read(FF_FIL * fp, void * buff, unsigned int btr, unsigned int * br)
     remain = fp->fsize - fp->fptr;
     if (btr > remain)
         btr = (unsigned int)remain;       /* Truncate btr by remaining bytes */
+    bcs = (DWORD)fp->fs->csize * fp->fs->ssize;
+    res = clmap_build(fp);
+    if (res == FR_INT_ERR || res == FR_DISK_ERR)
+        return ABORT(fp->fs, res);
 
     for (; btr;                                 /* Repeat until all data read */
         rbuff += rcnt, fp->fptr += rcnt, *br += rcnt, btr -= rcnt) {
@@ -2197,8 +2576,12 @@ FRESULT f_read(FF_FIL * fp, void * buff, unsigned int btr, unsigned int * br)
                     } else
 #endif
                     {
-                        /* Follow cluster chain on the FAT */
-                        clst = get_fat(fp->fs, fp->clust);
+                        /* Get cluster# from the cluster map */
+                        clst = clmap_clust(fp, fp->fptr / bcs);
+                        if (clst == 0) {
+                            /* Follow cluster chain on the FAT */
+                            clst = get_fat(fp->fs, fp->clust);
+                        }
                     }
                 }
                 if (clst < 2)
@@ -2213,11 +2596,13 @@ FRESULT f_read(FF_FIL * fp, void * buff, unsigned int btr, unsigned int * br)
             sect += csect;
             cc = btr / fp->fs->ssize; /* When remaining bytes >= sector size, */
             if (cc) { /* Read maximum contiguous sectors directly */
-                if (csect + cc > fp->fs->csize) /* Clip at cluster boundary */
-                    cc = fp->fs->csize - csect;
+                /* Clip at the end of contiguous clusters */
+                cc = clmap_clip(fp, csect, cc);
                 if (fatfs_disk_read(fp->fs, rbuff, sect,
                                     cc * fp->fs->ssize))
                     return ABORT(fp->fs, FR_DISK_ERR);
+                /* Last cluster touched by the transfer */
+                fp->clust += (csect + cc - 1) / fp->fs->csize;
                 /*
                  * Replace one of the read sectors with cached data if it
                  * contains a dirty sector
@@ -2270,10 +2655,11 @@ FRESULT f_read(FF_FIL * fp, void * buff, unsigned int btr, unsigned int * br)
 FRESULT f_write(FF_FIL * fp, const void * buff, unsigned int btw,
                 unsigned int * bw)
 {
-    DWORD clst, sect;
+    DWORD clst, sect, bcs;
     unsigned int wcnt, cc;
     const uint8_t * wbuff = (const uint8_t *)buff;
     uint8_t csect;
+    FRESULT res;
 
     *bw = 0;    /* Clear write byte counter */
 
@@ -2286,6 +2672,10 @@ FRESULT f_write(FF_FIL * fp, const void * buff, unsigned int btw,
         return LEAVE_FF(fp->fs, FR_DENIED);
     if (fp->fptr + btw < fp->fptr)
         btw = 0; /* File size cannot reach 4GB */
+    bcs = (DWORD)fp->fs->csize * fp->fs->ssize;
+    res = clmap_build(fp);
+    if (res == FR_INT_ERR || res == FR_DISK_ERR)
+        return ABORT(fp->fs, res);
 
     for (; btw;                             /* Repeat until all data written */
          wbuff += wcnt, fp->fptr += wcnt, *bw += wcnt, btw -= wcnt) {
@@ -2307,15 +2697,22 @@ FRESULT f_write(FF_FIL * fp, const void * buff, unsigned int btw,
                     } else /* Follow or stretch cluster chain on the FAT */
 #endif
                     {
-                        clst = create_chain(fp->fs, fp->clust);
+                        clst = clmap_clust(fp, fp->fptr / bcs);
+                        if (clst == 0)
+                            clst = create_chain(fp->fs, fp->clust);
                     }
                 }
                 if (clst == 0)
                     break; /* Could not allocate a new cluster (disk full) */
-                if (clst == 1)
-                    return ABORT(fp->fs, FR_INT_ERR);
-                if (clst == 0xFFFFFFFF)
-                    return ABORT(fp->fs, FR_DISK_ERR);
+                if (clst == 1) {
+                    res = FR_INT_ERR;
+                    goto fail;
+                }
+                if (clst == 0xFFFFFFFF) {
+                    res = FR_DISK_ERR;
+                    goto fail;
+                }
+                clmap_append(fp, fp->fptr / bcs, clst);
                 fp->clust = clst;           /* Update current cluster */
                 if (fp->sclust == 0) {
                     /* Set start cluster if the first write */
@@ -2326,22 +2723,34 @@ FRESULT f_write(FF_FIL * fp, const void * buff, unsigned int btw,
             if (fp->flag & FA__DIRTY) {     /* Write-back sector cache */
                 if (fatfs_disk_write(fp->fs, fp->buf, fp->dsect,
                                      fp->fs->ssize)) {
-                    return ABORT(fp->fs, FR_DISK_ERR);
+                    res = FR_DISK_ERR;
+                    goto fail;
                 }
                 fp->flag &= ~FA__DIRTY;
             }
 
             sect = clust2sect(fp->fs, fp->clust);   /* Get current sector */
-            if (!sect)
-                return ABORT(fp->fs, FR_INT_ERR);
+            if (!sect) {
+                res = FR_INT_ERR;
+                goto fail;
+            }
             sect += csect;
             cc = btw / fp->fs->ssize; /* When remaining bytes >= sector size, */
             if (cc) { /* Write maximum contiguous sectors directly */
-                if (csect + cc > fp->fs->csize) /* Clip at cluster boundary */
-                    cc = fp->fs->csize - csect;
+                if (csect + cc > fp->fs->csize) {
+                    /* Allocate the following clusters in advance */
+                    clmap_stretch(fp, fp->fptr / bcs +
+                                      (csect + cc - 1) / fp->fs->csize);
+                }
+                /* Clip at the end of contiguous clusters */
+                cc = clmap_clip(fp, csect, cc);
                 if (fatfs_disk_write(fp->fs, wbuff, sect,
-                                     cc * fp->fs->ssize))
-                    return ABORT(fp->fs, FR_DISK_ERR);
+                                     cc * fp->fs->ssize)) {
+                    res = FR_DISK_ERR;
+                    goto fail;
+                }
+                /* Last cluster touched by the transfer */
+                fp->clust += (csect + cc - 1) / fp->fs->csize;
                 if (fp->dsect - sect < cc) {
                     /*
                      * Refill sector cache if it gets invalidated by the direct
@@ -2360,7 +2769,8 @@ FRESULT f_write(FF_FIL * fp, const void * buff, unsigned int btw,
                 /* Fill sector cache with file data */
                 if (fp->fptr < fp->fsize &&
                     fatfs_disk_read(fp->fs, fp->buf, sect, fp->fs->ssize)) {
-                        return ABORT(fp->fs, FR_DISK_ERR);
+                    res = FR_DISK_ERR;
+                    goto fail;
                 }
             }
             fp->dsect = sect;
@@ -2380,6 +2790,10 @@ FRESULT f_write(FF_FIL * fp, const void * buff, unsigned int btw,
     fp->flag |= FA__WRITTEN;    /* Set file change flag */
 
     return LEAVE_FF(fp->fs, FR_OK);
+fail:
+    /* Don't leave clusters allocated in advance beyond the file. */
+    clmap_unstretch(fp);
+    return ABORT(fp->fs, res);
 }
 
 /**
@@ -2435,6 +2849,17 @@ fail:
     return LEAVE_FF(fp->fs, res);
 }
 
+/**
+ * Release resources held by a file object.
+ * The file object must not be used after this call without reopening it.
+ * @param fp Pointer to the file object.
+ */
+void f_release(FF_FIL * fp)
+{
+    kfree(fp->clmap.runs);
+    memset(&fp->clmap, 0, sizeof(fp->clmap));
+}
+
 /**
  * Seek File R/W Pointer.
  * @param fp Pointer to the file object.
@@ -2527,7 +2952,7 @@ FRESULT f_lseek(FF_FIL * fp, DWORD ofs)
 
     /* Normal Seek */
     {
-        DWORD clst, bcs, nsect, ifptr;
+        DWORD clst, bcs, nsect, fcl;
 
         if (fp->fs->opt & FATFS_READONLY) {
             if (ofs > fp->fsize) {
@@ -2538,34 +2963,42 @@ FRESULT f_lseek(FF_FIL * fp, DWORD ofs)
             ofs = fp->fsize;
         }
 
-        ifptr = fp->fptr;
         fp->fptr = nsect = 0;
         if (ofs) {
             /* Cluster size (byte) */
             bcs = (DWORD)fp->fs->csize * fp->fs->ssize;
-            if (ifptr > 0 &&
-                (ofs - 1) / bcs >= (ifptr - 1) / bcs) {
+            clst = fp->sclust; /* Start from the first cluster */
+            if (!(fp->fs->opt & FATFS_READONLY) && clst == 0) {
+                /* If no cluster chain, create a new chain */
+                clst = create_chain(fp->fs, 0);
+                if (clst == 1)
+                    return ABORT(fp->fs, FR_INT_ERR);
+                if (clst == 0xFFFFFFFF)
+                    return ABORT(fp->fs, FR_DISK_ERR);
+                fp->sclust = clst;
+                if (clst)
+                    clmap_append(fp, 0, clst);
+            }
+            fp->clust = clst;
+            if (clst != 0) {
                 /*
-                 * When seek to same or following cluster,
-                 * start from the current cluster
+                 * Jump directly to the cluster containing the new offset or
+                 * to the last mapped cluster if the chain must be stretched.
                  */
-                fp->fptr = (ifptr - 1) & ~(bcs - 1);
-                ofs -= fp->fptr;
-                clst = fp->clust;
-            } else { /* When seek to back cluster, */
-                clst = fp->sclust; /* start from the first cluster */
-                if (!(fp->fs->opt & FATFS_READONLY) && clst == 0) {
-                    /* If no cluster chain, create a new chain */
-                    clst = create_chain(fp->fs, 0);
-                    if (clst == 1)
-                        return ABORT(fp->fs, FR_INT_ERR);
-                    if (clst == 0xFFFFFFFF)
-                        return ABORT(fp->fs, FR_DISK_ERR);
-                    fp->sclust = clst;
+                res = clmap_build(fp);
+                if (res == FR_INT_ERR || res == FR_DISK_ERR)
+                    return ABORT(fp->fs, res);
+                res = FR_OK;
+                if (fp->clmap.valid) {
+                    fcl = (ofs - 1) / bcs;
+                    if (fcl >= fp->clmap.nr_clust)
+                        fcl = fp->clmap.nr_clust - 1;
+                    clst = clmap_clust(fp, fcl);
+                    fp->clust = clst;
+                    fp->fptr = fcl * bcs;
+                    ofs -= fp->fptr;
                 }
-                fp->clust = clst;
-            }
-            if (clst != 0) {
+
                 while (ofs > bcs) { /* Cluster following loop */
                     /* Check if in write mode or not */
                     if (!(fp->fs->opt & FATFS_READONLY) &&
@@ -2585,6 +3018,7 @@ FRESULT f_lseek(FF_FIL * fp, DWORD ofs)
                         return ABORT(fp->fs, FR_DISK_ERR);
                     if (clst <= 1 || clst >= fp->fs->n_fatent)
                         return ABORT(fp->fs, FR_INT_ERR);
+                    clmap_append(fp, fp->fptr / bcs + 1, clst);
                     fp->clust = clst;
                     fp->fptr += bcs;
                     ofs -= bcs;
@@ -2631,12 +3065,11 @@ fail:
 /**
  * Create a Directory Object.
  * @param dp Pointer to directory object to create.
- * @param path Pointer to the directory path.
+ * @param ent Pointer to the handle of the directory.
  */
-FRESULT f_opendir(FF_DIR * dp, FATFS * fs, const TCHAR * path)
+FRESULT f_opendir(FF_DIR * dp, FATFS * fs, const FF_ENT * ent)
 {
     FRESULT res;
-    DEF_NAMEBUF;
 
     if (lock_fs(fs))
         return FR_TIMEOUT;
@@ -2645,19 +3078,18 @@ FRESULT f_opendir(FF_DIR * dp, FATFS * fs, const TCHAR * path)
         goto fail;
 
     dp->fs = fs;
-    INIT_NAMEBUF(*dp);
-    res = follow_path(dp, path); /* Follow the path to the directory */
-    FREE_BUF();
-    if (res != FR_OK)
-        goto fail;
-
-    /* Follow completed */
-    if (dp->dir) { /* It is not the origin directory itself */
-        /*
-         * We should probably check if (dp->dir[DIR_Attr] & AM_DIR)
-         * holds but unfortunately AM_DIR is not always set for the root dir
-         * as the flag is meannt to mark subdirectories only.
-         */
+    if (ent->index == FF_ENT_ROOT) { /* It is the root directory */
+        dp->sclust = 0;
+    } else {
+        res = follow_ent(dp, ent);
+        if (res == FR_NO_FILE)
+            res = FR_NO_PATH;
+        if (res != FR_OK)
+            goto fail;
+        if (!(dp->dir[DIR_Attr] & AM_DIR)) { /* It is not a directory */
+            res = FR_NO_PATH;
+            goto fail;
+        }
         dp->sclust = ld_clust(fs, dp->dir);
     }
 
@@ -2712,14 +3144,13 @@ FRESULT f_readdir(FF_DIR * dp, FILINFO * fno)
 
 /**
  * Get File Status.
- * @param path Pointer to the file path.
+ * @param ent Pointer to the handle of the object.
  * @param fno Pointer to file information to return.
  */
-FRESULT f_stat(FATFS * fs, const TCHAR * path, FILINFO * fno)
+FRESULT f_stat(FATFS * fs, const FF_ENT * ent, FILINFO * fno)
 {
     FRESULT res;
     FF_DIR dj = { .fs = fs };
-    DEF_NAMEBUF;
 
     if (lock_fs(dj.fs))
         return FR_TIMEOUT;
@@ -2728,20 +3159,11 @@ FRESULT f_stat(FATFS * fs, const TCHAR * path, FILINFO * fno)
     if (res != FR_OK)
         goto fail;
 
-    INIT_NAMEBUF(dj);
-    res = follow_path(&dj, path);   /* Follow the file path */
-    if (res != FR_OK)
-        goto fail;
-
-    if (dj.dir) {       /* Found an object */
+    res = follow_ent(&dj, ent);
+    if (res == FR_OK)
         get_fileinfo(&dj, fno);
-    } else {            /* It is root directory */
-        res = FR_INVALID_NAME;
-    }
 
 fail:
-    FREE_BUF();
-
     return LEAVE_FF(dj.fs, res);
 }
 
@@ -2849,6 +3271,7 @@ FRESULT f_truncate(FF_FIL * fp)
             /* When set file size to zero, remove entire cluster chain */
             res = remove_chain(fp->fs, fp->sclust);
             fp->sclust = 0;
+            clmap_trim(fp, 0);
         } else {
             /*
              * When truncate a part of the file, remove remaining clusters
@@ -2863,6 +3286,8 @@ FRESULT f_truncate(FF_FIL * fp)
                 res = put_fat(fp->fs, fp->clust, 0x0FFFFFFF);
                 if (res == FR_OK)
                     res = remove_chain(fp->fs, ncl);
+                clmap_trim(fp, (fp->fptr - 1) /
+                               ((DWORD)fp->fs->csize * fp->fs->ssize) + 1);
             }
         }
 
@@ -2884,12 +3309,13 @@ fail:
 
 /**
  * Delete a File or Directory.
- * @param path Pointer to the file or directory path.
+ * @param dclust Start cluster of the directory (0:Root dir).
+ * @param path Pointer to the file or directory path relative to dclust.
  */
-FRESULT f_unlink(FATFS * fs, const TCHAR * path)
+FRESULT f_unlink(FATFS * fs, DWORD dclust, const TCHAR * path)
 {
     FRESULT res;
-    FF_DIR dj = { .fs = fs };
+    FF_DIR dj = { .fs = fs, .sclust = dclust };
     uint8_t * dir;
     DWORD dclst;
     DEF_NAMEBUF;
@@ -2952,12 +3378,13 @@ fail:
 
 /**
  * Create a Directory.
- * @param path Pointer to the directory path.
+ * @param dclust Start cluster of the directory (0:Root dir).
+ * @param path Pointer to the directory path relative to dclust.
  */
-FRESULT f_mkdir(FATFS * fs, const TCHAR * path)
+FRESULT f_mkdir(FATFS * fs, DWORD dclust, const TCHAR * path)
 {
     FRESULT res;
-    FF_DIR dj = { .fs = fs };
+    FF_DIR dj = { .fs = fs, .sclust = dclust };
     uint8_t * dir, n;
     DWORD dsc, dcl, pcl, tm = fatfs_time_get_time();
     DEF_NAMEBUF;
@@ -3038,16 +3465,15 @@ fail:
 
 /**
  * Change Attribute.
- * @param path Pointer to the file path.
+ * @param ent Pointer to the handle of the object.
  * @param value Attribute bits.
  * @param mask  Attribute mask to change.
  */
-FRESULT f_chmod(FATFS * fs, const TCHAR * path, uint8_t value, uint8_t mask)
+FRESULT f_chmod(FATFS * fs, const FF_ENT * ent, uint8_t value, uint8_t mask)
 {
     FRESULT res;
     FF_DIR dj = { .fs = fs };
     uint8_t * dir;
-    DEF_NAMEBUF;
 
     if (lock_fs(dj.fs))
         return FR_TIMEOUT;
@@ -3056,25 +3482,18 @@ FRESULT f_chmod(FATFS * fs, const TCHAR * path, uint8_t value, uint8_t mask)
     if (res != FR_OK)
         goto fail;
 
-    INIT_NAMEBUF(dj);
-    res = follow_path(&dj, path); /* Follow the file path */
-    FREE_BUF();
+    res = follow_ent(&dj, ent);
     if (res != FR_OK)
         goto fail;
 
     dir = dj.dir;
-    if (!dir) { /* Is it a root directory? */
-        res = FR_INVALID_NAME;
-    } else { /* File or sub directory */
-        mask &= AM_RDO|AM_HID|AM_SYS|AM_ARC; /* Valid attribute mask */
+    mask &= AM_RDO|AM_HID|AM_SYS|AM_ARC; /* Valid attribute mask */
 
-        /* Apply attribute change */
-        dir[DIR_Attr] = (value & mask) |
-                        (dir[DIR_Attr] & (uint8_t)~mask);
+    /* Apply attribute change */
+    dir[DIR_Attr] = (value & mask) | (dir[DIR_Attr] & (uint8_t)~mask);
 
-        dj.fs->wflag = 1;
-        res = sync_fs(dj.fs);
-    }
+    dj.fs->wflag = 1;
+    res = sync_fs(dj.fs);
 
 fail:
     return LEAVE_FF(dj.fs, res);
@@ -3136,6 +3555,7 @@ FRESULT f_rename(FATFS * fs, const TCHAR * path_old, const TCHAR * path_new)
     DEF_NAMEBUF;
 
     djo.fs = fs;
+    djo.sclust = 0;
     if (lock_fs(djo.fs))
         return FR_TIMEOUT;
 
@@ -3157,6 +3577,7 @@ FRESULT f_rename(FATFS * fs, const TCHAR * path_old, const TCHAR * path_new)
 
         /* Duplicate the directory object */
         memcpy(&djn, &djo, sizeof(FF_DIR));
+        djn.sclust = 0;
 
         /* check if new object is exist */
         res = follow_path(&djn, path_new);
@@ -85,6 +85,28 @@ typedef struct {
                             */
 } FATFS;
 
+/**
+ * A run of physically contiguous clusters of a file.
+ */
+struct ff_clrun {
+    DWORD fcl;              /* File relative index of the first cluster */
+    DWORD clst;             /* Cluster# of the first cluster */
+    DWORD len;              /* Number of clusters in the run */
+};
+
+/**
+ * Cluster run-length map of a file.
+ * The map is built lazily on first access and it's kept up to date when the
+ * cluster chain is stretched or truncated.
+ */
+struct ff_clmap {
+    struct ff_clrun * runs; /* Runs sorted by fcl */
+    unsigned nr_runs;       /* Number of runs used */
+    unsigned max_runs;      /* Number of runs allocated */
+    DWORD nr_clust;         /* Number of clusters mapped */
+    uint8_t valid;          /* Map covers the whole cluster chain */
+};
+
 /**
  * File object structure (FIL)
  */
@@ -103,6 +125,7 @@ typedef struct {
 #if _USE_FASTSEEK
     DWORD * cltbl;          /* Pointer to the cluster link map table (Nulled on file open) */
 #endif
+    struct ff_clmap clmap;  /* Cluster run-length map */
     uint8_t buf[MAX_SS];   /* File private data read/write window */
 } FF_FIL;
 
@@ -127,6 +150,23 @@ typedef struct {
 
 
 
+/* Directory entry handle (ENT) */
+
+/**
+ * A handle to a file or directory.
+ * An object is identified by the start cluster of its parent directory and
+ * the index of its SFN entry in the parent directory, which both remain
+ * constant for the lifetime of the object.
+ */
+typedef struct {
+    DWORD   dclust;         /* Start cluster of the parent directory (0:Root dir) */
+    WORD    index;          /* Index of the SFN entry in the parent directory */
+} FF_ENT;
+
+#define FF_ENT_ROOT 0xFFFF  /* Index of the root directory handle */
+
+
+
 /* File status structure (FILINFO) */
 
 typedef struct {
@@ -172,20 +212,25 @@ typedef enum {
 /*--------------------------------------------------------------*/
 /* FatFs module application interface                           */
 
-FRESULT f_open(FF_FIL * fp, FATFS * fs, const TCHAR * path, uint8_t mode);
+FRESULT f_open(FF_FIL * fp, FATFS * fs, const FF_ENT * ent, uint8_t mode);
+FRESULT f_create(FATFS * fs, DWORD dclust, const TCHAR * path, FF_ENT * ent);
+FRESULT f_lookup(FATFS * fs, DWORD dclust, const TCHAR * path, FF_ENT * ent,
+                 FILINFO * fno);
+FRESULT f_dirent(FATFS * fs, DWORD sclust, FF_ENT * ent);
 FRESULT f_read(FF_FIL * fp, void * buff, unsigned int btr, unsigned int * br);
 FRESULT f_write(FF_FIL * fp, const void * buff, unsigned int btw,
                 unsigned int * bw);
 FRESULT f_lseek(FF_FIL * fp, DWORD ofs);
 FRESULT f_truncate(FF_FIL * fp);
 FRESULT f_sync(FF_FIL * fp);
-FRESULT f_opendir(FF_DIR * dp, FATFS * fs, const TCHAR * path);
+void f_release(FF_FIL * fp);
+FRESULT f_opendir(FF_DIR * dp, FATFS * fs, const FF_ENT * ent);
 FRESULT f_readdir(FF_DIR * dp, FILINFO * fno);
-FRESULT f_mkdir(FATFS * fs, const TCHAR * path);
-FRESULT f_unlink(FATFS * fs, const TCHAR * path);
+FRESULT f_mkdir(FATFS * fs, DWORD dclust, const TCHAR * path);
+FRESULT f_unlink(FATFS * fs, DWORD dclust, const TCHAR * path);
 FRESULT f_rename(FATFS * fs, const TCHAR * path_old, const TCHAR * path_new);
-FRESULT f_stat(FATFS * fs, const TCHAR * path, FILINFO * fno);
-FRESULT f_chmod(FATFS * fs, const TCHAR * path, uint8_t value, uint8_t mask);
+FRESULT f_stat(FATFS * fs, const FF_ENT * ent, FILINFO * fno);
+FRESULT f_chmod(FATFS * fs, const FF_ENT * ent, uint8_t value, uint8_t mask);
 FRESULT f_utime(FATFS * fs, const TCHAR * path, const struct timespec * ts);
 FRESULT f_chdir(const TCHAR * path);
 FRESULT f_chdrive(const TCHAR * path);
@@ -301,6 +346,12 @@ DRESULT fatfs_disk_write(FATFS * ff_fs, const uint8_t * buff, DWORD sector,
 DRESULT fatfs_disk_ioctl(FATFS * ff_fs, unsigned cmd, void * buff,
                          size_t bsize);
 
+/* Sector cache for FAT and directory sectors */
+DRESULT fatfs_scache_read(FATFS * ff_fs, uint8_t * buff, DWORD sector);
+DRESULT fatfs_scache_write(FATFS * ff_fs, const uint8_t * buff, DWORD sector);
+DRESULT fatfs_scache_sync(FATFS * ff_fs);
+void fatfs_scache_destroy(FATFS * ff_fs);
+
 /* Generic command (used by FatFs) */
 #define CTRL_SYNC           0 /*!< Flush disk cache (for write functions) */
 #define CTRL_ERASE_SECTOR   4 /*!< Force erased a block of sectors
@@ -38,9 +38,11 @@
 #include <termios.h>
 #include <unistd.h>
 #include <buf.h>
+#include <exec.h>
 #include <fs/fs.h>
 #include <fs/fs_util.h>
 #include <fs/mbr.h>
+#include <fs/namecache.h>
 #include <kerror.h>
 #include <kinit.h>
 #include <kmalloc.h>
@@ -48,6 +50,7 @@
 #include <kstring.h>
 #include <libkern.h>
 #include <proc.h>
+#include <rcu.h>
 #include <thread.h>
 #include <vm/vm.h>
 
@@ -128,34 +131,6 @@ fs_t * fs_iterate(fs_t * fsp)
     return fsp;
 }
 
-/**
- * Get base vnode of a mountpoint.
- * If vn is not a mountpoint nothing is changed;
- * Otherwise the first vnode in a mount stack is returned. The first vnode
- * is the base mountpoint vnode.
- */
-static void get_base_vnode(vnode_t ** vnp)
-{
-    vnode_t * vnode = *vnp;
-
-    vrele(vnode);
-
-    while (vnode->vn_prev_mountpoint != vnode) {
-        vnode_t * tmp;
-
-        /*
-         * We loop here to get to the first file system mounted on this
-         * mountpoint.
-         */
-        tmp = vnode->vn_prev_mountpoint;
-        KASSERT(tmp != NULL, "prev_mountpoint should be always valid");
-        vnode = tmp;
-    }
-
-    vref(vnode);
-    *vnp = vnode;
-}
-
 /**
  * Get the top root vnode of a mountpoint.
  * If there is no mounts on this vnode nothing is changed;
@@ -262,6 +237,9 @@ int fs_umount(struct fs_superblock * sb)
     if (root->vn_prev_mountpoint == root)
         return -EINVAL; /* Can't unmount rootfs */
 
+    namecache_purge_sb(sb);
+    exec_text_purge_sb(sb);
+
     /*
      * Reverse the mount process to unmount.
      */
@@ -287,11 +265,133 @@ int fs_umount(struct fs_superblock * sb)
     return sb->umount(sb);
 }
 
-int lookup_vnode(vnode_t ** result, vnode_t * root, const char * str, int oflags)
+/**
+ * Get the next component of a path.
+ * @param[in,out] path  is a pointer to the remaining path, it's advanced past
+ *                      the returned component.
+ * @param end           is the end of the path.
+ * @param[out] len      returns the length of the component.
+ * @return  Returns a pointer to the component;
+ *          NULL if there is no more components left.
+ */
+static const char * path_next(const char ** path, const char * end,
+                              size_t * len)
+{
+    const char * s = *path;
+    const char * name;
+
+    while (s < end && *s == '/')
+        s++;
+    if (s == end || *s == '\0')
+        return NULL;
+
+    name = s;
+    while (s < end && *s != '/' && *s != '\0')
+        s++;
+
+    *path = s;
+    *len = (size_t)(s - name);
+    return name;
+}
+
+static int isdotdot(const char * name, size_t len)
 {
-    char * path;
-    char * nodename;
-    char * lasts;
+    return len == 2 && name[0] == '.' && name[1] == '.';
+}
+
+/**
+ * Lookup a path component from a directory using the name cache.
+ * A vnode found from the name cache is borrowed and stays valid only until
+ * the RCU read lock held by the caller is released. A vnode returned by
+ * the file system is referenced.
+ * The file system lookup may sleep, so on a name cache miss the directory
+ * is referenced and the RCU read lock is released for the duration of the
+ * lookup.
+ * @param[in,out] dir_borrowed is cleared if dir gets referenced.
+ * @param[in,out] ctx is the RCU read lock context of the caller.
+ * @param[out] borrowed is set if the result is borrowed.
+ */
+static int lookup_component(vnode_t * dir, int * dir_borrowed,
+                            struct rcu_lock_ctx * ctx,
+                            const char * name, size_t namelen,
+                            vnode_t ** result, int * borrowed)
+{
+    char buf[NAME_MAX + 1];
+    const int dotdot = isdotdot(name, namelen);
+    unsigned gen;
+    int retval;
+
+    if (namelen > NAME_MAX)
+        return -ENAMETOOLONG;
+
+    /* Caching dot-dot would create reference cycles. */
+    if (!dotdot) {
+        retval = namecache_lookup_rcu(dir, name, namelen, result);
+        if (retval != -EAGAIN) {
+            *borrowed = 1;
+            return retval;
+        }
+    }
+
+    if (*dir_borrowed) {
+        if (vref(dir))
+            return -ENOLINK;
+        *dir_borrowed = 0;
+    }
+
+    /* The file system wants a nul-terminated name. */
+    memcpy(buf, name, namelen);
+    buf[namelen] = '\0';
+
+    rcu_read_unlock(ctx);
+
+    gen = namecache_gen();
+    *borrowed = 0;
+    *result = NULL;
+    retval = dir->vnode_ops->lookup(dir, buf, result);
+    if (!dotdot) {
+        if (retval == 0)
+            namecache_enter(dir, name, namelen, *result, gen);
+        else if (retval == -ENOENT)
+            namecache_enter(dir, name, namelen, NULL, gen);
+    }
+
+    *ctx = rcu_read_lock();
+
+    return retval;
+}
+
+/**
+ * Replace the current vnode of a path walk.
+ * @param vnp       is a pointer to the current vnode.
+ * @param borrowed  is a pointer to the borrowed status of the current vnode.
+ * @param vn        is the new vnode.
+ * @param vn_borrowed tells whether vn is borrowed.
+ */
+static void walk_set(vnode_t ** vnp, int * borrowed, vnode_t * vn,
+                     int vn_borrowed)
+{
+    if (!*borrowed)
+        vrele(*vnp);
+    *vnp = vn;
+    *borrowed = vn_borrowed;
+}
+
+/**
+ * Lookup for a vnode by a path of len bytes.
+ * The path walk borrows the vnodes found from the name cache under the RCU
+ * read lock and only the final vnode and the directories passed to the file
+ * system lookup are referenced.
+ */
+static int lookup_vnode_len(vnode_t ** result, vnode_t * root,
+                            const char * str, size_t len, int oflags)
+{
+    const char * end = str + len;
+    const char * name;
+    size_t namelen;
+    struct rcu_lock_ctx ctx;
+    vnode_t * vn = root;
+    int borrowed = 1; /* The caller holds a reference to root. */
     int retval = 0;
 
     KERROR_DBG("%s(result %p, root %pV, str \"%s\", oflags %x)\n",
@@ -300,32 +400,25 @@ int lookup_vnode(vnode_t ** result, vnode_t * root, const char * str, int oflags
     if (!(result && root && root->vnode_ops && str))
         return -EINVAL;
 
-    path = kstrdup(str, PATH_MAX);
-    if (!path)
-        return -ENOMEM;
-
-    if (!(nodename = kstrtok(path, PATH_DELIMS, &lasts))) {
-        retval = -EINVAL;
-        goto out;
-    }
+    if (!(name = path_next(&str, end, &namelen)))
+        return -EINVAL;
 
     /*
      * Start looking up for a vnode.
      * We don't care if root is not a directory because lookup will spot it
      * anyway.
      */
-    vref(root);
-    *result = root;
+    ctx = rcu_read_lock();
     do {
         vnode_t * vnode;
+        int vnode_borrowed;
 
-        if (!strcmp(nodename, "."))
+        if (namelen == 1 && name[0] == '.')
             continue;
 
 again:  /* Get vnode by name in this dir. */
-        vnode = NULL;
-        retval = (*result)->vnode_ops->lookup(*result, nodename, &vnode);
-        vrele(*result);
+        retval = lookup_component(vn, &borrowed, &ctx, name, namelen,
+                                  &vnode, &vnode_borrowed);
         KASSERT((retval == 0 && vnode != NULL) || (retval != 0),
                 "vnode should be valid if !retval");
         if (retval != 0 && retval != -EDOM) {
@@ -340,16 +433,28 @@ again:  /* Get vnode by name in this dir. */
          * the root of the physical file system and trying to exit its
          * mountpoint, this requires some additional processing as follows.
          */
-        if (retval == -EDOM && !strcmp(nodename, "..") &&
-            vnode->vn_prev_mountpoint != vnode) {
-            /* Get prev dir of prev fs sb from mount point. */
-            vref(vnode);
-            get_base_vnode(&vnode);
-            *result = vnode;
-
-            /* Restart from the begining to get the actual prev dir. */
-            goto again;
+        if (retval == -EDOM) {
+            if (isdotdot(name, namelen) && vn->vn_prev_mountpoint != vn) {
+                vnode_t * base = vn;
+
+                /* Get prev dir of prev fs sb from mount point. */
+                while (base->vn_prev_mountpoint != base) {
+                    base = base->vn_prev_mountpoint;
+                    KASSERT(base != NULL,
+                            "prev_mountpoint should be always valid");
+                }
+                if (vref(base)) {
+                    retval = -ENOLINK;
+                    goto out;
+                }
+                walk_set(&vn, &borrowed, base, 0);
+
+                /* Restart from the begining to get the actual prev dir. */
+                goto again;
+            }
         } else {
+            vnode_t * top = vnode;
+
             /*
              * TODO soft links and O_NOFOLLOW for lookup_vnode()
              * - soft links support
@@ -358,64 +463,99 @@ again:  /* Get vnode by name in this dir. */
              */
 
             /* Go to the last mountpoint. */
-            get_top_vnode(&vnode);
-            *result = vnode;
+            while (top->vn_next_mountpoint != top) {
+                top = top->vn_next_mountpoint;
+                KASSERT(top != NULL, "next_mountpoint should be always valid");
+            }
+            if (top != vnode) {
+                if (vref(top)) {
+                    if (!vnode_borrowed)
+                        vrele(vnode);
+                    retval = -ENOLINK;
+                    goto out;
+                }
+                if (!vnode_borrowed)
+                    vrele(vnode);
+                vnode_borrowed = 0;
+            }
+            walk_set(&vn, &borrowed, top, vnode_borrowed);
         }
         retval = 0;
 
-        KASSERT(*result != NULL, "vfs is in inconsistent state");
-    } while ((nodename = kstrtok(0, PATH_DELIMS, &lasts)));
+        KASSERT(vn != NULL, "vfs is in inconsistent state");
+    } while ((name = path_next(&str, end, &namelen)));
 
-    if ((oflags & O_DIRECTORY) && !S_ISDIR((*result)->vn_mode)) {
-        vrele(*result);
-        *result = NULL;
+    if ((oflags & O_DIRECTORY) && !S_ISDIR(vn->vn_mode)) {
         retval = -ENOTDIR;
         goto out;
     }
 
+    /* Only the final vnode is pinned. */
+    if (borrowed && vref(vn)) {
+        retval = -ENOLINK;
+        goto out;
+    }
+    borrowed = 0;
+    *result = vn;
+    vn = NULL;
+
 out:
-    KERROR_DBG("%s: result %pV\n", __func__, (result) ? *result : NULL);
+    if (vn && !borrowed)
+        vrele(vn);
+    rcu_read_unlock(&ctx);
 
-    if (retval && retval != -EDOM) {
+    KERROR_DBG("%s: result %pV\n", __func__, (retval) ? NULL : *result);
+
+    if (retval)
         *result = NULL;
-    }
-    kfree(path);
     return retval;
 }
 
-int fs_namei_proc(vnode_t ** result, int fd, const char * path, int atflags)
+int lookup_vnode(vnode_t ** result, vnode_t * root, const char * str, int oflags)
+{
+    if (!str)
+        return -EINVAL;
+
+    return lookup_vnode_len(result, root, str, strlenn(str, PATH_MAX), oflags);
+}
+
+/**
+ * Walk the file system for the current process with a path of len bytes.
+ */
+static int namei_proc_len(vnode_t ** result, int fd, const char * path,
+                          size_t len, int atflags)
 {
     vnode_t * start;
+    file_t * file = NULL;
     int oflags = atflags & AT_SYMLINK_NOFOLLOW;
     int retval;
 
     KERROR_DBG("%s(result %p, fd %d, path \"%s\", atflags %x)\n",
                __func__, result, fd, path, atflags);
 
-    if (path[0] == '\0')
+    if (len == 0)
         return -EINVAL;
 
     if (path[0] == '/') { /* Absolute path */
         path++;
+        len--;
         start = curproc->croot;
 
         /* Short circuit: Caller requested '/' */
-        if (path[0] == '\0') {
+        if (len == 0) {
             *result = start;
             vref(start);
 
             return 0;
         }
     } else if (atflags & AT_FDARG && fd != AT_FDCWD) { /* AT_FDARG */
-        file_t * file;
-
         file = fs_fildes_ref(curproc->files, fd, 1);
         if (!file)
             return -EBADF;
         start = file->vnode;
 
         /* Short circuit: Caller requested '.' and AT_FDARG */
-        if (path[0] == '.' && path[1] == '\0') {
+        if (len == 1 && path[0] == '.') {
             *result = start;
             vref(start);
             fs_fildes_ref(curproc->files, fd, -1);
@@ -428,18 +568,28 @@ int fs_namei_proc(vnode_t ** result, int fd, const char * path, int atflags)
     KASSERT(start, "Start is set");
     KASSERT(start->vnode_ops, "vnode ops of start is valid");
 
-    if (path[strlenn(path, PATH_MAX)] == '/') {
+    if (path[len - 1] == '/') {
         oflags |= O_DIRECTORY;
     }
 
-    retval = lookup_vnode(result, start, path, oflags);
+    retval = lookup_vnode_len(result, start, path, len, oflags);
 
-    if (atflags & AT_FDARG)
+    if (file)
         fs_fildes_ref(curproc->files, fd, -1);
 
     return retval;
 }
 
+int fs_namei_proc(vnode_t ** result, int fd, const char * path, int atflags)
+{
+    const size_t len = strlenn(path, PATH_MAX + 1);
+
+    if (len > PATH_MAX)
+        return -ENAMETOOLONG;
+
+    return namei_proc_len(result, fd, path, len, atflags);
+}
+
 int chkperm(struct stat * stat, const struct cred * cred, int oflags)
 {
     const uid_t euid = curproc->cred.euid;
@@ -773,6 +923,44 @@ out:
     return err;
 }
 
+/**
+ * Do I/O through a temporary file descriptor so that the seek position of
+ * the file, possibly shared with other threads, is not touched.
+ */
+static ssize_t fildes_io_at(file_t * file, struct uio * uio, size_t count,
+                            off_t * off, int write)
+{
+    struct vnode_ops * vnops = file->vnode->vnode_ops;
+    file_t tmp;
+    ssize_t retval;
+
+    if (!off)
+        return (write) ? vnops->write(file, uio, count) :
+                         vnops->read(file, uio, count);
+
+    fs_fildes_set(&tmp, file->vnode, file->oflags);
+    tmp.seek_pos = *off;
+    tmp.stream = file->stream;
+
+    retval = (write) ? vnops->write(&tmp, uio, count) :
+                       vnops->read(&tmp, uio, count);
+    *off = tmp.seek_pos;
+
+    return retval;
+}
+
+ssize_t fs_fildes_read_at(file_t * file, struct uio * uio, size_t count,
+                          off_t * off)
+{
+    return fildes_io_at(file, uio, count, off, 0);
+}
+
+ssize_t fs_fildes_write_at(file_t * file, struct uio * uio, size_t count,
+                           off_t * off)
+{
+    return fildes_io_at(file, uio, count, off, 1);
+}
+
 files_t * fs_alloc_files(size_t nr_files, mode_t umask)
 {
     files_t * files;
@@ -789,58 +977,81 @@ files_t * fs_alloc_files(size_t nr_files, mode_t umask)
 
 /**
  * Get directory vnode of a target file and the actual directory entry name.
+ * The path is split in place, no memory is allocated.
+ * @param[in]   fd          is an optional starting point for relative search.
  * @param[in]   pathname    is a path to the target.
+ * @param[in]   atflags     AT_FDARG or AT_FDCWD.
  * @param[out]  dir         is the directory containing the entry.
- * @param[out]  filename    is the actual file name / directory entry name.
- * @param[in]   flag        0 = file should exist; O_CREAT = file should not
- *                          exist.
+ * @param[out]  filename    is a buffer of NAME_MAX + 1 bytes where the actual
+ *                          file name / directory entry name is copied to.
+ * @param[out]  file        If NULL the file should not exist;
+ *                          Otherwise the file should exist and a referenced
+ *                          vnode of it is returned.
  */
-static int getvndir(const char * pathname, vnode_t ** dir, char ** filename,
-                    int flag)
+static int getvndir(int fd, const char * pathname, int atflags,
+                    vnode_t ** dir, char * filename, vnode_t ** file)
 {
+    const size_t len = strlenn(pathname, PATH_MAX + 1);
+    size_t start, end;
     vnode_t * vn_file;
-    kmalloc_autofree char * path = NULL;
-    kmalloc_autofree char * name = NULL;
     int err;
 
-    if (pathname[0] == '\0') {
+    if (len == 0)
         return -EINVAL;
+    if (len > PATH_MAX)
+        return -ENAMETOOLONG;
+
+    /* Find the last path component. */
+    end = len;
+    while (end > 0 && pathname[end - 1] == '/') {
+        end--;
     }
+    start = end;
+    while (start > 0 && pathname[start - 1] != '/') {
+        start--;
+    }
+    if (start == end)
+        return -EINVAL;
+    if (end - start > NAME_MAX)
+        return -ENAMETOOLONG;
+    memcpy(filename, pathname + start, end - start);
+    filename[end - start] = '\0';
+
+    /* Get the directory, the last component was already parsed. */
+    err = (start == 0) ? namei_proc_len(dir, fd, ".", 1, atflags) :
+                         namei_proc_len(dir, fd, pathname, start, atflags);
+    if (err)
+        return err;
 
-    err = fs_namei_proc(&vn_file, -1, pathname, AT_FDCWD);
-    if (err == 0)
-        vrele(vn_file);
-    if (flag & O_CREAT) { /* File should not exist */
+    err = lookup_vnode_len(&vn_file, *dir, filename, end - start, 0);
+    if (!file) { /* File should not exist */
         if (err == 0) {
-            return -EEXIST;
-        } else if (err != -ENOENT) {
-            return err;
+            vrele(vn_file);
+            err = -EEXIST;
+        } else if (err == -ENOENT) {
+            err = 0;
         }
-    } else if (err) { /* File should exist */
-        return err;
+    } else if (err == 0) { /* File should exist */
+        *file = vn_file;
     }
-
-    err = parsenames(pathname, &path, &name);
     if (err) {
-        return err;
+        vrele(*dir);
+        *dir = NULL;
     }
 
-    kpalloc(name); /* Incr ref count */
-    *filename = name;
-
-    return fs_namei_proc(dir, -1, path, AT_FDCWD);
+    return err;
 }
 
 int fs_creat_curproc(const char * pathname, mode_t mode, vnode_t ** result)
 {
-    kmalloc_autofree char * name = NULL;
+    char name[NAME_MAX + 1];
     vnode_autorele vnode_t * dir = NULL;
     int retval = 0;
 
     KERROR_DBG("%s(pathname \"%s\", mode %u)\n",
                __func__, pathname, (unsigned)mode);
 
-    retval = getvndir(pathname, &dir, &name, O_CREAT);
+    retval = getvndir(-1, pathname, AT_FDCWD, &dir, name, NULL);
     if (retval)
         return retval;
 
@@ -849,6 +1060,7 @@ int fs_creat_curproc(const char * pathname, mode_t mode, vnode_t ** result)
     mode &= ~S_IFMT; /* Filter out file type bits */
     mode &= ~curproc->files->umask;
     retval = dir->vnode_ops->create(dir, name, mode, result);
+    namecache_purge(dir, name, strlenn(name, NAME_MAX + 1));
 
     KERROR_DBG("%s() result: %p\n", __func__, *result);
 
@@ -859,7 +1071,7 @@ int fs_link_curproc(int fd1, const char * path1,
                     int fd2, const char * path2,
                     int atflags)
 {
-    kmalloc_autofree char * targetname = NULL;
+    char targetname[NAME_MAX + 1];
     vnode_autorele vnode_t * vn_src = NULL;
     vnode_autorele vnode_t * vndir_dst = NULL;
     int err;
@@ -882,7 +1094,7 @@ int fs_link_curproc(int fd1, const char * path1,
     }
 
     /* Get vnode of the target directory */
-    err = getvndir(path2, &vndir_dst, &targetname, O_CREAT);
+    err = getvndir(-1, path2, AT_FDCWD, &vndir_dst, targetname, NULL);
     if (err) {
         return err;
     }
@@ -900,44 +1112,32 @@ int fs_link_curproc(int fd1, const char * path1,
         return err;
     }
 
-    return vndir_dst->vnode_ops->link(vndir_dst, vn_src, targetname);
+    err = vndir_dst->vnode_ops->link(vndir_dst, vn_src, targetname);
+    namecache_purge(vndir_dst, targetname, strlenn(targetname, NAME_MAX + 1));
+
+    return err;
 }
 
 int fs_unlink_curproc(int fd, const char * path, int atflags)
 {
-    kmalloc_autofree char * dirpath = NULL;
-    kmalloc_autofree char * filename = NULL;
+    char filename[NAME_MAX + 1];
     struct stat stat;
     vnode_autorele vnode_t * dir = NULL;
+    vnode_autorele vnode_t * fnode = NULL;
     int err;
 
-    {
-        vnode_t * fnode;
-
-        err = fs_namei_proc(&fnode, fd, path, atflags);
-        if (err) {
-            return err;
-        }
-
-        /* unlink() is prohibited on directories for non-root users. */
-        err = fnode->vnode_ops->stat(fnode, &stat);
-        vrele(fnode);
-        if (err) {
-            return err;
-        }
-        if (S_ISDIR(stat.st_mode) && curproc->cred.euid != 0) {
-            return -EPERM;
-        }
+    err = getvndir(fd, path, atflags, &dir, filename, &fnode);
+    if (err) {
+        return err;
     }
 
-    err = parsenames(path, &dirpath, &filename);
+    /* unlink() is prohibited on directories for non-root users. */
+    err = fnode->vnode_ops->stat(fnode, &stat);
     if (err) {
         return err;
     }
-
-    /* Get the vnode of the containing directory */
-    if (fs_namei_proc(&dir, fd, dirpath, atflags)) {
-        return -ENOENT;
+    if (S_ISDIR(stat.st_mode) && curproc->cred.euid != 0) {
+        return -EPERM;
     }
 
     /*
@@ -951,16 +1151,21 @@ int fs_unlink_curproc(int fd, const char * path, int atflags)
         return err;
     }
 
-    return dir->vnode_ops->unlink(dir, filename);
+    err = dir->vnode_ops->unlink(dir, filename);
+    namecache_purge(dir, filename, strlenn(filename, NAME_MAX + 1));
+    if (!err)
+        exec_text_purge_vnode(fnode);
+
+    return err;
 }
 
 int fs_mkdir_curproc(const char * pathname, mode_t mode)
 {
-    kmalloc_autofree char * name = NULL;
+    char name[NAME_MAX + 1];
     vnode_autorele vnode_t * dir = NULL;
     int err = 0;
 
-    err = getvndir(pathname, &dir, &name, O_CREAT);
+    err = getvndir(-1, pathname, AT_FDCWD, &dir, name, NULL);
     if (err) {
         return err;
     }
@@ -973,16 +1178,20 @@ int fs_mkdir_curproc(const char * pathname, mode_t mode)
 
     mode &= ~S_IFMT; /* Filter out file type bits */
     mode &= ~curproc->files->umask;
-    return dir->vnode_ops->mkdir(dir, name, mode);
+    err = dir->vnode_ops->mkdir(dir, name, mode);
+    namecache_purge(dir, name, strlenn(name, NAME_MAX + 1));
+
+    return err;
 }
 
 int fs_rmdir_curproc(const char * pathname)
 {
-    kmalloc_autofree char * name = NULL;
+    char name[NAME_MAX + 1];
     vnode_autorele vnode_t * dir = NULL;
+    vnode_autorele vnode_t * vn = NULL;
     int err;
 
-    err = getvndir(pathname, &dir, &name, 0);
+    err = getvndir(-1, pathname, AT_FDCWD, &dir, name, &vn);
     if (err) {
         return err;
     }
@@ -998,7 +1207,11 @@ int fs_rmdir_curproc(const char * pathname)
         return err;
     }
 
-    return dir->vnode_ops->rmdir(dir, name);
+    err = dir->vnode_ops->rmdir(dir, name);
+    namecache_purge(dir, name, strlenn(name, NAME_MAX + 1));
+    namecache_purge_vnode(vn);
+
+    return err;
 }
 
 int fs_utimes_curproc(int fildes, const struct timespec times[2])
@@ -43,34 +43,34 @@
 #include <kinit.h>
 #include <kmalloc.h>
 #include <libkern.h>
+#include <limits.h>
 #include <proc.h>
-#include <queue_r.h>
+#include <waitq.h>
 #include <kern_ipc.h>
 
 /*
  * TODO
- * - We should guarantee atomicity for transactions uder PIPE_BUF bytes
  * - Setting O_ASYNC should cause SIGIO to be sent if new input becomes
  *   available
  */
 
-/*
- * Just a humble guess that lazy yield may render improved performance on
- * MP system.
- */
-#ifdef configMP
-#define PIPE_YIELD_STRATEGY THREAD_YIELD_LAZY
-#else
-#define PIPE_YIELD_STRATEGY THREAD_YIELD_IMMEDIATE
-#endif
+#define PIPE_RCLOSED    0x01 /*!< The read end is closed. */
+#define PIPE_WCLOSED    0x02 /*!< The write end is closed. */
+#define PIPE_WBUSY      0x04 /*!< Free space is reserved by a splice. */
+#define PIPE_RBUSY      0x08 /*!< Data is being spliced out of the pipe. */
 
 /**
  * Pipe descriptor pointed by file->stream.
  */
 struct stream_pipe {
     struct vnode vnode;
-    struct queue_cb q;
     struct buf * bp;
+    mtx_t lock;         /*!< Protects the ring buffer and the flags. */
+    size_t size;        /*!< Size of the ring buffer. */
+    size_t rd;          /*!< Read offset in the ring buffer. */
+    size_t count;       /*!< Number of bytes in the ring buffer. */
+    unsigned flags;
+    struct waitq waitq; /*!< Threads waiting for the pipe state to change. */
     file_t file0; /*!< Read end. */
     file_t file1; /*!< Write end. */
     uid_t owner;
@@ -118,10 +118,46 @@ int __kinit__ fs_pipe_init(void)
     return 0;
 }
 
+/**
+ * Wakeup all threads waiting on the pipe.
+ * @note pipe->lock must be held.
+ */
+static void pipe_wakeup(struct stream_pipe * pipe)
+{
+    waitq_wakeup_all(&pipe->waitq);
+}
+
+/**
+ * Sleep until the state of the pipe changes.
+ * @note pipe->lock must be held.
+ */
+static void pipe_wait(struct stream_pipe * pipe)
+{
+    waitq_sleep_mtx(&pipe->waitq, &pipe->lock);
+}
+
+/**
+ * Destructor for the pipe file descriptors.
+ * Called when the last reference to an end of the pipe is closed.
+ */
+static void fs_pipe_fildes_dtor(struct kobj * obj)
+{
+    file_t * file = containerof(obj, struct file, f_obj);
+    struct stream_pipe * pipe = (struct stream_pipe *)file->stream;
+
+    mtx_lock(&pipe->lock);
+    pipe->flags |= (file == &pipe->file0) ? PIPE_RCLOSED : PIPE_WCLOSED;
+    pipe_wakeup(pipe);
+    mtx_unlock(&pipe->lock);
+
+    vrele(file->vnode);
+}
+
 static void init_file(file_t * file, vnode_t * vn, struct stream_pipe * pipe,
                       int oflags)
 {
     fs_fildes_set(file, vn, oflags);
+    kobj_init(&file->f_obj, fs_pipe_fildes_dtor);
 
     file->oflags &= ~O_CLOEXEC;
     file->stream = pipe;
@@ -152,7 +188,7 @@ int fs_pipe_curproc_creat(struct files_struct * files, int fildes[2],
     vnode_t * vnode;
     struct buf * bp;
 
-    len = memalign_size(len, MMU_PGSIZE_COARSE);
+    len = memalign_size(max(len, PIPE_BUF), MMU_PGSIZE_COARSE);
 
     /*
      * Allocate space for structs and get a buffer.
@@ -161,7 +197,7 @@ int fs_pipe_curproc_creat(struct files_struct * files, int fildes[2],
      * | pipe       |<--.
      * +------------+   |
      * | bp         |----------.
-     * | q          |   |      |
+     * | ring       |   |      |
      * |  data      |-------------------.
      * | file0      |   |      |        |
      * |  stream    |---+      |        |
@@ -195,9 +231,11 @@ int fs_pipe_curproc_creat(struct files_struct * files, int fildes[2],
     file1 = &pipe->file1;
     vnode = &pipe->vnode;
 
-    /* Init queue */
+    /* Init the ring buffer */
     pipe->bp = bp;
-    pipe->q = queue_create((char *)bp->b_data, sizeof(char), len);
+    mtx_init(&pipe->lock, MTX_TYPE_TICKET, MTX_OPT_DEFAULT);
+    pipe->size = len;
+    waitq_init(&pipe->waitq);
     pipe->owner = curproc->cred.euid;
     pipe->group = curproc->cred.egid;
 
@@ -235,81 +273,296 @@ int fs_pipe_destroy(vnode_t * vnode)
     return 0;
 }
 
+/**
+ * Copy size bytes from uio at offset to the ring buffer at wr.
+ * Called without pipe->lock, the space must be reserved with PIPE_WBUSY.
+ */
+static int pipe_copyin(struct stream_pipe * pipe, struct uio * uio,
+                       size_t offset, size_t wr, size_t size)
+{
+    char * data = (char *)pipe->bp->b_data;
+    size_t first = min(size, pipe->size - wr);
+    int err;
+
+    err = uio_copyin(uio, data + wr, offset, first);
+    if (!err && size > first)
+        err = uio_copyin(uio, data, offset + first, size - first);
+
+    return err;
+}
+
+/**
+ * Copy size bytes from the ring buffer at rd to uio.
+ * Called without pipe->lock, the data must be reserved with PIPE_RBUSY.
+ */
+static int pipe_copyout(struct stream_pipe * pipe, struct uio * uio,
+                        size_t rd, size_t size)
+{
+    const char * data = (const char *)pipe->bp->b_data;
+    size_t first = min(size, pipe->size - rd);
+    int err;
+
+    err = uio_copyout(data + rd, uio, 0, first);
+    if (!err && size > first)
+        err = uio_copyout(data, uio, first, size - first);
+
+    return err;
+}
+
 static ssize_t fs_pipe_write(file_t * file, struct uio * uio, size_t count)
 {
     struct stream_pipe * pipe = (struct stream_pipe *)file->stream;
-    char * buf_addr;
-    int err;
+    size_t done = 0;
+    int err = 0;
 
     if (!(file->oflags & O_WRONLY))
         return -EBADF;
 
-    if (kobj_ref(&pipe->file0.f_obj)) {
-        return -EPIPE;
-    }
+    mtx_lock(&pipe->lock);
+    while (done < count) {
+        size_t space, need, wr, n;
 
-    err = uio_get_kaddr(uio, (void **)(&buf_addr));
-    if (err)
-        return err;
+        if (pipe->flags & PIPE_RCLOSED) {
+            err = -EPIPE;
+            break;
+        }
 
-    /* TODO Implement O_NONBLOCK */
+        /*
+         * Writes of up to PIPE_BUF bytes must not be interleaved with other
+         * writes, so wait until the whole write fits in.
+         */
+        space = pipe->size - pipe->count;
+        need = (count <= PIPE_BUF) ? count : 1;
+        if (space < need || (pipe->flags & PIPE_WBUSY)) {
+            if (file->oflags & O_NONBLOCK) {
+                err = -EAGAIN;
+                break;
+            }
+            pipe_wait(pipe);
+            continue;
+        }
 
-    for (size_t i = 0; i < count;) {
-        if (queue_push(&pipe->q, buf_addr + i))
-            i++;
         /*
-         * FIXME Yielding is really needed but currently there seems to some
-         *       strange performance issues.
+         * The user buffer may fault so the copy is done without the lock.
+         * Readers only free more space so the reserved space stays valid.
          */
-#if 0
-        thread_yield(PIPE_YIELD_STRATEGY);
-#endif
+        wr = (pipe->rd + pipe->count) % pipe->size;
+        n = min(space, count - done);
+        pipe->flags |= PIPE_WBUSY;
+        mtx_unlock(&pipe->lock);
+
+        err = pipe_copyin(pipe, uio, done, wr, n);
+
+        mtx_lock(&pipe->lock);
+        pipe->flags &= ~PIPE_WBUSY;
+        if (!err) {
+            pipe->count += n;
+            done += n;
+        }
+        pipe_wakeup(pipe);
+        if (err)
+            break;
     }
+    if (done > 0)
+        getrealtime(&pipe->sp_mtime);
+    mtx_unlock(&pipe->lock);
 
-    return count;
+    return (done > 0) ? (ssize_t)done : err;
 }
 
 static ssize_t fs_pipe_read(file_t * file, struct uio * uio, size_t count)
 {
     struct stream_pipe * pipe = (struct stream_pipe *)file->stream;
-    char * buf_addr;
-    int oflags = file->oflags;
-    int trycount = 0;
+    size_t rd, n;
     int err;
 
+    if (!(file->oflags & O_RDONLY))
+        return -EBADF;
+
+    if (count == 0)
+        return 0;
+
+    mtx_lock(&pipe->lock);
+    while (pipe->count == 0 || (pipe->flags & PIPE_RBUSY)) {
+        if (pipe->count == 0 && (pipe->flags & PIPE_WCLOSED)) {
+            /* EOF */
+            mtx_unlock(&pipe->lock);
+            return 0;
+        }
+        if (file->oflags & O_NONBLOCK) {
+            mtx_unlock(&pipe->lock);
+            return -EAGAIN;
+        }
+        pipe_wait(pipe);
+    }
+
     /*
-     * TODO Atomic pipes
-     *
-     * Instead of using that trycount we should actually make pipes atomic per
-     * PIPE_BUF and return immediately after some data is received.
+     * Return immediately with whatever is available. Writers only append so
+     * the data stays in place while the lock is dropped for the copy.
      */
+    rd = pipe->rd;
+    n = min(count, pipe->count);
+    pipe->flags |= PIPE_RBUSY;
+    mtx_unlock(&pipe->lock);
+
+    err = pipe_copyout(pipe, uio, rd, n);
+
+    mtx_lock(&pipe->lock);
+    pipe->flags &= ~PIPE_RBUSY;
+    if (!err) {
+        pipe->rd = (pipe->rd + n) % pipe->size;
+        pipe->count -= n;
+        getrealtime(&pipe->sp_atime);
+    }
+    pipe_wakeup(pipe);
+    mtx_unlock(&pipe->lock);
+
+    return (err) ? err : (ssize_t)n;
+}
+
+int fs_pipe_isfile(file_t * file)
+{
+    return file->vnode && file->vnode->sb == &fs_pipe_sb;
+}
 
-    if (!(oflags & O_RDONLY))
+ssize_t fs_pipe_splice_in(file_t * file, file_t * src, off_t * src_off,
+                          size_t count, int flags)
+{
+    struct stream_pipe * pipe = (struct stream_pipe *)file->stream;
+    const int nonblock = (file->oflags & O_NONBLOCK) ||
+                         (flags & PIPE_SPLICE_NONBLOCK);
+    size_t done = 0;
+    ssize_t err = 0;
+
+    if (!(file->oflags & O_WRONLY))
         return -EBADF;
 
-    err = uio_get_kaddr(uio, (void **)(&buf_addr));
-    if (err)
-        return err;
+    mtx_lock(&pipe->lock);
+    while (done < count) {
+        struct uio uio;
+        size_t wr, n;
+        ssize_t retval;
 
-    for (size_t i = 0; i < count;) {
-        if (queue_isempty(&pipe->q) &&
-            ((trycount++ > 5 && (i > 0 || (oflags & O_NONBLOCK))) ||
-            kobj_ref(&pipe->file1.f_obj))) {
-            return i;
+        if (pipe->flags & PIPE_RCLOSED) {
+            err = -EPIPE;
+            break;
+        }
+        if (pipe->count == pipe->size || (pipe->flags & PIPE_WBUSY)) {
+            if (done > 0)
+                break;
+            if (nonblock) {
+                err = -EAGAIN;
+                break;
+            }
+            pipe_wait(pipe);
+            continue;
+        }
+
+        /*
+         * Reserve the contiguous free space at the tail of the ring and let
+         * the source read directly into it. Readers only ever free more
+         * space so the reservation stays valid while the lock is dropped.
+         */
+        wr = (pipe->rd + pipe->count) % pipe->size;
+        n = min(count - done, min(pipe->size - pipe->count, pipe->size - wr));
+        pipe->flags |= PIPE_WBUSY;
+        mtx_unlock(&pipe->lock);
+
+        uio_init_kbuf(&uio, (__kernel void *)((char *)pipe->bp->b_data + wr),
+                      n);
+        retval = fs_fildes_read_at(src, &uio, n, src_off);
+
+        mtx_lock(&pipe->lock);
+        pipe->flags &= ~PIPE_WBUSY;
+        if (retval > 0) {
+            pipe->count += retval;
+            done += retval;
+        }
+        pipe_wakeup(pipe);
+
+        if (retval < (ssize_t)n) {
+            if (retval < 0)
+                err = retval;
+            break;
+        }
+    }
+    if (done > 0)
+        getrealtime(&pipe->sp_mtime);
+    mtx_unlock(&pipe->lock);
+
+    return (done > 0) ? (ssize_t)done : err;
+}
+
+ssize_t fs_pipe_splice_out(file_t * file, file_t * dst, off_t * dst_off,
+                           size_t count, int flags)
+{
+    struct stream_pipe * pipe = (struct stream_pipe *)file->stream;
+    const int nonblock = (file->oflags & O_NONBLOCK) ||
+                         (flags & PIPE_SPLICE_NONBLOCK);
+    const int peek = flags & PIPE_SPLICE_PEEK;
+    size_t done = 0;
+    ssize_t err = 0;
+
+    if (!(file->oflags & O_RDONLY))
+        return -EBADF;
+
+    mtx_lock(&pipe->lock);
+    while (done < count) {
+        struct uio uio;
+        size_t avail, off, n;
+        ssize_t retval;
+
+        /* When peeking the data already passed on is still in the ring. */
+        avail = pipe->count - ((peek) ? done : 0);
+        if (avail == 0 || (pipe->flags & PIPE_RBUSY)) {
+            if (done > 0)
+                break;
+            if (avail == 0 && (pipe->flags & PIPE_WCLOSED))
+                break; /* EOF */
+            if (nonblock) {
+                err = -EAGAIN;
+                break;
+            }
+            pipe_wait(pipe);
+            continue;
         }
 
-        if (queue_pop(&pipe->q, buf_addr + i))
-            i++;
         /*
-         * FIXME Yielding is really needed but currently there seems to some
-         *       strange performance issues.
+         * Pass the contiguous data at the head of the ring directly to the
+         * destination. Writers only append so the data stays in place while
+         * the lock is dropped.
          */
-#if 0
-        thread_yield(PIPE_YIELD_STRATEGY);
-#endif
+        off = (pipe->rd + ((peek) ? done : 0)) % pipe->size;
+        n = min(count - done, min(avail, pipe->size - off));
+        pipe->flags |= PIPE_RBUSY;
+        mtx_unlock(&pipe->lock);
+
+        uio_init_kbuf(&uio, (__kernel void *)((char *)pipe->bp->b_data + off),
+                      n);
+        retval = fs_fildes_write_at(dst, &uio, n, dst_off);
+
+        mtx_lock(&pipe->lock);
+        pipe->flags &= ~PIPE_RBUSY;
+        if (retval > 0) {
+            if (!peek) {
+                pipe->rd = (pipe->rd + retval) % pipe->size;
+                pipe->count -= retval;
+            }
+            done += retval;
+        }
+        pipe_wakeup(pipe);
+
+        if (retval < (ssize_t)n) {
+            if (retval < 0)
+                err = retval;
+            break;
+        }
     }
+    if (done > 0)
+        getrealtime(&pipe->sp_atime);
+    mtx_unlock(&pipe->lock);
 
-    return count;
+    return (done > 0) ? (ssize_t)done : err;
 }
 
 int fs_pipe_stat(vnode_t * vnode, struct stat * stat)
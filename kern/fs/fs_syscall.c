@@ -41,10 +41,12 @@
 #include <syscall.h>
 #include <errno.h>
 #include <kerror.h>
+#include <kmalloc.h>
 #include <libkern.h>
 #include <kstring.h>
 #include <vm/vm.h>
 #include <vm/vm_copyinstruct.h>
+#include <vm/vm_pgcache.h>
 #include <thread.h>
 #include <proc.h>
 #include <sys/priv.h>
@@ -52,6 +54,7 @@
 #include <fs/devfs.h>
 #include <fs/fs.h>
 #include <fs/fs_util.h>
+#include <kern_ipc.h>
 
 static int sys_readwrite(__user void * user_args, int write)
 {
@@ -59,6 +62,7 @@ static int sys_readwrite(__user void * user_args, int write)
     int err, retval;
     vnode_t * vnode;
     file_t * file;
+    struct vm_pgcache * pgc;
     struct uio uio;
 
     /* Copyin args. */
@@ -92,8 +96,20 @@ static int sys_readwrite(__user void * user_args, int write)
         goto out;
     }
 
-    retval = (write) ? vnode->vnode_ops->write(file, &uio, args.nbytes) :
-                       vnode->vnode_ops->read(file, &uio, args.nbytes);
+    /*
+     * A memory mapped file must be accessed through its page cache to keep
+     * read() and write() coherent with the mappings.
+     */
+    pgc = (S_ISREG(vnode->vn_mode) && vnode->vn_pgcache) ?
+        vm_pgcache_ref(vnode, 0) : NULL;
+    if (pgc) {
+        retval = (write) ? vm_pgcache_write(pgc, file, &uio, args.nbytes) :
+                           vm_pgcache_read(pgc, file, &uio, args.nbytes);
+        vm_pgcache_unref(pgc);
+    } else {
+        retval = (write) ? vnode->vnode_ops->write(file, &uio, args.nbytes) :
+                           vnode->vnode_ops->read(file, &uio, args.nbytes);
+    }
     if (retval < 0) {
         set_errno(-retval);
         retval = -1;
@@ -980,6 +996,171 @@ out:
     return retval;
 }
 
+#define SENDFILE_BUFSIZE 4096
+
+/**
+ * Transfer data between two files that are not pipes through a kernel
+ * bounce buffer.
+ * A NULL offset means that the seek position of the file is used.
+ */
+static ssize_t fs_sendfile_bounce(file_t * fin, off_t * off_in,
+                                  file_t * fout, off_t * off_out, size_t len)
+{
+    const size_t bsize = min(len, SENDFILE_BUFSIZE);
+    char * buf;
+    size_t done = 0;
+    ssize_t err = 0;
+
+    if (len == 0)
+        return 0;
+
+    buf = kmalloc(bsize);
+    if (!buf)
+        return -ENOMEM;
+
+    while (done < len) {
+        struct uio uio;
+        size_t n = min(len - done, bsize);
+        ssize_t rd, wr;
+
+        uio_init_kbuf(&uio, buf, n);
+        rd = fs_fildes_read_at(fin, &uio, n, off_in);
+        if (rd <= 0) {
+            err = rd;
+            break;
+        }
+
+        uio_init_kbuf(&uio, buf, rd);
+        wr = fs_fildes_write_at(fout, &uio, rd, off_out);
+        if (wr < 0) {
+            err = wr;
+            wr = 0;
+        }
+        done += wr;
+
+        if (wr < rd) {
+            /* Unread what was not written if possible. */
+            if (off_in)
+                *off_in -= rd - wr;
+            else if (S_ISREG(fin->vnode->vn_mode))
+                fin->seek_pos -= rd - wr;
+            break;
+        }
+        if (rd < (ssize_t)n)
+            break;
+    }
+
+    kfree(buf);
+
+    return (done > 0) ? (ssize_t)done : err;
+}
+
+/**
+ * Move data from fin to fout.
+ * Data is moved directly between the pipe buffer and the other file if
+ * either of the files is a pipe.
+ */
+static ssize_t fs_splice_files(file_t * fin, off_t * off_in,
+                               file_t * fout, off_t * off_out, size_t len,
+                               unsigned flags, int syscall_nr)
+{
+    const int pipe_in = fs_pipe_isfile(fin);
+    const int pipe_out = fs_pipe_isfile(fout);
+    int pflags = (flags & SPLICE_F_NONBLOCK) ? PIPE_SPLICE_NONBLOCK : 0;
+
+    if (fin->vnode == fout->vnode)
+        return -EINVAL;
+
+    switch (syscall_nr) {
+    case SYSCALL_FS_TEE:
+        if (!(pipe_in && pipe_out))
+            return -EINVAL;
+        return fs_pipe_splice_out(fin, fout, NULL, len,
+                                  pflags | PIPE_SPLICE_PEEK);
+    case SYSCALL_FS_SPLICE:
+        if (!(pipe_in || pipe_out))
+            return -EINVAL;
+        break;
+    }
+
+    if (pipe_in)
+        return fs_pipe_splice_out(fin, fout, off_out, len, pflags);
+    if (pipe_out)
+        return fs_pipe_splice_in(fout, fin, off_in, len, pflags);
+    return fs_sendfile_bounce(fin, off_in, fout, off_out, len);
+}
+
+/**
+ * Common implementation of splice(), tee() and sendfile().
+ */
+static intptr_t sys_splice_common(__user void * user_args, int syscall_nr)
+{
+    struct _fs_splice_args args;
+    file_t * fin = NULL;
+    file_t * fout = NULL;
+    off_t * off_in = NULL;
+    off_t * off_out = NULL;
+    ssize_t retval;
+
+    if (!useracc(user_args, sizeof(args), VM_PROT_WRITE) ||
+        copyin(user_args, &args, sizeof(args))) {
+        set_errno(EFAULT);
+        return -1;
+    }
+
+    fin = fs_fildes_ref(curproc->files, args.fd_in, 1);
+    fout = fs_fildes_ref(curproc->files, args.fd_out, 1);
+    if (!(fin && fout && fin->vnode && fout->vnode) ||
+        !(fin->oflags & O_RDONLY) || !(fout->oflags & O_WRONLY)) {
+        retval = -EBADF;
+        goto out;
+    }
+
+    if (((args.flags & _SPLICE_F_OFF_IN) && fs_pipe_isfile(fin)) ||
+        ((args.flags & _SPLICE_F_OFF_OUT) && fs_pipe_isfile(fout))) {
+        retval = -ESPIPE;
+        goto out;
+    }
+
+    /* Explicit offsets don't change the file offsets, like pread(). */
+    if (args.flags & _SPLICE_F_OFF_IN)
+        off_in = &args.off_in;
+    if (args.flags & _SPLICE_F_OFF_OUT)
+        off_out = &args.off_out;
+
+    retval = fs_splice_files(fin, off_in, fout, off_out, args.len,
+                             args.flags, syscall_nr);
+
+    if ((off_in || off_out) && copyout(&args, user_args, sizeof(args)))
+        retval = -EFAULT;
+
+out:
+    if (fin)
+        fs_fildes_ref(curproc->files, args.fd_in, -1);
+    if (fout)
+        fs_fildes_ref(curproc->files, args.fd_out, -1);
+    if (retval < 0) {
+        set_errno(-retval);
+        retval = -1;
+    }
+    return retval;
+}
+
+static intptr_t sys_splice(__user void * user_args)
+{
+    return sys_splice_common(user_args, SYSCALL_FS_SPLICE);
+}
+
+static intptr_t sys_tee(__user void * user_args)
+{
+    return sys_splice_common(user_args, SYSCALL_FS_TEE);
+}
+
+static intptr_t sys_sendfile(__user void * user_args)
+{
+    return sys_splice_common(user_args, SYSCALL_FS_SENDFILE);
+}
+
 /**
  * Declarations of fs syscall functions.
  */
@@ -1007,5 +1188,8 @@ static const syscall_handler_t fs_sysfnmap[] = {
     ARRDECL_SYSCALL_HNDL(SYSCALL_FS_UMASK, sys_umask),
     ARRDECL_SYSCALL_HNDL(SYSCALL_FS_MOUNT, sys_mount),
     ARRDECL_SYSCALL_HNDL(SYSCALL_FS_UMOUNT, sys_umount),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_FS_SPLICE, sys_splice),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_FS_TEE, sys_tee),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_FS_SENDFILE, sys_sendfile),
 };
 SYSCALL_HANDLERDEF(fs_syscall, fs_sysfnmap)
@@ -151,24 +151,15 @@ void fs_vnode_init(vnode_t * vnode, ino_t vn_num, struct fs_superblock * sb,
     vnode->vn_prev_mountpoint = vnode;
     vnode->sb = sb;
     vnode->vnode_ops = (vnode_ops_t *)vnops;
+    LIST_INIT(&vnode->vn_bpo.bh_list);
+    vnode->vn_pgcache = NULL;
     mtx_init(&vnode->vn_lock, VN_LOCK_TYPE, VN_LOCK_OPT);
 }
 
 void fs_vnode_cleanup(vnode_t * vnode)
 {
-    struct buf * var, * nxt;
-
     KASSERT(vnode != NULL, "vnode can't be null.");
 
     /* Release associated buffers. */
-    if (!SPLAY_EMPTY(&vnode->vn_bpo.sroot)) {
-        for (var = SPLAY_MIN(bufhd_splay, &vnode->vn_bpo.sroot);
-                var != NULL; var = nxt) {
-            nxt = SPLAY_NEXT(bufhd_splay, &vnode->vn_bpo.sroot, var);
-            SPLAY_REMOVE(bufhd_splay, &vnode->vn_bpo.sroot, var);
-            if (!(var->b_flags & B_DONE))
-                var->b_flags |= B_DELWRI;
-            brelse(var);
-        }
-   }
+    bio_vnode_cleanup(vnode);
 }
@@ -42,6 +42,7 @@
 static intptr_t sys_ioctl(__user void * user_args)
 {
     struct _ioctl_get_args args;
+    struct uio uio;
     void * ioargs = NULL;
     file_t * file;
     int err, retval;
@@ -52,30 +53,41 @@ static intptr_t sys_ioctl(__user void * user_args)
         return -1;
     }
 
+    file = fs_fildes_ref(curproc->files, args.fd, 1);
+    if (!file) {
+        set_errno(EBADF);
+        return -1;
+    }
+
     if (args.arg) {
-        struct uio uio;
         __user void * user_buf = (__user void *)args.arg;
 
-        /* Get request needs wr and set request needs rd */
+        /*
+         * Get request needs wr and set request needs rd. A get request may
+         * also read its argument, so a bounce buffer is filled in both
+         * cases.
+         */
         const int rw = (args.request & 1) ? VM_PROT_WRITE : VM_PROT_READ;
 
-
         if ((err = uio_init_ubuf(&uio, user_buf, args.arg_len, rw)) ||
-            (err = uio_get_kaddr(&uio, &ioargs))) {
+            (err = uio_kmap(&uio, args.arg_len, rw | VM_PROT_READ,
+                            &ioargs))) {
+            fs_fildes_ref(curproc->files, args.fd, -1);
             set_errno(-err);
             return -1;
         }
     }
 
-    file = fs_fildes_ref(curproc->files, args.fd, 1);
-    if (!file) {
-        set_errno(EBADF);
-        return -1;
-    }
-
     /* Actual ioctl call */
     retval = file->vnode->vnode_ops->ioctl(file, args.request,
                                            ioargs, args.arg_len);
+    if (ioargs) {
+        err = uio_kunmap(&uio, ioargs,
+                         (retval >= 0 && (args.request & 1)) ?
+                         args.arg_len : 0);
+        if (err && retval >= 0)
+            retval = err;
+    }
     if (retval < 0) {
         retval = -1;
         set_errno(-retval);
@@ -39,300 +39,338 @@
 #include <fs/dehtable.h>
 
 /*
- * Chains
- * ------
+ * Chains and resizing
+ * -------------------
  *
- * Dirent hash table uses chaining to solve collisions. Chains are dh_dirent
- * arrays that are dynamically resized when necessary.
+ * Dirent hash table uses chaining to solve collisions. Each entry is a
+ * separately allocated node and the chains are singly linked lists kept in
+ * ascending order of dh_key, the bit reversed hash of the name.
  *
- * To keep a chain unbroken there shall be no empty slots between two entries.
- * If an entry is removed in the middle the chain must be restructured so that
- * empty slot is filled. There is no need to free the space left after
- * restructuring a chain because it will either completely reused on next link
- * or of partly freed if more than one entries have been removed before the next
- * insert.
+ * An entry with hash h lives in the chain h & (b_size - 1). Reversing the
+ * bits means that the chain index is in the most significant bits of dh_key,
+ * so walking the chains in bit reversed index order and each chain in order
+ * returns all entries sorted by dh_key regardless of b_size. Iterators and
+ * readdir offsets are therefore positions in the dh_key order and they remain
+ * valid while the table is resized.
  *
- * dh_link tag must be used to mark the end of chain.
+ * The table is doubled when the average chain length exceeds
+ * DEHTABLE_MAX_LOAD and shrunk to a load factor of at most one when it falls
+ * below 1 / DEHTABLE_MIN_LOAD.
+ * A resize only allocates a new bucket array; the chains of the old array
+ * are moved DEHTABLE_REHASH_STEP at a time by the following dh_link() and
+ * dh_unlink() calls. Lookups consult both arrays until the old one is empty.
+ * All entries of a single hash value are always in the same array because
+ * dh_link() migrates the old chain of the new entry before inserting it.
  */
 
-/**
- * Chain info struct.
- */
-typedef struct chain_info {
-    size_t i_last; /*!< Index of the last node of the chain. */
-    size_t i_size; /*!< Size of the chain. */
-} chain_info_t;
-
-#define DIRENT_SIZE (sizeof(dh_dirent_t) - sizeof(char))
-
-#define CH_NOLINK   0
-#define CH_LINK     1
-
-/**
- * Get reference to a directory entry in array.
- * @param dea is a directory entry array.
- * @param offset is the offset of dh_dirent in the array.
- * @return Pointer to a dh_dirent struct.
- */
-#define get_dirent(dea, offset) \
-    ((dh_dirent_t *)((size_t)(dea) + (offset)))
+#define MAX_ORDER   31
 
-/**
- * Returns true if given dirent node has an invalid dh_size.
- * Invalid dh_size would lead to invalid offset and possibly segmentation fault.
- * @param denode is a directory entry node.
- * @return 0 if dh_size is valid; Otherwise value other than zero.
- */
-#define is_invalid_offset(denode) \
-    ((denode)->dh_size > (DIRENT_SIZE + NAME_MAX + 1))
+static uint32_t bitrev32(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+    x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+    return (x >> 16) | (x << 16);
+}
 
 /**
  * Hash function.
- * @note Only upto 32 bits.
  * @param str is the string to be hashed.
+ * @param len is the length of str.
  * @return Hash value.
  */
-static size_t hash_fname(const char * str, uint32_t k[2])
+static uint32_t hash_fname(const char * str, size_t len, uint32_t k[2])
+{
+    return halfsiphash32(str, len, k);
+}
+
+static inline int buckets_active(const struct dh_buckets * bs)
 {
-    size_t len = strlenn(str, NAME_MAX + 1);
-    int mask, chunks = NBITS(DEHTABLE_SIZE);
-    uint32_t hash, retval = 0;
+    return bs->b_chain != NULL;
+}
 
-    hash = halfsiphash32(str, len, k);
+static inline struct dh_dirent ** get_chain(const struct dh_buckets * bs,
+                                            uint32_t hash)
+{
+    return &bs->b_chain[hash & (bs->b_size - 1)];
+}
 
-    /* fold */
-    mask = (DEHTABLE_SIZE - 1);
-    while (chunks--) {
-        retval += hash & mask;
-        mask <<= (DEHTABLE_SIZE - 1);
-    }
+static int buckets_alloc(struct dh_buckets * bs, unsigned order)
+{
+    const size_t size = (size_t)1 << order;
 
-    /* truncate */
-    retval &= (DEHTABLE_SIZE - 1);
+    bs->b_chain = kzalloc(size * sizeof(struct dh_dirent *));
+    if (!bs->b_chain)
+        return -ENOMEM;
+    bs->b_size = size;
+    bs->b_order = order;
+
+    return 0;
+}
+
+static void buckets_free(struct dh_buckets * bs)
+{
+    kfree(bs->b_chain);
+    *bs = (struct dh_buckets){ .b_chain = NULL };
+}
 
-    return retval;
+/**
+ * Insert a node to a chain keeping the chain sorted.
+ * Nodes with an equal key are kept in the insertion order.
+ */
+static void chain_insert(struct dh_dirent ** chain, dh_dirent_t * node)
+{
+    while (*chain && (*chain)->dh_key <= node->dh_key) {
+        chain = &(*chain)->dh_next;
+    }
+    node->dh_next = *chain;
+    *chain = node;
 }
 
 /**
  * Find a specific dirent node in chain.
- * @param chain     is the chain array.
+ * @param chain     is the chain.
+ * @param hash      is the hash of name.
  * @param name      is the name of the node searched for.
  * @param name_len  is the length of the name.
- * @return Returns a pointer to the node; Or null if node not found.
+ * @return Returns a pointer to the link pointing to the node;
+ *         Or null if node not found.
  */
-static dh_dirent_t * find_node(dh_dirent_t * chain, const char * name)
+static struct dh_dirent ** find_node(struct dh_dirent ** chain, uint32_t hash,
+                                     const char * name, size_t name_len)
 {
-    size_t name_len = strlenn(name, NAME_MAX + 1) + 1;
-    size_t offset = 0;
-    dh_dirent_t * node;
-    dh_dirent_t * retval = 0;
+    const uint32_t key = bitrev32(hash);
 
-    do {
-        node = get_dirent(chain, offset);
-        if (is_invalid_offset(node)) {
-            KERROR(KERROR_ERR, "Invalid offset in deh node");
-            break;
-        }
+    for (; *chain && (*chain)->dh_key <= key; chain = &(*chain)->dh_next) {
+        const dh_dirent_t * node = *chain;
 
-        if (strncmp(node->dh_name, name, name_len) == 0) {
-            retval = node;
-            break;
-        }
-        offset += node->dh_size;
-    } while (node->dh_link == CH_LINK);
+        if (node->dh_hash == hash &&
+            strncmp(node->dh_name, name, name_len + 1) == 0)
+            return chain;
+    }
 
-    return retval;
+    return NULL;
 }
 
 /**
- * Find the last node of the chain.
- * @param chain is the dirent chain array.
- * @return Returns the updated chain_info struct.
+ * Move a chain from the old bucket array to the new one.
  */
-static chain_info_t find_last_node(dh_dirent_t * chain)
+static void rehash_chain(dh_table_t * dir, size_t ind)
 {
-    dh_dirent_t * node;
-    chain_info_t chinfo;
-
-    chinfo.i_size = 0;
-    do {
-        node = get_dirent(chain, chinfo.i_size);
-        if (is_invalid_offset(node)) {
-            KERROR(KERROR_ERR, "Invalid offset in deh node: %u",
-                     node->dh_size);
+    dh_dirent_t * node = dir->dh_old.b_chain[ind];
 
-            break;
-        }
-        chinfo.i_size += node->dh_size;
-    } while (node->dh_link == CH_LINK);
-    chinfo.i_last = chinfo.i_size - node->dh_size;
+    dir->dh_old.b_chain[ind] = NULL;
+    while (node) {
+        dh_dirent_t * next = node->dh_next;
 
-    return chinfo;
+        chain_insert(get_chain(&dir->dh_new, node->dh_hash), node);
+        node = next;
+    }
 }
 
-static int rm_node(dh_dirent_t ** chain, const char * name)
+/**
+ * Continue an ongoing resize.
+ * @param n is the maximum number of chains to be moved. When shrinking the
+ *          old chains are sparse and n is scaled by the size ratio.
+ */
+static void rehash_step(dh_table_t * dir, size_t n)
 {
-    const chain_info_t chinfo = find_last_node(*chain);
-    size_t old_offset = 0, new_offset = 0, prev_noffset = 0;
-    dh_dirent_t * new_chain;
-    int match = 0;
-
-    if (chinfo.i_size < sizeof(void *))
-        return -ENOENT;
+    if (!buckets_active(&dir->dh_old))
+        return;
 
-    new_chain = kzalloc(chinfo.i_size);
-    if (!new_chain)
-        return -ENOMEM;
+    if (dir->dh_old.b_order > dir->dh_new.b_order)
+        n <<= dir->dh_old.b_order - dir->dh_new.b_order;
 
-    /* Initial empty first entry. */
-    *get_dirent(new_chain, 0) = (dh_dirent_t){ .dh_size = 0 };
+    while (n-- && dir->dh_rehash_ind < dir->dh_old.b_size) {
+        rehash_chain(dir, dir->dh_rehash_ind++);
+    }
 
-    while (1) {
-        const dh_dirent_t * const node = get_dirent(*chain, old_offset);
+    if (dir->dh_rehash_ind == dir->dh_old.b_size) {
+        buckets_free(&dir->dh_old);
+        dir->dh_rehash_ind = 0;
+    }
+}
 
-        if (is_invalid_offset(node)) {
-            KERROR(KERROR_ERR, "Invalid offset in deh node");
+/**
+ * Start resizing dir to 2^order buckets.
+ * The caller must ensure that the previous resize has been completed.
+ * Resizing is only an optimization, so failing to allocate the new array is
+ * not an error.
+ */
+static void resize(dh_table_t * dir, unsigned order)
+{
+    struct dh_buckets new;
 
-            kfree(new_chain);
-            return -ENOTRECOVERABLE;
-        }
+    if (buckets_alloc(&new, order))
+        return;
 
-        /* Copy if no match or already matched. */
-        if (match || strncmp(node->dh_name, name, NAME_MAX + 1) != 0) {
-            dh_dirent_t * new_node = get_dirent(new_chain, new_offset);
+    dir->dh_old = dir->dh_new;
+    dir->dh_new = new;
+    dir->dh_rehash_ind = 0;
+}
 
-            memcpy(new_node, node, node->dh_size);
-            prev_noffset = new_offset;
-            new_offset += node->dh_size;
-        } else {
-            match = 1;
+static void resize_if_needed(dh_table_t * dir)
+{
+    const struct dh_buckets * bs = &dir->dh_new;
+
+    if (buckets_active(&dir->dh_old))
+        return;
+
+    if (dir->dh_nr_entries > DEHTABLE_MAX_LOAD * bs->b_size &&
+        bs->b_order < MAX_ORDER)
+        resize(dir, bs->b_order + 1);
+    else if (dir->dh_nr_entries < bs->b_size / DEHTABLE_MIN_LOAD &&
+             bs->b_size > DEHTABLE_MIN_SIZE) {
+        unsigned order = bs->b_order;
+
+        /* Shrink directly to a load factor of at most one. */
+        while (order > DEHTABLE_MIN_ORDER &&
+               dir->dh_nr_entries <= ((size_t)1 << (order - 1))) {
+            order--;
         }
-        old_offset += node->dh_size;
-
-        if (node->dh_link == CH_NOLINK)
-            break;
+        resize(dir, order);
     }
+}
 
-    get_dirent(new_chain, prev_noffset)->dh_link = CH_NOLINK;
-
-    /* Check if new_chain is empty */
-    if (get_dirent(new_chain, 0)->dh_size == 0) {
-        kfree(new_chain);
-        new_chain = NULL;
-    }
+/**
+ * Find the link pointing to the node of name from both bucket arrays.
+ */
+static struct dh_dirent ** lookup_node(dh_table_t * dir, uint32_t hash,
+                                       const char * name, size_t name_len)
+{
+    struct dh_dirent ** link = NULL;
 
-    /* Replace old chain. */
-    kfree(*chain);
-    *chain = new_chain;
+    if (buckets_active(&dir->dh_old))
+        link = find_node(get_chain(&dir->dh_old, hash), hash, name, name_len);
+    if (!link && buckets_active(&dir->dh_new))
+        link = find_node(get_chain(&dir->dh_new, hash), hash, name, name_len);
 
-    return 0;
+    return link;
 }
 
 void dh_init(dh_table_t * dir)
 {
+    memset(dir, 0, sizeof(*dir));
     dir->k[0] = krandom();
     dir->k[1] = krandom();
-    memset(dir, 0, sizeof(dir->htable));
 }
 
 int dh_link(dh_table_t * dir, ino_t vnode_num, uint8_t d_type,
             const char * name)
 {
-    size_t name_len = strlenn(name, NAME_MAX + 1) + 1;
-    const size_t h = hash_fname(name, dir->k);
-    const size_t entry_size = memalign(DIRENT_SIZE + name_len);
-    dh_dirent_t * dea;
-    chain_info_t chinfo;
-    int retval = 0;
+    const size_t name_len = strlenn(name, NAME_MAX + 1);
+    const uint32_t h = hash_fname(name, name_len, dir->k);
+    dh_dirent_t * node;
 
-    /* Verify that link doesn't exist */
-    if (!dh_lookup(dir, name, NULL)) {
-        retval = -EEXIST;
-        goto out;
-    }
+    if (name_len > NAME_MAX)
+        return -ENAMETOOLONG;
 
-    dea = dir->htable[h];
-    if (!dea) { /* Chain array not yet created. */
-        dea = kzalloc(entry_size);
-
-        chinfo.i_last = 0;
-        chinfo.i_size = 0; /* Set size to 0 to fool the assignment code as
-                            * this is the first entry. */
-    } else { /* Chain array found. */
-        /* Find the last node of the chain and realloc a longer chain. */
-        chinfo = find_last_node(dea);
-        dea = krealloc(dea, chinfo.i_size + entry_size);
+    if (!buckets_active(&dir->dh_new)) {
+        if (buckets_alloc(&dir->dh_new, DEHTABLE_MIN_ORDER))
+            return -ENOMEM;
     }
-    if (!dea) {
+
+    /* Verify that link doesn't exist */
+    if (lookup_node(dir, h, name, name_len))
+        return -EEXIST;
+
+    node = kmalloc(sizeof(dh_dirent_t) + name_len);
+    if (!node) {
         /* OOM, can't add new entries. */
-        retval = -ENOMEM;
-        goto out;
+        return -ENOMEM;
     }
-    dir->htable[h] = dea;
-
-    /* Create a link */
-    get_dirent(dea, chinfo.i_last)->dh_link = CH_LINK;
-    /* New node */
-    get_dirent(dea, chinfo.i_size)->dh_ino = vnode_num;
-    get_dirent(dea, chinfo.i_size)->dh_type = d_type;
-    get_dirent(dea, chinfo.i_size)->dh_size = entry_size;
-    get_dirent(dea, chinfo.i_size)->dh_link = CH_NOLINK;
-    strlcpy(get_dirent(dea, chinfo.i_size)->dh_name, name, name_len + 1);
-
-out:
-    return retval;
+    node->dh_hash = h;
+    node->dh_key = bitrev32(h);
+    node->dh_ino = vnode_num;
+    node->dh_type = d_type;
+    memcpy(node->dh_name, name, name_len);
+    node->dh_name[name_len] = '\0';
+
+    /*
+     * Entries with an equal hash must stay in a single chain for the iterator
+     * so the old chain is migrated before inserting to the new array.
+     */
+    if (buckets_active(&dir->dh_old)) {
+        size_t ind = h & (dir->dh_old.b_size - 1);
+
+        if (ind >= dir->dh_rehash_ind)
+            rehash_chain(dir, ind);
+    }
+    chain_insert(get_chain(&dir->dh_new, h), node);
+    dir->dh_nr_entries++;
+
+    rehash_step(dir, DEHTABLE_REHASH_STEP);
+    resize_if_needed(dir);
+
+    return 0;
 }
 
 int dh_unlink(dh_table_t * dir, const char * name)
 {
-    const size_t h = hash_fname(name, dir->k);
-    dh_dirent_t ** dea;
-    int err;
+    const size_t name_len = strlenn(name, NAME_MAX + 1);
+    const uint32_t h = hash_fname(name, name_len, dir->k);
+    struct dh_dirent ** link;
+    dh_dirent_t * node;
 
-    dea = &dir->htable[h];
-    if (!dea)
+    link = lookup_node(dir, h, name, name_len);
+    if (!link)
         return -ENOENT;
 
-    err = rm_node(dea, name);
-    if (err)
-        return err;
+    node = *link;
+    *link = node->dh_next;
+    kfree(node);
+    dir->dh_nr_entries--;
+
+    rehash_step(dir, DEHTABLE_REHASH_STEP);
+    resize_if_needed(dir);
 
     return 0;
 }
 
-void dh_destroy_all(dh_table_t * dir)
+static void destroy_chains(struct dh_buckets * bs)
 {
     size_t i;
 
-    /* Free all dir entry chains. */
-    for (i = 0; i < DEHTABLE_SIZE; i++) {
-        /* No NuLL check needed. */
-        kfree(dir->htable[i]);
+    if (!buckets_active(bs))
+        return;
+
+    for (i = 0; i < bs->b_size; i++) {
+        dh_dirent_t * node = bs->b_chain[i];
+
+        while (node) {
+            dh_dirent_t * next = node->dh_next;
+
+            kfree(node);
+            node = next;
+        }
     }
+    buckets_free(bs);
 }
 
+void dh_destroy_all(dh_table_t * dir)
+{
+    /* Free all dir entry chains. */
+    destroy_chains(&dir->dh_old);
+    destroy_chains(&dir->dh_new);
+    dir->dh_nr_entries = 0;
+    dir->dh_rehash_ind = 0;
+}
 
 int dh_lookup(dh_table_t * dir, const char * name, ino_t * vnode_num)
 {
-    const size_t h = hash_fname(name, dir->k);
-    dh_dirent_t * dea;
-    dh_dirent_t * dent;
-    int retval = -ENOENT;
-
-    dea = dir->htable[h];
-    if (!dea)
-        goto out;
+    const size_t name_len = strlenn(name, NAME_MAX + 1);
+    struct dh_dirent ** link;
 
-    dent = find_node(dea, name);
-    if (!dent)
-        goto out;
+    link = lookup_node(dir, hash_fname(name, name_len, dir->k),
+                       name, name_len);
+    if (!link)
+        return -ENOENT;
 
     if (vnode_num)
-        *vnode_num = dent->dh_ino;
+        *vnode_num = (*link)->dh_ino;
 
-    retval = 0;
-out:
-    return retval;
+    return 0;
 }
 
 int dh_revlookup(dh_table_t * dir, ino_t ino, char * name, size_t name_len)
@@ -358,64 +396,77 @@ dh_dir_iter_t dh_get_iter(dh_table_t * dir)
 {
     dh_dir_iter_t it = {
         .dir = dir,
-        .dea_ind = 0,
-        .ch_ind = SIZE_MAX
+        .key = 0,
+        .dup = 0,
     };
 
     return it;
 }
 
-dh_dirent_t * dh_iter_next(dh_dir_iter_t * it)
+/**
+ * Find the first node at or after the position (key, dup) in bs.
+ * @param[out] dup_out is the dup index of the returned node.
+ */
+static dh_dirent_t * buckets_next(const struct dh_buckets * bs,
+                                  uint32_t key, uint32_t dup,
+                                  uint32_t * dup_out)
 {
-    dh_dirent_t * dea; /* Dir entry array (chain). */
-    dh_dirent_t * node; /* Dir entry node in chain. */
+    const unsigned shift = 32 - bs->b_order;
+    size_t slot;
 
-    /* Already iterated over all nodes? */
-    if (!it->dir || it->dea_ind >= DEHTABLE_SIZE)
+    if (!buckets_active(bs))
         return NULL;
 
-    if (it->ch_ind == SIZE_MAX) { /* Get a next chain array */
-        size_t i = it->dea_ind;
+    /*
+     * The slot is the position of a chain in the key order, its bit
+     * reversal is the chain index.
+     */
+    for (slot = key >> shift; slot < bs->b_size; slot++) {
+        dh_dirent_t * node = bs->b_chain[bitrev32(slot) >> shift];
+        uint32_t i = 0;
+
+        for (; node; node = node->dh_next) {
+            if (node->dh_key < key)
+                continue;
+            if (node->dh_key > key) {
+                *dup_out = 0;
+                return node;
+            }
+            if (i++ >= dup) {
+                *dup_out = i - 1;
+                return node;
+            }
+        }
+    }
+
+    return NULL;
+}
 
-        it->ch_ind = 0; /* Reset chain index */
+dh_dirent_t * dh_iter_next(dh_dir_iter_t * it)
+{
+    dh_dirent_t * node;
+    dh_dirent_t * node_old;
+    uint32_t dup, dup_old;
 
-        /* Get a dir entry array */
-        do {
-            dea = it->dir->htable[i];
-            i++;
-        } while (!dea && i < DEHTABLE_SIZE);
+    if (!it->dir)
+        return NULL;
 
-        it->dea_ind = i - 1;
-    } else { /* Still iterating the old chain. */
-        dea = it->dir->htable[it->dea_ind];
-    }
-    if (!dea)
-        return NULL; /* Empty hash table or No more entries. */
-
-    /* Get a node from the chain. */
-    node = get_dirent(dea, it->ch_ind);
-    if (is_invalid_offset(node))
-        return NULL; /* Broken dirent hash table. */
-
-    if (node->dh_link == CH_LINK) {
-        it->ch_ind += node->dh_size;
-    } else {
-        it->dea_ind++;
-        it->ch_ind = SIZE_MAX; /* It's quite safe to assume the array is
-                                * shorter than SIZE_MAX. */
+    node = buckets_next(&it->dir->dh_new, it->key, it->dup, &dup);
+    node_old = buckets_next(&it->dir->dh_old, it->key, it->dup, &dup_old);
+    if (node_old && (!node || node_old->dh_key < node->dh_key)) {
+        node = node_old;
+        dup = dup_old;
     }
+    if (!node)
+        return NULL;
+
+    it->key = node->dh_key;
+    it->dup = dup + 1;
 
     return node;
 }
 
 size_t dh_nr_entries(dh_table_t * dir)
 {
-    dh_dir_iter_t it = dh_get_iter(dir);
-    size_t n = 0;
-
-    while (dh_iter_next(&it)) {
-        n++;
-    }
-
-    return n;
+    return dir->dh_nr_entries;
 }
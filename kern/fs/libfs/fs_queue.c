@@ -31,34 +31,36 @@
  */
 
 #include <errno.h>
-#include <machine/atomic.h>
 #include <fs/fs_queue.h>
 #include <kerror.h>
+#include <kstring.h>
 #include <libkern.h>
 
 /**
- * FSQ signaling end points.
+ * Get the data capacity of a packet.
  */
-enum wait4end {
-    FSQ_WAIT4READ,
-    FSQ_WAIT4WRITE,
-};
+static inline size_t fsq_packet_size(struct fs_queue * fsq)
+{
+    return fsq->qcb.b_size - sizeof(struct fs_queue_packet);
+}
 
 struct fs_queue * fs_queue_create(size_t nr_blocks, size_t block_size)
 {
+    const size_t packet_size = sizeof(struct fs_queue_packet) + block_size;
     struct buf * bp;
     struct fs_queue * fsq;
 
-    bp = geteblk(sizeof(struct fs_queue)
-                 + nr_blocks * (sizeof(struct fs_queue_packet) + block_size));
+    bp = geteblk(sizeof(struct fs_queue) + nr_blocks * packet_size);
     if (!bp)
         return NULL;
 
     fsq = (struct fs_queue *)(bp->b_data);
 
-    fsq->qcb = queue_create(fsq->packet, block_size, nr_blocks);
+    fsq->qcb = queue_create(fsq->packet, packet_size, nr_blocks);
     mtx_init(&fsq->wr_lock, MTX_TYPE_TICKET, MTX_OPT_DEFAULT);
     mtx_init(&fsq->rd_lock, MTX_TYPE_TICKET, MTX_OPT_DEFAULT);
+    waitq_init(&fsq->rd_waitq);
+    waitq_init(&fsq->wr_waitq);
     fsq->bp = bp;
 
     return fsq;
@@ -78,144 +80,89 @@ void fs_queue_destroy(struct fs_queue * fsq)
 }
 
 /**
- * Get a pointer to the end point signals pointer.
- * @param fsq is a pointer to the fs queue object.
- * @param ep selects the end point.
- * @return A pointer to a corresponding signals struct pointer.
+ * Wait until the reading end frees some space.
+ * wr_lock is released while sleeping because the reader takes it to freeze
+ * last_wr_packet, so the write state must be reloaded after this call.
+ * @note wr_lock must be held by the caller.
  */
-static struct signals ** fsq_get_sigs(struct fs_queue * fsq, enum wait4end ep)
+static void fsq_wait_space(struct fs_queue * fsq)
 {
-    switch (ep) {
-    case FSQ_WAIT4READ:
-        return &fsq->waiting4read;
-    case FSQ_WAIT4WRITE:
-        return &fsq->waiting4write;
-    default:
-        panic("Invalid end point for waiting");
-    }
-}
-
-/**
- * Create a sigset to be used for fsq signal waiting.
- * @return A sigset_t with necessary signals set.
- */
-static sigset_t create_fsq_sigset(void)
-{
-    sigset_t sigset;
-
-    sigemptyset(&sigset);
-    sigaddset(&sigset, _SIGKERN);
-
-    return sigset;
-}
+    struct waitq_entry we;
 
-/**
- * Initialize sigwait cond for the current thread.
- * @param fsq is a pointer to the fs queue object.
- * @param[out] oldset is the original signal set blocked.
- */
-static void fsq_sigwait_init(struct fs_queue * fsq, enum wait4end ep,
-                             sigset_t * oldset)
-{
-    sigset_t newset = create_fsq_sigset();
-    struct signals * sigs = &current_thread->sigs;
-    struct signals ** waitsigsp = fsq_get_sigs(fsq, ep);
-
-    ksignal_sigsmask(sigs, SIG_BLOCK, &newset, oldset);
-    while (atomic_cmpxchg_ptr((void **)waitsigsp, NULL, sigs));
+    waitq_prepare(&fsq->wr_waitq, &we);
+    mtx_unlock(&fsq->wr_lock);
+    while (queue_isfull(&fsq->qcb)) {
+        waitq_sleep(&fsq->wr_waitq, &we);
+    }
+    waitq_finish(&fsq->wr_waitq, &we);
+    mtx_lock(&fsq->wr_lock);
 }
 
 /**
- * Wait for a signal telling us to continue the ongoing fsq operation.
+ * Get the next packet to read.
+ * Sleeps until the writing end writes something unless the nonblock flag is
+ * set.
+ * @return A pointer to the packet; NULL if the queue is empty and the
+ *         nonblock flag is set.
  */
-static inline void fsq_sigwait(void)
+static struct fs_queue_packet * fsq_peek_packet(struct fs_queue * fsq,
+                                                int flags)
 {
-    sigset_t newset = create_fsq_sigset();
-    siginfo_t retval;
-
-    /*
-     * FIXME We should wait for a signal here but for some reason it causes
-     * everything to hang.
-     */
+    struct fs_queue_packet * p;
+    struct waitq_entry we;
 
-    ksignal_sigwait(&retval, &newset);
-}
+    if (queue_peek(&fsq->qcb, (void **)(&p)))
+        return p;
+    if (flags & FS_QUEUE_FLAGS_NONBLOCK)
+        return NULL;
 
-/**
- * Clear sigwait cond of the current thread.
- * @param fsq is a pointer to the fs queue object.
- */
-static void fsq_sigwait_clear(struct fs_queue * fsq, enum wait4end ep,
-                              sigset_t * oldset)
-{
-    struct signals * sigs = &current_thread->sigs;
-    struct signals ** waitsigsp = fsq_get_sigs(fsq, ep);
+    waitq_prepare(&fsq->rd_waitq, &we);
+    while (!queue_peek(&fsq->qcb, (void **)(&p))) {
+        waitq_sleep(&fsq->rd_waitq, &we);
+    }
+    waitq_finish(&fsq->rd_waitq, &we);
 
-    ksignal_sigsmask(sigs, SIG_SETMASK, oldset, NULL);
-    atomic_set_ptr((void **)waitsigsp, NULL);
-}
-
-/**
- * Send a signal to the other end if a tread is waiting there.
- * @param fsq is a pointer to the fs queue object.
- */
-static void fsq_sigsend(struct fs_queue * fsq, enum wait4end ep)
-{
-    struct signals * waitsigs;
-    struct ksignal_param param = {
-        .si_code = SIGKERN_FSQ,
-    };
-
-    waitsigs = atomic_read_ptr((void **)fsq_get_sigs(fsq, ep));
-    if (waitsigs)
-        ksignal_sendsig(waitsigs, _SIGKERN, &param);
+    return p;
 }
 
 ssize_t fs_queue_write(struct fs_queue * fsq, uint8_t * buf, size_t count,
                        int flags)
 {
+    const size_t packet_size = fsq_packet_size(fsq);
     struct fs_queue_packet * p;
-    size_t offset, bytes, left = count;
+    size_t offset, bytes = 0, left = count;
     ssize_t wr = 0;
 
     if (count == 0)
         return 0;
 
     mtx_lock(&fsq->wr_lock);
+retry:
     if (flags & FS_QUEUE_FLAGS_PACKET) {
+        p = NULL;
         offset = 0;
     } else {
         /*
          * Continue writing to the packet pointed by last_wr_packet if it exist.
          */
         p = fsq->last_wr_packet;
-        offset = fsq->last_wr;
+        offset = (p) ? fsq->last_wr : 0;
     }
 
     while (left > 0) {
         if (offset == 0) {
-            if ((flags & FS_QUEUE_FLAGS_NONBLOCK) &&
-                !(p = queue_alloc_get(&fsq->qcb))) {
-                goto out;
-            } else { /* Blocking IO */
-                sigset_t oldset;
-
-                fsq_sigwait_init(fsq, FSQ_WAIT4READ, &oldset);
-                while (!(p = queue_alloc_get(&fsq->qcb))) {
-
-                    /*
-                     * Queue is full.
-                     * Wait for the reading end to free some space.
-                     */
-                    fsq_sigwait();
-                }
-
-                /* Reset sigmask and wait state. */
-                fsq_sigwait_clear(fsq, FSQ_WAIT4READ, &oldset);
+            p = queue_alloc_get(&fsq->qcb);
+            if (!p) {
+                /* Only block until something has been written. */
+                if (wr > 0 || (flags & FS_QUEUE_FLAGS_NONBLOCK))
+                    break;
+
+                fsq_wait_space(fsq);
+                goto retry;
             }
         }
 
-        bytes = min(left, fsq->qcb.b_size - offset);
+        bytes = min(left, packet_size - offset);
         if (offset > 0)
             p->size += bytes;
         else
@@ -224,26 +171,28 @@ ssize_t fs_queue_write(struct fs_queue * fsq, uint8_t * buf, size_t count,
         left -= bytes;
         wr += bytes;
 
-        if (offset + bytes >= fsq->qcb.b_size) {
+        if (offset == 0)
+            queue_alloc_commit(&fsq->qcb);
+        if (offset + bytes >= packet_size) {
             bytes = 0;
             offset = 0;
+        } else {
+            offset += bytes;
         }
 
-        queue_alloc_commit(&fsq->qcb);
-        fsq_sigsend(fsq, FSQ_WAIT4WRITE);
+        waitq_wakeup_one(&fsq->rd_waitq);
     }
 
     if (bytes > 0 && !(flags & FS_QUEUE_FLAGS_PACKET)) {
         fsq->last_wr_packet = p;
-        fsq->last_wr = offset + bytes;
+        fsq->last_wr = offset;
     } else {
         fsq->last_wr_packet = NULL;
         fsq->last_wr = 0;
     }
 
-out:
     mtx_unlock(&fsq->wr_lock);
-    return wr;
+    return (wr == 0 && count > 0) ? -EAGAIN : wr;
 }
 
 ssize_t fs_queue_read(struct fs_queue * fsq, uint8_t * buf, size_t count,
@@ -273,24 +222,10 @@ ssize_t fs_queue_read(struct fs_queue * fsq, uint8_t * buf, size_t count,
     while (left > 0) {
         struct fs_queue_packet * p;
 
-        if ((flags & FS_QUEUE_FLAGS_NONBLOCK) &&
-            !queue_peek(&fsq->qcb, (void **)(&p))) {
-            goto out;
-        } else { /* Blocking IO */
-            sigset_t oldset;
-
-            fsq_sigwait_init(fsq, FSQ_WAIT4WRITE, &oldset);
-            while (!queue_peek(&fsq->qcb, (void **)(&p))) {
-                /*
-                 * Queue is empty.
-                 * Wait for the writing end to write something.
-                 */
-                fsq_sigwait();
-            }
-
-            /* Reset sigmask and wait state. */
-            fsq_sigwait_clear(fsq, FSQ_WAIT4WRITE, &oldset);
-        }
+        /* Only block until there is something to return. */
+        p = fsq_peek_packet(fsq, (rd > 0) ? FS_QUEUE_FLAGS_NONBLOCK : flags);
+        if (!p)
+            break;
 
         bytes = min(left, p->size - offset);
         memmove(buf + rd, p->data + offset, bytes);
@@ -299,19 +234,20 @@ ssize_t fs_queue_read(struct fs_queue * fsq, uint8_t * buf, size_t count,
 
         if (flags & FS_QUEUE_FLAGS_PACKET) {
             queue_skip(&fsq->qcb, 1);
-            bytes = 0;
+            offset = 0;
             break;
         } else if (offset + bytes >= p->size) {
             queue_skip(&fsq->qcb, 1);
-            bytes = 0;
             offset = 0;
+        } else {
+            offset += bytes;
         }
     }
 
-    fsq->last_rd = bytes;
+    fsq->last_rd = offset;
 
 out:
-    fsq_sigsend(fsq, FSQ_WAIT4READ);
+    waitq_wakeup_one(&fsq->wr_waitq);
     mtx_unlock(&fsq->rd_lock);
-    return rd;
+    return (rd == 0 && count > 0) ? -EAGAIN : rd;
 }
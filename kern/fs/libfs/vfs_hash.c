@@ -109,7 +109,10 @@ int vfs_hash_remove(vfs_hash_ctx_t ctx, struct vnode * vp)
 {
 
     mtx_lock(&ctx->ctx_lock);
-    LIST_REMOVE(vp, vn_hashlist);
+    if (vp->vn_hashlist.le_prev) {
+        LIST_REMOVE(vp, vn_hashlist);
+        vp->vn_hashlist.le_prev = NULL;
+    }
     mtx_unlock(&ctx->ctx_lock);
 
     return 0;
@@ -171,7 +174,8 @@ int vfs_hash_insert(vfs_hash_ctx_t ctx, struct vnode * vp, size_t hash,
 int vfs_hash_rehash(vfs_hash_ctx_t ctx, struct vnode * vp, size_t hash)
 {
     mtx_lock(&ctx->ctx_lock);
-    LIST_REMOVE(vp, vn_hashlist);
+    if (vp->vn_hashlist.le_prev)
+        LIST_REMOVE(vp, vn_hashlist);
     LIST_INSERT_HEAD(vfs_hash_bucket(ctx, vp->sb, hash), vp, vn_hashlist);
     vp->vn_hash = hash;
     mtx_unlock(&ctx->ctx_lock);
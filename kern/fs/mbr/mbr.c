@@ -59,6 +59,7 @@
 #include <kmalloc.h>
 #include <kerror.h>
 #include <proc.h>
+#include <fs/blkq.h>
 #include <fs/mbr.h>
 
 #define MBR_SIZE            512
@@ -311,7 +312,8 @@ static int mbr_read(struct dev_info * devnfo, off_t offset,
     struct mbr_dev * mbr = containerof(devnfo, struct mbr_dev, dev);
     struct dev_info * parent = mbr->parent;
 
-    return parent->read(parent, offset + mbr->start_block, buf, count, oflags);
+    return blkq_rw(parent, BLK_REQ_READ, offset + mbr->start_block,
+                   buf, count, oflags);
 }
 
 static int mbr_write(struct dev_info * devnfo, off_t offset,
@@ -320,7 +322,8 @@ static int mbr_write(struct dev_info * devnfo, off_t offset,
     struct mbr_dev * mbr = containerof(devnfo, struct mbr_dev, dev);
     struct dev_info * parent = mbr->parent;
 
-    return parent->write(parent, offset + mbr->start_block, buf, count, oflags);
+    return blkq_rw(parent, BLK_REQ_WRITE, offset + mbr->start_block,
+                   buf, count, oflags);
 }
 
 static off_t mbr_lseek(file_t * file, struct dev_info * devnfo, off_t offset,
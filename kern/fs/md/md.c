@@ -0,0 +1,486 @@
+/**
+ *******************************************************************************
+ * @file    md.c
+ * @author  Olli Vanhoja
+ * @brief   Memory disk driver.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+#include <errno.h>
+#include <sys/dev_major.h>
+#include <sys/ioctl.h>
+#include <sys/priv.h>
+#include <sys/sysctl.h>
+#include <buf.h>
+#include <fs/blkq.h>
+#include <fs/md.h>
+#include <fs/namecache.h>
+#include <hal/hw_timers.h>
+#include <kerror.h>
+#include <kinit.h>
+#include <klocks.h>
+#include <kmalloc.h>
+#include <kstring.h>
+#include <libkern.h>
+#include <proc.h>
+#include <rcu.h>
+
+static int mdctl_ioctl(struct dev_info * devnfo, uint32_t request,
+                       void * arg, size_t arg_len);
+
+static const char drv_name[] = "md";
+
+/**
+ * Control device for creating and destroying memory disks.
+ */
+static struct dev_info mdctl_info = {
+    .dev_id = DEV_MMTODEV(VDEV_MJNR_MD, 0),
+    .drv_name = drv_name,
+    .dev_name = "mdctl",
+    .block_size = 1,
+    .ioctl = mdctl_ioctl,
+};
+
+/*
+ * List of memory disks sorted by unit number.
+ */
+static LIST_HEAD(md_list_head, md_dev) md_list =
+    LIST_HEAD_INITIALIZER(md_list);
+static mtx_t md_lock = MTX_INITIALIZER(MTX_TYPE_TICKET, 0);
+static int md_last_unit = -1;
+
+SYSCTL_DECL(_vfs_md);
+SYSCTL_NODE(_vfs, OID_AUTO, md, CTLFLAG_RW, 0,
+            "Memory disks");
+
+static int sysctl_vfs_md_create(SYSCTL_HANDLER_ARGS)
+{
+    int error;
+    int value = md_last_unit;
+
+    error = sysctl_handle_int(oidp, &value, sizeof(value), req);
+    if (!error && req->newptr) {
+        struct md_dev * md;
+
+        if (value <= 0)
+            return -EINVAL;
+        error = md_create((size_t)value * 1024, &md);
+    }
+
+    return error;
+}
+SYSCTL_PROC(_vfs_md, OID_AUTO, create, CTLTYPE_INT | CTLFLAG_RW,
+            NULL, 0, sysctl_vfs_md_create, "I",
+            "Write a size in KB to create a memory disk, "
+            "reads the unit of the last one created.");
+
+/**
+ * Create the vfs.md.<dev_name> sysctl subtree for a memory disk.
+ */
+static void md_sysctl_register(struct md_dev * md)
+{
+    struct sysctl_oid_list * children = &md->sysctl_children;
+
+    md->sysctl_node = sysctl_add_oid(&SYSCTL_NODE_CHILDREN(_vfs, md),
+                                     md->dev.dev_name,
+                                     CTLTYPE_NODE | CTLFLAG_RD,
+                                     children, 0, NULL, "N",
+                                     "Memory disk");
+    if (!md->sysctl_node) {
+        KERROR(KERROR_WARN, "Failed to add sysctl node for %s\n",
+               md->dev.dev_name);
+        return;
+    }
+
+    (void)sysctl_add_oid(children, "size", CTLTYPE_UINT | CTLFLAG_RD,
+                         &md->md_size, 0, sysctl_handle_int, "IU",
+                         "Size in bytes.");
+    (void)sysctl_add_oid(children, "lat_us", CTLTYPE_UINT | CTLFLAG_RW,
+                         &md->md_lat_us, 0, sysctl_handle_int, "IU",
+                         "Injected latency per transfer in us.");
+    (void)sysctl_add_oid(children, "blk_us", CTLTYPE_UINT | CTLFLAG_RW,
+                         &md->md_blk_us, 0, sysctl_handle_int, "IU",
+                         "Injected latency per block in us.");
+}
+
+/**
+ * Simulate the timing of a real device.
+ * The emmc driver polls the controller, so busy waiting is what the rest of
+ * the system would see with a real card too.
+ */
+static void md_delay(struct md_dev * md, size_t bcount)
+{
+    const uint32_t us = md->md_lat_us +
+        md->md_blk_us * ((bcount + MD_BLOCK_SIZE - 1) / MD_BLOCK_SIZE);
+
+    if (us)
+        udelay(us);
+}
+
+/**
+ * Get a pointer to the storage of a block and clip bcount to the disk size.
+ * @return Returns NULL if blkno is past the end of the disk.
+ */
+static uint8_t * md_blkaddr(struct md_dev * md, off_t blkno, size_t * bcount)
+{
+    size_t off;
+
+    if (blkno < 0 || blkno >= md->dev.num_blocks)
+        return NULL;
+
+    off = (size_t)blkno * MD_BLOCK_SIZE;
+    *bcount = ulmin(*bcount, md->md_size - off);
+
+    return (uint8_t *)md->md_buf->b_data + off;
+}
+
+static ssize_t md_read(struct dev_info * devnfo, off_t blkno,
+                       uint8_t * buf, size_t bcount, int oflags)
+{
+    struct md_dev * md = containerof(devnfo, struct md_dev, dev);
+    uint8_t * p;
+
+    p = md_blkaddr(md, blkno, &bcount);
+    if (!p)
+        return 0;
+
+    md_delay(md, bcount);
+    memcpy(buf, p, bcount);
+
+    return bcount;
+}
+
+static ssize_t md_write(struct dev_info * devnfo, off_t blkno,
+                        uint8_t * buf, size_t bcount, int oflags)
+{
+    struct md_dev * md = containerof(devnfo, struct md_dev, dev);
+    uint8_t * p;
+
+    p = md_blkaddr(md, blkno, &bcount);
+    if (!p)
+        return -ENOSPC;
+
+    md_delay(md, bcount);
+    if (md->md_bad_blk >= blkno &&
+        md->md_bad_blk < blkno + (off_t)((bcount + MD_BLOCK_SIZE - 1) /
+                                         MD_BLOCK_SIZE)) {
+        return -EIO;
+    }
+    memcpy(p, buf, bcount);
+
+    return bcount;
+}
+
+/**
+ * Get the lowest unit number not in use that is at least first.
+ * @note md_lock must be held.
+ */
+static int md_alloc_unit(int first)
+{
+    struct md_dev * md;
+    int unit = first;
+
+    LIST_FOREACH(md, &md_list, md_entry_) {
+        if (md->md_unit > unit)
+            break;
+        if (md->md_unit == unit)
+            unit++;
+    }
+
+    return unit;
+}
+
+/**
+ * Insert a memory disk to the list keeping it sorted by unit number.
+ * @note md_lock must be held.
+ */
+static void md_insert(struct md_dev * md)
+{
+    struct md_dev * prev = NULL;
+    struct md_dev * it;
+
+    LIST_FOREACH(it, &md_list, md_entry_) {
+        if (it->md_unit > md->md_unit)
+            break;
+        prev = it;
+    }
+
+    if (prev)
+        LIST_INSERT_AFTER(prev, md, md_entry_);
+    else
+        LIST_INSERT_HEAD(&md_list, md, md_entry_);
+}
+
+int md_create(size_t size, struct md_dev ** result)
+{
+    struct md_dev * md;
+    int unit = 0;
+    int err;
+
+    size = memalign_size(size, MD_BLOCK_SIZE);
+    if (size == 0)
+        return -EINVAL;
+
+    md = kzalloc(sizeof(struct md_dev));
+    if (!md)
+        return -ENOMEM;
+
+    md->md_buf = geteblk(size);
+    if (!md->md_buf) {
+        err = -ENOMEM;
+        goto fail;
+    }
+    memset((void *)md->md_buf->b_data, 0, size);
+    md->md_size = size;
+    md->md_bad_blk = -1;
+
+    md->dev.drv_name = drv_name;
+    md->dev.block_size = MD_BLOCK_SIZE;
+    md->dev.num_blocks = size / MD_BLOCK_SIZE;
+    md->dev.flags = DEV_FLAGS_MB_READ | DEV_FLAGS_MB_WRITE;
+    md->dev.read = md_read;
+    md->dev.write = md_write;
+
+    err = blkq_create(&md->dev);
+    if (err)
+        goto fail;
+
+    /*
+     * The device node owns the name, so a unit is ours once make_dev()
+     * succeeds. A concurrent md_create() or a disk that is still being
+     * freed may hold the name of a free unit, try the next one then.
+     */
+    do {
+        mtx_lock(&md_lock);
+        unit = md_alloc_unit(unit);
+        mtx_unlock(&md_lock);
+
+        md->md_unit = unit++;
+        md->dev.dev_id = DEV_MMTODEV(VDEV_MJNR_MD, md->md_unit + 1);
+        ksprintf(md->dev.dev_name, sizeof(md->dev.dev_name), "md%d",
+                 md->md_unit);
+        err = make_dev(&md->dev, 0, 0, 0666, &md->md_vn);
+    } while (err == -EEXIST);
+    if (err) {
+        blkq_destroy(&md->dev);
+        goto fail;
+    }
+
+    mtx_lock(&md_lock);
+    md_insert(md);
+    md_last_unit = md->md_unit;
+    mtx_unlock(&md_lock);
+
+    md_sysctl_register(md);
+
+    *result = md;
+    return 0;
+fail:
+    if (md->md_buf)
+        vrfree(md->md_buf);
+    kfree(md);
+    return err;
+}
+
+/**
+ * Find a memory disk by unit number.
+ * @note md_lock must be held.
+ */
+static struct md_dev * md_find(int unit)
+{
+    struct md_dev * md;
+
+    LIST_FOREACH(md, &md_list, md_entry_) {
+        if (md->md_unit == unit)
+            break;
+    }
+
+    return md;
+}
+
+/**
+ * Drop the references held by cached lookups of the device file.
+ * Must be called without md_lock held as it waits for an RCU grace period.
+ */
+static void md_purge_names(struct md_dev * md)
+{
+    namecache_purge_vnode(md->md_vn);
+
+    /* The purged entries release their references after a grace period. */
+    rcu_synchronize();
+}
+
+/**
+ * Remove a memory disk from the list unless it's in use.
+ * The device file has one reference held by devfs and one held by md, any
+ * other reference is an open file or a mounted file system.
+ * @note md_lock must be held.
+ */
+static int md_unlink(struct md_dev * md)
+{
+    if (vrefcnt(md->md_vn) > 2)
+        return -EBUSY;
+
+    LIST_REMOVE(md, md_entry_);
+
+    return 0;
+}
+
+/**
+ * Free a memory disk removed with md_unlink().
+ */
+static void md_free(struct md_dev * md)
+{
+    if (md->sysctl_node)
+        (void)sysctl_remove_oid(md->sysctl_node, 1, 1);
+
+    /* Write out and drop the buffers before the device goes away. */
+    bio_vnode_cleanup(md->md_vn);
+    destroy_dev(md->md_vn);
+    vrele(md->md_vn);
+
+    blkq_destroy(&md->dev);
+    vrfree(md->md_buf);
+    kfree(md);
+}
+
+int md_destroy(struct md_dev * md)
+{
+    int err;
+
+    md_purge_names(md);
+
+    mtx_lock(&md_lock);
+    err = md_unlink(md);
+    mtx_unlock(&md_lock);
+    if (err)
+        return err;
+
+    md_free(md);
+
+    return 0;
+}
+
+struct md_dev * md_get(int unit)
+{
+    struct md_dev * md;
+
+    mtx_lock(&md_lock);
+    md = md_find(unit);
+    mtx_unlock(&md_lock);
+
+    return md;
+}
+
+int md_load(struct md_dev * md, const void * image, size_t len)
+{
+    if (len > md->md_size)
+        return -EFBIG;
+
+    memcpy((void *)md->md_buf->b_data, image, len);
+
+    return 0;
+}
+
+static int mdctl_ioctl(struct dev_info * devnfo, uint32_t request,
+                       void * arg, size_t arg_len)
+{
+    struct md_ioctl * mdio = (struct md_ioctl *)arg;
+    struct md_dev * md;
+    int err;
+
+    switch (request) {
+    case IOCTL_MD_CREAT:
+        if (!arg || arg_len < sizeof(struct md_ioctl))
+            return -EINVAL;
+        if (priv_check(&curproc->cred, PRIV_DRIVER))
+            return -EPERM;
+
+        err = md_create(mdio->md_size, &md);
+        if (err)
+            return err;
+        md->md_lat_us = mdio->md_lat_us;
+        md->md_blk_us = mdio->md_blk_us;
+        mdio->md_unit = md->md_unit;
+
+        return 0;
+    case IOCTL_MD_DESTROY:
+        if (!arg || arg_len < sizeof(int))
+            return -EINVAL;
+        if (priv_check(&curproc->cred, PRIV_DRIVER))
+            return -EPERM;
+
+        /*
+         * The reference keeps any other caller from unlinking and freeing md
+         * while the name cache is purged.
+         */
+        mtx_lock(&md_lock);
+        md = md_find(*(int *)arg);
+        if (md && vref(md->md_vn))
+            md = NULL;
+        mtx_unlock(&md_lock);
+        if (!md)
+            return -ENODEV;
+
+        md_purge_names(md);
+
+        mtx_lock(&md_lock);
+        vrele(md->md_vn);
+        err = md_unlink(md);
+        mtx_unlock(&md_lock);
+        if (err)
+            return err;
+        md_free(md);
+
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+int __kinit__ md_init(void)
+{
+    SUBSYS_DEP(devfs_init);
+    SUBSYS_INIT("md");
+
+    if (make_dev(&mdctl_info, 0, 0, 0600, NULL)) {
+        KERROR(KERROR_ERR, "Failed to make /dev/mdctl\n");
+        return -ENODEV;
+    }
+
+#if configMD_SIZE > 0
+    struct md_dev * md;
+    int err;
+
+    err = md_create(configMD_SIZE * 1024, &md);
+    if (err) {
+        KERROR(KERROR_ERR, "Failed to create md0 (%d)\n", err);
+    }
+#endif
+
+    return 0;
+}
@@ -0,0 +1,326 @@
+/**
+ *******************************************************************************
+ * @file    namecache.c
+ * @author  Olli Vanhoja
+ * @brief   Directory name lookup cache.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/hash.h>
+#include <sys/queue.h>
+#include <sys/sysctl.h>
+#include <fs/fs.h>
+#include <fs/namecache.h>
+#include <kmalloc.h>
+#include <kstring.h>
+#include <libkern.h>
+#include <rcu.h>
+
+#define NC_HASHSIZE     128 /*!< Number of hash buckets, a power of 2. */
+#define NC_NAME_MAX     31  /*!< Longer names are not cached. */
+
+/**
+ * Name cache entry.
+ * Everything except the hash chain link and the reference bit is immutable
+ * once the entry is visible to readers.
+ */
+struct nc_entry {
+    struct nc_entry * next;             /*!< RCU protected hash chain. */
+    TAILQ_ENTRY(nc_entry) lru_entry_;   /*!< Protected by nc_lock. */
+    struct rcu_cb rcu;
+    struct vnode * dir;
+    struct vnode * vnode;               /*!< NULL for a negative entry. */
+    uint32_t hash;
+    int referenced;                     /*!< Set by readers. */
+    size_t namelen;
+    char name[NC_NAME_MAX];
+};
+
+static struct nc_entry * nc_hashtbl[NC_HASHSIZE];
+static TAILQ_HEAD(nc_lru_head, nc_entry) nc_lru =
+    TAILQ_HEAD_INITIALIZER(nc_lru);
+static mtx_t nc_lock = MTX_INITIALIZER(MTX_TYPE_TICKET, MTX_OPT_DEFAULT);
+static unsigned nc_nr_entries;
+static atomic_t nc_gen = ATOMIC_INIT(0);
+
+static atomic_t nc_hits = ATOMIC_INIT(0);
+static atomic_t nc_neghits = ATOMIC_INIT(0);
+static atomic_t nc_misses = ATOMIC_INIT(0);
+
+SYSCTL_DECL(_vfs_namecache);
+SYSCTL_NODE(_vfs, OID_AUTO, namecache, CTLFLAG_RW, 0,
+            "Name lookup cache");
+
+SYSCTL_UINT(_vfs_namecache, OID_AUTO, entries, CTLFLAG_RD,
+            &nc_nr_entries, 0, "Number of entries in the name cache");
+SYSCTL_INT(_vfs_namecache, OID_AUTO, hits, CTLFLAG_RD,
+           &nc_hits, 0, "Positive name cache hits");
+SYSCTL_INT(_vfs_namecache, OID_AUTO, neghits, CTLFLAG_RD,
+           &nc_neghits, 0, "Negative name cache hits");
+SYSCTL_INT(_vfs_namecache, OID_AUTO, misses, CTLFLAG_RD,
+           &nc_misses, 0, "Name cache misses");
+
+static uint32_t nc_hash(const struct vnode * dir, const char * name,
+                        size_t namelen)
+{
+    uint32_t hash;
+
+    hash = hash32_buf(&dir, sizeof(dir), HASHINIT);
+    return hash32_buf(name, namelen, hash);
+}
+
+static struct nc_entry ** nc_bucket(uint32_t hash)
+{
+    return &nc_hashtbl[hash & (NC_HASHSIZE - 1)];
+}
+
+static int nc_match(const struct nc_entry * ncp, uint32_t hash,
+                    const struct vnode * dir, const char * name,
+                    size_t namelen)
+{
+    return ncp->hash == hash && ncp->dir == dir && ncp->namelen == namelen &&
+           !memcmp(ncp->name, name, namelen);
+}
+
+/**
+ * Free an entry after the RCU grace period.
+ */
+static void nc_free(struct rcu_cb * cb)
+{
+    struct nc_entry * ncp = containerof(cb, struct nc_entry, rcu);
+
+    vrele(ncp->dir);
+    vrele(ncp->vnode);
+    kfree(ncp);
+}
+
+/**
+ * Remove an entry from the cache.
+ * @note nc_lock must be held.
+ */
+static void nc_remove(struct nc_entry * ncp)
+{
+    struct nc_entry ** prev = nc_bucket(ncp->hash);
+
+    while (*prev != ncp) {
+        prev = &(*prev)->next;
+    }
+    rcu_assign_pointer(*prev, ncp->next);
+    TAILQ_REMOVE(&nc_lru, ncp, lru_entry_);
+    nc_nr_entries--;
+
+    /* Readers may still be traversing the entry. */
+    rcu_call(&ncp->rcu, nc_free);
+}
+
+/**
+ * Evict one entry using the clock algorithm.
+ * @note nc_lock must be held.
+ */
+static void nc_evict(void)
+{
+    struct nc_entry * ncp;
+    unsigned i = nc_nr_entries;
+
+    while ((ncp = TAILQ_FIRST(&nc_lru))) {
+        if (!ncp->referenced || i-- == 0) {
+            nc_remove(ncp);
+            return;
+        }
+
+        /* Give it a second chance. */
+        ncp->referenced = 0;
+        TAILQ_REMOVE(&nc_lru, ncp, lru_entry_);
+        TAILQ_INSERT_TAIL(&nc_lru, ncp, lru_entry_);
+    }
+}
+
+int namecache_lookup_rcu(struct vnode * dir, const char * name,
+                         size_t namelen, struct vnode ** result)
+{
+    struct nc_entry * ncp;
+    uint32_t hash;
+    int retval = -EAGAIN;
+
+    if (namelen > NC_NAME_MAX) {
+        atomic_inc(&nc_misses);
+        return -EAGAIN;
+    }
+
+    hash = nc_hash(dir, name, namelen);
+
+    for (ncp = rcu_dereference(*nc_bucket(hash)); ncp;
+         ncp = rcu_dereference(ncp->next)) {
+        if (!nc_match(ncp, hash, dir, name, namelen))
+            continue;
+
+        ncp->referenced = 1;
+        if (!ncp->vnode) {
+            retval = -ENOENT;
+        } else {
+            *result = ncp->vnode;
+            retval = 0;
+        }
+        break;
+    }
+
+    if (retval == 0)
+        atomic_inc(&nc_hits);
+    else if (retval == -ENOENT)
+        atomic_inc(&nc_neghits);
+    else
+        atomic_inc(&nc_misses);
+
+    return retval;
+}
+
+int namecache_lookup(struct vnode * dir, const char * name, size_t namelen,
+                     struct vnode ** result)
+{
+    struct rcu_lock_ctx ctx;
+    struct vnode * vn;
+    int retval;
+
+    ctx = rcu_read_lock();
+    retval = namecache_lookup_rcu(dir, name, namelen, &vn);
+    if (retval == 0) {
+        if (vref(vn))
+            retval = -EAGAIN;
+        else
+            *result = vn;
+    }
+    rcu_read_unlock(&ctx);
+
+    return retval;
+}
+
+unsigned namecache_gen(void)
+{
+    return (unsigned)atomic_read(&nc_gen);
+}
+
+void namecache_enter(struct vnode * dir, const char * name, size_t namelen,
+                     struct vnode * vnode, unsigned gen)
+{
+    struct nc_entry * ncp;
+    struct nc_entry ** bucket;
+
+    if (namelen > NC_NAME_MAX || configFS_NAMECACHE_SIZE == 0)
+        return;
+
+    ncp = kmalloc(sizeof(struct nc_entry));
+    if (!ncp)
+        return;
+
+    ncp->hash = nc_hash(dir, name, namelen);
+    ncp->referenced = 0;
+    ncp->namelen = namelen;
+    memcpy(ncp->name, name, namelen);
+    ncp->dir = (vref(dir)) ? NULL : dir;
+    ncp->vnode = (vnode && vref(vnode)) ? NULL : vnode;
+    if (!ncp->dir || ncp->vnode != vnode)
+        goto drop;
+
+    bucket = nc_bucket(ncp->hash);
+
+    mtx_lock(&nc_lock);
+    if (gen != (unsigned)atomic_read(&nc_gen)) {
+        /* Purged since the caller did the lookup so the entry is stale. */
+        mtx_unlock(&nc_lock);
+        goto drop;
+    }
+    for (struct nc_entry * p = *bucket; p; p = p->next) {
+        if (nc_match(p, ncp->hash, dir, name, namelen)) {
+            mtx_unlock(&nc_lock);
+            goto drop;
+        }
+    }
+
+    if (nc_nr_entries >= configFS_NAMECACHE_SIZE)
+        nc_evict();
+
+    ncp->next = *bucket;
+    rcu_assign_pointer(*bucket, ncp);
+    TAILQ_INSERT_TAIL(&nc_lru, ncp, lru_entry_);
+    nc_nr_entries++;
+    mtx_unlock(&nc_lock);
+
+    return;
+drop:
+    vrele(ncp->dir);
+    vrele(ncp->vnode);
+    kfree(ncp);
+}
+
+void namecache_purge(struct vnode * dir, const char * name, size_t namelen)
+{
+    const uint32_t hash = nc_hash(dir, name, namelen);
+    struct nc_entry * ncp;
+
+    mtx_lock(&nc_lock);
+    atomic_inc(&nc_gen);
+    for (ncp = *nc_bucket(hash); ncp; ncp = ncp->next) {
+        if (nc_match(ncp, hash, dir, name, namelen)) {
+            nc_remove(ncp);
+            break;
+        }
+    }
+    mtx_unlock(&nc_lock);
+}
+
+void namecache_purge_vnode(struct vnode * vnode)
+{
+    struct nc_entry * ncp;
+    struct nc_entry * ncp_tmp;
+
+    mtx_lock(&nc_lock);
+    atomic_inc(&nc_gen);
+    TAILQ_FOREACH_SAFE(ncp, &nc_lru, lru_entry_, ncp_tmp) {
+        if (ncp->dir == vnode || ncp->vnode == vnode)
+            nc_remove(ncp);
+    }
+    mtx_unlock(&nc_lock);
+}
+
+void namecache_purge_sb(struct fs_superblock * sb)
+{
+    struct nc_entry * ncp;
+    struct nc_entry * ncp_tmp;
+
+    mtx_lock(&nc_lock);
+    atomic_inc(&nc_gen);
+    TAILQ_FOREACH_SAFE(ncp, &nc_lru, lru_entry_, ncp_tmp) {
+        if (ncp->dir->sb == sb || (ncp->vnode && ncp->vnode->sb == sb))
+            nc_remove(ncp);
+    }
+    mtx_unlock(&nc_lock);
+
+    /* Release the vnode references held by the purged entries. */
+    rcu_synchronize();
+}
@@ -35,6 +35,7 @@
 #include <errno.h>
 #include <fs/fs.h>
 #include <fs/fs_util.h>
+#include <fs/namecache.h>
 #include <fs/procfs.h>
 #include <fs/ramfs.h>
 #include <hal/core.h>
@@ -157,7 +158,7 @@ static ssize_t procfs_read(file_t * file, struct uio * uio, size_t bcount)
     if (!spec || !file->stream)
         return -EIO;
 
-    err = uio_get_kaddr(uio, &vbuf);
+    err = uio_kmap(uio, bcount, VM_PROT_WRITE, &vbuf);
     if (err)
         return err;
 
@@ -176,6 +177,10 @@ static ssize_t procfs_read(file_t * file, struct uio * uio, size_t bcount)
         }
     }
 
+    err = uio_kunmap(uio, vbuf, (bytes > 0) ? bytes : 0);
+    if (err)
+        return err;
+
     return bytes;
 }
 
@@ -187,6 +192,7 @@ static ssize_t procfs_write(file_t * file, struct uio * uio, size_t bcount)
     const struct procfs_file * spec = PROCFS_GET_FILESPEC(file);
     procfs_writefn_t * fn;
     void * vbuf;
+    ssize_t retval;
     int err;
 
     if (!spec || !file->stream)
@@ -196,12 +202,14 @@ static ssize_t procfs_write(file_t * file, struct uio * uio, size_t bcount)
     if (!fn)
         return -ENOTSUP;
 
-    err = uio_get_kaddr(uio, &vbuf);
+    err = uio_kmap(uio, bcount, VM_PROT_READ, &vbuf);
     if (err)
         return err;
 
-    return fn(spec, (struct procfs_stream *)(file->stream),
-              vbuf, bcount);
+    retval = fn(spec, (struct procfs_stream *)(file->stream), vbuf, bcount);
+    uio_kunmap(uio, vbuf, 0);
+
+    return retval;
 }
 
 static void procfs_event_fd_created(struct proc_info * p, file_t * file)
@@ -259,6 +267,8 @@ static int create_proc_file(vnode_t * pdir, struct procfs_file * spec)
 
     err = pdir->vnode_ops->mknod(pdir, spec->filename, S_IFREG | PROCFS_PERMS,
                                  spec, &vn);
+    namecache_purge(pdir, spec->filename,
+                    strlenn(spec->filename, NAME_MAX + 1));
     if (err) {
         return -ENOTDIR;
     }
@@ -44,6 +44,7 @@
 #include <libkern.h>
 #include <kstring.h>
 #include <kmalloc.h>
+#include <kmem_cache.h>
 #include <buf.h>
 #include <proc.h>
 #include <fs/dehtable.h>
@@ -77,19 +78,19 @@ typedef struct ramfs_inode {
     struct timespec in_birthtime;
     blksize_t   in_blksize; /*!< Preferred I/O block size for this object.
                                  This is allowed to vary from file to file. */
-    blkcnt_t    in_blocks;  /*!< Number of blocks allocated for this object. */
+    blkcnt_t    in_blocks;  /*!< Number of 512 byte blocks allocated for this
+                                 object. */
 
     union {
         /**
-         * Data array.
-         * This is a pointer to an array of pointer pointing to the actual
-         * blocks of data. Blocks are fragments of data of the stored file.
-         * in_blksize and in_blocks can be used to calculate the size of this
-         * file. The size derived from those variables might not correspond to
-         * the size indicated by in_vnode->len but the size is always at least
-         * in_vnode->len in case of ramfs.
+         * Block map of a regular file.
+         * A radix tree indexed by the block number. Blocks are allocated on
+         * the first write, so missing blocks are holes in the file.
          */
-        struct buf ** data;
+        struct ramfs_blkmap {
+            void ** root; /*!< Root node; NULL if no blocks. */
+            unsigned height; /*!< Number of levels in the tree. */
+        } data;
         dh_table_t * dir;
     } in;
     rwlock_t in_lock;
@@ -108,15 +109,46 @@ typedef struct ramfs_sb {
 
 #define RAMFS_SB_FLAG_DYING 0x1    /*!< SB is being umounted */
 
+/**
+ * Cache for ramfs inodes.
+ */
+static KMEM_CACHE(ramfs_inode, sizeof(ramfs_inode_t), 0, NULL, NULL);
+
 #define RAMFS_SB_IS_HEALTHY(_x_) \
     (!(((_x_)->ramfs_flags & RAMFS_SB_FLAG_DYING) == RAMFS_SB_FLAG_DYING))
 
+/*
+ * Regular file data
+ * -----------------
+ *
+ * The first RAMFS_NR_SMALL_BLOCKS blocks of a file are RAMFS_SMALL_BLKSIZE
+ * bytes and the rest are RAMFS_LARGE_BLKSIZE bytes, so small files don't
+ * waste memory and large files need less blocks and map nodes.
+ *
+ * Each level of the block map consumes RAMFS_RADIX_SHIFT bits of the block
+ * number and leaf level slots point to the data buffers.
+ */
+#define RAMFS_SMALL_BLKSIZE     MMU_PGSIZE_COARSE
+#define RAMFS_NR_SMALL_BLOCKS   16
+#define RAMFS_SMALL_LIMIT       ((off_t)RAMFS_NR_SMALL_BLOCKS * \
+                                 RAMFS_SMALL_BLKSIZE)
+#define RAMFS_LARGE_BLKSIZE     (16 * MMU_PGSIZE_COARSE)
+#define RAMFS_RADIX_SHIFT       7
+#define RAMFS_RADIX_SIZE        (1 << RAMFS_RADIX_SHIFT)
+#define RAMFS_RADIX_MASK        (RAMFS_RADIX_SIZE - 1)
+#define RAMFS_RADIX_MAX_HEIGHT  4
+
+/**
+ * Convert a size in bytes to st_blocks units.
+ */
+#define RAMFS_NBLKS(_size_) ((_size_) / 512)
+
 /**
  * Data pointer.
  * Data pointer to a block of data stored in vnode (regular file).
  */
 struct ramfs_dp {
-    char * p;   /*!< Pointer to a data in file. */
+    char * p;   /*!< Pointer to a data in file; NULL if it's a hole. */
     size_t len; /*!< Length of block pointed by p. */
 };
 
@@ -131,7 +163,9 @@ static void destroy_vnode(vnode_t * vnode);
 static void destroy_inode(ramfs_inode_t * inode);
 static void destroy_inode_data(ramfs_inode_t * inode);
 static int insert_inode(ramfs_inode_t * inode);
-static struct ramfs_dp get_dp_by_offset(ramfs_inode_t * inode, off_t offset);
+static int get_dp_by_offset(ramfs_inode_t * inode, off_t offset, int alloc,
+                            struct ramfs_dp * dp);
+static void truncate_data(ramfs_inode_t * inode, off_t new_size);
 
 /**
  * Get the vnode struct linked to a vnode number.
@@ -515,17 +549,8 @@ int ramfs_create(vnode_t * dir, const char * name, mode_t mode,
 
     inode = get_inode_of_vnode(vnode);
 
-    /* Init the file data section. */
+    /* Data blocks are allocated on the first write. */
     init_inode_attr(inode, S_IFREG | mode);
-    err = ramfs_set_filesize(&inode->in_vnode, 1 * MMU_PGSIZE_COARSE);
-    if (err) {
-#ifdef configRAMFS_DEBUG
-        FS_KERROR_VNODE(KERROR_DEBUG, dir,
-                        "ramfs_set_filesize() failed on inode creation\n");
-#endif
-        destroy_inode(inode);
-        return err;
-    }
 
     /* Create a directory entry. */
     insert_inode(inode); /* Insert into the lookup table of the super block. */
@@ -619,10 +644,10 @@ int ramfs_link(vnode_t * dir, vnode_t * vnode, const char * name)
     inode_dir = get_inode_of_vnode(dir);
     inode = get_inode_of_vnode(vnode);
 
-    rwlock_rdlock(&inode_dir->in_lock);
+    rwlock_wrlock(&inode_dir->in_lock);
     err = dh_link(inode_dir->in.dir, vnode->vn_num,
                   IFTODT(vnode->vn_mode), name);
-    rwlock_rdunlock(&inode_dir->in_lock);
+    rwlock_wrunlock(&inode_dir->in_lock);
     if (err)
         return err;
 
@@ -793,41 +818,48 @@ int ramfs_rmdir(vnode_t * dir,  const char * name)
 
 int ramfs_readdir(vnode_t * dir, struct dirent * d, off_t * off)
 {
-    const off_t dea_ind_mask = 0x7FFFFFFF00000000;
-    const off_t ch_ind_mask  = DIRENT_SEEK_START;
+    const off_t dup_mask = 0xFFFF;
+    ramfs_inode_t * inode_dir;
     dh_dir_iter_t it;
     dh_dirent_t * dh;
+    int retval = 0;
 
     if (!S_ISDIR(dir->vn_mode))
         return -ENOTDIR; /* No a directory entry. */
 
+    inode_dir = get_inode_of_vnode(dir);
+
     /*
      * Dirent to iterator translation.
-     * We assume here that off_t is a 64-bit signed integer, so we can store the
-     * dea index to upper bits as it's definitely shorter than chain index which
-     * will be the low 32-bits.
-     * Note: For the first iteration ch_ind must be set to 0xFFFFFFFF.
+     * The iterator position is a 32-bit key and an index among entries
+     * sharing the same key. The key is stored to the bits 16..47 and the
+     * index to the low 16 bits, so the offset is always positive and it
+     * stays valid if the dh_table is resized between calls.
+     * Note: DIRENT_SEEK_START can't collide with a valid position as the
+     *       index would need to be 0xFFFF.
      */
-    it.dir = get_inode_of_vnode(dir)->in.dir;
-    it.dea_ind = (*off & dea_ind_mask) >> 32;
-    it.ch_ind  = (*off & ch_ind_mask);
-    if (it.ch_ind == ch_ind_mask)
-        it.ch_ind = SIZE_MAX; /* Just to make sure that the requirements of the
-                               * iterator are met on systems with different
-                               * architectures. (i.e. len of size_t) */
+    it = dh_get_iter(inode_dir->in.dir);
+    if (*off != DIRENT_SEEK_START) {
+        it.key = (uint32_t)(*off >> 16);
+        it.dup = (uint32_t)(*off & dup_mask);
+    }
 
+    rwlock_rdlock(&inode_dir->in_lock);
     dh = dh_iter_next(&it);
-    if (!dh || dh->dh_size == 0)
-        return -ESPIPE; /* End of dir. */
+    if (!dh) {
+        retval = -ESPIPE; /* End of dir. */
+        goto out;
+    }
 
     /* Translate iterator back to dirent. */
-    *off = ((((off_t)it.dea_ind) << 32) & dea_ind_mask) |
-           (off_t)(it.ch_ind & ch_ind_mask);
+    *off = ((off_t)it.key << 16) | ((off_t)it.dup & dup_mask);
     d->d_ino = dh->dh_ino;
     d->d_type = dh->dh_type;
     strlcpy(d->d_name, dh->dh_name, member_size(struct dirent, d_name));
 
-    return 0;
+out:
+    rwlock_rdunlock(&inode_dir->in_lock);
+    return retval;
 }
 
 int ramfs_stat(vnode_t * vnode, struct stat * buf)
@@ -962,7 +994,7 @@ static vnode_t * ramfs_raw_create_inode(const struct fs_superblock * sb)
     if (!RAMFS_SB_IS_HEALTHY(ramfs_sb))
         return NULL;
 
-    inode = kzalloc(sizeof(ramfs_inode_t));
+    inode = kmem_cache_alloc(&kmem_cache_ramfs_inode);
     if (!inode)
         return NULL;
 
@@ -1005,7 +1037,7 @@ static void destroy_inode(ramfs_inode_t * inode)
 
     atomic_dec(&ramfs_sb->nr_inodes);
     destroy_inode_data(inode);
-    kfree(inode);
+    kmem_cache_free(&kmem_cache_ramfs_inode, inode);
 }
 
 /**
@@ -1018,7 +1050,7 @@ static void destroy_inode_data(ramfs_inode_t * inode)
     switch (inode->in_vnode.vn_mode & S_IFMT) {
     case S_IFREG:
         /* Free all data blocks. */
-        ramfs_set_filesize(&inode->in_vnode, 0);
+        truncate_data(inode, 0);
         break;
     case S_IFDIR:
         /* Free dhtable entries and dhtable. */
@@ -1054,6 +1086,201 @@ static int insert_inode(ramfs_inode_t * inode)
     return err;
 }
 
+/**
+ * Get the block number of a file offset.
+ * @param offset        is the offset in the file.
+ * @param[out] blkoff   is the offset in the block.
+ * @param[out] blksize  is the size of the block.
+ * @return Returns the block number.
+ */
+static size_t get_blkno(off_t offset, size_t * blkoff, size_t * blksize)
+{
+    if (offset < RAMFS_SMALL_LIMIT) {
+        *blksize = RAMFS_SMALL_BLKSIZE;
+        *blkoff = (size_t)offset & (RAMFS_SMALL_BLKSIZE - 1);
+        return (size_t)offset / RAMFS_SMALL_BLKSIZE;
+    }
+
+    offset -= RAMFS_SMALL_LIMIT;
+    *blksize = RAMFS_LARGE_BLKSIZE;
+    *blkoff = (size_t)(offset & (RAMFS_LARGE_BLKSIZE - 1));
+    offset /= RAMFS_LARGE_BLKSIZE;
+    if (offset >= (off_t)1 << (RAMFS_RADIX_SHIFT * RAMFS_RADIX_MAX_HEIGHT))
+        return SIZE_MAX;
+
+    return RAMFS_NR_SMALL_BLOCKS + (size_t)offset;
+}
+
+static size_t blkmap_capacity(unsigned height)
+{
+    return (height) ? (size_t)1 << (RAMFS_RADIX_SHIFT * height) : 0;
+}
+
+/**
+ * Get the block map slot of a block.
+ * @param map   is the block map.
+ * @param blkno is the block number.
+ * @param alloc tells whether missing map nodes should be allocated.
+ * @return Returns a pointer to the slot;
+ *         NULL if the slot doesn't exist and alloc wasn't set or if
+ *         the allocation failed.
+ */
+static struct buf ** blkmap_slot(struct ramfs_blkmap * map, size_t blkno,
+                                 int alloc)
+{
+    void ** slot;
+    unsigned level;
+
+    if (blkno >= blkmap_capacity(map->height)) {
+        if (!alloc)
+            return NULL;
+
+        /* Add levels on top of the current root. */
+        while (blkno >= blkmap_capacity(map->height)) {
+            void ** node;
+
+            if (map->height == RAMFS_RADIX_MAX_HEIGHT)
+                return NULL;
+            node = kzalloc(RAMFS_RADIX_SIZE * sizeof(void *));
+            if (!node)
+                return NULL;
+            node[0] = map->root;
+            map->root = node;
+            map->height++;
+        }
+    }
+
+    slot = (void **)&map->root;
+    for (level = map->height; level > 0; level--) {
+        void ** node = *slot;
+
+        if (!node) {
+            if (!alloc)
+                return NULL;
+            node = kzalloc(RAMFS_RADIX_SIZE * sizeof(void *));
+            if (!node)
+                return NULL;
+            *slot = node;
+        }
+        slot = &node[(blkno >> (RAMFS_RADIX_SHIFT * (level - 1))) &
+                     RAMFS_RADIX_MASK];
+    }
+
+    return (struct buf **)slot;
+}
+
+static void free_block(ramfs_inode_t * inode, struct buf * bp)
+{
+    inode->in_blocks -= RAMFS_NBLKS(bp->b_bufsize);
+    vrfree(bp);
+}
+
+/**
+ * Free all blocks starting from the block number from in a subtree.
+ * @param node  is the root of the subtree.
+ * @param level is the level of node, leaf nodes are at level 1.
+ * @param base  is the first block number mapped by node.
+ * @param from  is the first block number to be freed.
+ * @return Returns 1 if node doesn't map any blocks anymore;
+ *         Otherwise 0.
+ */
+static int blkmap_trunc(ramfs_inode_t * inode, void ** node, unsigned level,
+                        size_t base, size_t from)
+{
+    const size_t span = (level > 1) ? blkmap_capacity(level - 1) : 1;
+    int empty = 1;
+    size_t i;
+
+    for (i = 0; i < RAMFS_RADIX_SIZE; i++) {
+        const size_t child_base = base + i * span;
+
+        if (!node[i])
+            continue;
+
+        if (child_base + span <= from) {
+            empty = 0;
+        } else if (level == 1) {
+            free_block(inode, node[i]);
+            node[i] = NULL;
+        } else if (blkmap_trunc(inode, node[i], level - 1, child_base, from)) {
+            kfree(node[i]);
+            node[i] = NULL;
+        } else {
+            empty = 0;
+        }
+    }
+
+    return empty;
+}
+
+/**
+ * Truncate or extend the data of a regular file.
+ * Blocks past new_size are freed and the tail of the last block is cleared,
+ * so extending the file later will read zeroes.
+ */
+static void truncate_data(ramfs_inode_t * inode, off_t new_size)
+{
+    struct ramfs_blkmap * map = &inode->in.data;
+    size_t from = 0;
+
+    if (new_size > 0) {
+        size_t blkoff, blksize;
+        struct buf ** slot;
+
+        from = get_blkno(new_size - 1, &blkoff, &blksize);
+        if (from == SIZE_MAX)
+            return;
+
+        slot = blkmap_slot(map, from, 0);
+        if (slot && *slot && blkoff + 1 < blksize) {
+            memset((char *)(*slot)->b_data + blkoff + 1, 0,
+                   blksize - blkoff - 1);
+        }
+        from++;
+    }
+
+    if (map->root && blkmap_trunc(inode, map->root, map->height, 0, from)) {
+        kfree(map->root);
+        map->root = NULL;
+        map->height = 0;
+    }
+
+    /* Drop levels that only map the first subtree. */
+    while (map->root && map->height > 1 &&
+           from <= blkmap_capacity(map->height - 1)) {
+        void ** root = map->root;
+
+        map->root = root[0];
+        map->height--;
+        kfree(root);
+    }
+    if (!map->root)
+        map->height = 0;
+
+    inode->in_vnode.vn_len = new_size;
+}
+
+/**
+ * Copy zeroes to uio.
+ */
+static int uio_copyout_zeroes(struct uio * uio, size_t offset, size_t count)
+{
+    static const char zeroes[256];
+
+    while (count > 0) {
+        const size_t n = min(count, sizeof(zeroes));
+        int err;
+
+        err = uio_copyout(zeroes, uio, offset, n);
+        if (err)
+            return err;
+        offset += n;
+        count -= n;
+    }
+
+    return 0;
+}
+
 /**
  * Transfers bytes from buf into a regular file.
  * Writing is begin from offset and ended at offset + count. buf must therefore
@@ -1070,44 +1297,41 @@ ssize_t ramfs_wr_regular(vnode_t * file, const off_t * restrict offset,
                          struct uio * uio, size_t count)
 {
     ramfs_inode_t * inode = get_inode_of_vnode(file);
-    const blksize_t blksize = inode->in_blksize;
-    struct ramfs_dp dp;
     size_t bytes_wr = 0;
+    int err = 0;
 
     /*
      * No file type check is needed as this function is called only for regular
      * files.
      */
 
-    do {
-        const size_t remain = count - bytes_wr;
+    rwlock_wrlock(&inode->in_lock);
+    while (bytes_wr < count) {
+        struct ramfs_dp dp;
         size_t curr_wr_len;
-        int err;
 
-        /* Get next block pointer. */
-        dp = get_dp_by_offset(inode, *offset + bytes_wr);
-        if (!dp.p) { /* Extend the file first. */
-            /* Extend the file to the final size if possible. */
-            if (ramfs_set_filesize(file, inode->in_blocks * blksize
-                        + *offset + (off_t)count)) {
-                break; /* Failed to extend the file. */
-            } else { /* Try again to get a block. */
-                continue;
-            }
-        }
+        /* Get next block pointer, allocates the block if necessary. */
+        err = get_dp_by_offset(inode, *offset + bytes_wr, 1, &dp);
+        if (err)
+            break;
 
         /*
          * Write bytes to the block.
          * Max per iteration is the size of the current block.
          */
-        curr_wr_len = min(remain, dp.len);
+        curr_wr_len = min(count - bytes_wr, dp.len);
         err = uio_copyin(uio, dp.p, bytes_wr, curr_wr_len);
         if (err)
-            return err;
+            break;
         bytes_wr += curr_wr_len;
-    } while (bytes_wr < count);
+    }
 
-    file->vn_len = max(file->vn_len, *offset + bytes_wr);
+    if (bytes_wr > 0)
+        file->vn_len = max(file->vn_len, *offset + (off_t)bytes_wr);
+    rwlock_wrunlock(&inode->in_lock);
+
+    if (bytes_wr == 0 && err)
+        return err;
     return bytes_wr;
 }
 
@@ -1122,43 +1346,52 @@ ssize_t ramfs_rd_regular(vnode_t * file, const off_t * restrict offset,
                          struct uio * uio, size_t count)
 {
     ramfs_inode_t * inode = get_inode_of_vnode(file);
-    struct ramfs_dp dp;
     size_t bytes_rd = 0;
+    int err = 0;
 
     /*
      * No file type check is needed as this function is called only for regular
      * files.
      */
 
-    do {
-        const size_t remain = count - bytes_rd;
+    rwlock_rdlock(&inode->in_lock);
+    while (bytes_rd < count) {
+        const off_t pos = *offset + bytes_rd;
+        struct ramfs_dp dp;
         size_t curr_rd_len;
-        int err;
 
-        if ((*offset + bytes_rd) >= file->vn_len) {
+        if (pos >= file->vn_len) {
             break; /* EOF */
         }
 
         /* Get next block pointer. */
-        dp = get_dp_by_offset(inode, *offset + bytes_rd);
-        if (!dp.p) {
-            break; /* EOF */
-        }
-
-        /* Read bytes from the block. */
-        curr_rd_len = min(remain, dp.len);
-        err = uio_copyout(dp.p, uio, bytes_rd, curr_rd_len);
+        err = get_dp_by_offset(inode, pos, 0, &dp);
         if (err)
-            return err;
+            break;
+
+        /* Read bytes from the block, a hole reads as zeroes. */
+        curr_rd_len = min(count - bytes_rd, dp.len);
+        if (file->vn_len - pos < (off_t)curr_rd_len)
+            curr_rd_len = (size_t)(file->vn_len - pos);
+        if (dp.p)
+            err = uio_copyout(dp.p, uio, bytes_rd, curr_rd_len);
+        else
+            err = uio_copyout_zeroes(uio, bytes_rd, curr_rd_len);
+        if (err)
+            break;
         bytes_rd += curr_rd_len;
-    } while (bytes_rd < count);
+    }
+    rwlock_rdunlock(&inode->in_lock);
 
+    if (bytes_rd == 0 && err)
+        return err;
     return bytes_rd;
 }
 
 /**
  * Set file size.
- * Sets a new size for a regular file.
+ * Truncates or extends a regular file to new_size. Blocks past the new size
+ * are freed and extending the file creates a hole.
  * @param file      is the inode of a regular file.
  * @param new_size  is the new size of file.
  * @return Returns 0 if succeeded; Otherwise value other than zero.
@@ -1166,93 +1399,60 @@ ssize_t ramfs_rd_regular(vnode_t * file, const off_t * restrict offset,
 int ramfs_set_filesize(vnode_t * vnode, off_t new_size)
 {
     ramfs_inode_t * file = get_inode_of_vnode(vnode);
-    const blksize_t blksize = file->in_blksize;
-    const off_t old_size = (off_t)file->in_blocks * (off_t)blksize;
+    size_t blkoff, blksize;
 
-    /* Calculate a block aligned new_size.
-     * Some size_t casts to speed up the computation as ramfs doesn't support
-     * larger files anyway. */
-    new_size = new_size +
-        (off_t)((size_t)blksize -
-                (((size_t)new_size - 1) & ((size_t)blksize - 1)) - 1);
+    if (new_size < 0)
+        return -EINVAL;
+    if (get_blkno(new_size, &blkoff, &blksize) == SIZE_MAX)
+        return -EFBIG;
 
-    if (new_size == old_size) { /* Same as old */
-        return 0;
-    } else if (new_size < old_size) { /* Truncate */
-        if (new_size > 0) {
-            /* TODO Free blocks to truncate the file */
-        } else {  /* Free all blocks. */
-            struct buf ** bpp = file->in.data;
-            size_t i;
-
-            for (i = 0; i < file->in_blocks; i++) {
-                if (bpp[i])
-                    vrfree(bpp[i]);
-            }
-            file->in.data = NULL;
-            file->in_blocks = 0;
-        }
-    } else { /* Extend */
-        struct buf ** new_data;
-        const blkcnt_t new_blkcnt = new_size / blksize;
-        size_t i;
-
-        new_data = krealloc(file->in.data, sizeof(struct buf) * new_blkcnt);
-        if (!new_data) {
-            return -ENOMEM; /* Can't extend. */
-        }
-        file->in.data = new_data;
-
-        /*
-         * TODO It would be possibly more efficient for memory usage to allocate
-         * new blocks just before writing but that'd require some refactoring.
-         */
-
-        /* Allocate new blocks. */
-        for (i = file->in_blocks; i < new_blkcnt; i++) {
-            new_data[i] = geteblk(blksize);
-            if (!new_data[i]) { /* Can't alloc. */
-                file->in_blocks += i;
-                return -ENOMEM; /* Can't extend to the requested size. */
-            }
-        }
-        file->in_blocks = new_blkcnt;
-    }
+    rwlock_wrlock(&file->in_lock);
+    truncate_data(file, new_size);
+    rwlock_wrunlock(&file->in_lock);
 
     return 0;
 }
 
 /**
  * Get data pointer by given offset.
- * @note This function may return pointers that are pointing to a memory
- * location after the EOF.
  * @param inode     is a ramfs inode.
  * @param offset    is the offset of seek pointer.
- * @return Returns a struct that contains a pointer to the requested data and
- *         length of returned block. dp.p == NULL if request out of bounds.
+ * @param alloc     tells whether a missing block should be allocated.
+ * @param[out] dp   is the pointer to the requested data and the length of the
+ *                  rest of the block. dp->p is set to NULL if the offset is
+ *                  in a hole and alloc wasn't set.
+ * @return Returns 0 if succeed; Otherwise a negative errno code is returned.
  */
-static struct ramfs_dp get_dp_by_offset(ramfs_inode_t * inode, off_t offset)
+static int get_dp_by_offset(ramfs_inode_t * inode, off_t offset, int alloc,
+                            struct ramfs_dp * dp)
 {
-    const blksize_t blksize = inode->in_blksize;
-    struct ramfs_dp dp = { .p = 0, .len = 0 }; /* Return value. */
-
-    if (/* Out of bounds check. */
-        !(offset >= ((off_t)inode->in_blocks * (off_t)blksize)) &&
-        /* Data array is set. */
-        inode->in.data) {
-        size_t bi; /* Block index. */
-        size_t di; /* Data index. */
-        char * block; /* Pointer to the block. */
-
-        bi = (size_t)((offset - (offset & ((off_t)(blksize - 1))))
-                / (off_t)blksize);
-        di = (size_t)(((size_t)offset) & (blksize - 1));
-        block = (char *)(inode->in.data[bi]->b_data);
-
-        /* Return value. */
-        dp.p = &block[di];
-        dp.len = blksize - di;
+    size_t blkno, blkoff, blksize;
+    struct buf ** slot;
+    struct buf * bp;
+
+    blkno = get_blkno(offset, &blkoff, &blksize);
+    if (blkno == SIZE_MAX)
+        return -EFBIG;
+
+    dp->len = blksize - blkoff;
+    dp->p = NULL;
+
+    slot = blkmap_slot(&inode->in.data, blkno, alloc);
+    if (!slot)
+        return (alloc) ? -ENOSPC : 0;
+
+    bp = *slot;
+    if (!bp) {
+        if (!alloc)
+            return 0;
+
+        bp = geteblk(blksize);
+        if (!bp)
+            return -ENOSPC;
+        inode->in_blocks += RAMFS_NBLKS(bp->b_bufsize);
+        *slot = bp;
     }
+    dp->p = (char *)bp->b_data + blkoff;
 
-    return dp;
+    return 0;
 }
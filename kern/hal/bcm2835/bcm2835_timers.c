@@ -135,6 +135,31 @@ static int enable_arm_timer(unsigned freq_hz)
     return irq_register(0, &bcm2835_timer_irq_handler);
 }
 
+__weak_reference(bcm_set_next_tick, hw_timers_set_next_tick);
+void bcm_set_next_tick(uint32_t usec)
+{
+    const uint32_t tick_load = SYS_CLOCK / (configSCHED_HZ * 16);
+    uint32_t load;
+    istate_t s_entry;
+
+    /* The timer counts at SYS_CLOCK / 16 Hz. */
+    if (usec > 1000000)
+        usec = 1000000;
+    load = (usec / 1000) * (SYS_CLOCK / 16) / 1000;
+    if (load < tick_load)
+        load = tick_load;
+    if (load > 0x7fffff) /* 23-bit counter */
+        load = 0x7fffff;
+
+    /*
+     * Writing the load register restarts the count, the reload value is
+     * still used after this period.
+     */
+    mmio_start(&s_entry);
+    mmio_write(ARM_TIMER_LOAD, load);
+    mmio_end(&s_entry);
+}
+
 __weak_reference(bcm_udelay, udelay);
 void bcm_udelay(uint32_t delay)
 {
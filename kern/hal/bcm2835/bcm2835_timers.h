@@ -48,6 +48,7 @@
 
 void bcm2835_timers_arm_clear(void);
 void bcm_udelay(uint32_t delay);
+void bcm_set_next_tick(uint32_t usec);
 
 #endif /* BCM2835_TIMERS_H */
 
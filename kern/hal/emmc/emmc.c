@@ -70,6 +70,7 @@
 #include <sys/dev_major.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <fs/blkq.h>
 #include <fs/mbr.h>
 #include <hal/hw_timers.h>
 #include <kerror.h>
@@ -338,14 +339,15 @@ int __kinit__ emmc_init(void)
     if (err)
         return err;
 
-    /* TODO Block cache not implemented */
-#ifdef ENABLE_BLOCK_CACHE
-    struct dev_info * c_dev = sd_edev->dev;
-    uintptr_t cache_start = alloc_buf(BLOCK_CACHE_SIZE);
-
-    if (cache_start != 0)
-        cache_init(&sd_edev->dev, &c_dev, cache_start, BLOCK_CACHE_SIZE);
-#endif
+    /*
+     * Sort and merge the transfers before they hit the card, caching is done
+     * by bio.
+     */
+    err = blkq_create(&sd_edev->dev);
+    if (err) {
+        KERROR(KERROR_WARN, "Failed to create a request queue for %s (%d)\n",
+               sd_edev->dev.dev_name, err);
+    }
 
     /* Register with devfs */
     if (make_dev(&sd_edev->dev, 0, 0, 0666, &vnode)) {
@@ -35,6 +35,8 @@
 #define BUF_H
 
 #include <sys/queue.h>
+#include <bitmap.h>
+#include <fs/blkq.h>
 #include <fs/fs.h>
 #include <hal/mmu.h>
 #include <kobj.h>
@@ -67,11 +69,25 @@ struct buf {
     mmu_region_t b_mmu;     /*!< MMU struct for user space or special access. */
     int b_uflags;           /*!< Actual user space permissions and flags. */
 
+    /* Partial copy-on-write. */
+    struct buf * b_cowsrc;  /*!< Region the pages not yet copied to b_pages
+                             *   are still shared with. */
+    size_t b_cowcount;      /*!< Number of pages copied from b_cowsrc. */
+
+    /* Demand paging. */
+    struct buf ** b_pages;  /*!< Pages of a demand paged region, a page is
+                             *   NULL until it's faulted in. */
+    bitmap_t * b_pgwrmap;   /*!< Pages mapped writable. */
+    size_t b_pgfill;        /*!< Offset in a private demand paged region
+                             *   where the file data ends and zero filled
+                             *   pages start. */
+
     /* IO Buffer */
     file_t b_file;          /*!< File descriptor for the buffered vnode. */
     file_t b_devfile;       /*!< File descriptor for the buffered device. */
     size_t b_dirtyoff;      /*!< Offset in buffer of dirty region. */
     size_t b_dirtyend;      /*!< Offset of end of dirty region. */
+    struct blk_req b_blkreq; /*!< Request for the device request queue. */
 
     /* Status */
     unsigned long b_flags;  /*!< Buffer control flags. */
@@ -87,9 +103,11 @@ struct buf {
     const struct vm_ops * vm_ops;
 
     void * allocator_data;  /*!< Allocator specific data. */
-    SPLAY_ENTRY(buf) sentry_;
+    LIST_ENTRY(buf) hash_entry_; /*!< bio hash bucket entry. */
+    LIST_ENTRY(buf) vnode_entry_; /*!< Buffer list entry of the vnode. */
     LIST_ENTRY(buf) shmem_entry_; /*!< shmem sync list entry. */
     TAILQ_ENTRY(buf) relse_entry_; /*!< bio relse list entry. */
+    TAILQ_ENTRY(buf) ioq_entry_; /*!< bio async I/O queue entry. */
 
     struct kobj b_obj;
     mtx_t lock;
@@ -130,28 +148,45 @@ typedef struct vm_ops {
 #define B_BUSY      0x0000008  /*!< Buffer busy. */
 #define B_LOCKED    0x0000010  /*!< Locked in memory. */
 #define B_DIRTY     0x0000020
+#define B_CACHED    0x0000040  /*!< Counted in the buffer cache size. */
 #define B_NOCOPY    0x0000100  /*!< Don't copy-on-write this buf. */
 #define B_NOSYNC    0x0001000  /*!< Never synch to the fs. */
 #define B_ASYNC     0x0002000  /*!< Start I/O but don't wait for completion. */
 #define B_DELWRI    0x0004000  /*!< Delayed write. */
+#define B_READ      0x0008000  /*!< Queued I/O is a read. */
 /* shmem */
 #define B_NOTSHARED 0x0010000  /*!< Don't share on fork() */
+#define B_PRIVATE   0x0020000  /*!< Demand paged pages are private copies. */
 #define B_NOCORE    0x0080000  /*!< Don't include in core dumps. */
 /* errors */
 #define B_IOERROR   0x1000000  /*!< IO Error. */
 
+/**
+ * Maximum number of read-ahead blocks started by bread().
+ */
+#define BIO_MAXRA   8
+
+/**
+ * Sector size used to round dirty ranges on write out.
+ */
+#define BIO_SECSIZE 512
+
+/**
+ * Maximum size of a coalesced write issued by the buffer cache flush.
+ */
+#define BIO_MAXCLUSTER  (64 * 1024)
+
 #define BUF_LOCK(bp)    mtx_lock(&(bp)->lock)
 #define BUF_UNLOCK(bp)  mtx_unlock(&(bp)->lock)
 
-int biobuf_compar(struct buf * a, struct buf * b);
-SPLAY_PROTOTYPE(bufhd_splay, buf, sentry_, biobuf_compar);
-
 /**
  * Read a block corresponding to vnode and blkno.
  * If the buffer is not found (i.e. the block is not cached in memory,
  * bread() calls getblk() to allocate a buffer with enough pages for
  * size and reads the specified disk block into it. The buffer returned
- * by bread() is marked as busy. (The B_BUSY  flag is set.) After manipulation
+ * by bread() is marked as busy. (The B_BUSY  flag is set.) If the access
+ * seems to be sequential bread() also starts read-ahead of the following
+ * blocks, see breadn(). After manipulation
  * of the buffer returned from bread(), the caller should unbusy it so that
  * another thread can get it. If the buffer contents are modified and should be
  * written back to disk, it should be unbusied using one of the variants of
@@ -172,17 +207,30 @@ int bread(vnode_t * vnode, size_t blkno, int size, struct buf ** bpp);
  * @param[in]   vnode   is a pointer to a vnode.
  * @param[in]   blkno   is a block number.
  * @param[in]   size    is the size to be read.
- * @param[in]   rablks
- * @param[in]   rasizes
- * @param[in]   nrablks
+ * @param[in]   rablks  is an array of block numbers to be read ahead.
+ * @param[in]   rasizes is an array of sizes of the read-ahead blocks.
+ * @param[in]   nrablks is the number of read-ahead blocks.
  * @param[out]  bpp     points to the returned buffer.
  * @return      Returns 0 if succeed; A negative errno if failed.
  */
 int  breadn(vnode_t * vnode, size_t blkno, int size, size_t rablks[],
             int rasizes[], int nrablks, struct buf ** bpp);
 
+/**
+ * Mark a range of a buffer dirty.
+ * The dirty range of a buffer grows to cover all marked ranges until the
+ * buffer is written out. Only the sectors covering the dirty range are
+ * written; if nothing has been marked the whole buffer is written.
+ * @param[in] buf   is the associated buffer.
+ * @param[in] off   is the offset of the modified range in the buffer.
+ * @param[in] len   is the length of the modified range.
+ */
+void bio_markdirty(struct buf * bp, size_t off, size_t len);
+
 /**
  * Write a block.
+ * Only the range marked with bio_markdirty() is written, or the whole
+ * buffer if nothing has been marked.
  * This will block until IO is complete.
  * @param[in] buf   is the associated buffer.
  * @return  0 if IO was complete; -EIO in case of IO error.
@@ -191,12 +239,16 @@ int bwrite(struct buf * bp);
 
 /**
  * Write a block asynchronously.
+ * The write is queued for the bio worker thread and the buffer is released
+ * when the write completes.
  * @param[in] buf   is the associated buffer.
  */
 void bawrite(struct buf * bp);
 
 /**
  * Delayed write.
+ * The buffer is written out by the buffer cache flush, where delayed writes
+ * to adjacent blocks of the same device are merged into one write.
  * @param[in] buf   is the associated buffer.
  */
 void bdwrite(struct buf * bp);
@@ -243,6 +295,13 @@ struct buf * geteblk_special(size_t size, uint32_t control)
  */
 struct buf * incore(vnode_t * vnode, size_t blkno);
 
+/**
+ * Release all cached buffers of a vnode.
+ * Delayed writes are written out before the buffers are freed.
+ * @param[in]   vnode   is a vnode pointer.
+ */
+void bio_vnode_cleanup(vnode_t * vnode);
+
 /**
  * Readin file backed buffer.
  * @param bp is the buffer.
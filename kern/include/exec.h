@@ -66,4 +66,56 @@ int exec_file(struct exec_loadfn * loader, int fildes,
               char name[PROC_NAME_SIZE], struct buf * env_bp,
               int uargc, uintptr_t uargv, uintptr_t uenvp);
 
+/**
+ * @addtogroup exec_text exec_text_get, exec_text_put, exec_text_purge_sb,
+ *             exec_text_purge_vnode
+ * Cache of loaded read-only text regions.
+ *
+ * Read-only sections of executables are cached by the file, the section
+ * offset in the file and the load address, so every process executing the
+ * same unmodified binary maps the same region.
+ * @{
+ */
+
+/**
+ * Get a cached text region.
+ * @param vnode is the executable file.
+ * @param offset is the offset of the section in the file.
+ * @param vaddr is the load address of the section.
+ * @param size is the size of the section.
+ * @return Returns a referenced region if a region was found and the file
+ *         hasn't been modified after the region was loaded; Otherwise NULL.
+ */
+struct buf * exec_text_get(struct vnode * vnode, off_t offset,
+                           uintptr_t vaddr, size_t size);
+
+/**
+ * Add a read-only text region to the cache.
+ * The cache takes its own reference to the region. Nothing is done if the
+ * same section is already cached.
+ */
+void exec_text_put(struct vnode * vnode, off_t offset, uintptr_t vaddr,
+                   size_t size, struct buf * region);
+
+/**
+ * Test if a region is held by the text cache.
+ * @return Returns 1 if the cache holds a reference to region; Otherwise 0.
+ */
+int exec_text_cached(struct buf * region);
+
+/**
+ * Remove all cached text regions of files in a file system.
+ */
+void exec_text_purge_sb(struct fs_superblock * sb);
+
+/**
+ * Remove the cached text regions of a file if it has no links left.
+ * Called on unlink so that the cache doesn't keep unlinked files alive.
+ */
+void exec_text_purge_vnode(struct vnode * vnode);
+
+/**
+ * @}
+ */
+
 #endif /* EXEC_H */
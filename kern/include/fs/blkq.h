@@ -0,0 +1,187 @@
+/**
+ *******************************************************************************
+ * @file    blkq.h
+ * @author  Olli Vanhoja
+ * @brief   Block device request queues.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/**
+ * @addtogroup fs
+ * @{
+ */
+
+/**
+ * @addtogroup blkq blkq_create, blkq_submit, blkq_rw
+ * Block device request queues.
+ *
+ * A block device driver can attach a request queue to its dev_info with
+ * blkq_create(). Requests submitted to the queue are kept sorted by the block
+ * number and dispatched in one direction (C-LOOK), and adjacent requests of
+ * the same direction are merged into a single multi-block transfer if the
+ * driver supports it. A queue can be plugged to collect requests before
+ * dispatching them.
+ *
+ * Requests are dispatched by the blkq worker thread or, for synchronous
+ * requests and before the worker is running, by the submitting thread.
+ * @{
+ */
+
+#pragma once
+#ifndef _FS_BLKQ_H_
+#define _FS_BLKQ_H_
+
+#include <sys/queue.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <klocks.h>
+#include <waitq.h>
+
+struct dev_info;
+struct blk_req;
+
+/**
+ * Max number of blocks transferred by a merged request.
+ */
+#define BLKQ_MAX_MERGE          128
+
+#define BLK_REQ_READ            0x01 /*!< Read request. */
+#define BLK_REQ_WRITE           0x02 /*!< Write request. */
+#define BLK_REQ_DONE            0x04 /*!< Set when the request is completed. */
+
+/**
+ * Request completion callback.
+ * Called by the dispatching thread after br_result is set. The callback
+ * must not submit new requests to the same device.
+ */
+typedef void blk_done_t(struct blk_req * req);
+
+/**
+ * Block I/O request.
+ */
+struct blk_req {
+    struct dev_info * br_dev;   /*!< Target device. */
+    off_t br_blkno;             /*!< First block. */
+    uint8_t * br_buf;           /*!< Kernel buffer. */
+    size_t br_bcount;           /*!< Transfer size in bytes. */
+    int br_flags;               /*!< BLK_REQ_ flags. */
+    int br_oflags;              /*!< Passed to the driver. */
+    ssize_t br_result;          /*!< Bytes transferred or a negative errno. */
+    blk_done_t * br_done;       /*!< Optional completion callback. */
+    void * br_arg;              /*!< Argument for the callback. */
+    struct timespec br_queued;  /*!< Submission time. */
+    TAILQ_ENTRY(blk_req) br_entry_;
+    struct blk_req * br_merged_; /*!< Next request merged to this one. */
+};
+
+/**
+ * Request queue of a block device.
+ */
+struct blk_queue {
+    struct dev_info * bq_dev;
+    mtx_t bq_lock;
+    TAILQ_HEAD(blk_req_list, blk_req) bq_reqs; /*!< Pending, sorted by blkno. */
+    off_t bq_pos;               /*!< Block after the last dispatch. */
+    unsigned bq_plugged;        /*!< Plug count. */
+    int bq_active;              /*!< Set while a thread is dispatching. */
+    int bq_kicked;              /*!< Set when the worker should run this. */
+    struct waitq bq_waitq;      /*!< Waiters for request completion. */
+    SLIST_ENTRY(blk_queue) bq_link_;
+
+    /* Stats */
+    unsigned bq_depth;          /*!< Number of pending requests. */
+    unsigned bq_max_depth;
+    unsigned bq_nr_reqs;
+    unsigned bq_nr_merged;
+    unsigned bq_nr_dispatched;  /*!< Number of driver calls. */
+    unsigned bq_lat_avg_us;     /*!< Moving average of request latency. */
+    unsigned bq_lat_max_us;
+
+    struct sysctl_oid * bq_sysctl_node;
+    struct sysctl_oid_list bq_sysctl_children;
+};
+
+/**
+ * Create a request queue for a device.
+ * The device name should be set before calling this function as it's used
+ * for the vfs.blkq.<dev_name> sysctl node.
+ * @param dev is a pointer to the device.
+ * @return Returns 0 if succeed; Otherwise a negative errno.
+ */
+int blkq_create(struct dev_info * dev);
+
+/**
+ * Destroy the request queue of a device.
+ * The queue must be empty.
+ */
+void blkq_destroy(struct dev_info * dev);
+
+/**
+ * Submit an asynchronous request.
+ * br_dev, br_blkno, br_buf, br_bcount, br_flags and br_oflags must be set
+ * by the caller. If the device has no queue the request is completed
+ * synchronously.
+ * @param req is a pointer to the request, it must stay valid until completed.
+ */
+void blkq_submit(struct blk_req * req);
+
+/**
+ * Wait for the completion of a request.
+ * @return Returns br_result of the request.
+ */
+ssize_t blkq_wait(struct blk_req * req);
+
+/**
+ * Synchronous block transfer through the request queue of a device.
+ * @param flags is either BLK_REQ_READ or BLK_REQ_WRITE.
+ * @return Returns the number of bytes transferred or a negative errno.
+ */
+ssize_t blkq_rw(struct dev_info * dev, int flags, off_t blkno,
+                uint8_t * buf, size_t bcount, int oflags);
+
+/**
+ * Plug the queue of a device.
+ * Asynchronous requests are held in the queue until the last plug is
+ * removed so they can be sorted and merged.
+ */
+void blkq_plug(struct dev_info * dev);
+
+/**
+ * Unplug the queue of a device and dispatch held requests.
+ */
+void blkq_unplug(struct dev_info * dev);
+
+#endif /* _FS_BLKQ_H_ */
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
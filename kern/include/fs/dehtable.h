@@ -41,35 +41,75 @@
 
 #include <fs/fs.h>
 
-#define DEHTABLE_SIZE 16
+/**
+ * log_2 of the initial and minimum number of buckets in a dh_table.
+ */
+#define DEHTABLE_MIN_ORDER      4
+#define DEHTABLE_MIN_SIZE       (1 << DEHTABLE_MIN_ORDER)
+
+/**
+ * Grow the table when there are more than DEHTABLE_MAX_LOAD entries per bucket
+ * on average.
+ */
+#define DEHTABLE_MAX_LOAD       2
+
+/**
+ * Shrink the table when there are less than one entry per DEHTABLE_MIN_LOAD
+ * buckets on average.
+ */
+#define DEHTABLE_MIN_LOAD       8
+
+/**
+ * Number of buckets migrated from the old bucket array on each modifying
+ * operation while a resize is in progress.
+ */
+#define DEHTABLE_REHASH_STEP    8
 
 /**
  * Directory entry.
  */
 typedef struct dh_dirent {
+    struct dh_dirent * dh_next; /*!< Next entry in the hash chain. */
+    uint32_t dh_hash; /*!< Keyed hash of dh_name. */
+    uint32_t dh_key; /*!< Bit reversed dh_hash, the iteration order key. */
     ino_t dh_ino; /*!< File serial number. */
     uint8_t dh_type; /*!< Dirent type. */
-    size_t dh_size; /*!< Size of this directory entry. */
-    uint8_t dh_link; /*!< Internal link tag. If 0 chain ends here; otherwise
-                      * chain linking continues. */
     char dh_name[1]; /*!< Name of the entry. */
 } dh_dirent_t;
 
 /**
- * Directory entry hash table array type.
+ * An array of hash chains.
+ */
+struct dh_buckets {
+    struct dh_dirent ** b_chain; /*!< Chain heads. */
+    size_t b_size; /*!< Number of chains, a power of two. */
+    unsigned b_order; /*!< log_2 b_size. */
+};
+
+/**
+ * Directory entry hash table.
+ * While a resize is in progress the entries are split between dh_new and
+ * dh_old, and every modifying operation moves a few of the remaining
+ * chains from dh_old to dh_new.
  */
 typedef struct dh_table {
-    uint32_t k[2];
-    struct dh_dirent * htable[DEHTABLE_SIZE];
+    uint32_t k[2]; /*!< SipHash key. */
+    size_t dh_nr_entries; /*!< Number of entries in the table. */
+    struct dh_buckets dh_new; /*!< The current bucket array. */
+    struct dh_buckets dh_old; /*!< The bucket array being drained. */
+    size_t dh_rehash_ind; /*!< Next chain of dh_old to be migrated. */
 } dh_table_t;
 
 /**
  * Directory iterator.
+ * Entries are returned in the order of dh_key, which doesn't depend on the
+ * current size of the table, so the pair (key, dup) stays valid as a
+ * position over resizes.
  */
 typedef struct dh_dir_iter {
     dh_table_t * dir;
-    size_t dea_ind;
-    size_t ch_ind;
+    uint32_t key; /*!< Key of the next entry to be returned. */
+    uint32_t dup; /*!< Index among the entries sharing the key. */
 } dh_dir_iter_t;
 
 /**
@@ -126,7 +166,7 @@ int dh_revlookup(dh_table_t * dir, ino_t ino, char * name, size_t name_len);
 
 /**
  * Get a dirent hashtable iterator.
- * @param is a directory entry hash table.
+ * @param dir is a directory entry hash table.
  * @return Returns a dent hash table iterator struct.
  */
 dh_dir_iter_t dh_get_iter(dh_table_t * dir);
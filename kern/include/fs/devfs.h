@@ -48,6 +48,8 @@
 #include <sys/types.h>
 #include <fs/fs.h>
 
+struct blk_queue;
+
 #define DEVFS_FSNAME            "devfs" /*!< Name of the devfs in vfs. */
 
 #define DEV_FLAGS_MB_READ       0x01 /*!< Supports multiple block read. */
@@ -66,6 +68,13 @@ struct dev_info {
 
     void * opt_data; /*!< Optional device data internal to the driver. */
 
+    /**
+     * Request queue of a block device.
+     * If set, dev_read() and dev_write() pass the transfers through the queue.
+     * @note Can be NULL.
+     */
+    struct blk_queue * blkq;
+
     ssize_t (*read)(struct dev_info * devnfo, off_t blkno,
                     uint8_t * buf, size_t bcount, int oflags);
     ssize_t (*write)(struct dev_info * devnfo, off_t blkno,
@@ -92,13 +92,15 @@
 struct cred;
 struct proc_info;
 struct statvfs;
+struct vm_pgcache;
 
 /*
  * Types for buffer pointer storage object in vnode.
  */
-SPLAY_HEAD(bufhd_splay, buf);
+LIST_HEAD(bufhd_list, buf);
 struct bufhd {
-    struct bufhd_splay sroot;
+    struct bufhd_list bh_list; /*!< Cached buffers of the vnode. */
+    size_t ra_next; /*!< Expected next blkno on sequential reads. */
 };
 
 typedef struct vnode {
@@ -125,10 +127,17 @@ typedef struct vnode {
      * Pointer to a buffer pointer storage object.
      * vn_bpo represents a set of buffers belonging to the same vnode where
      * different buffers cover different non-overlapping ranges of data
-     * within the vnode.
+     * within the vnode. Lookups are done through the global bio hash, this
+     * is only used to release the buffers of the vnode.
      */
     struct bufhd vn_bpo;
 
+    /**
+     * Page cache of the vnode.
+     * Set only while the vnode is memory mapped, see vm_pgcache_ref().
+     */
+    struct vm_pgcache * vn_pgcache;
+
     /**
      * Pointer to the super block of this vnode.
      * Superblock is representing the actual file system mount.
@@ -683,6 +692,28 @@ void fs_fildes_close_exec(struct proc_info * p);
  */
 int fs_fildes_isatty(int fd);
 
+/**
+ * Read from a file at an explicit offset.
+ * @param off   is a pointer to the offset, it's advanced by the number of
+ *              bytes read and the seek position of the file is not changed;
+ *              If NULL the seek position is used and updated.
+ * @return  Returns the number of bytes read;
+ *          Otherwise a negative errno code is returned.
+ */
+ssize_t fs_fildes_read_at(file_t * file, struct uio * uio, size_t count,
+                          off_t * off);
+
+/**
+ * Write to a file at an explicit offset.
+ * @param off   is a pointer to the offset, it's advanced by the number of
+ *              bytes written and the seek position of the file is not changed;
+ *              If NULL the seek position is used and updated.
+ * @return  Returns the number of bytes written;
+ *          Otherwise a negative errno code is returned.
+ */
+ssize_t fs_fildes_write_at(file_t * file, struct uio * uio, size_t count,
+                           off_t * off);
+
 /**
  * Allocate a files_t struct for storing file descriptors.
  * @param nrfiles is the maximum number of files open.
@@ -36,7 +36,7 @@
 #include <fcntl.h>
 #include <buf.h>
 #include <queue_r.h>
-#include <ksignal.h>
+#include <waitq.h>
 
 struct fs_queue_packet {
     size_t size;
@@ -54,8 +54,8 @@ struct fs_queue {
     size_t last_rd; /*!< peek offset if the read count is less that block size. */
     mtx_t wr_lock;
     mtx_t rd_lock;
-    struct signals * waiting4read;
-    struct signals * waiting4write;
+    struct waitq rd_waitq; /*!< Readers waiting for data. */
+    struct waitq wr_waitq; /*!< Writers waiting for free space. */
     struct fs_queue_packet packet[];
 };
 
@@ -0,0 +1,116 @@
+/**
+ *******************************************************************************
+ * @file    md.h
+ * @author  Olli Vanhoja
+ * @brief   Memory disks.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/**
+ * @addtogroup fs
+ * @{
+ */
+
+/**
+ * @addtogroup md md_create, md_destroy, md_load
+ * Memory disks.
+ * RAM backed block devices for benchmarking and testing the storage stack.
+ * A memory disk can optionally simulate the timings of a real device by
+ * delaying each transfer.
+ * @{
+ */
+
+#pragma once
+#ifndef _FS_MD_H_
+#define _FS_MD_H_
+
+#include <sys/md.h>
+#include <sys/queue.h>
+#include <sys/sysctl.h>
+#include <fs/devfs.h>
+
+struct buf;
+
+/**
+ * Memory disk descriptor.
+ */
+struct md_dev {
+    struct dev_info dev;
+    int md_unit;
+    size_t md_size;             /*!< Size in bytes. */
+    struct buf * md_buf;        /*!< Backing storage. */
+    vnode_t * md_vn;            /*!< Device file. */
+    unsigned md_lat_us;         /*!< Injected latency per transfer. */
+    unsigned md_blk_us;         /*!< Injected latency per block. */
+    off_t md_bad_blk;           /*!< Writes to this block fail, -1 if none. */
+    LIST_ENTRY(md_dev) md_entry_;
+
+    struct sysctl_oid * sysctl_node;
+    struct sysctl_oid_list sysctl_children;
+};
+
+/**
+ * Create a new memory disk /dev/mdN.
+ * The disk is zeroed and has no injected latency or bad blocks.
+ * @param size is the size of the disk in bytes, rounded up to MD_BLOCK_SIZE.
+ * @param[out] result returns a pointer to the new disk.
+ * @return Returns 0 if succeed; Otherwise a negative errno.
+ */
+int md_create(size_t size, struct md_dev ** result);
+
+/**
+ * Destroy a memory disk.
+ * The device file is removed and the memory is freed.
+ * @return Returns 0 if succeed; -EBUSY if the device file is open or a file
+ *         system is mounted on it.
+ */
+int md_destroy(struct md_dev * md);
+
+/**
+ * Get a memory disk by unit number.
+ * The returned pointer is not referenced, the caller must make sure the disk
+ * isn't destroyed while it's used.
+ */
+struct md_dev * md_get(int unit);
+
+/**
+ * Copy an image to the beginning of a memory disk.
+ * @param image is a pointer to a disk image, e.g. a FAT file system.
+ * @param len is the size of the image.
+ * @return Returns 0 if succeed; -EFBIG if the image doesn't fit to the disk.
+ */
+int md_load(struct md_dev * md, const void * image, size_t len);
+
+#endif /* _FS_MD_H_ */
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
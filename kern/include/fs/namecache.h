@@ -0,0 +1,134 @@
+/**
+ *******************************************************************************
+ * @file    namecache.h
+ * @author  Olli Vanhoja
+ * @brief   Directory name lookup cache.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/**
+ * @addtogroup fs
+ * @{
+ */
+
+/**
+ * @addtogroup namecache
+ * A global cache of (directory vnode, name) to vnode translations.
+ * Readers are lock-free and protected by RCU. Negative entries cache names
+ * that don't exist in a directory.
+ *
+ * The cache holds a reference to the directory and the target vnode of each
+ * entry, therefore callers modifying directories must purge the affected
+ * entries after the modification.
+ * @{
+ */
+
+#pragma once
+#ifndef FS_NAMECACHE_H
+#define FS_NAMECACHE_H
+
+#include <sys/types/_size_t.h>
+
+struct fs_superblock;
+struct vnode;
+
+/**
+ * Lookup a name from the name cache.
+ * @param dir is the directory vnode.
+ * @param name is the name of the entry, doesn't need to be nul-terminated.
+ * @param namelen is the length of name.
+ * @param[out] result returns a referenced vnode on a positive hit.
+ * @return Returns 0 on a positive hit;
+ *         -ENOENT on a negative hit;
+ *         -EAGAIN if the name is not in the cache.
+ */
+int namecache_lookup(struct vnode * dir, const char * name, size_t namelen,
+                     struct vnode ** result);
+
+/**
+ * Lookup a name from the name cache without taking a reference.
+ * The caller must hold the RCU read lock and the vnode returned on a
+ * positive hit is only guaranteed to stay valid until the lock is released.
+ * @param dir is the directory vnode.
+ * @param name is the name of the entry, doesn't need to be nul-terminated.
+ * @param namelen is the length of name.
+ * @param[out] result returns a borrowed vnode on a positive hit.
+ * @return Returns 0 on a positive hit;
+ *         -ENOENT on a negative hit;
+ *         -EAGAIN if the name is not in the cache.
+ */
+int namecache_lookup_rcu(struct vnode * dir, const char * name,
+                         size_t namelen, struct vnode ** result);
+
+/**
+ * Get the current generation of the name cache.
+ * The generation is incremented by every purge and must be read before
+ * looking up the name from the file system to be entered.
+ */
+unsigned namecache_gen(void);
+
+/**
+ * Enter a name to the name cache.
+ * The entry is silently dropped if the cache was purged after gen was read.
+ * @param dir is the directory vnode.
+ * @param name is the name of the entry.
+ * @param namelen is the length of name.
+ * @param vnode is the vnode found or NULL for a negative entry.
+ * @param gen is the generation returned by namecache_gen().
+ */
+void namecache_enter(struct vnode * dir, const char * name, size_t namelen,
+                     struct vnode * vnode, unsigned gen);
+
+/**
+ * Purge an entry from the name cache.
+ * @param dir is the directory vnode.
+ * @param name is the name of the entry.
+ * @param namelen is the length of name.
+ */
+void namecache_purge(struct vnode * dir, const char * name, size_t namelen);
+
+/**
+ * Purge all entries that refer to vnode either as a directory or a target.
+ */
+void namecache_purge_vnode(struct vnode * vnode);
+
+/**
+ * Purge all entries that belong to a superblock.
+ * All the vnode references held by the purged entries are released before
+ * this function returns.
+ */
+void namecache_purge_sb(struct fs_superblock * sb);
+
+#endif /* FS_NAMECACHE_H */
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
@@ -92,7 +92,9 @@ int ramfs_umount(struct fs_superblock * fs_sb);
 int ramfs_delete_vnode(struct vnode * vnode);
 
 /**
- * Resize the data section of a regular file.
+ * Truncate or extend a regular file to new_size bytes.
+ * Blocks past the new end of the file are freed and extending the file creates
+ * a hole that reads as zeroes.
  */
 int ramfs_set_filesize(vnode_t * vnode, off_t new_size);
 
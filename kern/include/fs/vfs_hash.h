@@ -86,6 +86,7 @@ int vfs_hash_rehash(vfs_hash_ctx_t ctx, struct vnode * vp, size_t hash)
 
 /**
  * Remove a vnode from the hashmap of a vfs_hash context.
+ * Removing a vnode that is not in the hashmap does nothing.
  * @retval -EINVAL if cid is invalid.
  */
 int vfs_hash_remove(vfs_hash_ctx_t ctx, struct vnode * vp)
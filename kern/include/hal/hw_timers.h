@@ -65,4 +65,11 @@ typedef void timer_task_t(void);
  */
 void hw_timers_run(void);
 
+/**
+ * Set the delay to the next scheduling timer interrupt.
+ * The timer continues at configSCHED_HZ after the next interrupt.
+ * @param usec is the delay to the next tick in usec.
+ */
+void hw_timers_set_next_tick(uint32_t usec);
+
 #endif /* HW_TIMERS_H */
@@ -57,4 +57,14 @@ struct _idle_task_desc _idle_task_##_fun_ = {   \
 };                                              \
 DATA_SET(_idle_tasks, _idle_task_##_fun_)
 
+#ifdef configSCHED_TICKLESS
+/**
+ * Restart the periodic scheduler tick if it was stopped by the idle thread.
+ * Must be called when a thread becomes ready for execution.
+ */
+void idle_restart_tick(void);
+#else
+#define idle_restart_tick() do { } while (0)
+#endif
+
 #endif /* IDLE_H */
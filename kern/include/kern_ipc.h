@@ -51,4 +51,40 @@ int fs_pipe_curproc_creat(struct files_struct * files, int fildes[2],
  */
 int fs_pipe_destroy(vnode_t * vnode);
 
+/**
+ * Test if file is an end of a pipe.
+ */
+int fs_pipe_isfile(file_t * file);
+
+#define PIPE_SPLICE_NONBLOCK    0x01 /*!< Don't block on the pipe. */
+#define PIPE_SPLICE_PEEK        0x02 /*!< Don't consume the data spliced out. */
+
+/**
+ * Splice data from a file to a pipe.
+ * The source file reads directly into the pipe buffer.
+ * @param file is the write end of the pipe.
+ * @param src is the source file.
+ * @param src_off is the offset in src, or NULL to use the seek position of src.
+ * @param count is the maximum number of bytes to move.
+ * @param flags is a combination of PIPE_SPLICE_ flags.
+ * @return Returns the number of bytes moved;
+ *         Otherwise a negative errno is returned.
+ */
+ssize_t fs_pipe_splice_in(file_t * file, file_t * src, off_t * src_off,
+                          size_t count, int flags);
+
+/**
+ * Splice data from a pipe to a file.
+ * The destination file writes directly from the pipe buffer.
+ * @param file is the read end of the pipe.
+ * @param dst is the destination file.
+ * @param dst_off is the offset in dst, or NULL to use the seek position of dst.
+ * @param count is the maximum number of bytes to move.
+ * @param flags is a combination of PIPE_SPLICE_ flags.
+ * @return Returns the number of bytes moved;
+ *         Otherwise a negative errno is returned.
+ */
+ssize_t fs_pipe_splice_out(file_t * file, file_t * dst, off_t * dst_off,
+                           size_t count, int flags);
+
 #endif /* KERN_IPC_H */
@@ -0,0 +1,197 @@
+/**
+ *******************************************************************************
+ * @file    kmem_cache.h
+ * @author  Olli Vanhoja
+ * @brief   Named object caches.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/**
+ * @addtogroup kmem_cache
+ * Object caching allocator.
+ * A kmem_cache hands out fixed size objects carved from growable slabs.
+ * Objects are constructed once when a slab is carved and returned to the
+ * cache in a constructed state, so the constructor cost is not paid again on
+ * reuse. Each CPU has a small magazine of free objects that is accessed
+ * without taking the cache lock.
+ * @{
+ */
+
+#pragma once
+#ifndef KMEM_CACHE_H
+#define KMEM_CACHE_H
+
+#include <stddef.h>
+#include <machine/atomic.h>
+#include <sys/linker_set.h>
+#include <sys/sysctl.h>
+#include <klocks.h>
+#include <ksched.h>
+
+/**
+ * Number of objects in a per CPU magazine.
+ */
+#define KMEM_MAGAZINE_SIZE  8
+
+/**
+ * Object constructor.
+ * Called once for each object when a new slab is carved.
+ */
+typedef void kmem_cache_ctor_t(void * obj);
+
+/**
+ * Object destructor.
+ * Called for each free object when the cache is destroyed.
+ */
+typedef void kmem_cache_dtor_t(void * obj);
+
+/**
+ * Per CPU magazine of free objects.
+ */
+struct kmem_magazine {
+    unsigned rounds;
+    void * objs[KMEM_MAGAZINE_SIZE];
+};
+
+struct kmem_slab;
+
+/**
+ * Object cache descriptor.
+ */
+struct kmem_cache {
+    const char * name;
+    size_t size;                /*!< Object size. */
+    size_t align;               /*!< Object alignment. */
+    size_t stride;              /*!< Object slot size in a slab. */
+    kmem_cache_ctor_t * ctor;
+    kmem_cache_dtor_t * dtor;
+    unsigned flags;
+
+    mtx_t lock;                 /*!< Lock for the depot and slabs. */
+    void * depot;               /*!< Free objects not in any magazine. */
+    struct kmem_slab * slabs;   /*!< All slabs of this cache. */
+    struct kmem_magazine mag[KSCHED_CPU_COUNT];
+
+    /* Stats */
+    unsigned nr_total;          /*!< Number of objects carved. */
+    atomic_t nr_live;           /*!< Number of objects currently allocated. */
+    unsigned nr_peak;           /*!< Peak value of nr_live. */
+
+    struct sysctl_oid * sysctl_node;
+    struct sysctl_oid_list sysctl_children;
+};
+
+#define KMEM_CACHE_DYNAMIC  0x01 /*!< Created with kmem_cache_create(). */
+
+/**
+ * Get the object alignment used by the cache.
+ */
+#define KMEM_CACHE_ALIGN(_align_) \
+    ((_align_) ? (_align_) : sizeof(void *))
+
+#define KMEM_CACHE_ROUNDUP(_x_, _a_) \
+    (((_x_) + (_a_) - 1) & ~((_a_) - 1))
+
+/**
+ * Calculate the slot size of an object in a slab.
+ * The slot contains the object and a link, stored in the last word of the
+ * slot, used when the object is free.
+ */
+#define KMEM_CACHE_STRIDE(_size_, _align_)                                  \
+    KMEM_CACHE_ROUNDUP(KMEM_CACHE_ROUNDUP((_size_), sizeof(void *)) +       \
+                       sizeof(void *), KMEM_CACHE_ALIGN(_align_))
+
+/**
+ * Static kmem_cache initializer.
+ */
+#define KMEM_CACHE_INITIALIZER(_name_, _size_, _align_, _ctor_, _dtor_) { \
+    .name = _name_,                                                     \
+    .size = (_size_),                                                   \
+    .align = KMEM_CACHE_ALIGN(_align_),                                 \
+    .stride = KMEM_CACHE_STRIDE(_size_, _align_),                       \
+    .ctor = (_ctor_),                                                   \
+    .dtor = (_dtor_),                                                   \
+    .lock = MTX_INITIALIZER(MTX_TYPE_TICKET, 0),                        \
+}
+
+/**
+ * Define a statically allocated object cache.
+ * The cache is available immediately, even before kernel initializers have
+ * been executed, and it's accessible as kmem_cache_<name>.
+ * @param _name_ is the name of the cache.
+ * @param _size_ is the object size.
+ * @param _align_ is the object alignment, 0 for the default alignment.
+ * @param _ctor_ is an optional object constructor.
+ * @param _dtor_ is an optional object destructor.
+ */
+#define KMEM_CACHE(_name_, _size_, _align_, _ctor_, _dtor_)             \
+    struct kmem_cache kmem_cache_##_name_ =                             \
+        KMEM_CACHE_INITIALIZER(#_name_, _size_, _align_, _ctor_, _dtor_); \
+    DATA_SET(kmem_cache_set, kmem_cache_##_name_)
+
+/**
+ * Create a new object cache.
+ * @param name is the name of the cache, shown under vm.kmem_cache.
+ * @param size is the object size.
+ * @param align is the object alignment, must be a power of two or 0 for
+ *              the default alignment.
+ * @param ctor is an optional object constructor.
+ * @param dtor is an optional object destructor.
+ * @return Returns a pointer to the new cache; NULL if out of memory.
+ */
+struct kmem_cache * kmem_cache_create(const char * name, size_t size,
+                                      size_t align, kmem_cache_ctor_t * ctor,
+                                      kmem_cache_dtor_t * dtor);
+
+/**
+ * Destroy an object cache created with kmem_cache_create().
+ * All objects must have been returned to the cache before calling this
+ * function.
+ * @param cache is a pointer to the cache.
+ */
+void kmem_cache_destroy(struct kmem_cache * cache);
+
+/**
+ * Allocate a constructed object from a cache.
+ * @param cache is a pointer to the cache.
+ * @return Returns a pointer to an object; NULL if out of memory.
+ */
+void * kmem_cache_alloc(struct kmem_cache * cache);
+
+/**
+ * Return an object to its cache.
+ * The object must be in a constructed state when it's returned.
+ * @param cache is a pointer to the cache.
+ * @param obj is a pointer to the object.
+ */
+void kmem_cache_free(struct kmem_cache * cache, void * obj);
+
+#endif /* KMEM_CACHE_H */
+
+/**
+ * @}
+ */
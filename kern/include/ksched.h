@@ -78,6 +78,15 @@ struct scheduler {
      * @return  Number of threads scheduled in the context of sobj.
      */
     unsigned (*get_nr_active_threads)(struct scheduler * sobj);
+    /**
+     * Remove a thread from the run queue of this scheduler.
+     * Called when a thread inserted to this scheduler becomes blocked or
+     * dead, so the scheduler doesn't need to find it lazily.
+     * @note Can be null.
+     * @param sobj is a pointer to the scheduling object.
+     * @param thread is a pointer to the thread to be removed.
+     */
+    void (*remove)(struct scheduler * sobj, struct thread_info * thread);
 };
 
 /**
@@ -146,6 +155,13 @@ void sched_get_loads(uint32_t loads[3]);
 
 void sched_handler(void);
 
+/**
+ * Remove a thread from the run queue of the scheduler it was inserted to.
+ * This is called when the state of a thread changes to blocked or dead.
+ * @param thread is a pointer to the thread.
+ */
+void sched_runq_remove(struct thread_info * thread);
+
 #endif /* KSCHED_H */
 
 /**
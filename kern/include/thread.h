@@ -104,6 +104,8 @@ enum {
  */
 #define TMNOVAL (-1)
 
+struct scheduler;
+
 /**
  * Thread state info struct.
  * Thread Control Block structure.
@@ -113,6 +115,7 @@ struct thread_info {
     uint32_t flags;                 /*!< Status flags. */
     pid_t pid_owner;                /*!< Owner process of this thread. */
     char name[16];                  /*!< Thread name. */
+    atomic_t refcount;              /*!< Reference count of this struct. */
 
     /**
      * Scheduler data.
@@ -124,6 +127,8 @@ struct thread_info {
         int ts_counter;             /*!< Thread time slice counter;
                                      *   Set to -1 if not used. */
         mtx_t tdlock;               /*!< Lock for data in this substruct. */
+        struct scheduler * sobj;    /*!< Scheduler object the thread was
+                                     *   last inserted to. */
         RB_ENTRY(thread_info) ttentry_; /*!< Thread table entry. */
         STAILQ_ENTRY(thread_info) readyq_entry_;
 
@@ -136,8 +141,17 @@ struct thread_info {
             } fifo;
             /* RR policy */
             struct thread_sched_rr {
+                int prio;           /*!< Run queue index. */
                 TAILQ_ENTRY(thread_info) runq_entry_;
             } rr;
+            /* Fair policy */
+            struct thread_sched_fair {
+                uint64_t vruntime;  /*!< Weighted virtual runtime. */
+                uint32_t weight;    /*!< Weight by the nice value. */
+                int ts_last;        /*!< ts_counter at the last charge. */
+                RB_ENTRY(thread_info) runq_entry_;
+                TAILQ_ENTRY(thread_info) deadq_entry_;
+            } fair;
         };
     } sched;
     struct sched_param param;       /*!< Scheduling parameters set by user. */
@@ -58,8 +58,20 @@
 
 typedef int timers_flags_t;
 
+/**
+ * timers_next_expiry() return value if no timer is enabled.
+ */
+#define TIMERS_NO_EXPIRY UINT64_MAX
+
 void timers_run(void);
 
+/**
+ * Get the expiration time of the next enabled timer.
+ * @return Returns the absolute expiration time in usec as returned by
+ *         get_utime(); TIMERS_NO_EXPIRY if no timer is enabled.
+ */
+uint64_t timers_next_expiry(void);
+
 /**
  * Allocate a new timer
  * @param thread_id thread id to add this timer for.
@@ -52,6 +52,7 @@ struct uio {
     __user void * ubuf;
     struct proc_info * proc;
     size_t bufsize;
+    __kernel void * bounce; /*!< Bounce buffer allocated by uio_kmap(). */
 };
 
 /**
@@ -101,14 +102,33 @@ int uio_copyout(const void * src, struct uio * uio, size_t offset,
 int uio_copyin(struct uio * uio, void * dst, size_t offset, size_t size);
 
 /**
- * Get UIO kernel address.
+ * Get a contiguous kernel address of a UIO buffer.
+ * User pages are faulted in and if rw contains VM_PROT_WRITE copy-on-write
+ * is broken. A bounce buffer is used if the user buffer is not contiguous
+ * in kernel space, e.g. it's demand paged. The buffer is filled from the
+ * user buffer if rw contains VM_PROT_READ. uio_kunmap() must be always
+ * called after the buffer has been accessed.
  * @param uio is a pointer to the UIO descriptor.
- * @param[out] addr returns a kernel mapped address of the UIO buffer.
+ * @param size is the number of bytes accessed.
+ * @param rw is VM_PROT_READ if the buffer is read and VM_PROT_WRITE if
+ *           it's written.
+ * @param[out] addr returns a kernel address of the UIO buffer.
  * @return  Returns 0 if succeed;
  *          Otherwise a negative errno is returned and the value of addr is
  *          invalid.
  */
-int uio_get_kaddr(struct uio * uio, __kernel void ** addr);
+int uio_kmap(struct uio * uio, size_t size, int rw, __kernel void ** addr);
+
+/**
+ * Release a kernel address returned by uio_kmap().
+ * If a bounce buffer was used the bytes written to it are copied to the
+ * user buffer.
+ * @param uio is a pointer to the UIO descriptor.
+ * @param addr is the address returned by uio_kmap().
+ * @param len is the number of bytes written to addr.
+ * @return  Returns 0 if succeed; Otherwise a negative errno code.
+ */
+int uio_kunmap(struct uio * uio, __kernel void * addr, size_t len);
 
 #endif /* UIO_H */
 
@@ -195,6 +195,23 @@ __kernel void * vm_uaddr2kaddr(struct proc_info * proc,
                                __user const void * uaddr,
                                size_t acc_size);
 
+/**
+ * Get a kernel address of a user space range that is contiguous in kernel
+ * space.
+ * Demand paged pages of the range are faulted in and if write is set
+ * copy-on-write is broken.
+ * @note This function doesn't check if the process has access to the range.
+ * @param proc      is a pointer to the process.
+ * @param uaddr     is the user space address in context of proc.
+ * @param len       is the length of the range.
+ * @param write     tells whether the range will be written.
+ * @return Returns a pointer in kernel space; NULL if the range can't be
+ *         accessed or it's not contiguous in kernel space.
+ */
+__kernel void * vm_uaddr2kaddr_range(struct proc_info * proc,
+                                     __user const void * uaddr, size_t len,
+                                     int write);
+
 /**
  * @addtogroup copy copyin, copyout, copyinstr
  * Kernel copy functions.
@@ -405,6 +422,82 @@ int vm_unload_regions(struct proc_info * proc, int start, int end);
  */
 void vm_fixmemmap_proc(struct proc_info * proc);
 
+/**
+ * @addtogroup vm_cow vm_cow_fault, vm_cow_finish, vm_cow_detach
+ * Page granular copy-on-write.
+ *
+ * A write to a shared copy-on-write region creates a private demand paged
+ * region for the process but only the written page is allocated and copied.
+ * The pages not yet copied are kept mapped read-only from the shared region
+ * and each one of them is copied on the first write access. If the process is the last user of a
+ * copy-on-write region the region is just made writable.
+ * @{
+ */
+
+/**
+ * Resolve a copy-on-write fault.
+ * @param proc is the process.
+ * @param vaddr is the faulting address.
+ * @return Zero if succeed; Otherwise a negative errno.
+ */
+int vm_cow_fault(struct proc_info * proc, uintptr_t vaddr);
+
+/**
+ * Copy all the remaining pages of a partially copied region.
+ * Mappings of the region are not updated, so the caller must remap the
+ * region if the owner process continues running.
+ * @param region is a vm region buffer.
+ * @return Zero if succeed; Otherwise a negative errno.
+ */
+int vm_cow_finish(struct buf * region);
+
+/**
+ * Release the copy-on-write source of a region that is being freed.
+ * @param region is a vm region buffer.
+ */
+void vm_cow_detach(struct buf * region);
+
+/**
+ * @}
+ */
+
+/**
+ * @addtogroup vm_page_fault vm_page_fault, vm_page_fault_range
+ * Demand paging of page cache regions.
+ *
+ * The pages of a region created by vm_pgcache_newregion() are mapped
+ * on the first access. A page is first mapped read-only and it's made
+ * writable on the first write access, so the page cache knows which pages
+ * need to be synced.
+ * @{
+ */
+
+/**
+ * Resolve a page fault on a demand paged region.
+ * @param proc is the process.
+ * @param vaddr is the faulting address.
+ * @param write tells whether the page should be mapped writable.
+ * @return Zero if succeed; Otherwise a negative errno.
+ */
+int vm_page_fault(struct proc_info * proc, uintptr_t vaddr, int write);
+
+/**
+ * Fault in the demand paged pages of a user space address range.
+ * @param proc is the process.
+ * @param uaddr is the start of the range.
+ * @param len is the length of the range.
+ * @param write tells whether the pages should be mapped writable.
+ * @return  Returns a positive value if the range contains demand paged pages;
+ *          Zero if the range doesn't contain any demand paged pages;
+ *          Otherwise a negative errno.
+ */
+int vm_page_fault_range(struct proc_info * proc, uintptr_t uaddr, size_t len,
+                        int write);
+
+/**
+ * @}
+ */
+
 /**
  * @addtogroup useracc kernacc, useracc, useracc_proc
  * Check memory regions for accessibility.
@@ -0,0 +1,160 @@
+/**
+ *******************************************************************************
+ * @file    vm_pgcache.h
+ * @author  Olli Vanhoja
+ * @brief   Per-vnode page cache.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/**
+ * @addtogroup vm_pgcache vm_pgcache_ref, vm_pgcache_unref, vm_pgcache_getpage
+ * Per-vnode page cache.
+ *
+ * The page cache holds page sized copies of a regular file that are shared
+ * by every MAP_SHARED mapping of the file and by read() while the file is
+ * mapped. Pages are read in on demand when a process faults on a mapping
+ * and writable mappings are tracked page by page, so only the pages that
+ * were actually written are synced back to the file.
+ * @{
+ */
+
+#pragma once
+#ifndef _VM_VM_PGCACHE_H
+#define _VM_VM_PGCACHE_H
+
+#include <sys/types.h>
+#include <bitmap.h>
+
+struct buf;
+struct file;
+struct uio;
+struct vnode;
+struct vm_pgcache;
+
+/**
+ * Size of the writable pages bitmap of a demand paged region in bytes.
+ */
+#define VM_PGCACHE_MAPSIZE(region) \
+    ((E2BITMAP_SIZE((region)->b_mmu.num_pages) + 1) * sizeof(bitmap_t))
+
+/**
+ * Get a reference to the page cache of a vnode.
+ * @param vnode is a pointer to the vnode.
+ * @param creat tells whether a new page cache should be created if the vnode
+ *              doesn't have one yet.
+ * @return  Returns a pointer to the page cache;
+ *          Returns NULL if the vnode doesn't have a page cache and creat
+ *          wasn't set or the allocation failed.
+ */
+struct vm_pgcache * vm_pgcache_ref(struct vnode * vnode, int creat);
+
+/**
+ * Release a reference to a page cache.
+ * Dirty pages are written back and the pages are freed when the last
+ * reference is released.
+ * @param pgc is a pointer to the page cache.
+ */
+void vm_pgcache_unref(struct vm_pgcache * pgc);
+
+/**
+ * Get a page of a page cache.
+ * The page is read in from the file if it's not in the cache yet, the part
+ * of the page beyond the end of the file is zeroed.
+ * @param pgc is a pointer to the page cache.
+ * @param pgno is the page number in the file.
+ * @param[out] bpp returns a referenced page; The reference must be released
+ *                 with bpp->vm_ops->rfree().
+ * @return Returns 0 if succeed; Otherwise a negative errno.
+ */
+int vm_pgcache_getpage(struct vm_pgcache * pgc, size_t pgno,
+                       struct buf ** bpp);
+
+/**
+ * Create a new demand paged memory region of a page cache.
+ * The pages of the region are mapped from the page cache when a process
+ * faults on them, see vm_page_fault().
+ * @param pgc is a pointer to the page cache.
+ * @param pgno is the page number of the first page of the region in the file.
+ * @param size is the size of the region in bytes.
+ * @return Returns a pointer to the new region; Otherwise NULL.
+ */
+struct buf * vm_pgcache_newregion(struct vm_pgcache * pgc, size_t pgno,
+                                  size_t size);
+
+/**
+ * Create a new private demand paged memory region.
+ * A page of the region is a private copy of the corresponding page of the
+ * file made on the first access, pages from filelen onwards are zero
+ * filled. The region is marked with B_PRIVATE.
+ * @param pgc is a pointer to the page cache; Can be NULL if filelen is zero.
+ * @param pgno is the page number of the first page of the region in the file.
+ * @param size is the size of the region in bytes.
+ * @param filelen is the offset in the region where the file data ends.
+ * @return Returns a pointer to the new region; Otherwise NULL.
+ */
+struct buf * vm_pgcache_newpriv(struct vm_pgcache * pgc, size_t pgno,
+                                size_t size, size_t filelen);
+
+/**
+ * Get a page for a demand paged region.
+ * @param region is a region created by vm_pgcache_newregion() or
+ *               vm_pgcache_newpriv().
+ * @param page is the page number in the region.
+ * @param[out] bpp returns a referenced page.
+ * @return Returns 0 if succeed; Otherwise a negative errno.
+ */
+int vm_pgcache_regionpage(struct buf * region, size_t page,
+                          struct buf ** bpp);
+
+/**
+ * Read from a file through its page cache.
+ * Same as vnode read() except that file->vnode must have a page cache pgc.
+ */
+ssize_t vm_pgcache_read(struct vm_pgcache * pgc, struct file * file,
+                        struct uio * uio, size_t count);
+
+/**
+ * Write to a file and update its page cache.
+ * The data is written through to the file and the cached pages covering
+ * the written range are updated.
+ * Same as vnode write() except that file->vnode must have a page cache pgc.
+ */
+ssize_t vm_pgcache_write(struct vm_pgcache * pgc, struct file * file,
+                         struct uio * uio, size_t count);
+
+/**
+ * Write back the dirty pages of all page caches.
+ * Pages written through a mapping since the previous sync are made read-only
+ * again so the next write to them will mark them dirty.
+ */
+void vm_pgcache_sync_all(void);
+
+#endif /* _VM_VM_PGCACHE_H */
+
+/**
+ * @}
+ */
@@ -0,0 +1,142 @@
+/**
+ *******************************************************************************
+ * @file    waitq.h
+ * @author  Olli Vanhoja
+ * @brief   Kernel wait queues.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/**
+ * @addtogroup waitq waitq_prepare, waitq_sleep, waitq_wakeup_one
+ * Kernel wait queues.
+ *
+ * A wait queue is a list of threads sleeping until some condition changes.
+ * A waiter is queued with waitq_prepare() before the condition is tested.
+ * A wakeup marks the entry as woken under the queue lock and waitq_sleep()
+ * only blocks if the mark is clear, so a wakeup made after the test can't be
+ * lost:
+ *
+ * @code
+ * struct waitq_entry we;
+ *
+ * waitq_prepare(&wq, &we);
+ * while (!condition) {
+ *     waitq_sleep(&wq, &we);
+ * }
+ * waitq_finish(&wq, &we);
+ * @endcode
+ *
+ * The thread changing the condition calls waitq_wakeup_one() or
+ * waitq_wakeup_all() after the change is visible. Wakeups can be spurious,
+ * for example a signal wakes the thread, so the condition must be always
+ * tested again.
+ * @{
+ */
+
+#pragma once
+#ifndef _WAITQ_H_
+#define _WAITQ_H_
+
+#include <sys/queue.h>
+#include <sys/types_pthread.h>
+#include <klocks.h>
+
+/**
+ * A thread waiting on a wait queue.
+ * Usually allocated from the stack of the waiting thread.
+ */
+struct waitq_entry {
+    pthread_t tid;
+    int queued;                     /*!< Set while in the queue. */
+    int woken;                      /*!< Set by a wakeup. */
+    STAILQ_ENTRY(waitq_entry) entry_;
+};
+
+/**
+ * Wait queue descriptor.
+ */
+struct waitq {
+    mtx_t wq_lock;
+    STAILQ_HEAD(waitq_head, waitq_entry) wq_head;
+};
+
+/**
+ * Static initializer for a wait queue.
+ */
+#define WAITQ_INITIALIZER(_wq_) {                                   \
+    .wq_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DINT),        \
+    .wq_head = STAILQ_HEAD_INITIALIZER((_wq_).wq_head),             \
+}
+
+/**
+ * Initialize a wait queue.
+ */
+void waitq_init(struct waitq * wq);
+
+/**
+ * Queue the current thread to a wait queue.
+ * Does nothing if we is already queued.
+ * @param wq is a pointer to the wait queue.
+ * @param we is a pointer to the wait queue entry of the current thread.
+ */
+void waitq_prepare(struct waitq * wq, struct waitq_entry * we);
+
+/**
+ * Sleep until woken up.
+ * The current thread is queued again if it was removed from the queue by a
+ * wakeup, so waitq_sleep() can be called in a loop.
+ */
+void waitq_sleep(struct waitq * wq, struct waitq_entry * we);
+
+/**
+ * Remove the current thread from a wait queue.
+ */
+void waitq_finish(struct waitq * wq, struct waitq_entry * we);
+
+/**
+ * Sleep on a wait queue releasing a mutex.
+ * Works like a condition variable; mtx must be locked by the caller and it's
+ * locked again before returning. The condition must be changed only while
+ * holding mtx.
+ */
+void waitq_sleep_mtx(struct waitq * wq, mtx_t * mtx);
+
+/**
+ * Wakeup the first thread waiting on a wait queue.
+ */
+void waitq_wakeup_one(struct waitq * wq);
+
+/**
+ * Wakeup all threads waiting on a wait queue.
+ */
+void waitq_wakeup_all(struct waitq * wq);
+
+#endif /* _WAITQ_H_ */
+
+/**
+ * @}
+ */
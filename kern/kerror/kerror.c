@@ -39,6 +39,7 @@
 #include <hal/uart.h>
 #include <kerror.h>
 #include <kinit.h>
+#include <kmalloc.h>
 #include <kstring.h>
 #include <libkern.h>
 
@@ -145,13 +146,21 @@ void _kerror_panic(const char * where, const char * msg)
  */
 static ssize_t kerror_fdwrite(file_t * file, struct uio * uio, size_t count)
 {
-    void * buf;
+    char * buf;
     int err;
 
-    err = uio_get_kaddr(uio, &buf);
-    if (err)
+    buf = kmalloc(count + 1);
+    if (!buf)
+        return -ENOMEM;
+
+    err = uio_copyin(uio, buf, 0, count);
+    if (err) {
+        kfree(buf);
         return err;
+    }
+    buf[count] = '\0';
     kputs(buf);
+    kfree(buf);
 
     return count;
 }
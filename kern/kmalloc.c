@@ -31,9 +31,12 @@
  */
 
 #include <machine/atomic.h>
+#include <errno.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/queue.h>
 #include <sys/sysctl.h>
+#include <bitmap.h>
 #include <dynmem.h>
 #include <hal/core.h>
 #include <hal/mmu.h>
@@ -50,6 +53,8 @@
  */
 #define KM_SIGNATURE_VALID      0XBAADF00D /*!< a valid mblock entry. */
 #define KM_SIGNATURE_INVALID    0xDEADF00D /*!< an invalid mblock entry. */
+#define KM_SIGNATURE_SLAB       0xBAADC000 /*!< a slab object, class in LSBs. */
+#define KM_SIGNATURE_SLAB_MASK  0xFFFFFF00
 
 /**
  * kmalloc statistics strcut.
@@ -86,6 +91,146 @@ SYSCTL_INT(_vm_kmalloc, OID_AUTO, fragm_rat, CTLFLAG_RD,
         &fragm_ratio, 0, "Fragmentation percentage");
 #endif
 
+/*
+ * Slab front end.
+ *
+ * Small allocations are served from per size class slab pages. The pages
+ * are carved from dynmem sections reserved for the slab arena. A page is
+ * returned to the arena once all of its objects are freed and a section is
+ * returned to dynmem once all of its pages are free. Larger allocations fall
+ * back to the mblock allocator.
+ */
+
+/**
+ * Size of a slab page carved from an arena section.
+ */
+#define KM_SLAB_PAGE_SIZE       4096
+
+/**
+ * Number of slab pages in a single dynmem section.
+ */
+#define KM_SLAB_PAGES_PER_SECT  (DYNMEM_PAGE_SIZE / KM_SLAB_PAGE_SIZE)
+
+/**
+ * Number of dynmem sections that may belong to the slab arena.
+ */
+#define KM_SLAB_NSECT           (configDYNMEM_SIZE / DYNMEM_PAGE_SIZE)
+
+/**
+ * Slab size classes.
+ * X(class_index, object_size), object_size includes the object header.
+ */
+#define KM_SLAB_CLASSES(X)  \
+    X(0, 32)                \
+    X(1, 64)                \
+    X(2, 128)               \
+    X(3, 256)               \
+    X(4, 512)               \
+    X(5, 1024)              \
+    X(6, 2048)
+
+#define KM_SLAB_CLASS_COUNT(_i_, _size_) + 1
+#define KM_SLAB_NR_CLASSES  (0 KM_SLAB_CLASSES(KM_SLAB_CLASS_COUNT))
+
+/**
+ * Slab object descriptor.
+ */
+typedef struct kmslab_obj {
+    unsigned signature;     /*!< KM_SIGNATURE_SLAB | class index. */
+    atomic_t refcount;      /*!< Ref count. */
+    char data[];            /*!< Next free object pointer when free. */
+} kmslab_obj_t;
+
+#define KM_SLAB_HDR_SIZE    (sizeof(kmslab_obj_t))
+
+/**
+ * Largest allocation served by the slab front end.
+ */
+#define KM_SLAB_MAX         (2048 - KM_SLAB_HDR_SIZE)
+
+/**
+ * Slab page descriptor.
+ * The first slab page of an arena section holds the descriptors of all the
+ * pages in the section, so a descriptor is at most
+ * KM_SLAB_PAGE_SIZE / KM_SLAB_PAGES_PER_SECT bytes. The descriptor of the
+ * first page counts the pages of the section that are in use.
+ */
+struct kmslab_page {
+    LIST_ENTRY(kmslab_page) link; /*!< Arena free list or class partial list. */
+    kmslab_obj_t * free;    /*!< Freelist of objects in the page. */
+    uint16_t inuse;         /*!< Number of objects or pages in use. */
+};
+
+LIST_HEAD(kmslab_page_list, kmslab_page);
+
+/**
+ * Slab size class descriptor.
+ */
+struct kmslab_class {
+    mtx_t lock;
+    size_t obj_size;        /*!< Object size including header. */
+    struct kmslab_page_list partial; /*!< Pages with free objects. */
+    /* Stats */
+    unsigned hits;          /*!< Allocations served from a partial page. */
+    unsigned misses;        /*!< Allocations that required a new slab page. */
+    unsigned inuse;         /*!< Number of objects currently allocated. */
+    unsigned total;         /*!< Number of objects carved for this class. */
+};
+
+#define KM_SLAB_CLASS_INIT(_i_, _size_)                         \
+    [_i_] = {                                                   \
+        .lock = MTX_INITIALIZER(MTX_TYPE_TICKET, 0),            \
+        .obj_size = _size_,                                     \
+        .partial = LIST_HEAD_INITIALIZER(partial),              \
+    },
+
+static struct kmslab_class kmslab_classes[KM_SLAB_NR_CLASSES] = {
+    KM_SLAB_CLASSES(KM_SLAB_CLASS_INIT)
+};
+
+/**
+ * Slab arena.
+ * Free slab pages are kept in a list of their descriptors.
+ */
+static struct {
+    mtx_t lock;
+    struct kmslab_page_list free_pages;
+    size_t nr_free_pages;
+    size_t mem_res;         /*!< Amount of memory reserved for slabs. */
+    bitmap_t sections[E2BITMAP_SIZE(KM_SLAB_NSECT) + 1];
+} kmslab_arena = {
+    .lock = MTX_INITIALIZER(MTX_TYPE_TICKET, 0),
+    .free_pages = LIST_HEAD_INITIALIZER(free_pages),
+};
+
+SYSCTL_UINT(_vm_kmalloc, OID_AUTO, slab_res, CTLFLAG_RD,
+        ((unsigned int *)&(kmslab_arena.mem_res)), 0,
+        "Amount of memory currently reserved for kmalloc slabs.");
+SYSCTL_UINT(_vm_kmalloc, OID_AUTO, slab_free_pages, CTLFLAG_RD,
+        ((unsigned int *)&(kmslab_arena.nr_free_pages)), 0,
+        "Number of unused slab pages in the slab arena.");
+
+/*
+ * Export per class slab stats to sysctl.
+ */
+#define KM_SLAB_CLASS_SYSCTL(_i_, _size_)                                   \
+SYSCTL_NODE(_vm_kmalloc, OID_AUTO, slab##_size_, CTLFLAG_RW, 0,             \
+        "kmalloc " #_size_ " byte slab class stats");                       \
+SYSCTL_UINT(_vm_kmalloc_slab##_size_, OID_AUTO, hits, CTLFLAG_RD,           \
+        &kmslab_classes[_i_].hits, 0,                                       \
+        "Allocations served from the freelist.");                           \
+SYSCTL_UINT(_vm_kmalloc_slab##_size_, OID_AUTO, misses, CTLFLAG_RD,         \
+        &kmslab_classes[_i_].misses, 0,                                     \
+        "Allocations that required a new slab page.");                      \
+SYSCTL_UINT(_vm_kmalloc_slab##_size_, OID_AUTO, inuse, CTLFLAG_RD,          \
+        &kmslab_classes[_i_].inuse, 0,                                      \
+        "Number of objects currently allocated.");                          \
+SYSCTL_UINT(_vm_kmalloc_slab##_size_, OID_AUTO, total, CTLFLAG_RD,          \
+        &kmslab_classes[_i_].total, 0,                                      \
+        "Number of objects currently carved for the class.");
+
+KM_SLAB_CLASSES(KM_SLAB_CLASS_SYSCTL)
+
 /**
  * Memory block descriptor.
  */
@@ -140,6 +285,9 @@ static mblock_t * find_mblock(mblock_t ** last, size_t size);
 static void split_mblock(mblock_t * b, size_t s);
 static mblock_t * merge(mblock_t * b);
 static int valid_addr(void * p);
+static int kmslab_owns(const void * p);
+static void * kmslab_alloc(size_t size);
+static void kmslab_free(void * p);
 /* Stat functions */
 static void update_stat_up(size_t * stat_act, size_t amount);
 static void update_stat_down(size_t * stat_act, size_t amount);
@@ -284,6 +432,274 @@ out:
     return b;
 }
 
+/**
+ * Get the slab object descriptor of a slab allocation.
+ * @param p is the memory block address.
+ * @return Address to the slab object descriptor of p.
+ */
+#define get_kmslab_obj(p) ((kmslab_obj_t *)((uint8_t *)p - KM_SLAB_HDR_SIZE))
+
+/**
+ * Get the slab class index stored in a slab object.
+ */
+#define kmslab_obj_class(obj) ((obj)->signature & ~KM_SIGNATURE_SLAB_MASK)
+
+/**
+ * Get the index of the dynmem section containing p.
+ */
+#define kmslab_sect_index(p) \
+    (((uintptr_t)(p) - configDYNMEM_START) / DYNMEM_PAGE_SIZE)
+
+/**
+ * Get the page descriptor array of the arena section containing p.
+ */
+#define kmslab_sect_desc(p) ((struct kmslab_page *)(configDYNMEM_START + \
+    kmslab_sect_index(p) * DYNMEM_PAGE_SIZE))
+
+/**
+ * Test if the address p belongs to the slab arena.
+ * @param p is a pointer to a memory block.
+ * @return Returns value other than 0 if p is inside a slab arena section.
+ */
+static int kmslab_owns(const void * p)
+{
+    if ((uintptr_t)p < configDYNMEM_START ||
+        (uintptr_t)p >= configDYNMEM_START + configDYNMEM_SIZE)
+        return 0;
+
+    return bitmap_status(kmslab_arena.sections, kmslab_sect_index(p),
+                         sizeof(kmslab_arena.sections)) == 1;
+}
+
+/**
+ * Get the descriptor of the slab page containing p.
+ */
+static struct kmslab_page * kmslab_page_desc(const void * p)
+{
+    struct kmslab_page * desc = kmslab_sect_desc(p);
+
+    return desc + ((uintptr_t)p - (uintptr_t)desc) / KM_SLAB_PAGE_SIZE;
+}
+
+/**
+ * Get the address of the slab page described by pg.
+ */
+static uint8_t * kmslab_page_addr(struct kmslab_page * pg)
+{
+    struct kmslab_page * desc = kmslab_sect_desc(pg);
+
+    return (uint8_t *)desc + (pg - desc) * KM_SLAB_PAGE_SIZE;
+}
+
+/**
+ * Get a free slab page from the slab arena.
+ * Reserves a new dynmem section for the arena if there is no free pages left.
+ * @return A pointer to the descriptor of a slab page; NULL if out of memory.
+ */
+static struct kmslab_page * kmslab_page_get(void)
+{
+    struct kmslab_page * pg;
+
+    mtx_lock(&kmslab_arena.lock);
+    if (LIST_EMPTY(&kmslab_arena.free_pages)) {
+        struct kmslab_page * desc;
+        size_t i;
+
+        desc = dynmem_alloc_region(1, MMU_AP_RWNA, MMU_CTRL_MEMTYPE_WB);
+        if (!desc) {
+            mtx_unlock(&kmslab_arena.lock);
+            KERROR(KERROR_WARN, "dynmem returned null.\n");
+            return NULL;
+        }
+
+        bitmap_set(kmslab_arena.sections, kmslab_sect_index(desc),
+                   sizeof(kmslab_arena.sections));
+        kmslab_arena.mem_res += DYNMEM_PAGE_SIZE;
+        mtx_lock(&kmalloc_giant_lock);
+        update_stat_up(&(kmalloc_stat.kms_mem_res), DYNMEM_PAGE_SIZE);
+        mtx_unlock(&kmalloc_giant_lock);
+
+        /* The first page holds the descriptors. */
+        desc[0].inuse = 0;
+        for (i = 1; i < KM_SLAB_PAGES_PER_SECT; i++) {
+            LIST_INSERT_HEAD(&kmslab_arena.free_pages, &desc[i], link);
+        }
+        kmslab_arena.nr_free_pages += KM_SLAB_PAGES_PER_SECT - 1;
+    }
+
+    pg = LIST_FIRST(&kmslab_arena.free_pages);
+    LIST_REMOVE(pg, link);
+    kmslab_arena.nr_free_pages--;
+    kmslab_sect_desc(pg)->inuse++;
+    mtx_unlock(&kmslab_arena.lock);
+
+    return pg;
+}
+
+/**
+ * Return a slab page back to the slab arena.
+ * The section of the page is freed back to dynmem if none of its pages is in
+ * use and the arena has another section's worth of free pages left.
+ * @param pg is the descriptor of a slab page.
+ */
+static void kmslab_page_put(struct kmslab_page * pg)
+{
+    struct kmslab_page * desc = kmslab_sect_desc(pg);
+    size_t i;
+
+    mtx_lock(&kmslab_arena.lock);
+    LIST_INSERT_HEAD(&kmslab_arena.free_pages, pg, link);
+    kmslab_arena.nr_free_pages++;
+    if (--desc[0].inuse > 0 ||
+        kmslab_arena.nr_free_pages < 2 * (KM_SLAB_PAGES_PER_SECT - 1)) {
+        mtx_unlock(&kmslab_arena.lock);
+        return;
+    }
+
+    for (i = 1; i < KM_SLAB_PAGES_PER_SECT; i++) {
+        LIST_REMOVE(&desc[i], link);
+    }
+    kmslab_arena.nr_free_pages -= KM_SLAB_PAGES_PER_SECT - 1;
+    bitmap_clear(kmslab_arena.sections, kmslab_sect_index(desc),
+                 sizeof(kmslab_arena.sections));
+    kmslab_arena.mem_res -= DYNMEM_PAGE_SIZE;
+    mtx_lock(&kmalloc_giant_lock);
+    update_stat_down(&(kmalloc_stat.kms_mem_res), DYNMEM_PAGE_SIZE);
+    mtx_unlock(&kmalloc_giant_lock);
+    mtx_unlock(&kmslab_arena.lock);
+
+    dynmem_free_region(desc);
+}
+
+/**
+ * Carve a new slab page into free objects of a class.
+ * Must be called with the class lock held.
+ * @param cls is the slab class.
+ * @param cls_i is the index of the slab class.
+ * @return A pointer to the descriptor of the new page;
+ *         NULL if out of memory.
+ */
+static struct kmslab_page * kmslab_grow(struct kmslab_class * cls,
+                                        unsigned cls_i)
+{
+    struct kmslab_page * pg;
+    uint8_t * page;
+    size_t i, n;
+
+    pg = kmslab_page_get();
+    if (!pg)
+        return NULL;
+
+    page = kmslab_page_addr(pg);
+    pg->free = NULL;
+    pg->inuse = 0;
+    n = KM_SLAB_PAGE_SIZE / cls->obj_size;
+    for (i = 0; i < n; i++) {
+        kmslab_obj_t * obj = (kmslab_obj_t *)(page + i * cls->obj_size);
+
+        obj->signature = KM_SIGNATURE_SLAB | cls_i;
+        obj->refcount = ATOMIC_INIT(0);
+        *(kmslab_obj_t **)obj->data = pg->free;
+        pg->free = obj;
+    }
+    LIST_INSERT_HEAD(&cls->partial, pg, link);
+    cls->total += n;
+
+    return pg;
+}
+
+/**
+ * Allocate a block from the slab front end.
+ * @param size is the aligned size of the block, at most KM_SLAB_MAX.
+ * @return A pointer to the data section of a slab object;
+ *         NULL if out of memory.
+ */
+static void * kmslab_alloc(size_t size)
+{
+    struct kmslab_class * cls;
+    struct kmslab_page * pg;
+    kmslab_obj_t * obj;
+    unsigned i = 0;
+
+    while (kmslab_classes[i].obj_size - KM_SLAB_HDR_SIZE < size)
+        i++;
+    cls = &kmslab_classes[i];
+
+    mtx_lock(&cls->lock);
+    pg = LIST_FIRST(&cls->partial);
+    if (pg) {
+        cls->hits++;
+    } else {
+        cls->misses++;
+        pg = kmslab_grow(cls, i);
+        if (!pg) {
+            mtx_unlock(&cls->lock);
+            return NULL;
+        }
+    }
+    obj = pg->free;
+    pg->free = *(kmslab_obj_t **)obj->data;
+    if (!pg->free) /* The page is full. */
+        LIST_REMOVE(pg, link);
+    pg->inuse++;
+    cls->inuse++;
+    atomic_set(&obj->refcount, 1);
+    mtx_unlock(&cls->lock);
+
+    mtx_lock(&kmalloc_giant_lock);
+    update_stat_up(&(kmalloc_stat.kms_mem_alloc), cls->obj_size);
+    mtx_unlock(&kmalloc_giant_lock);
+
+    return obj->data;
+}
+
+/**
+ * Return a slab object back to its slab page.
+ * The page is returned to the slab arena once all of its objects are free.
+ * @param p is a pointer to the data section of a slab object.
+ */
+static void kmslab_free(void * p)
+{
+    kmslab_obj_t * obj = get_kmslab_obj(p);
+    struct kmslab_class * cls;
+    struct kmslab_page * pg;
+
+    if ((obj->signature & KM_SIGNATURE_SLAB_MASK) != KM_SIGNATURE_SLAB ||
+        kmslab_obj_class(obj) >= KM_SLAB_NR_CLASSES) {
+        KERROR(KERROR_ERR, "Invalid slab object: p = %p sign = %x\n",
+               p, obj->signature);
+        return;
+    }
+
+    if (atomic_read(&obj->refcount) <= 0) /* Already freed. */
+        return;
+    if (atomic_dec(&obj->refcount) > 1)
+        return;
+
+    cls = &kmslab_classes[kmslab_obj_class(obj)];
+    pg = kmslab_page_desc(obj);
+    mtx_lock(&cls->lock);
+    if (!pg->free) /* The page was full. */
+        LIST_INSERT_HEAD(&cls->partial, pg, link);
+    *(kmslab_obj_t **)obj->data = pg->free;
+    pg->free = obj;
+    cls->inuse--;
+    if (--pg->inuse == 0) {
+        LIST_REMOVE(pg, link);
+        cls->total -= KM_SLAB_PAGE_SIZE / cls->obj_size;
+    } else {
+        pg = NULL;
+    }
+    mtx_unlock(&cls->lock);
+
+    mtx_lock(&kmalloc_giant_lock);
+    update_stat_down(&(kmalloc_stat.kms_mem_alloc), cls->obj_size);
+    mtx_unlock(&kmalloc_giant_lock);
+
+    if (pg)
+        kmslab_page_put(pg);
+}
+
 /**
  * Validate a given memory block address.
  * @param p is a pointer to a memory block.
@@ -313,6 +729,9 @@ void * kmalloc(size_t size)
     mblock_t * last;
     size_t s = memalign(size);
 
+    if (s <= KM_SLAB_MAX)
+        return kmslab_alloc(s);
+
     mtx_lock(&kmalloc_giant_lock);
     if (kmalloc_base) {
         /* Find a mblock. */
@@ -390,6 +809,11 @@ void kfree(void * p)
 {
     mblock_t * b;
 
+    if (kmslab_owns(p)) {
+        kmslab_free(p);
+        return;
+    }
+
     if (!valid_addr(p))
         return;
 
@@ -453,9 +877,15 @@ void kfree_lazy(void * p)
     disable_interrupt();
 
     if (!queue_push(&lazy_free_queue, &p)) {
-        mblock_t * b = get_mblock(p);
+        size_t size;
+
+        if (kmslab_owns(p)) {
+            size = kmslab_classes[kmslab_obj_class(get_kmslab_obj(p))].obj_size;
+        } else {
+            size = get_mblock(p)->size;
+        }
         KERROR(KERROR_WARN, "kfree lazy queue full, leaked %u bytes\n",
-               (uint32_t)b->size);
+               (uint32_t)size);
     }
 
     set_interrupt_state(istate);
@@ -493,6 +923,24 @@ void * krealloc(void * p, size_t size)
         goto out;
     }
 
+    if (kmslab_owns(p)) {
+        kmslab_obj_t * obj = get_kmslab_obj(p);
+        size_t old_size;
+
+        old_size = kmslab_classes[kmslab_obj_class(obj)].obj_size -
+                   KM_SLAB_HDR_SIZE;
+        s = memalign(size);
+        if (s <= old_size) /* Fits in the current object. */
+            return p;
+
+        np = kmalloc(s);
+        if (!np)
+            return NULL;
+        memcpy(np, p, old_size);
+        kfree(p);
+        return np;
+    }
+
     if (!valid_addr(p))
         return NULL;
 
@@ -556,7 +1004,9 @@ out:
 
 void * kpalloc(void * p)
 {
-    if (valid_addr(p)) {
+    if (kmslab_owns(p)) {
+        atomic_inc(&(get_kmslab_obj(p)->refcount));
+    } else if (valid_addr(p)) {
         atomic_inc(&(get_mblock(p)->refcount));
     }
     return p;
@@ -0,0 +1,347 @@
+/**
+ *******************************************************************************
+ * @file    kmem_cache.c
+ * @author  Olli Vanhoja
+ * @brief   Named object caches.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/linker_set.h>
+#include <sys/sysctl.h>
+#include <hal/core.h>
+#include <kerror.h>
+#include <kinit.h>
+#include <kmalloc.h>
+#include <kmem_cache.h>
+#include <ksched.h>
+#include <kstring.h>
+#include <libkern.h>
+
+/**
+ * Preferred size of a slab.
+ */
+#define KMEM_SLAB_SIZE      4096
+
+/**
+ * Minimum number of objects carved in a single slab.
+ */
+#define KMEM_SLAB_MIN_OBJS  4
+
+/**
+ * Slab descriptor.
+ * The descriptor is followed by the object slots of the slab.
+ */
+struct kmem_slab {
+    struct kmem_slab * next;
+    size_t nr_objs;
+    char data[];
+};
+
+/**
+ * Get the free list link of an object.
+ */
+#define obj_link(_cache_, _obj_) \
+    (*(void **)((uint8_t *)(_obj_) + (_cache_)->stride - sizeof(void *)))
+
+SET_DECLARE(kmem_cache_set, struct kmem_cache);
+
+SYSCTL_DECL(_vm_kmem_cache);
+SYSCTL_NODE(_vm, OID_AUTO, kmem_cache, CTLFLAG_RW, 0,
+            "kmem_cache stats");
+
+static int sysctl_kmem_cache_free(SYSCTL_HANDLER_ARGS)
+{
+    struct kmem_cache * cache = (struct kmem_cache *)arg1;
+    unsigned nr_free = cache->nr_total - atomic_read(&cache->nr_live);
+
+    return sysctl_handle_int(oidp, &nr_free, sizeof(nr_free), req);
+}
+
+/**
+ * Create the vm.kmem_cache.<name> sysctl subtree for a cache.
+ * @param cache is a pointer to the cache.
+ */
+static void kmem_cache_sysctl_register(struct kmem_cache * cache)
+{
+    struct sysctl_oid_list * children = &cache->sysctl_children;
+
+    cache->sysctl_node = sysctl_add_oid(&SYSCTL_NODE_CHILDREN(_vm, kmem_cache),
+                                        cache->name, CTLTYPE_NODE | CTLFLAG_RD,
+                                        children, 0, NULL, "N",
+                                        "kmem_cache stats");
+    if (!cache->sysctl_node) {
+        KERROR(KERROR_WARN, "Failed to add sysctl node for kmem_cache %s\n",
+               cache->name);
+        return;
+    }
+
+    (void)sysctl_add_oid(children, "live", CTLTYPE_INT | CTLFLAG_RD,
+                         &cache->nr_live, 0, sysctl_handle_int, "I",
+                         "Number of objects currently allocated.");
+    (void)sysctl_add_oid(children, "free", CTLTYPE_UINT | CTLFLAG_RD,
+                         cache, 0, sysctl_kmem_cache_free, "IU",
+                         "Number of free constructed objects.");
+    (void)sysctl_add_oid(children, "peak", CTLTYPE_UINT | CTLFLAG_RD,
+                         &cache->nr_peak, 0, sysctl_handle_int, "IU",
+                         "Peak number of objects allocated.");
+}
+
+int __kinit__ kmem_cache_init(void)
+{
+    struct kmem_cache ** cache_p;
+
+    SUBSYS_INIT("kmem_cache");
+
+    SET_FOREACH(cache_p, kmem_cache_set) {
+        kmem_cache_sysctl_register(*cache_p);
+    }
+
+    return 0;
+}
+
+struct kmem_cache * kmem_cache_create(const char * name, size_t size,
+                                      size_t align, kmem_cache_ctor_t * ctor,
+                                      kmem_cache_dtor_t * dtor)
+{
+    struct kmem_cache * cache;
+
+    if (align & (align - 1))
+        return NULL;
+
+    cache = kzalloc(sizeof(struct kmem_cache));
+    if (!cache)
+        return NULL;
+
+    *cache = (struct kmem_cache)KMEM_CACHE_INITIALIZER(name, size, align,
+                                                       ctor, dtor);
+    cache->name = kstrdup(name, CTL_MAXSTRNAME);
+    if (!cache->name) {
+        kfree(cache);
+        return NULL;
+    }
+    cache->flags = KMEM_CACHE_DYNAMIC;
+
+    kmem_cache_sysctl_register(cache);
+
+    return cache;
+}
+
+void kmem_cache_destroy(struct kmem_cache * cache)
+{
+    struct kmem_slab * slab;
+
+    KASSERT(cache->flags & KMEM_CACHE_DYNAMIC,
+            "Only dynamic caches can be destroyed");
+
+    if (atomic_read(&cache->nr_live) != 0) {
+        KERROR(KERROR_WARN, "kmem_cache %s destroyed with %d live objects\n",
+               cache->name, atomic_read(&cache->nr_live));
+    }
+
+    if (cache->sysctl_node)
+        (void)sysctl_remove_oid(cache->sysctl_node, 1, 1);
+
+    mtx_lock(&cache->lock);
+    slab = cache->slabs;
+    while (slab) {
+        struct kmem_slab * next = slab->next;
+
+        if (cache->dtor) {
+            uint8_t * p = (uint8_t *)KMEM_CACHE_ROUNDUP((uintptr_t)slab->data,
+                                                        cache->align);
+
+            for (size_t i = 0; i < slab->nr_objs; i++) {
+                cache->dtor(p + i * cache->stride);
+            }
+        }
+        kfree(slab);
+        slab = next;
+    }
+    cache->slabs = NULL;
+    cache->depot = NULL;
+    mtx_unlock(&cache->lock);
+
+    kfree((void *)cache->name);
+    kfree(cache);
+}
+
+/**
+ * Carve a new slab for the cache.
+ * The cache lock must be held.
+ * @param cache is a pointer to the cache.
+ * @return 0 if succeed; Otherwise a negative errno.
+ */
+static int kmem_cache_grow(struct kmem_cache * cache)
+{
+    struct kmem_slab * slab;
+    size_t nr_objs;
+    uint8_t * p;
+
+    nr_objs = (KMEM_SLAB_SIZE - sizeof(struct kmem_slab)) / cache->stride;
+    if (nr_objs < KMEM_SLAB_MIN_OBJS)
+        nr_objs = KMEM_SLAB_MIN_OBJS;
+
+    slab = kmalloc(sizeof(struct kmem_slab) + cache->align - 1 +
+                   nr_objs * cache->stride);
+    if (!slab)
+        return -ENOMEM;
+
+    slab->nr_objs = nr_objs;
+    slab->next = cache->slabs;
+    cache->slabs = slab;
+
+    p = (uint8_t *)KMEM_CACHE_ROUNDUP((uintptr_t)slab->data, cache->align);
+    for (size_t i = 0; i < nr_objs; i++) {
+        void * obj = p + i * cache->stride;
+
+        if (cache->ctor)
+            cache->ctor(obj);
+        obj_link(cache, obj) = cache->depot;
+        cache->depot = obj;
+    }
+    cache->nr_total += nr_objs;
+
+    return 0;
+}
+
+/**
+ * Get an object from the depot and refill the magazine of the current CPU.
+ * @param cache is a pointer to the cache.
+ * @return Returns a pointer to an object; NULL if out of memory.
+ */
+static void * kmem_cache_depot_get(struct kmem_cache * cache)
+{
+    void * batch[KMEM_MAGAZINE_SIZE / 2];
+    size_t n = 0;
+    void * obj;
+    istate_t istate;
+    struct kmem_magazine * mag;
+
+    mtx_lock(&cache->lock);
+    if (!cache->depot && kmem_cache_grow(cache)) {
+        mtx_unlock(&cache->lock);
+        return NULL;
+    }
+
+    obj = cache->depot;
+    cache->depot = obj_link(cache, obj);
+
+    while (cache->depot && n < num_elem(batch)) {
+        batch[n++] = cache->depot;
+        cache->depot = obj_link(cache, cache->depot);
+    }
+    mtx_unlock(&cache->lock);
+
+    if (n == 0)
+        return obj;
+
+    istate = get_interrupt_state();
+    disable_interrupt();
+    mag = &cache->mag[get_cpu_index()];
+    while (n > 0 && mag->rounds < KMEM_MAGAZINE_SIZE) {
+        mag->objs[mag->rounds++] = batch[--n];
+    }
+    set_interrupt_state(istate);
+
+    if (n > 0) { /* The magazine was refilled meanwhile. */
+        mtx_lock(&cache->lock);
+        while (n > 0) {
+            void * p = batch[--n];
+
+            obj_link(cache, p) = cache->depot;
+            cache->depot = p;
+        }
+        mtx_unlock(&cache->lock);
+    }
+
+    return obj;
+}
+
+void * kmem_cache_alloc(struct kmem_cache * cache)
+{
+    struct kmem_magazine * mag;
+    void * obj = NULL;
+    istate_t istate;
+    unsigned live;
+
+    istate = get_interrupt_state();
+    disable_interrupt();
+    mag = &cache->mag[get_cpu_index()];
+    if (mag->rounds > 0)
+        obj = mag->objs[--mag->rounds];
+    set_interrupt_state(istate);
+
+    if (!obj) {
+        obj = kmem_cache_depot_get(cache);
+        if (!obj)
+            return NULL;
+    }
+
+    live = atomic_inc(&cache->nr_live) + 1;
+    if (live > cache->nr_peak)
+        cache->nr_peak = live;
+
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache * cache, void * obj)
+{
+    void * batch[KMEM_MAGAZINE_SIZE / 2];
+    size_t n = 0;
+    struct kmem_magazine * mag;
+    istate_t istate;
+
+    if (!obj)
+        return;
+
+    atomic_dec(&cache->nr_live);
+
+    istate = get_interrupt_state();
+    disable_interrupt();
+    mag = &cache->mag[get_cpu_index()];
+    if (mag->rounds == KMEM_MAGAZINE_SIZE) {
+        /* Move a half of the magazine back to the depot. */
+        while (n < num_elem(batch)) {
+            batch[n++] = mag->objs[--mag->rounds];
+        }
+    }
+    mag->objs[mag->rounds++] = obj;
+    set_interrupt_state(istate);
+
+    if (n > 0) {
+        mtx_lock(&cache->lock);
+        while (n > 0) {
+            void * p = batch[--n];
+
+            obj_link(cache, p) = cache->depot;
+            cache->depot = p;
+        }
+        mtx_unlock(&cache->lock);
+    }
+}
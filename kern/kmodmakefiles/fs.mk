@@ -12,6 +12,9 @@ fs-SRC-y += fs/libfs/fs_queue.c
 # mbr
 fs-SRC-$(configMBR) += $(wildcard fs/mbr/*.c)
 
+# md
+fs-SRC-$(configMD) += $(wildcard fs/md/*.c)
+
 # ramfs
 fs-SRC-$(configRAMFS) += $(wildcard fs/ramfs/*.c)
 
@@ -285,7 +285,7 @@ pid_t * proc_get_pids_buffer(void)
     pid_t * buf;
 
     buf = pids_buf[isema_acquire(pids_buf_isema, num_elem(pids_buf_isema))];
-    memset(buf, 0, configMAXPROC + 1);
+    memset(buf, 0, sizeof(pids_buf[0]));
 
     return buf;
 }
@@ -583,6 +583,17 @@ int proc_abo_handler(const struct mmu_abo_param * restrict abo)
          * This is the correct region.
          */
 
+        if (region->b_pages && !region->b_cowsrc) {
+            /*
+             * Demand paged region. A translation fault maps the page and
+             * a permission fault is the first write to a read-only
+             * mapped page.
+             */
+            mtx_unlock(&mm->regions_lock);
+            return vm_page_fault(abo->proc, vaddr,
+                                 !MMU_ABORT_IS_TRANSLATION_FAULT(abo->fsr));
+        }
+
         if (MMU_ABORT_IS_TRANSLATION_FAULT(abo->fsr)) { /* Translation fault */
             /*
              * Sometimes we see translation faults due to ordering of region
@@ -604,35 +615,15 @@ int proc_abo_handler(const struct mmu_abo_param * restrict abo)
             return 0;
         }
 
-        /* Test for COW flag. */
-        if ((region->b_uflags & VM_PROT_COW) != VM_PROT_COW) {
+        /* Test for COW. */
+        if (!(region->b_uflags & VM_PROT_COW) && !region->b_cowsrc) {
             KERROR_DBG("Memory protection error\n");
             err = -EACCES; /* Memory protection error. */
             goto fail;
         }
 
-        if (!region->vm_ops->rclone) {
-            KERROR_DBG("rclone() not supported\n");
-            err = -ENOTSUP; /* rclone() not supported. */
-            goto fail;
-        }
-
-        region = region->vm_ops->rclone(region);
-        if (!region) {
-            KERROR_DBG("Can't clone region; COW failed\n");
-            err = -ENOMEM; /* Can't clone region; COW failed. */
-            goto fail;
-        }
-        /*
-         * The old region remains marked as COW as it would be racy to change
-         * its state.
-         */
-
         mtx_unlock(&mm->regions_lock);
-        err = vm_replace_region(abo->proc, region, i, VM_INSOP_MAP_REG);
-
-        KERROR_DBG("COW done (%d)\n", err);
-        return err; /* COW done. */
+        return vm_cow_fault(abo->proc, vaddr);
     }
 
     KERROR_DBG("No mapping found\n");
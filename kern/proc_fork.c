@@ -131,10 +131,15 @@ static int clone_regions_from(struct proc_info * new_proc,
 
         /*
          * If the region is writable we want to either clone it or mark it as
-         * copy-on-write.
+         * copy-on-write. Shared page cache regions are always shared and
+         * private demand paged regions are always cloned, so only the pages
+         * already touched are copied. This includes partially copied
+         * copy-on-write regions.
          */
-        if (vm_reg_tmp->b_uflags & VM_PROT_WRITE) {
-            if (cow_enabled) { /* Set COW bit if the feature is enabled. */
+        if ((vm_reg_tmp->b_uflags & VM_PROT_WRITE) &&
+            !(vm_reg_tmp->b_pages && !(vm_reg_tmp->b_flags & B_PRIVATE))) {
+            if (cow_enabled && !vm_reg_tmp->b_pages) {
+                /* Set COW bit if the feature is enabled. */
                 vm_reg_tmp->b_uflags |= VM_PROT_COW;
 
                 /*
@@ -38,6 +38,7 @@
 #include <sys/proc.h>
 #include <sys/sysctl.h>
 #include <buf.h>
+#include <exec.h>
 #include <kmalloc.h>
 #include <proc.h>
 #include <vm/vm.h>
@@ -90,6 +91,39 @@ static int proc_sysctl_pids(struct sysctl_oid * oidp, struct sysctl_req * req)
     return retval;
 }
 
+/**
+ * Get the resident size of a region.
+ */
+static size_t region_rss(struct buf * region)
+{
+    size_t rss = 0;
+
+    if (!region->b_pages)
+        return (region->b_data) ? region->b_bufsize : 0;
+
+    mtx_lock(&region->lock);
+    for (size_t i = 0; i < region->b_mmu.num_pages; i++) {
+        if (region->b_pages[i])
+            rss += MMU_PGSIZE_COARSE;
+    }
+    mtx_unlock(&region->lock);
+
+    return rss;
+}
+
+/**
+ * Test if the pages of a region are shared with other processes or with the
+ * page cache.
+ * The reference held by the text cache doesn't make a region shared.
+ */
+static int region_shared(struct buf * region)
+{
+    if (region->b_pages && !(region->b_flags & B_PRIVATE))
+        return 1;
+
+    return kobj_refcnt(&region->b_obj) - exec_text_cached(region) > 1;
+}
+
 static int proc_sysctl_vmmap(struct sysctl_oid * oidp,
                              struct proc_info * proc,
                              struct sysctl_req * req)
@@ -127,6 +161,8 @@ static int proc_sysctl_vmmap(struct sysctl_oid * oidp,
             .reg_start = region->b_mmu.vaddr,
             .reg_end = region->b_mmu.vaddr + region->b_bufsize - 1,
             .flags = region->b_flags,
+            .rss = region_rss(region),
+            .shared = region_shared(region),
         };
         vm_get_uapstring(entry->uap, region);
         entry++;
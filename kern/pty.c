@@ -68,6 +68,9 @@ struct pty_device {
     RB_ENTRY(pty_device) _entry;
 };
 
+#define PTY_QUEUE_LEN   9   /*!< Number of packets in a pty queue + 1. */
+#define PTY_BLOCK_SIZE  512 /*!< Size of a packet in a pty queue. */
+
 static const char drv_name[] = "PTY";
 static const char dev_name[] = "ptmx";
 
@@ -138,31 +141,41 @@ void pty_remove(struct pty_device * ptydev)
 static ssize_t ptymaster_read(struct file * file, struct uio * uio,
                               size_t count)
 {
+    ssize_t retval;
     int err;
     const int flags = oflags2fsq_flags(file->oflags);
     struct pty_device * ptydev = (struct pty_device *)file->stream;
     uint8_t * buf;
 
-    err = uio_get_kaddr(uio, (void **)(&buf));
+    err = uio_kmap(uio, count, VM_PROT_WRITE, (void **)(&buf));
     if (err)
         return err;
 
-    return fs_queue_read(ptydev->fsq_sm, buf, count, flags);
+    retval = fs_queue_read(ptydev->fsq_sm, buf, count, flags);
+    err = uio_kunmap(uio, buf, (retval > 0) ? retval : 0);
+    if (err)
+        return err;
+
+    return retval;
 }
 
 static ssize_t ptymaster_write(struct file * file, struct uio * uio,
                                size_t count)
 {
+    ssize_t retval;
     int err;
     const int flags = oflags2fsq_flags(file->oflags);
     struct pty_device * ptydev = (struct pty_device *)file->stream;
     uint8_t * buf;
 
-    err = uio_get_kaddr(uio, (void **)(&buf));
+    err = uio_kmap(uio, count, VM_PROT_READ, (void **)(&buf));
     if (err)
         return err;
 
-    return fs_queue_write(ptydev->fsq_ms, buf, count, flags);
+    retval = fs_queue_write(ptydev->fsq_ms, buf, count, flags);
+    uio_kunmap(uio, buf, 0);
+
+    return retval;
 }
 
 static int ptyslave_read(struct tty * tty, off_t blkno,
@@ -234,10 +247,9 @@ static void creat_pty(file_t * file, struct tty * tty)
 
     /*
      * Create queues.
-     * TODO Get block size from somewhere else maybe
      */
-    ptydev->fsq_ms = fs_queue_create(3, 512);
-    ptydev->fsq_sm = fs_queue_create(3, 512);
+    ptydev->fsq_ms = fs_queue_create(PTY_QUEUE_LEN, PTY_BLOCK_SIZE);
+    ptydev->fsq_sm = fs_queue_create(PTY_QUEUE_LEN, PTY_BLOCK_SIZE);
     if (!ptydev->fsq_ms || !ptydev->fsq_sm) {
         fs_queue_destroy(ptydev->fsq_ms);
         fs_queue_destroy(ptydev->fsq_sm);
@@ -37,9 +37,11 @@
 #include <errno.h>
 #include <buf.h>
 #include <hal/core.h>
+#include <hal/hw_timers.h>
 #include <kerror.h>
 #include <ksched.h>
 #include <idle.h>
+#include <timers.h>
 
 SET_DECLARE(_idle_tasks, struct _idle_task_desc);
 
@@ -61,6 +63,54 @@ void * idle_thread(void * arg)
     }
 }
 
+#ifdef configSCHED_TICKLESS
+/**
+ * Maximum time to sleep without a tick.
+ */
+#define IDLE_MAX_SLEEP_USEC 1000000
+
+#define TICK_USEC (1000000 / configSCHED_HZ)
+
+static int idle_tick_stopped;
+
+/**
+ * Stop the periodic tick if the idle thread was selected.
+ * The next tick will happen on the next timer deadline.
+ */
+static void idle_stop_tick(void)
+{
+    uint64_t now, next;
+    uint32_t delta;
+
+    if (current_thread != idle_info) {
+        /* The timer is already back to the normal rate. */
+        idle_tick_stopped = 0;
+        return;
+    }
+
+    now = get_utime();
+    next = timers_next_expiry();
+    if (next <= now)
+        return;
+    delta = (next - now > IDLE_MAX_SLEEP_USEC) ? IDLE_MAX_SLEEP_USEC :
+                                                 next - now;
+    if (delta <= TICK_USEC)
+        return;
+
+    idle_tick_stopped = 1;
+    hw_timers_set_next_tick(delta);
+}
+SCHED_POST_SCHED_TASK(idle_stop_tick);
+
+void idle_restart_tick(void)
+{
+    if (idle_tick_stopped) {
+        idle_tick_stopped = 0;
+        hw_timers_set_next_tick(TICK_USEC);
+    }
+}
+#endif
+
 static int idle_insert(struct scheduler * sobj, struct thread_info * thread)
 {
     if (idle_info)
@@ -97,7 +147,7 @@ struct scheduler * sched_create_idle(void)
     bp = geteblk(MMU_PGSIZE_COARSE);
 
     tdef_idle = (struct _sched_pthread_create_args){
-        .param.sched_policy   = SCHED_OTHER + 1,
+        .param.sched_policy   = SCHED_FAIR + 1,
         .param.sched_priority = NZERO,
         .stack_addr = (void *)bp->b_data,
         .stack_size = bp->b_bufsize,
@@ -45,6 +45,7 @@
 #include <kinit.h>
 #include <kmalloc.h>
 #include <kmem.h>
+#include <kmem_cache.h>
 #include <ksched.h>
 #include <kstring.h>
 #include <libkern.h>
@@ -60,6 +61,7 @@ SYSCTL_NODE(_kern, OID_AUTO, sched, CTLFLAG_RW, 0, "Scheduler");
  */
 extern struct scheduler * sched_create_fifo(void);
 extern struct scheduler * sched_create_rr(void);
+extern struct scheduler * sched_create_fair(void);
 extern struct scheduler * sched_create_idle(void);
 
 /**
@@ -68,6 +70,7 @@ extern struct scheduler * sched_create_idle(void);
 static sched_constructor * const sched_ctor_arr[] = {
     &sched_create_fifo,
     &sched_create_rr,
+    &sched_create_fair,
     &sched_create_idle,
 };
 #define NR_SCHEDULERS num_elem(sched_ctor_arr)
@@ -152,6 +155,11 @@ SET_DECLARE(thread_ctors, thread_cdtor_t);
 SET_DECLARE(thread_dtors, thread_cdtor_t);
 SET_DECLARE(thread_fork_handlers, thread_fork_handler_t);
 
+/**
+ * Cache for thread_info structs.
+ */
+static KMEM_CACHE(thread_info, sizeof(struct thread_info), 0, NULL, NULL);
+
 /**
  * Next thread id.
  */
@@ -383,6 +391,8 @@ void sched_handler(void)
         if (sched->insert(sched, thread)) {
             KERROR(KERROR_ERR, "Failed to schedule a thread (%d) to \"%s\"\n",
                    thread->id, sched->name);
+        } else {
+            thread->sched.sobj = sched;
         }
     }
 
@@ -416,6 +426,21 @@ void sched_handler(void)
 #endif
 }
 
+void sched_runq_remove(struct thread_info * thread)
+{
+    struct scheduler * sched = thread->sched.sobj;
+    istate_t istate;
+
+    if (!sched || !sched->remove)
+        return;
+
+    /* Schedulers expect interrupts to be disabled. */
+    istate = get_interrupt_state();
+    disable_interrupt();
+    sched->remove(sched, thread);
+    set_interrupt_state(istate);
+}
+
 /* Thread creation ************************************************************/
 
 /**
@@ -454,6 +479,26 @@ static void thread_free_kstack(struct buf * bp)
     bp->vm_ops->rfree(bp);
 }
 
+/**
+ * Take a reference to a thread_info struct.
+ * @param thread is a pointer to the thread_info struct.
+ */
+static void thread_info_ref(struct thread_info * thread)
+{
+    atomic_inc(&thread->refcount);
+}
+
+/**
+ * Release a reference to a thread_info struct.
+ * The struct is returned to the cache when the last reference is released.
+ * @param thread is a pointer to the thread_info struct.
+ */
+static void thread_info_unref(struct thread_info * thread)
+{
+    if (atomic_dec(&thread->refcount) == 1)
+        kmem_cache_free(&kmem_cache_thread_info, thread);
+}
+
 /**
  * Initialize a sched data structure.
  */
@@ -484,7 +529,7 @@ static void thread_set_inheritance(struct thread_info * child,
 
     if (parent == NULL)
         return;
-    kpalloc(parent);
+    thread_info_ref(parent);
 
     if (parent->inh.first_child == NULL) {
         /* This is the first child of this parent */
@@ -547,12 +592,14 @@ pthread_t thread_create(struct _sched_pthread_create_args * thread_def,
     if (thread_id < 0)
         panic("Out of thread IDs");
 
-    tp = kzalloc(sizeof(struct thread_info));
+    tp = kmem_cache_alloc(&kmem_cache_thread_info);
     if (!tp)
         return -EAGAIN;
+    memset(tp, 0, sizeof(struct thread_info));
+    tp->refcount = ATOMIC_INIT(1);
 
     if (!(tp->kstack_region = thread_alloc_kstack())) {
-        kfree(tp);
+        kmem_cache_free(&kmem_cache_thread_info, tp);
         return -EAGAIN;
     }
 
@@ -650,18 +697,19 @@ struct thread_info * thread_fork(pid_t new_pid)
         return NULL;
     }
 
-    new_thread = kmalloc(sizeof(struct thread_info));
+    new_thread = kmem_cache_alloc(&kmem_cache_thread_info);
     if (!new_thread)
         return NULL;
 
     memcpy(new_thread, old_thread, sizeof(struct thread_info));
+    new_thread->refcount = ATOMIC_INIT(1);
     new_thread->id       = new_id;
     new_thread->flags   &= ~SCHED_INSYS_FLAG;
     new_thread->flags   |= SCHED_DETACH_FLAG; /* New main must be detached. */
 
     /* New thread kstack */
     if (!(new_thread->kstack_region = thread_alloc_kstack())) {
-        kfree(new_thread);
+        kmem_cache_free(&kmem_cache_thread_info, new_thread);
         return NULL;
     }
 
@@ -718,6 +766,7 @@ int thread_ready(pthread_t thread_id)
     mtx_lock(&CURRENT_CPU->lock);
     STAILQ_INSERT_TAIL(&CURRENT_CPU->readyq, thread, sched.readyq_entry_);
     mtx_unlock(&CURRENT_CPU->lock);
+    idle_restart_tick();
 
     return 0;
 }
@@ -832,7 +881,7 @@ int thread_set_policy(pthread_t thread_id, unsigned policy)
     if (!thread || thread_flags_not_set(thread, SCHED_IN_USE_FLAG))
         return -ESRCH;
 
-    if (policy > SCHED_OTHER)
+    if (policy > SCHED_FAIR)
         return -EINVAL;
 
     thread->param.sched_policy = policy;
@@ -1001,10 +1050,10 @@ int thread_terminate(pthread_t thread_id)
 
         ksignal_sendsig(sigs, SIGCHLDTHRD, &sigparm);
         /*
-         * kfree() is called for the parent because we originally called
-         * kpalloc() for it.
+         * Release the reference taken to the parent in
+         * thread_set_inheritance().
          */
-        kfree(parent);
+        thread_info_unref(parent);
     }
 
     return 0;
@@ -1027,6 +1076,9 @@ void thread_remove(pthread_t thread_id)
     thread->flags = 0; /* Clear all flags */
     thread->param.sched_priority = NICE_ERR;
 
+    /* Make sure the scheduler doesn't hold a reference to the thread. */
+    sched_runq_remove(thread);
+
     /* Release wait timeout timer */
     if (thread->wait_tim >= 0) {
         timers_release(thread->wait_tim);
@@ -1080,7 +1132,7 @@ static void free_threads(uintptr_t arg)
     while (queue_pop(&CURRENT_CPU->thread_free_queue, &thread)) {
         thread_free_kstack(thread->kstack_region);
         kfree(thread->exit_ksiginfo);
-        kfree_lazy(thread);
+        thread_info_unref(thread);
     }
 }
 IDLE_TASK(free_threads, 0);
@@ -1304,7 +1356,8 @@ static intptr_t sys_thread_setpolicy(__user void * user_args)
         return -1;
     }
 
-    if (((curproc->pid != thread->pid_owner || args.policy != SCHED_OTHER) &&
+    if (((curproc->pid != thread->pid_owner ||
+          args.policy != SCHED_OTHER) &&
          (err = priv_check(&curproc->cred, PRIV_SCHED_SETPOLICY))) ||
         (err = thread_set_policy(args.id, args.policy))) {
         set_errno(-err);
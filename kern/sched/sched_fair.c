@@ -0,0 +1,416 @@
+/**
+ *******************************************************************************
+ * @file    sched_fair.c
+ * @author  Olli Vanhoja
+ * @brief   Fair share scheduler.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+
+#include <stddef.h>
+#include <sys/sysctl.h>
+#include <sys/tree.h>
+#include <kerror.h>
+#include <kmalloc.h>
+#include <ksched.h>
+#include <libkern.h>
+#include <thread.h>
+
+/*
+ * A proportional share scheduler.
+ * Each thread accumulates virtual runtime while it's executing, the
+ * runtime is weighted by the nice value of the thread, and the thread
+ * with the smallest virtual runtime is always selected next. The run
+ * queue is kept sorted by virtual runtime in a red-black tree.
+ *
+ * Time is accounted in scheduler ticks by using ts_counter that is
+ * decremented by sched_handler() on every tick while the thread is the
+ * current thread, so the accounting stays correct even if a higher
+ * priority scheduler preempts the thread.
+ */
+
+#define SCHED_POLFLAG_INFAIRRQ  0x01 /*!< Thread in run queue. */
+#define SCHED_POLFLAG_INFAIRDQ  0x02 /*!< Thread in dead queue. */
+
+#define FAIRRUNQ_ENTRY  sched.fair.runq_entry_
+#define FAIRDEADQ_ENTRY sched.fair.deadq_entry_
+
+/**
+ * Weight of a thread with nice value zero.
+ */
+#define FAIR_NICE0_WEIGHT   1024
+
+/**
+ * Virtual runtime units per tick for a thread with weight FAIR_NICE0_WEIGHT.
+ */
+#define FAIR_VRT_TICK       1024
+
+/**
+ * Maximum number of ticks charged at once.
+ * Keeps the virtual runtime delta within 32 bits.
+ */
+#define FAIR_MAX_CHARGE     1000
+
+/**
+ * Weights for nice levels from NICE_MIN to NICE_MAX.
+ * Every nice level is roughly 1.25 times the weight of the next one, so
+ * a thread gets approximately 10% more CPU time for each level.
+ */
+static const uint32_t fair_weights[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */  9548,  7620,  6100,  4904,  3906,
+    /*  -5 */  3121,  2501,  1991,  1586,  1277,
+    /*   0 */  1024,   820,   655,   526,   423,
+    /*   5 */   335,   272,   215,   172,   137,
+    /*  10 */   110,    87,    70,    56,    45,
+    /*  15 */    36,    29,    23,    18,    15,
+    /*  20 */    12,
+};
+
+/**
+ * Targeted scheduling period in ticks.
+ * Every runnable thread should run at least once during this period.
+ */
+static unsigned fair_latency = 6;
+/**
+ * Minimum time slice in ticks.
+ */
+static unsigned fair_min_granularity = 1;
+/**
+ * Virtual runtime credit, in ticks, given to a thread waking up from sleep.
+ */
+static unsigned fair_sleeper_credit = 3;
+
+SYSCTL_DECL(_kern_sched_fair);
+SYSCTL_NODE(_kern_sched, OID_AUTO, fair, CTLFLAG_RW, 0,
+            "Fair share scheduler");
+
+SYSCTL_UINT(_kern_sched_fair, OID_AUTO, latency, CTLFLAG_RW,
+            &fair_latency, 0, "Targeted scheduling period [ticks]");
+SYSCTL_UINT(_kern_sched_fair, OID_AUTO, min_granularity, CTLFLAG_RW,
+            &fair_min_granularity, 0, "Minimum time slice [ticks]");
+SYSCTL_UINT(_kern_sched_fair, OID_AUTO, sleeper_credit, CTLFLAG_RW,
+            &fair_sleeper_credit, 0, "Sleeper credit [ticks]");
+
+struct sched_fair {
+    struct scheduler sched;
+    unsigned nr_active;
+    uint32_t total_weight;  /*!< Sum of the weights of all queued threads. */
+    uint64_t min_vruntime;  /*!< Monotonic virtual runtime floor. */
+    struct thread_info * curr; /*!< Last thread selected by this scheduler. */
+    RB_HEAD(fairrunq, thread_info) runq_head;
+    /**
+     * Detached threads removed while dead, waiting to be freed.
+     */
+    TAILQ_HEAD(fairdeadq, thread_info) deadq_head;
+};
+
+static int fair_vruntime_compare(struct thread_info * a, struct thread_info * b)
+{
+    if (a->sched.fair.vruntime < b->sched.fair.vruntime)
+        return -1;
+    else if (a->sched.fair.vruntime > b->sched.fair.vruntime)
+        return 1;
+    return a->id - b->id;
+}
+
+RB_PROTOTYPE_STATIC(fairrunq, thread_info, FAIRRUNQ_ENTRY,
+                    fair_vruntime_compare);
+RB_GENERATE_STATIC(fairrunq, thread_info, FAIRRUNQ_ENTRY,
+                   fair_vruntime_compare);
+
+static inline uint32_t get_weight(struct thread_info * thread)
+{
+    int prio = thread_p_get_scheduling_priority(thread);
+
+    if (prio < NICE_MIN)
+        prio = NICE_MIN;
+    else if (prio > NICE_MAX)
+        prio = NICE_MAX;
+
+    return fair_weights[prio - NICE_MIN];
+}
+
+/**
+ * Get the length of the next time slice for a thread.
+ * The scheduling period is divided between the queued threads in
+ * proportion to their weights.
+ */
+static int get_slice(struct sched_fair * fair, struct thread_info * thread)
+{
+    unsigned period = fair_latency;
+    unsigned slice;
+
+    if (fair->nr_active * fair_min_granularity > period)
+        period = fair->nr_active * fair_min_granularity;
+    if (fair->total_weight == 0)
+        return period;
+
+    slice = (period * thread->sched.fair.weight) / fair->total_weight;
+    if (slice < fair_min_granularity)
+        slice = fair_min_granularity;
+
+    return (slice > 0) ? slice : 1;
+}
+
+/**
+ * Charge the ticks consumed by a thread since the last call.
+ */
+static void fair_update_curr(struct sched_fair * fair,
+                             struct thread_info * thread)
+{
+    int ran = thread->sched.fair.ts_last - thread->sched.ts_counter;
+
+    if (ran <= 0)
+        return;
+    if (ran > FAIR_MAX_CHARGE)
+        ran = FAIR_MAX_CHARGE;
+
+    thread->sched.fair.vruntime += (uint32_t)ran *
+        ((FAIR_NICE0_WEIGHT * FAIR_VRT_TICK) / thread->sched.fair.weight);
+    thread->sched.fair.ts_last = thread->sched.ts_counter;
+}
+
+static void fair_update_min_vruntime(struct sched_fair * fair)
+{
+    struct thread_info * first = RB_MIN(fairrunq, &fair->runq_head);
+
+    if (first && first->sched.fair.vruntime > fair->min_vruntime) {
+        fair->min_vruntime = first->sched.fair.vruntime;
+    }
+}
+
+static int fair_insert(struct scheduler * sobj, struct thread_info * thread)
+{
+    struct sched_fair * fair = containerof(sobj, struct sched_fair, sched);
+    const uint64_t credit = (uint64_t)fair_sleeper_credit * FAIR_VRT_TICK;
+    uint64_t floor;
+
+    if (thread_test_polflag(thread, SCHED_POLFLAG_INFAIRRQ))
+        return 0;
+
+    /*
+     * Place the thread relative to the current min_vruntime. A new thread
+     * starts from min_vruntime, and so does a thread switched from another
+     * policy as the policy data is shared with the other schedulers. A
+     * thread that has been sleeping gets a small credit so interactive
+     * threads are selected soon after they wake up, but it can't bank the
+     * time it was sleeping.
+     */
+    floor = (fair->min_vruntime > credit) ? fair->min_vruntime - credit : 0;
+    if (thread->sched.sobj != sobj || thread->sched.fair.vruntime == 0)
+        thread->sched.fair.vruntime = fair->min_vruntime;
+    else if (thread->sched.fair.vruntime < floor)
+        thread->sched.fair.vruntime = floor;
+
+    thread->sched.fair.weight = get_weight(thread);
+    thread->sched.ts_counter = 0;
+    thread->sched.fair.ts_last = 0;
+    RB_INSERT(fairrunq, &fair->runq_head, thread);
+    thread->sched.policy_flags |= SCHED_POLFLAG_INFAIRRQ;
+    fair->total_weight += thread->sched.fair.weight;
+    fair->nr_active++;
+
+    return 0;
+}
+
+static void fair_runq_remove(struct sched_fair * fair,
+                             struct thread_info * thread)
+{
+    if (fair->curr == thread) {
+        fair_update_curr(fair, thread);
+        fair->curr = NULL;
+    }
+
+    RB_REMOVE(fairrunq, &fair->runq_head, thread);
+    thread->sched.policy_flags &= ~SCHED_POLFLAG_INFAIRRQ;
+    fair->total_weight -= thread->sched.fair.weight;
+    fair->nr_active--;
+}
+
+/**
+ * Remove a thread that became blocked, dead or was removed.
+ * Detached dead threads are only queued here and freed later in
+ * fair_schedule().
+ */
+static void fair_remove(struct scheduler * sobj, struct thread_info * thread)
+{
+    struct sched_fair * fair = containerof(sobj, struct sched_fair, sched);
+
+    if (thread_test_polflag(thread, SCHED_POLFLAG_INFAIRDQ)) {
+        TAILQ_REMOVE(&fair->deadq_head, thread, FAIRDEADQ_ENTRY);
+        thread->sched.policy_flags &= ~SCHED_POLFLAG_INFAIRDQ;
+        return;
+    }
+
+    if (!thread_test_polflag(thread, SCHED_POLFLAG_INFAIRRQ))
+        return;
+
+    fair_runq_remove(fair, thread);
+    if (thread_state_get(thread) == THREAD_STATE_DEAD &&
+        thread_flags_is_set(thread, SCHED_IN_USE_FLAG) &&
+        thread_flags_is_set(thread, SCHED_DETACH_FLAG)) {
+        TAILQ_INSERT_TAIL(&fair->deadq_head, thread, FAIRDEADQ_ENTRY);
+        thread->sched.policy_flags |= SCHED_POLFLAG_INFAIRDQ;
+    }
+}
+
+static void fair_thread_act(struct sched_fair * fair,
+                            struct thread_info * thread,
+                            enum thread_state state)
+{
+    switch (state) {
+    case THREAD_STATE_READY:
+        /* Thread already in readyq */
+    case THREAD_STATE_BLOCKED:
+        fair_runq_remove(fair, thread);
+        break;
+    case THREAD_STATE_DEAD:
+        fair_runq_remove(fair, thread);
+        if (thread_flags_is_set(thread, SCHED_DETACH_FLAG))
+            thread_remove(thread->id);
+        break;
+    default:
+        KERROR(KERROR_ERR, "Thread (%d) state: %d\n", thread->id, state);
+        panic("Inconsistent thread state");
+    }
+}
+
+static void fair_reap(struct sched_fair * fair)
+{
+    struct thread_info * thread;
+
+    while ((thread = TAILQ_FIRST(&fair->deadq_head))) {
+        TAILQ_REMOVE(&fair->deadq_head, thread, FAIRDEADQ_ENTRY);
+        thread->sched.policy_flags &= ~SCHED_POLFLAG_INFAIRDQ;
+        thread_remove(thread->id);
+    }
+}
+
+static inline int fair_is_runnable(struct thread_info * thread)
+{
+    return thread_flags_is_set(thread, SCHED_IN_USE_FLAG) &&
+           thread_state_get(thread) == THREAD_STATE_EXEC;
+}
+
+/**
+ * Get the leftmost runnable thread in the run queue.
+ */
+static struct thread_info * fair_first(struct sched_fair * fair)
+{
+    struct thread_info * thread;
+
+    while ((thread = RB_MIN(fairrunq, &fair->runq_head))) {
+        if (fair_is_runnable(thread))
+            break;
+        fair_thread_act(fair, thread, thread_state_get(thread));
+    }
+
+    return thread;
+}
+
+static struct thread_info * fair_schedule(struct scheduler * sobj)
+{
+    struct sched_fair * fair = containerof(sobj, struct sched_fair, sched);
+    struct thread_info * curr = fair->curr;
+    struct thread_info * yielded = NULL;
+    struct thread_info * next;
+
+    fair_reap(fair);
+
+    if (curr) {
+        fair->curr = NULL;
+        fair_update_curr(fair, curr);
+
+        if (fair_is_runnable(curr)) {
+            /* Reposition by the new vruntime. */
+            RB_REMOVE(fairrunq, &fair->runq_head, curr);
+            RB_INSERT(fairrunq, &fair->runq_head, curr);
+
+            if (thread_flags_is_set(curr, SCHED_YIELD_FLAG)) {
+                thread_flags_clear(curr, SCHED_YIELD_FLAG);
+                yielded = curr;
+            } else if (curr->sched.ts_counter > 0) {
+                /* Slice left, keep running. */
+                fair->curr = curr;
+                return curr;
+            }
+        }
+    }
+
+    next = fair_first(fair);
+    if (!next)
+        return NULL;
+
+    if (next == yielded) {
+        struct thread_info * alt = RB_NEXT(fairrunq, &fair->runq_head, next);
+
+        if (alt && fair_is_runnable(alt))
+            next = alt;
+    }
+
+    fair_update_min_vruntime(fair);
+    next->sched.ts_counter = get_slice(fair, next);
+    next->sched.fair.ts_last = next->sched.ts_counter;
+    fair->curr = next;
+
+    return next;
+}
+
+static unsigned get_nr_active(struct scheduler * sobj)
+{
+    struct sched_fair * fair = containerof(sobj, struct sched_fair, sched);
+
+    return fair->nr_active;
+}
+
+/**
+ * Initializer struct for a fair scheduler.
+ */
+static const struct sched_fair sched_fair_init = {
+    .sched.name = "sched_fair",
+    .sched.insert = fair_insert,
+    .sched.run = fair_schedule,
+    .sched.get_nr_active_threads = get_nr_active,
+    .sched.remove = fair_remove,
+};
+
+struct scheduler * sched_create_fair(void)
+{
+    struct sched_fair * sched;
+
+    sched = kmalloc(sizeof(struct sched_fair));
+    if (!sched)
+        return NULL;
+
+    *sched = sched_fair_init; /* init */
+    RB_INIT(&sched->runq_head);
+    TAILQ_INIT(&sched->deadq_head);
+
+    return &sched->sched;
+}
@@ -31,6 +31,7 @@
  */
 
 #include <stddef.h>
+#include <bitmap.h>
 #include <kerror.h>
 #include <kmalloc.h>
 #include <ksched.h>
@@ -38,13 +39,30 @@
 #include <thread.h>
 
 #define SCHED_POLFLAG_INRRRQ  0x01 /*!< Thread in run queue. */
+#define SCHED_POLFLAG_INRRDQ  0x02 /*!< Thread in dead queue. */
 
 #define RRRUNQ_ENTRY    sched.rr.runq_entry_
 
+/**
+ * Number of priority levels and run queues.
+ */
+#define RR_NR_PRIO      (NICE_MAX - NICE_MIN + 1)
+
+TAILQ_HEAD(rr_runq, thread_info);
+
 struct sched_rr {
     struct scheduler sched;
     unsigned nr_active;
-    TAILQ_HEAD(runq, thread_info) runq_head;
+    /**
+     * Bitmap of non-empty run queues.
+     * Bit 0 corresponds to the highest priority, NICE_MIN.
+     */
+    bitmap_t prio_map[E2BITMAP_SIZE(RR_NR_PRIO) + 1];
+    struct rr_runq runq_head[RR_NR_PRIO];
+    /**
+     * Detached threads removed while dead, waiting to be freed.
+     */
+    struct rr_runq deadq_head;
 };
 
 static inline int get_tts(struct thread_info * thread)
@@ -52,12 +70,28 @@ static inline int get_tts(struct thread_info * thread)
     return 21 + thread_p_get_scheduling_priority(thread);
 }
 
+static inline int get_prio_index(struct thread_info * thread)
+{
+    int prio = thread_p_get_scheduling_priority(thread);
+
+    if (prio < NICE_MIN)
+        prio = NICE_MIN;
+    else if (prio > NICE_MAX)
+        prio = NICE_MAX;
+
+    return prio - NICE_MIN;
+}
+
 static int rr_insert(struct scheduler * sobj, struct thread_info * thread)
 {
     struct sched_rr * rr = containerof(sobj, struct sched_rr, sched);
 
     if (!thread_test_polflag(thread, SCHED_POLFLAG_INRRRQ)) {
-        TAILQ_INSERT_TAIL(&rr->runq_head, thread, RRRUNQ_ENTRY);
+        const int i = get_prio_index(thread);
+
+        TAILQ_INSERT_TAIL(&rr->runq_head[i], thread, RRRUNQ_ENTRY);
+        bitmap_set(rr->prio_map, i, sizeof(rr->prio_map));
+        thread->sched.rr.prio = i;
         thread->sched.ts_counter = get_tts(thread);
         thread->sched.policy_flags |= SCHED_POLFLAG_INRRRQ;
         rr->nr_active++;
@@ -66,35 +100,56 @@ static int rr_insert(struct scheduler * sobj, struct thread_info * thread)
     return 0;
 }
 
+static void rr_runq_remove(struct sched_rr * rr, struct thread_info * thread)
+{
+    const int i = thread->sched.rr.prio;
+
+    TAILQ_REMOVE(&rr->runq_head[i], thread, RRRUNQ_ENTRY);
+    if (TAILQ_EMPTY(&rr->runq_head[i]))
+        bitmap_clear(rr->prio_map, i, sizeof(rr->prio_map));
+    thread->sched.policy_flags &= ~SCHED_POLFLAG_INRRRQ;
+    rr->nr_active--;
+}
+
+/**
+ * Remove a thread that became blocked, dead or was removed.
+ * The remove callback can be called from any context, so detached dead
+ * threads are only queued here and freed later in rr_schedule().
+ */
 static void rr_remove(struct scheduler * sobj, struct thread_info * thread)
 {
     struct sched_rr * rr = containerof(sobj, struct sched_rr, sched);
 
-    if (thread_test_polflag(thread, SCHED_POLFLAG_INRRRQ)) {
-        TAILQ_REMOVE(&rr->runq_head, thread, RRRUNQ_ENTRY);
-        thread->sched.policy_flags &= ~SCHED_POLFLAG_INRRRQ;
-        rr->nr_active--;
+    if (thread_test_polflag(thread, SCHED_POLFLAG_INRRDQ)) {
+        /* Removed by someone else before we got to reap it. */
+        TAILQ_REMOVE(&rr->deadq_head, thread, RRRUNQ_ENTRY);
+        thread->sched.policy_flags &= ~SCHED_POLFLAG_INRRDQ;
+        return;
+    }
+
+    if (!thread_test_polflag(thread, SCHED_POLFLAG_INRRRQ))
+        return;
+
+    rr_runq_remove(rr, thread);
+    if (thread_state_get(thread) == THREAD_STATE_DEAD &&
+        thread_flags_is_set(thread, SCHED_IN_USE_FLAG) &&
+        thread_flags_is_set(thread, SCHED_DETACH_FLAG)) {
+        TAILQ_INSERT_TAIL(&rr->deadq_head, thread, RRRUNQ_ENTRY);
+        thread->sched.policy_flags |= SCHED_POLFLAG_INRRDQ;
     }
 }
 
-static void rr_thread_act(struct scheduler * sobj, struct thread_info * thread,
+static void rr_thread_act(struct sched_rr * rr, struct thread_info * thread,
                           enum thread_state state)
 {
     switch (state) {
     case THREAD_STATE_READY:
         /* Thread already in readyq */
-        rr_remove(sobj, thread);
-        break;
-    case THREAD_STATE_EXEC:
-        if (thread->sched.ts_counter <= 0) {
-            thread->sched.ts_counter = get_tts(thread);
-        }
-        break;
     case THREAD_STATE_BLOCKED:
-        rr_remove(sobj, thread);
+        rr_runq_remove(rr, thread);
         break;
     case THREAD_STATE_DEAD:
-        rr_remove(sobj, thread);
+        rr_runq_remove(rr, thread);
         if (thread_flags_is_set(thread, SCHED_DETACH_FLAG))
             thread_remove(thread->id);
         break;
@@ -104,28 +159,77 @@ static void rr_thread_act(struct scheduler * sobj, struct thread_info * thread,
     }
 }
 
-static struct thread_info * rr_schedule(struct scheduler * sobj)
+/**
+ * Free the detached dead threads removed by rr_remove().
+ */
+static void rr_reap(struct sched_rr * rr)
 {
-    struct sched_rr * rr = containerof(sobj, struct sched_rr, sched);
+    struct thread_info * thread;
+
+    while ((thread = TAILQ_FIRST(&rr->deadq_head))) {
+        TAILQ_REMOVE(&rr->deadq_head, thread, RRRUNQ_ENTRY);
+        thread->sched.policy_flags &= ~SCHED_POLFLAG_INRRDQ;
+        thread_remove(thread->id);
+    }
+}
+
+/**
+ * Select the next thread from a single priority level.
+ * The head of the queue is the next thread to run; threads that yield or
+ * have exhausted their time slice are rotated to the tail.
+ */
+static struct thread_info * rr_schedule_runq(struct sched_rr * rr, int i)
+{
+    struct rr_runq * runq = &rr->runq_head[i];
+    struct thread_info * first_yield = NULL;
     struct thread_info * next;
-    struct thread_info * tmp;
 
-    TAILQ_FOREACH_SAFE(next, &rr->runq_head, RRRUNQ_ENTRY, tmp) {
+    while ((next = TAILQ_FIRST(runq)) && next != first_yield) {
         const enum thread_state state = thread_state_get(next);
-        const int yield = thread_flags_is_set(next, SCHED_YIELD_FLAG);
 
-        if (thread_flags_not_set(next, SCHED_IN_USE_FLAG)) {
-            rr_thread_act(sobj, next, state);
+        if (thread_flags_not_set(next, SCHED_IN_USE_FLAG) ||
+            state != THREAD_STATE_EXEC) {
+            rr_thread_act(rr, next, state);
             continue;
         }
 
-        if (!yield) {
-            if (state == THREAD_STATE_EXEC && next->sched.ts_counter > 0) {
-                return next;
-            }
-            rr_thread_act(sobj, next, state);
-        } else {
+        if (thread_flags_is_set(next, SCHED_YIELD_FLAG)) {
             thread_flags_clear(next, SCHED_YIELD_FLAG);
+            if (!first_yield)
+                first_yield = next;
+        } else if (next->sched.ts_counter > 0) {
+            return next;
+        } else {
+            next->sched.ts_counter = get_tts(next);
+        }
+
+        TAILQ_REMOVE(runq, next, RRRUNQ_ENTRY);
+        TAILQ_INSERT_TAIL(runq, next, RRRUNQ_ENTRY);
+    }
+
+    return NULL;
+}
+
+static struct thread_info * rr_schedule(struct scheduler * sobj)
+{
+    struct sched_rr * rr = containerof(sobj, struct sched_rr, sched);
+    const size_t words = num_elem(rr->prio_map);
+    struct thread_info * next;
+    size_t w;
+
+    rr_reap(rr);
+
+    for (w = 0; w < words; w++) {
+        bitmap_t map = rr->prio_map[w];
+
+        while (map) {
+            const int bit = ffs(map) - 1;
+            const int i = w * (sizeof(bitmap_t) * 8) + bit;
+
+            next = rr_schedule_runq(rr, i);
+            if (next)
+                return next;
+            map &= ~((bitmap_t)1 << bit);
         }
     }
 
@@ -147,18 +251,23 @@ static const struct sched_rr sched_rr_init = {
     .sched.insert = rr_insert,
     .sched.run = rr_schedule,
     .sched.get_nr_active_threads = get_nr_active,
+    .sched.remove = rr_remove,
 };
 
 struct scheduler * sched_create_rr(void)
 {
     struct sched_rr * sched;
+    size_t i;
 
     sched = kmalloc(sizeof(struct sched_rr));
     if (!sched)
         return NULL;
 
     *sched = sched_rr_init; /* init */
-    TAILQ_INIT(&sched->runq_head);
+    for (i = 0; i < num_elem(sched->runq_head); i++) {
+        TAILQ_INIT(&sched->runq_head[i]);
+    }
+    TAILQ_INIT(&sched->deadq_head);
 
     return &sched->sched;
 }
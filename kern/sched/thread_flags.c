@@ -32,6 +32,7 @@
 
 #include <hal/core.h>
 #include <kerror.h>
+#include <ksched.h>
 #include <thread.h>
 
 int thread_flags_set(struct thread_info * thread, uint32_t flags_mask)
@@ -103,5 +104,10 @@ enum thread_state thread_state_set(struct thread_info * thread,
         thread->sched.state = state;
     mtx_unlock(&thread->sched.tdlock);
 
+    if (old_state != state && old_state != THREAD_STATE_DEAD &&
+        (state == THREAD_STATE_BLOCKED || state == THREAD_STATE_DEAD)) {
+        sched_runq_remove(thread);
+    }
+
     return old_state;
 }
@@ -42,6 +42,7 @@
 #include <proc.h>
 #include <thread.h>
 #include <vm/vm.h>
+#include <vm/vm_pgcache.h>
 
 static mtx_t sync_lock;
 static pthread_t sync_thread_tid;
@@ -122,6 +123,34 @@ static int mmap_file(file_t * file, size_t blkno, size_t bsize,
     return 0;
 }
 
+/**
+ * Map a regular file shared through the page cache of the file.
+ * @param file is the file to be memory mapped.
+ * @param pgno is the page number of the first page mapped.
+ * @param bsize is the size of the mapping.
+ * @param bp_out is a pointer to a buf pointer than should be written if
+ *               mmap is succesful.
+ * @param Return 0 if succeed; Otherwise a negative errno value is returned.
+ */
+static int mmap_pgcache(file_t * file, size_t pgno, size_t bsize,
+                        struct buf ** bp_out)
+{
+    struct vm_pgcache * pgc;
+    struct buf * bp;
+
+    pgc = vm_pgcache_ref(file->vnode, 1);
+    if (!pgc)
+        return -ENOMEM;
+
+    bp = vm_pgcache_newregion(pgc, pgno, bsize);
+    vm_pgcache_unref(pgc);
+    if (!bp)
+        return -ENOMEM;
+
+    *bp_out = bp;
+    return 0;
+}
+
 int shmem_mmap(struct proc_info * proc, uintptr_t vaddr, size_t bsize, int prot,
              int flags, int fildes, off_t off, struct buf ** out, char ** uaddr)
 {
@@ -177,6 +206,15 @@ int shmem_mmap(struct proc_info * proc, uintptr_t vaddr, size_t bsize, int prot,
         if (err)
             goto errout;
 
+        if (S_ISREG(vnode->vn_mode) &&
+            (flags & (MAP_SHARED | MAP_PRIVATE)) == MAP_SHARED) {
+            /* Shared file mappings are demand paged from the page cache. */
+            blksize = MMU_PGSIZE_COARSE;
+            bsize = memalign_size(bsize + off % blksize, blksize);
+            err = mmap_pgcache(file, off / blksize, bsize, &bp);
+            goto mapped;
+        }
+
         blksize = statbuf.st_blksize;
         bsize = memalign_size(bsize, blksize);
 
@@ -192,6 +230,7 @@ int shmem_mmap(struct proc_info * proc, uintptr_t vaddr, size_t bsize, int prot,
         } else { /* Use the generic mmap function. */
             err = mmap_file(file, blkno, bsize, flags, &bp);
         }
+mapped:
         fs_fildes_ref(proc->files, fildes, -1);
 errout:
         if (err)
@@ -233,7 +272,7 @@ errout:
     /*
      * Insert bp to the periodic sync list if necessary/allowed.
      */
-    if (!(bp->b_flags & B_NOSYNC)) {
+    if (!(bp->b_flags & B_NOSYNC) && !bp->b_pages) {
         mtx_lock(&sync_lock);
         LIST_INSERT_HEAD(&shmem_sync_list, bp, shmem_entry_);
         mtx_unlock(&sync_lock);
@@ -253,7 +292,8 @@ int shmem_munmap(struct buf * bp, size_t size)
 
     /* TODO unmapping the region from the process should be moved to here */
 
-    if (!(flags & B_NOSYNC)) {
+    /* Page cache regions are synced by the page cache. */
+    if (!(flags & B_NOSYNC) && !bp->b_pages) {
         mtx_lock(&sync_lock);
         LIST_REMOVE(bp, shmem_entry_);
         mtx_unlock(&sync_lock);
@@ -309,6 +349,9 @@ static void * shmem_sync_thread(void * arg)
         }
 
         mtx_unlock(&sync_lock);
+
+        /* Only the dirty pages of shared file mappings are written. */
+        vm_pgcache_sync_all();
     }
 
     return NULL;
@@ -376,11 +419,10 @@ static intptr_t sys_munmap(__user void * user_args)
     }
 
     regnr = vm_find_reg(curproc, (uintptr_t)args.addr, &bp);
-    if (!bp) {
+    if (regnr < 0) {
         retval = -EINVAL;
         goto fail;
     }
-    vm_replace_region(curproc, NULL, regnr, 0);
 
     /*
      * RFE
@@ -389,13 +431,15 @@ static intptr_t sys_munmap(__user void * user_args)
      * to do fancy things like expecting page allocation, allocating a big chunk
      * and the trying to unmap it partially to change some of the pages.
      */
-    if (args.size == 0 || args.size == bp->b_bcount) {
-        shmem_munmap(bp, args.size);
-    } else {
+    if (args.size != 0 && args.size != bp->b_bcount) {
         retval = -EINVAL;
         goto fail;
     }
 
+    /* The reference of the process is released by shmem_munmap(). */
+    vm_replace_region(curproc, NULL, regnr, VM_INSOP_NOFREE);
+    shmem_munmap(bp, args.size);
+
     retval = 0;
 fail:
     if (retval != 0) {
@@ -0,0 +1,181 @@
+/**
+ * @file test_blkq.c
+ * @brief Test block device request queues.
+ */
+
+#include <errno.h>
+#include <kunit.h>
+#include <kstring.h>
+#include <buf.h>
+#include <fs/blkq.h>
+#include <fs/devfs.h>
+#include <fs/fs.h>
+
+#define BLOCK_SIZE  16
+#define NR_BLOCKS   8
+
+static uint8_t disk[NR_BLOCKS * BLOCK_SIZE];
+static struct dev_info dev;
+static int nr_calls;
+static off_t last_blkno;
+static size_t last_bcount;
+
+static ssize_t fake_read(struct dev_info * devnfo, off_t blkno,
+                         uint8_t * buf, size_t bcount, int oflags)
+{
+    nr_calls++;
+    last_blkno = blkno;
+    last_bcount = bcount;
+    memcpy(buf, disk + blkno * BLOCK_SIZE, bcount);
+
+    return bcount;
+}
+
+static ssize_t fake_write(struct dev_info * devnfo, off_t blkno,
+                          uint8_t * buf, size_t bcount, int oflags)
+{
+    nr_calls++;
+    last_blkno = blkno;
+    last_bcount = bcount;
+    memcpy(disk + blkno * BLOCK_SIZE, buf, bcount);
+
+    return bcount;
+}
+
+static void setup(void)
+{
+    memset(&dev, 0, sizeof(dev));
+    strlcpy(dev.dev_name, "blkqtest", sizeof(dev.dev_name));
+    dev.block_size = BLOCK_SIZE;
+    dev.num_blocks = NR_BLOCKS;
+    dev.flags = DEV_FLAGS_MB_READ | DEV_FLAGS_MB_WRITE;
+    dev.read = fake_read;
+    dev.write = fake_write;
+
+    for (size_t i = 0; i < sizeof(disk); i++) {
+        disk[i] = (uint8_t)i;
+    }
+    nr_calls = 0;
+
+    blkq_create(&dev);
+}
+
+static void teardown(void)
+{
+    blkq_destroy(&dev);
+}
+
+static char * test_rw(void)
+{
+    uint8_t in[2 * BLOCK_SIZE];
+    uint8_t out[2 * BLOCK_SIZE];
+
+    ku_test_description("Test synchronous transfers through a queue.");
+
+    ku_assert("queue created", dev.blkq);
+
+    memset(in, 0xa5, sizeof(in));
+    ku_assert_equal("write ok",
+                    (int)blkq_rw(&dev, BLK_REQ_WRITE, 2, in, sizeof(in), 0),
+                    (int)sizeof(in));
+    ku_assert_equal("read ok",
+                    (int)blkq_rw(&dev, BLK_REQ_READ, 2, out, sizeof(out), 0),
+                    (int)sizeof(out));
+    ku_assert("data ok", !memcmp(in, out, sizeof(in)));
+
+    return NULL;
+}
+
+static char * test_merge(void)
+{
+    struct blk_req req[3];
+    uint8_t buf[3][BLOCK_SIZE];
+    const off_t order[] = { 5, 3, 4 };
+
+    ku_test_description("Test that adjacent requests are sorted and merged.");
+
+    blkq_plug(&dev);
+    for (int i = 0; i < 3; i++) {
+        req[i] = (struct blk_req){
+            .br_dev = &dev,
+            .br_blkno = order[i],
+            .br_buf = buf[i],
+            .br_bcount = BLOCK_SIZE,
+            .br_flags = BLK_REQ_READ,
+        };
+        blkq_submit(&req[i]);
+    }
+    ku_assert_equal("held while plugged", nr_calls, 0);
+    blkq_unplug(&dev);
+
+    for (int i = 0; i < 3; i++) {
+        ku_assert_equal("read ok", (int)blkq_wait(&req[i]), BLOCK_SIZE);
+        ku_assert("data ok",
+                  !memcmp(buf[i], disk + order[i] * BLOCK_SIZE, BLOCK_SIZE));
+    }
+    ku_assert_equal("single transfer", nr_calls, 1);
+    ku_assert_equal("blkno", (int)last_blkno, 3);
+    ku_assert_equal("bcount", (int)last_bcount, 3 * BLOCK_SIZE);
+    ku_assert_equal("merged", (int)dev.blkq->bq_nr_merged, 2);
+
+    return NULL;
+}
+
+static char * test_no_mb(void)
+{
+    uint8_t out[3 * BLOCK_SIZE];
+
+    ku_test_description("Test that transfers are split for single block devices.");
+
+    dev.flags = 0;
+    ku_assert_equal("read ok",
+                    (int)blkq_rw(&dev, BLK_REQ_READ, 1, out, sizeof(out), 0),
+                    (int)sizeof(out));
+    ku_assert_equal("split", nr_calls, 3);
+    ku_assert("data ok", !memcmp(out, disk + BLOCK_SIZE, sizeof(out)));
+
+    return NULL;
+}
+
+static char * test_bio_readahead(void)
+{
+    vnode_t * vn;
+    struct buf * bp;
+
+    ku_test_description("Test that bio read-ahead is merged by the queue.");
+
+    ku_assert_equal("device created", make_dev(&dev, 0, 0, 0666, &vn), 0);
+
+    /* The second sequential read starts read-ahead of blocks 3 and 4. */
+    ku_assert_equal("read 1", bread(vn, 1, BLOCK_SIZE, &bp), 0);
+    brelse(bp);
+    ku_assert_equal("read 2", bread(vn, 2, BLOCK_SIZE, &bp), 0);
+    ku_assert_equal("data ok", ((uint8_t *)bp->b_data)[0], 2 * BLOCK_SIZE);
+    brelse(bp);
+
+    bp = getblk(vn, 4, BLOCK_SIZE, 0);
+    ku_assert("read-ahead buffer", bp);
+    ku_assert("read-ahead done", bp->b_flags & B_DONE);
+    ku_assert_equal("read-ahead data ok", ((uint8_t *)bp->b_data)[0],
+                    4 * BLOCK_SIZE);
+    brelse(bp);
+
+    ku_assert("read-ahead merged", dev.blkq->bq_nr_merged > 0);
+
+    /* Drop the buffers before the device goes away. */
+    bio_vnode_cleanup(vn);
+    destroy_dev(vn);
+    vrele(vn);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_rw, KU_RUN);
+    ku_def_test(test_merge, KU_RUN);
+    ku_def_test(test_no_mb, KU_RUN);
+    ku_def_test(test_bio_readahead, KU_RUN);
+}
+
+TEST_MODULE(fs, blkq);
@@ -4,78 +4,64 @@
  */
 
 #include <kunit.h>
+#include <errno.h>
 #include <kmalloc.h>
 #include <fs/fs.h>
 #include <fs/dehtable.h>
 
-#define get_dirent(dea, offset) ((dh_dirent_t *)((size_t)(dea) + (offset)))
-
 static dh_table_t table;
 
 static void setup(void)
 {
-    memset(table, 0, sizeof(dh_table_t));
+    dh_init(&table);
 }
 
 static void teardown(void)
 {
+    dh_destroy_all(&table);
 }
 
 static char * test_link(void)
 {
 #define str "test"
-    size_t i;
     vnode_t vnode;
-    dh_dirent_t * dea;
+    ino_t nnum;
 
     ku_test_description("Test that dh_link works correctly.");
 
     vnode.vn_num = 10;
-    dh_link(&table, vnode.vn_num, 0, str);
-
-    for (i = 0; i < DEHTABLE_SIZE; i++) {
-        if ((dea = table[i]) != 0) break;
-    }
-    ku_assert("Created chain found.", dea != 0);
+    ku_assert_equal("Insert succeeded.",
+                    dh_link(&table, vnode.vn_num, 0, str), 0);
+    ku_assert_equal("Entry count updated.", (int)dh_nr_entries(&table), 1);
+    ku_assert_equal("Duplicate is rejected.",
+                    dh_link(&table, vnode.vn_num, 0, str), -EEXIST);
 
+    ku_assert_equal("Entry found.", dh_lookup(&table, str, &nnum), 0);
     ku_assert_equal("Entry has a correct vnode number.",
-                    (int)dea[0].dh_ino, (int)vnode.vn_num);
+                    (int)nnum, (int)vnode.vn_num);
 
 #undef str
     return NULL;
 }
 
-static char * test_link_chain(void)
+static char * test_unlink(void)
 {
 #define str1 "test"
 #define str2 "teest"
-    size_t i;
-    int res;
-    vnode_t vnode1;
-    vnode_t vnode2;
-    dh_dirent_t * dea;
-    size_t offset;
-
-    ku_test_description("Test that dh_link chaining works correctly.");
-
-    vnode1.vn_num = 10;
-    vnode2.vn_num = 11;
+    ino_t nnum;
 
-    res = dh_link(&table, vnode1.vn_num, 0, str1);
-    ku_assert_equal("Insert succeeded.", res, 0);
-    res = dh_link(&table, vnode2.vn_num, 0, str2);
-    ku_assert_equal("Insert succeeded.", res, 0);
+    ku_test_description("Test that dh_unlink removes only the given link.");
 
-    for (i = 0; i < DEHTABLE_SIZE; i++) {
-        if ((dea = table[i]) != 0) break;
-    }
-    ku_assert("Created chain found.", dea != 0);
+    ku_assert_equal("Insert succeeded.", dh_link(&table, 10, 0, str1), 0);
+    ku_assert_equal("Insert succeeded.", dh_link(&table, 11, 0, str2), 0);
 
-    ku_assert_equal("First entry has a correct vnode number.",
-                    (int)get_dirent(dea, 0)->dh_ino, (int)vnode1.vn_num);
-    offset = get_dirent(dea, 0)->dh_size;
-    ku_assert_equal("Second entry has a correct vnode number.",
-                    (int)get_dirent(dea, offset)->dh_ino, (int)vnode2.vn_num);
+    ku_assert_equal("Unlink succeeded.", dh_unlink(&table, str1), 0);
+    ku_assert_equal("Unlinked entry not found.",
+                    dh_lookup(&table, str1, NULL), -ENOENT);
+    ku_assert_equal("Other entry found.", dh_lookup(&table, str2, &nnum), 0);
+    ku_assert_equal("vnode num equal.", (int)nnum, 11);
+    ku_assert_equal("Second unlink fails.", dh_unlink(&table, str1), -ENOENT);
+    ku_assert_equal("Entry count updated.", (int)dh_nr_entries(&table), 1);
 
 #undef str1
 #undef str2
@@ -150,7 +136,7 @@ static char * test_iterator(void)
         it = dh_get_iter(&table);
 
         /* Loop the iterator */
-        for (i = 0; i < DEHTABLE_SIZE; i++) {
+        for (i = 0; i < 10; i++) {
             dh_dirent_t * entry = dh_iter_next(&it);
 
             if (!entry)
@@ -168,12 +154,90 @@ static char * test_iterator(void)
     return NULL;
 }
 
+#define NR_RESIZE_ENTRIES 500
+
+static char * test_resize(void)
+{
+    char name[16];
+    size_t i;
+
+    ku_test_description("Test that the table grows and shrinks.");
+
+    for (i = 0; i < NR_RESIZE_ENTRIES; i++) {
+        ksprintf(name, sizeof(name), "f%u", (unsigned)i);
+        ku_assert_equal("Insert OK.", dh_link(&table, i, 0, name), 0);
+    }
+    ku_assert("Table has grown.", table.dh_new.b_size > DEHTABLE_MIN_SIZE);
+
+    for (i = 0; i < NR_RESIZE_ENTRIES; i++) {
+        ino_t nnum;
+
+        ksprintf(name, sizeof(name), "f%u", (unsigned)i);
+        ku_assert_equal("Entry found.", dh_lookup(&table, name, &nnum), 0);
+        ku_assert_equal("vnode num equal.", (int)nnum, (int)i);
+    }
+
+    for (i = 0; i < NR_RESIZE_ENTRIES; i++) {
+        ksprintf(name, sizeof(name), "f%u", (unsigned)i);
+        ku_assert_equal("Unlink OK.", dh_unlink(&table, name), 0);
+    }
+    ku_assert_equal("Table is empty.", (int)dh_nr_entries(&table), 0);
+    ku_assert("Table has shrunk.",
+              table.dh_new.b_size < 4 * DEHTABLE_MIN_SIZE);
+
+    return NULL;
+}
+
+static char * test_iterator_resize(void)
+{
+    char name[16];
+    size_t i, n = 0;
+    dh_dir_iter_t it;
+    dh_dirent_t * entry;
+    uint8_t found[NR_RESIZE_ENTRIES];
+
+    ku_test_description("Test that an iterator survives resizing.");
+
+    memset(found, 0, sizeof(found));
+    for (i = 0; i < NR_RESIZE_ENTRIES / 2; i++) {
+        ksprintf(name, sizeof(name), "f%u", (unsigned)i);
+        ku_assert_equal("Insert OK.", dh_link(&table, i, 0, name), 0);
+    }
+
+    it = dh_get_iter(&table);
+    while ((entry = dh_iter_next(&it))) {
+        ku_assert("Valid inode number.", entry->dh_ino < NR_RESIZE_ENTRIES);
+        found[entry->dh_ino]++;
+
+        /* Force resizes while iterating. */
+        if (n++ == 10) {
+            for (i = NR_RESIZE_ENTRIES / 2; i < NR_RESIZE_ENTRIES; i++) {
+                ksprintf(name, sizeof(name), "f%u", (unsigned)i);
+                ku_assert_equal("Insert OK.",
+                                dh_link(&table, i, 0, name), 0);
+            }
+        }
+    }
+
+    for (i = 0; i < NR_RESIZE_ENTRIES / 2; i++) {
+        ku_assert_equal("Old entries returned exactly once.",
+                        (int)found[i], 1);
+    }
+    for (; i < NR_RESIZE_ENTRIES; i++) {
+        ku_assert("New entries returned at most once.", found[i] <= 1);
+    }
+
+    return NULL;
+}
+
 static void all_tests(void)
 {
     ku_def_test(test_link, KU_RUN);
-    ku_def_test(test_link_chain, KU_SKIP);
+    ku_def_test(test_unlink, KU_RUN);
     ku_def_test(test_lookup, KU_RUN);
     ku_def_test(test_iterator, KU_RUN);
+    ku_def_test(test_resize, KU_RUN);
+    ku_def_test(test_iterator_resize, KU_RUN);
 }
 
 TEST_MODULE(fs, dehtable);
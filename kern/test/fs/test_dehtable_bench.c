@@ -0,0 +1,164 @@
+/**
+ * @file test_dehtable_bench.c
+ * @brief Benchmark directory entry hash table operations on large directories.
+ */
+
+#include <sys/time.h>
+#include <errno.h>
+#include <kunit.h>
+#include <kstring.h>
+#include <fs/fs.h>
+#include <fs/dehtable.h>
+
+#define NR_BENCH_ENTRIES 4000
+
+static dh_table_t table;
+static struct timespec start;
+
+static void setup(void)
+{
+    dh_init(&table);
+}
+
+static void teardown(void)
+{
+    dh_destroy_all(&table);
+}
+
+static void bench_start(void)
+{
+    nanotime(&start);
+}
+
+static void bench_end(const char * op, size_t n)
+{
+    struct timespec end, diff;
+    unsigned usec;
+
+    nanotime(&end);
+    timespec_sub(&diff, &end, &start);
+    usec = (unsigned)diff.tv_sec * 1000000 + (unsigned)diff.tv_nsec / 1000;
+
+    printf("%s: %u ops in %u us, %u buckets\n",
+           op, (unsigned)n, usec, (unsigned)table.dh_new.b_size);
+}
+
+static void bench_name(char * name, size_t size, size_t i)
+{
+    ksprintf(name, size, "file%u", (unsigned)i);
+}
+
+static char * link_all(void)
+{
+    char name[16];
+    size_t i;
+
+    for (i = 0; i < NR_BENCH_ENTRIES; i++) {
+        bench_name(name, sizeof(name), i);
+        ku_assert_equal("Insert OK.", dh_link(&table, i, 0, name), 0);
+    }
+
+    return NULL;
+}
+
+static char * test_bench_link(void)
+{
+    char * err;
+
+    ku_test_description("Benchmark dh_link on a large directory.");
+
+    bench_start();
+    err = link_all();
+    bench_end("dh_link", NR_BENCH_ENTRIES);
+
+    return err;
+}
+
+static char * test_bench_lookup(void)
+{
+    char name[16];
+    char * err;
+    size_t i;
+
+    ku_test_description("Benchmark dh_lookup on a large directory.");
+
+    err = link_all();
+    if (err)
+        return err;
+
+    bench_start();
+    for (i = 0; i < NR_BENCH_ENTRIES; i++) {
+        ino_t nnum;
+
+        bench_name(name, sizeof(name), i);
+        ku_assert_equal("Entry found.", dh_lookup(&table, name, &nnum), 0);
+        ku_assert_equal("vnode num equal.", (int)nnum, (int)i);
+    }
+    bench_end("dh_lookup", NR_BENCH_ENTRIES);
+
+    bench_start();
+    for (i = 0; i < NR_BENCH_ENTRIES; i++) {
+        ksprintf(name, sizeof(name), "nofile%u", (unsigned)i);
+        ku_assert_equal("Entry not found.",
+                        dh_lookup(&table, name, NULL), -ENOENT);
+    }
+    bench_end("dh_lookup miss", NR_BENCH_ENTRIES);
+
+    return NULL;
+}
+
+static char * test_bench_iter(void)
+{
+    dh_dir_iter_t it;
+    char * err;
+    size_t n = 0;
+
+    ku_test_description("Benchmark iterating a large directory.");
+
+    err = link_all();
+    if (err)
+        return err;
+
+    bench_start();
+    it = dh_get_iter(&table);
+    while (dh_iter_next(&it)) {
+        n++;
+    }
+    bench_end("dh_iter_next", n);
+    ku_assert_equal("All entries iterated.", (int)n, NR_BENCH_ENTRIES);
+
+    return NULL;
+}
+
+static char * test_bench_unlink(void)
+{
+    char name[16];
+    char * err;
+    size_t i;
+
+    ku_test_description("Benchmark dh_unlink on a large directory.");
+
+    err = link_all();
+    if (err)
+        return err;
+
+    bench_start();
+    for (i = 0; i < NR_BENCH_ENTRIES; i++) {
+        bench_name(name, sizeof(name), i);
+        ku_assert_equal("Unlink OK.", dh_unlink(&table, name), 0);
+    }
+    bench_end("dh_unlink", NR_BENCH_ENTRIES);
+    ku_assert_equal("Table is empty.", (int)dh_nr_entries(&table), 0);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_bench_link, KU_RUN);
+    ku_def_test(test_bench_lookup, KU_RUN);
+    ku_def_test(test_bench_iter, KU_RUN);
+    ku_def_test(test_bench_unlink, KU_RUN);
+}
+
+TEST_MODULE(fs, dehtable_bench);
@@ -0,0 +1,321 @@
+/**
+ * @file test_fatfs.c
+ * @brief Test fatfs on a memory disk.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <kunit.h>
+#include <kstring.h>
+#include <sys/stat.h>
+#include <buf.h>
+#include <fs/fs.h>
+#include <fs/md.h>
+#include <kmalloc.h>
+#include <proc.h>
+#include <uio.h>
+
+static void setup(void)
+{
+}
+
+static void teardown(void)
+{
+}
+
+#define FAT_NSECT   64
+#define FAT_MP      "fattest"
+#define FAT_DATA_SECT 4 /* Sector of cluster 2. */
+
+static const char fat_file_data[] = "Hello from a memory disk\n";
+
+static void st_word(uint8_t * p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+/*
+ * Build a FAT12 image with one sector per cluster, two FATs, a one sector
+ * root directory, a file HELLO.TXT in cluster 2 and a file HOLE.BIN in
+ * cluster 3. Cluster n is at sector FAT_DATA_SECT + n - 2.
+ */
+static void build_fat12(uint8_t * img)
+{
+    uint8_t * bs = img;
+    uint8_t * fat;
+    uint8_t * dir = img + 3 * MD_BLOCK_SIZE;
+
+    memset(img, 0, FAT_NSECT * MD_BLOCK_SIZE);
+
+    bs[0] = 0xEB;
+    bs[1] = 0x3C;
+    bs[2] = 0x90;
+    memcpy(bs + 3, "MSDOS5.0", 8);
+    st_word(bs + 11, MD_BLOCK_SIZE);    /* BPB_BytsPerSec */
+    bs[13] = 1;                         /* BPB_SecPerClus */
+    st_word(bs + 14, 1);                /* BPB_RsvdSecCnt */
+    bs[16] = 2;                         /* BPB_NumFATs */
+    st_word(bs + 17, MD_BLOCK_SIZE / 32); /* BPB_RootEntCnt */
+    st_word(bs + 19, FAT_NSECT);        /* BPB_TotSec16 */
+    bs[21] = 0xF8;                      /* BPB_Media */
+    st_word(bs + 22, 1);                /* BPB_FATSz16 */
+    st_word(bs + 24, 32);               /* BPB_SecPerTrk */
+    st_word(bs + 26, 1);                /* BPB_NumHeads */
+    bs[38] = 0x29;                      /* BS_BootSig */
+    memcpy(bs + 43, "NO NAME    ", 11);
+    memcpy(bs + 54, "FAT12   ", 8);
+    bs[510] = 0x55;
+    bs[511] = 0xAA;
+
+    /*
+     * Entries 0 and 1 are reserved, both files are single cluster chains.
+     */
+    for (int i = 0; i < 2; i++) {
+        fat = img + (1 + i) * MD_BLOCK_SIZE;
+        fat[0] = 0xF8;
+        fat[1] = 0xFF;
+        fat[2] = 0xFF;
+        fat[3] = 0xFF;
+        fat[4] = 0xFF;
+        fat[5] = 0xFF;
+    }
+
+    memcpy(dir, "HELLO   TXT", 11);
+    dir[11] = 0x20;                     /* AM_ARC */
+    st_word(dir + 26, 2);               /* DIR_FstClusLO */
+    st_word(dir + 28, sizeof(fat_file_data) - 1); /* DIR_FileSize */
+
+    dir += 32;
+    memcpy(dir, "HOLE    BIN", 11);
+    dir[11] = 0x20;
+    st_word(dir + 26, 3);
+    st_word(dir + 28, MD_BLOCK_SIZE);
+
+    memcpy(img + FAT_DATA_SECT * MD_BLOCK_SIZE, fat_file_data,
+           sizeof(fat_file_data) - 1);
+    memset(img + (FAT_DATA_SECT + 1) * MD_BLOCK_SIZE, 0xee, MD_BLOCK_SIZE);
+}
+
+static struct md_dev * fat_md;
+
+/**
+ * Create a memory disk with a FAT12 image and mount it to FAT_MP.
+ */
+static int fat_mount(void)
+{
+    uint8_t * img;
+    char src[16];
+    vnode_t * vn;
+    int err;
+
+    err = md_create(FAT_NSECT * MD_BLOCK_SIZE, &fat_md);
+    if (err)
+        return err;
+
+    img = kmalloc(FAT_NSECT * MD_BLOCK_SIZE);
+    if (!img)
+        return -ENOMEM;
+    build_fat12(img);
+    err = md_load(fat_md, img, FAT_NSECT * MD_BLOCK_SIZE);
+    kfree(img);
+    if (err)
+        return err;
+
+    err = fs_mkdir_curproc("/" FAT_MP, S_IRWXU);
+    if (err)
+        return err;
+    err = lookup_vnode(&vn, curproc->croot, FAT_MP, O_DIRECTORY);
+    if (err)
+        return err;
+    ksprintf(src, sizeof(src), "/dev/md%d", fat_md->md_unit);
+    err = fs_mount(vn, src, "fatfs", 0, NULL, 0);
+    vrele(vn);
+
+    return err;
+}
+
+static int fat_umount(void)
+{
+    vnode_t * root;
+    int err;
+
+    err = lookup_vnode(&root, curproc->croot, FAT_MP, O_DIRECTORY);
+    if (err)
+        return err;
+    vrele(root);
+    err = fs_umount(root->sb);
+    if (err)
+        return err;
+
+    return fs_rmdir_curproc("/" FAT_MP);
+}
+
+static ssize_t fat_pread(file_t * file, void * buf, size_t count, off_t off)
+{
+    struct uio uio;
+
+    file->vnode->vnode_ops->lseek(file, off, SEEK_SET);
+    uio_init_kbuf(&uio, buf, count);
+    return file->vnode->vnode_ops->read(file, &uio, count);
+}
+
+static ssize_t fat_pwrite(file_t * file, void * buf, size_t count, off_t off)
+{
+    struct uio uio;
+
+    file->vnode->vnode_ops->lseek(file, off, SEEK_SET);
+    uio_init_kbuf(&uio, buf, count);
+    return file->vnode->vnode_ops->write(file, &uio, count);
+}
+
+static uint8_t * fat_sector(size_t sect)
+{
+    return (uint8_t *)fat_md->md_buf->b_data + sect * MD_BLOCK_SIZE;
+}
+
+static char * test_fatfs(void)
+{
+    char buf[sizeof(fat_file_data)];
+    vnode_t * vn;
+    file_t * file;
+    int fd;
+    ssize_t n;
+
+    ku_test_description("Test that a FAT image on a memory disk can be read.");
+
+    ku_assert_equal("mounted", fat_mount(), 0);
+    ku_assert_equal("busy while mounted", md_destroy(fat_md), -EBUSY);
+
+    ku_assert_equal("lookup file",
+                    lookup_vnode(&vn, curproc->croot, FAT_MP "/HELLO.TXT",
+                                 O_RDONLY), 0);
+    fd = fs_fildes_create_curproc(vn, O_RDONLY);
+    vrele(vn);
+    ku_assert("file opened", fd >= 0);
+    file = fs_fildes_ref(curproc->files, fd, 1);
+    n = fat_pread(file, buf, sizeof(buf), 0);
+    fs_fildes_ref(curproc->files, fd, -1);
+    fs_fildes_close(curproc, fd);
+    ku_assert_equal("read", (int)n, sizeof(fat_file_data) - 1);
+    ku_assert("data ok", !memcmp(buf, fat_file_data, n));
+
+    ku_assert_equal("unmounted", fat_umount(), 0);
+    ku_assert_equal("destroyed", md_destroy(fat_md), 0);
+
+    return NULL;
+}
+
+static char * test_fatfs_clmap(void)
+{
+    static uint8_t data[4 * MD_BLOCK_SIZE];
+    static uint8_t out[4 * MD_BLOCK_SIZE];
+    vnode_t * root;
+    vnode_t * vn;
+    file_t * file;
+    int fd, err;
+
+    ku_test_description("Test fatfs multi-cluster writes over a fragmented "
+                        "free space.");
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i / MD_BLOCK_SIZE + 1);
+    }
+
+    ku_assert_equal("mounted", fat_mount(), 0);
+    ku_assert_equal("lookup root",
+                    lookup_vnode(&root, curproc->croot, FAT_MP, O_DIRECTORY),
+                    0);
+    err = root->vnode_ops->create(root, "DATA.BIN", S_IRUSR | S_IWUSR, &vn);
+    vrele(root);
+    ku_assert_equal("created", err, 0);
+    fd = fs_fildes_create_curproc(vn, O_RDWR);
+    vrele(vn);
+    ku_assert("file opened", fd >= 0);
+    file = fs_fildes_ref(curproc->files, fd, 1);
+
+    /*
+     * The free clusters are 2, 4, 5, 6... so the write must be clipped
+     * after the first cluster and the rest written to 4-6 at once.
+     */
+    ku_assert_equal("write", (int)fat_pwrite(file, data, sizeof(data), 0),
+                    sizeof(data));
+    ku_assert("cluster 2",
+              !memcmp(fat_sector(FAT_DATA_SECT), data, MD_BLOCK_SIZE));
+    ku_assert_equal("hole intact", fat_sector(FAT_DATA_SECT + 1)[0], 0xee);
+    ku_assert("clusters 4-6",
+              !memcmp(fat_sector(FAT_DATA_SECT + 2), data + MD_BLOCK_SIZE,
+                      3 * MD_BLOCK_SIZE));
+
+    /* Seek through the map. */
+    ku_assert_equal("read at cluster 3",
+                    (int)fat_pread(file, out, MD_BLOCK_SIZE,
+                                   3 * MD_BLOCK_SIZE),
+                    MD_BLOCK_SIZE);
+    ku_assert("data ok", !memcmp(out, data + 3 * MD_BLOCK_SIZE, MD_BLOCK_SIZE));
+    ku_assert_equal("read over the gap",
+                    (int)fat_pread(file, out, 2 * MD_BLOCK_SIZE, 100),
+                    2 * MD_BLOCK_SIZE);
+    ku_assert("data ok", !memcmp(out, data + 100, 2 * MD_BLOCK_SIZE));
+
+    fs_fildes_ref(curproc->files, fd, -1);
+    fs_fildes_close(curproc, fd);
+
+    ku_assert_equal("unmounted", fat_umount(), 0);
+    ku_assert_equal("destroyed", md_destroy(fat_md), 0);
+
+    return NULL;
+}
+
+static char * test_fatfs_scache_mirror(void)
+{
+    static uint8_t data[MD_BLOCK_SIZE];
+    vnode_t * root;
+    vnode_t * vn;
+    file_t * file;
+    int fd, err;
+
+    ku_test_description("Test that a FAT sector stays dirty in the sector "
+                        "cache if writing a FAT mirror fails.");
+
+    memset(data, 0x55, sizeof(data));
+
+    ku_assert_equal("mounted", fat_mount(), 0);
+    fat_md->md_bad_blk = 2; /* The second FAT. */
+
+    ku_assert_equal("lookup root",
+                    lookup_vnode(&root, curproc->croot, FAT_MP, O_DIRECTORY),
+                    0);
+    err = root->vnode_ops->create(root, "DATA.BIN", S_IRUSR | S_IWUSR, &vn);
+    vrele(root);
+    ku_assert_equal("created", err, 0);
+    fd = fs_fildes_create_curproc(vn, O_RDWR);
+    vrele(vn);
+    ku_assert("file opened", fd >= 0);
+    file = fs_fildes_ref(curproc->files, fd, 1);
+    ku_assert_equal("write", (int)fat_pwrite(file, data, sizeof(data), 0),
+                    sizeof(data));
+    fs_fildes_ref(curproc->files, fd, -1);
+    fs_fildes_close(curproc, fd); /* Syncs the volume. */
+
+    ku_assert("mirror not written",
+              memcmp(fat_sector(1), fat_sector(2), MD_BLOCK_SIZE));
+
+    /* The FAT sector is written again on umount. */
+    fat_md->md_bad_blk = -1;
+    ku_assert_equal("unmounted", fat_umount(), 0);
+    ku_assert("mirror written",
+              !memcmp(fat_sector(1), fat_sector(2), MD_BLOCK_SIZE));
+    ku_assert_equal("destroyed", md_destroy(fat_md), 0);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_fatfs, KU_RUN);
+    ku_def_test(test_fatfs_clmap, KU_RUN);
+    ku_def_test(test_fatfs_scache_mirror, KU_RUN);
+}
+
+TEST_MODULE(fs, fatfs);
@@ -0,0 +1,207 @@
+/**
+ * @file test_fs_queue.c
+ * @brief Test fs queues.
+ */
+
+#include <errno.h>
+#include <kunit.h>
+#include <kstring.h>
+#include <fs/fs_queue.h>
+#include <thread.h>
+
+#define NR_BLOCKS   3
+#define BLOCK_SIZE  16
+
+static struct fs_queue * fsq;
+
+static void setup(void)
+{
+    fsq = fs_queue_create(NR_BLOCKS, BLOCK_SIZE);
+}
+
+static void teardown(void)
+{
+    fs_queue_destroy(fsq);
+}
+
+static char * test_write_read(void)
+{
+    uint8_t in[] = "hello";
+    uint8_t out[sizeof(in)];
+
+    ku_test_description("Test that written data can be read back.");
+
+    ku_assert("fsq created", fsq);
+    ku_assert_equal("write ok",
+                    (int)fs_queue_write(fsq, in, sizeof(in),
+                                        FS_QUEUE_FLAGS_NONBLOCK),
+                    (int)sizeof(in));
+
+    memset(out, 0, sizeof(out));
+    ku_assert_equal("read ok",
+                    (int)fs_queue_read(fsq, out, sizeof(out),
+                                       FS_QUEUE_FLAGS_NONBLOCK),
+                    (int)sizeof(in));
+    ku_assert_str_equal("data ok", (char *)out, (char *)in);
+
+    return NULL;
+}
+
+static char * test_read_empty(void)
+{
+    uint8_t out[4];
+
+    ku_test_description("Test nonblocking read of an empty queue.");
+
+    ku_assert_equal("EAGAIN",
+                    (int)fs_queue_read(fsq, out, sizeof(out),
+                                       FS_QUEUE_FLAGS_NONBLOCK),
+                    -EAGAIN);
+
+    return NULL;
+}
+
+static char * test_write_full(void)
+{
+    uint8_t in[(NR_BLOCKS - 1) * BLOCK_SIZE + 1];
+    uint8_t out[sizeof(in)];
+    ssize_t n;
+
+    ku_test_description("Test nonblocking write to a full queue.");
+
+    for (size_t i = 0; i < sizeof(in); i++) {
+        in[i] = (uint8_t)i;
+    }
+
+    n = fs_queue_write(fsq, in, sizeof(in), FS_QUEUE_FLAGS_NONBLOCK);
+    ku_assert_equal("short write", (int)n, (NR_BLOCKS - 1) * BLOCK_SIZE);
+    ku_assert_equal("EAGAIN",
+                    (int)fs_queue_write(fsq, in, 1, FS_QUEUE_FLAGS_NONBLOCK),
+                    -EAGAIN);
+
+    ku_assert_equal("read all",
+                    (int)fs_queue_read(fsq, out, sizeof(out),
+                                       FS_QUEUE_FLAGS_NONBLOCK),
+                    (int)n);
+    ku_assert("data ok", !memcmp(in, out, n));
+
+    return NULL;
+}
+
+static char * test_partial_read(void)
+{
+    uint8_t in[] = "abcdef";
+    uint8_t out[3];
+
+    ku_test_description("Test that a packet can be read in parts.");
+
+    fs_queue_write(fsq, in, 6, FS_QUEUE_FLAGS_NONBLOCK);
+
+    ku_assert_equal("read 3",
+                    (int)fs_queue_read(fsq, out, 3, FS_QUEUE_FLAGS_NONBLOCK),
+                    3);
+    ku_assert("first part", !memcmp(out, "abc", 3));
+    ku_assert_equal("read 3",
+                    (int)fs_queue_read(fsq, out, 3, FS_QUEUE_FLAGS_NONBLOCK),
+                    3);
+    ku_assert("second part", !memcmp(out, "def", 3));
+
+    return NULL;
+}
+
+static char * test_packet_mode(void)
+{
+    uint8_t out[BLOCK_SIZE];
+
+    ku_test_description("Test that packet reads don't cross packets.");
+
+    fs_queue_write(fsq, (uint8_t *)"ab", 2, FS_QUEUE_FLAGS_PACKET |
+                                            FS_QUEUE_FLAGS_NONBLOCK);
+    fs_queue_write(fsq, (uint8_t *)"cd", 2, FS_QUEUE_FLAGS_PACKET |
+                                            FS_QUEUE_FLAGS_NONBLOCK);
+
+    ku_assert_equal("first packet",
+                    (int)fs_queue_read(fsq, out, sizeof(out),
+                                       FS_QUEUE_FLAGS_PACKET |
+                                       FS_QUEUE_FLAGS_NONBLOCK),
+                    2);
+    ku_assert("first data", !memcmp(out, "ab", 2));
+    ku_assert_equal("second packet",
+                    (int)fs_queue_read(fsq, out, sizeof(out),
+                                       FS_QUEUE_FLAGS_PACKET |
+                                       FS_QUEUE_FLAGS_NONBLOCK),
+                    2);
+    ku_assert("second data", !memcmp(out, "cd", 2));
+
+    return NULL;
+}
+
+static uint8_t blk_in[BLOCK_SIZE];
+static int blk_written;
+
+static void * blocking_writer(void * arg)
+{
+    blk_written = (int)fs_queue_write(fsq, blk_in, sizeof(blk_in), 0);
+
+    return NULL;
+}
+
+static char * test_blocking_write(void)
+{
+    struct sched_param param = {
+        .sched_policy = SCHED_RR,
+        .sched_priority = 0,
+    };
+    uint8_t in[(NR_BLOCKS - 1) * BLOCK_SIZE];
+    uint8_t out[sizeof(in)];
+    int tries;
+
+    ku_test_description("Test that a reader can empty a queue while a "
+                        "writer is blocked on it.");
+
+    memset(in, 'a', sizeof(in));
+    memset(blk_in, 'b', sizeof(blk_in));
+    blk_written = 0;
+
+    ku_assert_equal("fill",
+                    (int)fs_queue_write(fsq, in, sizeof(in),
+                                        FS_QUEUE_FLAGS_NONBLOCK),
+                    (int)sizeof(in));
+
+    ku_assert("writer created",
+              kthread_create("fsq_test_wr", &param, 0, blocking_writer,
+                             NULL) >= 0);
+    /* Give the writer a chance to block on the full queue. */
+    thread_sleep(10);
+    ku_assert_equal("writer blocked", blk_written, 0);
+
+    ku_assert_equal("blocking read",
+                    (int)fs_queue_read(fsq, out, sizeof(out), 0),
+                    (int)sizeof(out));
+    ku_assert("data ok", !memcmp(in, out, sizeof(out)));
+
+    for (tries = 100; blk_written == 0 && tries > 0; tries--) {
+        thread_sleep(10);
+    }
+    ku_assert_equal("writer done", blk_written, (int)sizeof(blk_in));
+
+    ku_assert_equal("read written",
+                    (int)fs_queue_read(fsq, out, sizeof(out),
+                                       FS_QUEUE_FLAGS_NONBLOCK),
+                    (int)sizeof(blk_in));
+    ku_assert("written data ok", !memcmp(blk_in, out, sizeof(blk_in)));
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_write_read, KU_RUN);
+    ku_def_test(test_read_empty, KU_RUN);
+    ku_def_test(test_write_full, KU_RUN);
+    ku_def_test(test_partial_read, KU_RUN);
+    ku_def_test(test_packet_mode, KU_RUN);
+    ku_def_test(test_blocking_write, KU_RUN);
+}
+
+TEST_MODULE(fs, fs_queue);
@@ -0,0 +1,175 @@
+/**
+ * @file test_md.c
+ * @brief Test memory disks.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <kunit.h>
+#include <kstring.h>
+#include <sys/time.h>
+#include <fs/blkq.h>
+#include <fs/fs.h>
+#include <fs/md.h>
+#include <kerror.h>
+#include <proc.h>
+
+#define NR_BLOCKS   8
+
+static struct md_dev * md;
+
+static void setup(void)
+{
+    md = NULL;
+    (void)md_create(NR_BLOCKS * MD_BLOCK_SIZE, &md);
+}
+
+static void teardown(void)
+{
+    int err;
+
+    if (md && (err = md_destroy(md)))
+        KERROR(KERROR_ERR, "Failed to destroy md%d (%d)\n", md->md_unit, err);
+}
+
+static char * test_create(void)
+{
+    char name[SPECNAMELEN];
+
+    ku_test_description("Test that a memory disk can be created.");
+
+    ku_assert("md created", md);
+    ksprintf(name, sizeof(name), "md%d", md->md_unit);
+    ku_assert_str_equal("name ok", md->dev.dev_name, name);
+    ku_assert_equal("num_blocks", (int)md->dev.num_blocks, NR_BLOCKS);
+    ku_assert("found by unit", md_get(md->md_unit) == md);
+    ku_assert("has a queue", md->dev.blkq);
+
+    return NULL;
+}
+
+static char * test_destroy(void)
+{
+    char path[SPECNAMELEN + 5];
+    struct vnode * vn;
+    int unit;
+
+    ku_test_description("Test that a memory disk can be destroyed.");
+
+    ku_assert("md created", md);
+    unit = md->md_unit;
+
+    /* A cached lookup of the device file must not keep the disk busy. */
+    ksprintf(path, sizeof(path), "/dev/%s", md->dev.dev_name);
+    ku_assert_equal("lookup",
+                    lookup_vnode(&vn, curproc->croot, path, O_RDONLY), 0);
+    vrele(vn);
+
+    ku_assert_equal("destroyed", md_destroy(md), 0);
+    md = NULL;
+    ku_assert("not found", !md_get(unit));
+
+    ku_assert_equal("unit reused", md_create(MD_BLOCK_SIZE, &md), 0);
+    ku_assert_equal("same unit", md->md_unit, unit);
+
+    return NULL;
+}
+
+static char * test_load(void)
+{
+    uint8_t image[2 * MD_BLOCK_SIZE];
+    uint8_t out[MD_BLOCK_SIZE];
+
+    ku_test_description("Test that an image can be loaded and read back.");
+
+    for (size_t i = 0; i < sizeof(image); i++) {
+        image[i] = (uint8_t)(i * 7);
+    }
+    ku_assert_equal("load ok", md_load(md, image, sizeof(image)), 0);
+    ku_assert_equal("too large", md_load(md, image, md->md_size + 1), -EFBIG);
+
+    ku_assert_equal("read ok",
+                    (int)blkq_rw(&md->dev, BLK_REQ_READ, 1, out, sizeof(out),
+                                 0),
+                    (int)sizeof(out));
+    ku_assert("data ok", !memcmp(out, image + MD_BLOCK_SIZE, sizeof(out)));
+
+    return NULL;
+}
+
+static char * test_bounds(void)
+{
+    uint8_t buf[2 * MD_BLOCK_SIZE];
+
+    ku_test_description("Test transfers at the end of a memory disk.");
+
+    memset(buf, 0, sizeof(buf));
+    ku_assert_equal("clipped read",
+                    (int)blkq_rw(&md->dev, BLK_REQ_READ, NR_BLOCKS - 1,
+                                 buf, sizeof(buf), 0),
+                    MD_BLOCK_SIZE);
+    ku_assert_equal("EOF",
+                    (int)blkq_rw(&md->dev, BLK_REQ_READ, NR_BLOCKS,
+                                 buf, MD_BLOCK_SIZE, 0),
+                    0);
+    ku_assert_equal("ENOSPC",
+                    (int)blkq_rw(&md->dev, BLK_REQ_WRITE, NR_BLOCKS,
+                                 buf, MD_BLOCK_SIZE, 0),
+                    -ENOSPC);
+
+    return NULL;
+}
+
+static char * test_bad_blk(void)
+{
+    uint8_t buf[2 * MD_BLOCK_SIZE];
+
+    ku_test_description("Test that writes to a bad block fail.");
+
+    memset(buf, 0, sizeof(buf));
+    md->md_bad_blk = 1;
+    ku_assert_equal("write before",
+                    (int)blkq_rw(&md->dev, BLK_REQ_WRITE, 0,
+                                 buf, MD_BLOCK_SIZE, 0),
+                    MD_BLOCK_SIZE);
+    ku_assert_equal("EIO",
+                    (int)blkq_rw(&md->dev, BLK_REQ_WRITE, 0,
+                                 buf, sizeof(buf), 0),
+                    -EIO);
+    ku_assert_equal("read ok",
+                    (int)blkq_rw(&md->dev, BLK_REQ_READ, 1,
+                                 buf, MD_BLOCK_SIZE, 0),
+                    MD_BLOCK_SIZE);
+
+    return NULL;
+}
+
+static char * test_latency(void)
+{
+    uint8_t buf[MD_BLOCK_SIZE];
+    struct timespec start, end, diff;
+
+    ku_test_description("Test injected latency.");
+
+    md->md_lat_us = 2000;
+    nanotime(&start);
+    blkq_rw(&md->dev, BLK_REQ_READ, 0, buf, sizeof(buf), 0);
+    nanotime(&end);
+    timespec_sub(&diff, &end, &start);
+
+    ku_assert("delayed", diff.tv_sec > 0 || diff.tv_nsec >= 2000000);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_create, KU_RUN);
+    ku_def_test(test_destroy, KU_RUN);
+    ku_def_test(test_load, KU_RUN);
+    ku_def_test(test_bounds, KU_RUN);
+    ku_def_test(test_bad_blk, KU_RUN);
+    ku_def_test(test_latency, KU_RUN);
+}
+
+TEST_MODULE(fs, md);
@@ -0,0 +1,116 @@
+/**
+ * @file test_namecache.c
+ * @brief Test the directory name lookup cache.
+ */
+
+#include <errno.h>
+#include <kunit.h>
+#include <fs/fs.h>
+#include <fs/namecache.h>
+
+static int delete_vnode(vnode_t * vnode)
+{
+    return 0;
+}
+
+static struct fs_superblock sb = {
+    .delete_vnode = delete_vnode,
+};
+static vnode_t dir;
+static vnode_t file;
+
+static void setup(void)
+{
+    dir.sb = &sb;
+    file.sb = &sb;
+    vrefset(&dir, 1);
+    vrefset(&file, 1);
+}
+
+static void teardown(void)
+{
+    namecache_purge_sb(&sb);
+}
+
+static char * test_positive(void)
+{
+    vnode_t * vn = NULL;
+    int err;
+
+    ku_test_description("Test that a positive entry can be found.");
+
+    namecache_enter(&dir, "file", 4, &file, namecache_gen());
+    ku_assert_equal("Cache holds a ref", vrefcnt(&file), 2);
+
+    err = namecache_lookup(&dir, "file", 4, &vn);
+    ku_assert_equal("Positive hit", err, 0);
+    ku_assert_ptr_equal("Correct vnode", vn, &file);
+    ku_assert_equal("Ref taken", vrefcnt(&file), 3);
+    vrele(vn);
+
+    err = namecache_lookup(&dir, "fil", 3, &vn);
+    ku_assert_equal("Prefix is a miss", err, -EAGAIN);
+
+    return NULL;
+}
+
+static char * test_negative(void)
+{
+    vnode_t * vn = NULL;
+    int err;
+
+    ku_test_description("Test that a negative entry can be found.");
+
+    namecache_enter(&dir, "nofile", 6, NULL, namecache_gen());
+
+    err = namecache_lookup(&dir, "nofile", 6, &vn);
+    ku_assert_equal("Negative hit", err, -ENOENT);
+    ku_assert_ptr_equal("No vnode returned", vn, NULL);
+
+    return NULL;
+}
+
+static char * test_purge(void)
+{
+    vnode_t * vn;
+    int err;
+
+    ku_test_description("Test that purged entries are not found.");
+
+    namecache_enter(&dir, "file", 4, &file, namecache_gen());
+    namecache_purge(&dir, "file", 4);
+
+    err = namecache_lookup(&dir, "file", 4, &vn);
+    ku_assert_equal("Miss after purge", err, -EAGAIN);
+
+    return NULL;
+}
+
+static char * test_stale_enter(void)
+{
+    vnode_t * vn;
+    unsigned gen;
+    int err;
+
+    ku_test_description("Test that an entry is dropped if the cache was purged after the lookup.");
+
+    gen = namecache_gen();
+    namecache_purge(&dir, "file", 4);
+    namecache_enter(&dir, "file", 4, &file, gen);
+
+    err = namecache_lookup(&dir, "file", 4, &vn);
+    ku_assert_equal("Stale entry not entered", err, -EAGAIN);
+    ku_assert_equal("No ref leaked", vrefcnt(&file), 1);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_positive, KU_RUN);
+    ku_def_test(test_negative, KU_RUN);
+    ku_def_test(test_purge, KU_RUN);
+    ku_def_test(test_stale_enter, KU_RUN);
+}
+
+TEST_MODULE(fs, namecache);
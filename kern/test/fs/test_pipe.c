@@ -0,0 +1,225 @@
+/**
+ * @file test_pipe.c
+ * @brief Test pipes.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <kunit.h>
+#include <kstring.h>
+#include <limits.h>
+#include <fs/fs.h>
+#include <kern_ipc.h>
+#include <proc.h>
+#include <uio.h>
+
+#define REG_NAME "pipetest.dat"
+
+static int fildes[2];
+static file_t * rd_file;
+static file_t * wr_file;
+static int reg_fd;
+static file_t * reg_file;
+static uint8_t in[3000];
+static uint8_t out[4096];
+
+static void setup(void)
+{
+    fildes[0] = -1;
+    fildes[1] = -1;
+    rd_file = NULL;
+    wr_file = NULL;
+    reg_fd = -1;
+    reg_file = NULL;
+
+    if (fs_pipe_curproc_creat(curproc->files, fildes, 0))
+        return;
+    rd_file = fs_fildes_ref(curproc->files, fildes[0], 1);
+    wr_file = fs_fildes_ref(curproc->files, fildes[1], 1);
+}
+
+static void teardown(void)
+{
+    if (rd_file)
+        fs_fildes_ref(curproc->files, fildes[0], -1);
+    if (wr_file)
+        fs_fildes_ref(curproc->files, fildes[1], -1);
+    if (fildes[0] >= 0)
+        fs_fildes_close(curproc, fildes[0]);
+    if (fildes[1] >= 0)
+        fs_fildes_close(curproc, fildes[1]);
+    if (reg_file)
+        fs_fildes_ref(curproc->files, reg_fd, -1);
+    if (reg_fd >= 0) {
+        fs_fildes_close(curproc, reg_fd);
+        curproc->croot->vnode_ops->unlink(curproc->croot, REG_NAME);
+    }
+}
+
+/**
+ * Create a regular file for testing splicing to and from a pipe.
+ */
+static int reg_create(void)
+{
+    vnode_t * croot = curproc->croot;
+    vnode_t * vn;
+    int err;
+
+    err = croot->vnode_ops->create(croot, REG_NAME, S_IRUSR | S_IWUSR, &vn);
+    if (err)
+        return err;
+    reg_fd = fs_fildes_create_curproc(vn, O_RDWR);
+    vrele(vn);
+    if (reg_fd < 0)
+        return reg_fd;
+    reg_file = fs_fildes_ref(curproc->files, reg_fd, 1);
+
+    return 0;
+}
+
+static ssize_t pipe_write(void * buf, size_t count)
+{
+    struct uio uio;
+
+    uio_init_kbuf(&uio, buf, count);
+    return wr_file->vnode->vnode_ops->write(wr_file, &uio, count);
+}
+
+static ssize_t pipe_read(void * buf, size_t count)
+{
+    struct uio uio;
+
+    uio_init_kbuf(&uio, buf, count);
+    return rd_file->vnode->vnode_ops->read(rd_file, &uio, count);
+}
+
+static char * test_wrap(void)
+{
+    ku_test_description("Test that data wraps around the ring buffer.");
+
+    ku_assert("pipe created", rd_file && wr_file);
+    ku_assert_equal("ring size", (int)rd_file->vnode->vn_len, 4096);
+
+    for (size_t i = 0; i < sizeof(in); i++) {
+        in[i] = (uint8_t)i;
+    }
+
+    ku_assert_equal("write", (int)pipe_write(in, sizeof(in)), sizeof(in));
+    ku_assert_equal("partial read", (int)pipe_read(out, 2000), 2000);
+    ku_assert("data ok", !memcmp(out, in, 2000));
+
+    /* The tail of this write wraps to the beginning of the ring. */
+    ku_assert_equal("write wraps", (int)pipe_write(in, sizeof(in)),
+                    sizeof(in));
+    ku_assert_equal("read all", (int)pipe_read(out, sizeof(out)), 4000);
+    ku_assert("first write ok", !memcmp(out, in + 2000, 1000));
+    ku_assert("wrapped write ok", !memcmp(out + 1000, in, sizeof(in)));
+
+    return NULL;
+}
+
+static char * test_nonblock(void)
+{
+    ssize_t n;
+
+    ku_test_description("Test non-blocking I/O on a full and empty pipe.");
+
+    ku_assert("pipe created", rd_file && wr_file);
+
+    rd_file->oflags |= O_NONBLOCK;
+    wr_file->oflags |= O_NONBLOCK;
+
+    ku_assert_equal("empty", (int)pipe_read(out, sizeof(out)), -EAGAIN);
+
+    memset(out, 0xaa, sizeof(out));
+    ku_assert_equal("fill", (int)pipe_write(out, sizeof(out)), sizeof(out));
+    ku_assert_equal("full", (int)pipe_write(in, 1), -EAGAIN);
+
+    /* A write of up to PIPE_BUF bytes is not split. */
+    ku_assert_equal("read", (int)pipe_read(out, PIPE_BUF - 1), PIPE_BUF - 1);
+    ku_assert_equal("atomic write", (int)pipe_write(in, PIPE_BUF), -EAGAIN);
+
+    /* A larger write is done partially. */
+    n = pipe_write(in, PIPE_BUF + 1);
+    ku_assert_equal("partial write", (int)n, PIPE_BUF - 1);
+
+    return NULL;
+}
+
+static char * test_eof(void)
+{
+    ku_test_description("Test that closing the write end gives EOF.");
+
+    ku_assert("pipe created", rd_file && wr_file);
+
+    ku_assert_equal("write", (int)pipe_write(in, 10), 10);
+    fs_fildes_ref(curproc->files, fildes[1], -1);
+    wr_file = NULL;
+    fs_fildes_close(curproc, fildes[1]);
+    fildes[1] = -1;
+
+    ku_assert_equal("data before EOF", (int)pipe_read(out, sizeof(out)), 10);
+    ku_assert_equal("EOF", (int)pipe_read(out, sizeof(out)), 0);
+
+    return NULL;
+}
+
+static char * test_splice_offset(void)
+{
+    struct uio uio;
+    off_t off;
+
+    ku_test_description("Test splicing at an explicit file offset.");
+
+    ku_assert("pipe created", rd_file && wr_file);
+    ku_assert_equal("file created", reg_create(), 0);
+
+    uio_init_kbuf(&uio, "0123456789", 10);
+    ku_assert_equal("write file",
+                    (int)reg_file->vnode->vnode_ops->write(reg_file, &uio, 10),
+                    10);
+
+    /* Splice out of the pipe to the middle of the file. */
+    ku_assert_equal("write pipe", (int)pipe_write("abcd", 4), 4);
+    off = 3;
+    ku_assert_equal("splice out",
+                    (int)fs_pipe_splice_out(rd_file, reg_file, &off, 4, 0), 4);
+    ku_assert_equal("out offset advanced", (int)off, 7);
+    ku_assert_equal("seek pos kept", (int)reg_file->seek_pos, 10);
+
+    off = 0;
+    uio_init_kbuf(&uio, out, sizeof(out));
+    ku_assert_equal("read file",
+                    (int)fs_fildes_read_at(reg_file, &uio, 10, &off), 10);
+    ku_assert("file data ok", !memcmp(out, "012abcd789", 10));
+
+    /* Splice from the middle of the file into the pipe. */
+    off = 5;
+    ku_assert_equal("splice in",
+                    (int)fs_pipe_splice_in(wr_file, reg_file, &off, 3, 0), 3);
+    ku_assert_equal("in offset advanced", (int)off, 8);
+    ku_assert_equal("seek pos kept", (int)reg_file->seek_pos, 10);
+    ku_assert_equal("read pipe", (int)pipe_read(out, sizeof(out)), 3);
+    ku_assert("pipe data ok", !memcmp(out, "cd7", 3));
+
+    /* Peeking leaves the data in the pipe. */
+    ku_assert_equal("write pipe", (int)pipe_write("xy", 2), 2);
+    ku_assert_equal("peek",
+                    (int)fs_pipe_splice_out(rd_file, reg_file, NULL, 2,
+                                            PIPE_SPLICE_PEEK), 2);
+    ku_assert_equal("seek pos advanced", (int)reg_file->seek_pos, 12);
+    ku_assert_equal("data kept", (int)pipe_read(out, sizeof(out)), 2);
+    ku_assert("peeked data ok", !memcmp(out, "xy", 2));
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_wrap, KU_RUN);
+    ku_def_test(test_nonblock, KU_RUN);
+    ku_def_test(test_eof, KU_RUN);
+    ku_def_test(test_splice_offset, KU_RUN);
+}
+
+TEST_MODULE(fs, pipe);
@@ -0,0 +1,115 @@
+#include <kunit.h>
+#include <kmem_cache.h>
+#include <libkern.h>
+
+struct tobj {
+    int ctor_count;
+    int data;
+};
+
+static struct kmem_cache * cache;
+static int nr_dtor;
+
+static void tobj_ctor(void * p)
+{
+    struct tobj * obj = (struct tobj *)p;
+
+    obj->ctor_count++;
+}
+
+static void tobj_dtor(void * p)
+{
+    nr_dtor++;
+}
+
+static void setup(void)
+{
+    nr_dtor = 0;
+    cache = kmem_cache_create("unittest", sizeof(struct tobj), 0,
+                              tobj_ctor, tobj_dtor);
+}
+
+static void teardown(void)
+{
+    if (cache)
+        kmem_cache_destroy(cache);
+    cache = NULL;
+}
+
+static char * test_alloc_free(void)
+{
+    struct tobj * obj;
+
+    ku_assert("cache created", cache != NULL);
+
+    obj = kmem_cache_alloc(cache);
+    ku_assert("object allocated", obj != NULL);
+    ku_assert_equal("object constructed", obj->ctor_count, 1);
+    ku_assert_equal("live count", atomic_read(&cache->nr_live), 1);
+
+    kmem_cache_free(cache, obj);
+    ku_assert_equal("live count", atomic_read(&cache->nr_live), 0);
+    ku_assert_equal("peak count", cache->nr_peak, 1);
+
+    return NULL;
+}
+
+static char * test_reuse(void)
+{
+    struct tobj * obj1;
+    struct tobj * obj2;
+
+    obj1 = kmem_cache_alloc(cache);
+    ku_assert("object allocated", obj1 != NULL);
+    obj1->data = 42;
+    kmem_cache_free(cache, obj1);
+
+    obj2 = kmem_cache_alloc(cache);
+    ku_assert_ptr_equal("object reused", obj2, obj1);
+    ku_assert_equal("not reconstructed", obj2->ctor_count, 1);
+    ku_assert_equal("state preserved", obj2->data, 42);
+    kmem_cache_free(cache, obj2);
+
+    return NULL;
+}
+
+static char * test_grow(void)
+{
+    struct tobj * objs[100];
+    size_t i;
+
+    for (i = 0; i < num_elem(objs); i++) {
+        objs[i] = kmem_cache_alloc(cache);
+        ku_assert("object allocated", objs[i] != NULL);
+    }
+    ku_assert("cache has grown", cache->nr_total >= num_elem(objs));
+    for (i = 0; i < num_elem(objs); i++) {
+        kmem_cache_free(cache, objs[i]);
+    }
+    ku_assert_equal("all freed", atomic_read(&cache->nr_live), 0);
+
+    return NULL;
+}
+
+static char * test_destroy(void)
+{
+    size_t nr_total;
+
+    kmem_cache_free(cache, kmem_cache_alloc(cache));
+    nr_total = cache->nr_total;
+    kmem_cache_destroy(cache);
+    cache = NULL;
+    ku_assert_equal("all objects destructed", nr_dtor, (int)nr_total);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_alloc_free, KU_RUN);
+    ku_def_test(test_reuse, KU_RUN);
+    ku_def_test(test_grow, KU_RUN);
+    ku_def_test(test_destroy, KU_RUN);
+}
+
+TEST_MODULE(generic, kmem_cache);
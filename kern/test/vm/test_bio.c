@@ -4,18 +4,84 @@
  */
 
 #include <fcntl.h>
+#include <kstring.h>
 #include <buf.h>
+#include <fs/devfs.h>
 #include <fs/fs.h>
 #include <kunit.h>
 #include <libkern.h>
 #include <proc.h>
 
+/*
+ * A fake device filling each read with the 4 kB block number and recording
+ * the last write.
+ */
+static ssize_t biotest_read(struct dev_info * devnfo, off_t blkno,
+                            uint8_t * buf, size_t bcount, int oflags)
+{
+    memset(buf, (int)(blkno / 4096), bcount);
+
+    return bcount;
+}
+
+static off_t biotest_wr_off;
+static size_t biotest_wr_len;
+
+static ssize_t biotest_write(struct dev_info * devnfo, off_t blkno,
+                             uint8_t * buf, size_t bcount, int oflags)
+{
+    biotest_wr_off = blkno;
+    biotest_wr_len = bcount;
+
+    return bcount;
+}
+
+static struct dev_info biotest_dev = {
+    .drv_name = "biotest",
+    .dev_name = "biotest",
+    .flags = DEV_FLAGS_MB_READ | DEV_FLAGS_MB_WRITE,
+    .block_size = 1,
+    .read = biotest_read,
+    .write = biotest_write,
+};
+static vnode_t * vn_biotest;
+
+/*
+ * The same device addressed by 1 kB blocks.
+ */
+static struct dev_info biotest_blkdev = {
+    .drv_name = "biotest",
+    .dev_name = "biotestblk",
+    .flags = DEV_FLAGS_MB_READ | DEV_FLAGS_MB_WRITE,
+    .block_size = 1024,
+    .read = biotest_read,
+    .write = biotest_write,
+};
+static vnode_t * vn_biotestblk;
+
 static void setup(void)
 {
+    vn_biotest = NULL;
+    vn_biotestblk = NULL;
+    (void)make_dev(&biotest_dev, 0, 0, 0666, &vn_biotest);
+    (void)make_dev(&biotest_blkdev, 0, 0, 0666, &vn_biotestblk);
+}
+
+static void biotest_destroy(vnode_t * vn)
+{
+    if (!vn)
+        return;
+
+    /* Drop the buffers before the device goes away. */
+    bio_vnode_cleanup(vn);
+    destroy_dev(vn);
+    vrele(vn);
 }
 
 static void teardown(void)
 {
+    biotest_destroy(vn_biotest);
+    biotest_destroy(vn_biotestblk);
 }
 
 static char * test_geteblk(void)
@@ -87,11 +153,153 @@ static char * test_bread(void)
     return NULL;
 }
 
+static char * test_bread_readahead(void)
+{
+    struct buf * bp;
+    int err;
+
+    ku_test_description("Test that sequential bread() starts read-ahead.");
+
+    ku_assert("device created", vn_biotest);
+
+    err = bread(vn_biotest, 4096, 4096, &bp);
+    ku_assert_equal("no error", err, 0);
+    brelse(bp);
+    err = bread(vn_biotest, 8192, 4096, &bp);
+    ku_assert_equal("no error", err, 0);
+    ku_assert_equal("data ok", ((uint8_t *)bp->b_data)[0], 2);
+    brelse(bp);
+
+    ku_assert("next block is in core", incore(vn_biotest, 12288));
+
+    err = bread(vn_biotest, 12288, 4096, &bp);
+    ku_assert_equal("no error", err, 0);
+    ku_assert_equal("read-ahead data ok", ((uint8_t *)bp->b_data)[4095], 3);
+    brelse(bp);
+
+    return NULL;
+}
+
+static char * test_bread_readahead_blkdev(void)
+{
+    struct buf * bp;
+    int err;
+
+    ku_test_description("Test that read-ahead of a block device steps by "
+                        "device blocks.");
+
+    ku_assert("device created", vn_biotestblk);
+
+    err = bread(vn_biotestblk, 4, 4096, &bp);
+    ku_assert_equal("no error", err, 0);
+    brelse(bp);
+    err = bread(vn_biotestblk, 8, 4096, &bp);
+    ku_assert_equal("no error", err, 0);
+    brelse(bp);
+
+    ku_assert("next block is in core", incore(vn_biotestblk, 12));
+    ku_assert("not stepped by bytes", !incore(vn_biotestblk, 8 + 4096));
+
+    return NULL;
+}
+
+static char * test_markdirty(void)
+{
+    struct buf * bp;
+
+    ku_test_description("Test that bio_markdirty() merges dirty ranges.");
+
+    bp = geteblk(4096);
+    ku_assert("got a buffer", bp);
+
+    bio_markdirty(bp, 1024, 100);
+    ku_assert_equal("dirtyoff", bp->b_dirtyoff, 1024);
+    ku_assert_equal("dirtyend", bp->b_dirtyend, 1124);
+
+    bio_markdirty(bp, 100, 10);
+    ku_assert_equal("dirtyoff extended", bp->b_dirtyoff, 100);
+    ku_assert_equal("dirtyend kept", bp->b_dirtyend, 1124);
+
+    bio_markdirty(bp, 4000, 1000);
+    ku_assert_equal("dirtyend clamped", bp->b_dirtyend, 4096);
+
+    brelse(bp);
+
+    return NULL;
+}
+
+static char * test_bwrite_dirty_range(void)
+{
+    struct buf * bp;
+    int err;
+
+    ku_test_description("Test that bwrite() only writes the dirty sectors.");
+
+    ku_assert("device created", vn_biotest);
+
+    bp = getblk(vn_biotest, 65536, 4096, 0);
+    ku_assert("got a buffer", bp);
+
+    bio_markdirty(bp, 1000, 30);
+    biotest_wr_len = 0;
+    err = bwrite(bp);
+    ku_assert_equal("no error", err, 0);
+    ku_assert_equal("dirty sector written", (int)biotest_wr_off, 65536 + 512);
+    ku_assert_equal("one sector written", biotest_wr_len, 512);
+    ku_assert_equal("range reset", bp->b_dirtyend, 0);
+
+    /* Nothing marked, the whole buffer is dirty. */
+    err = bwrite(bp);
+    ku_assert_equal("no error", err, 0);
+    ku_assert_equal("buffer written", (int)biotest_wr_off, 65536);
+    ku_assert_equal("whole buffer written", biotest_wr_len, 4096);
+
+    brelse(bp);
+
+    return NULL;
+}
+
+static char * test_bwrite_blkdev(void)
+{
+    struct buf * bp;
+    int err;
+
+    ku_test_description("Test that bwrite() addresses a block device by "
+                        "blocks.");
+
+    ku_assert("device created", vn_biotestblk);
+
+    bp = getblk(vn_biotestblk, 64, 4096, 0);
+    ku_assert("got a buffer", bp);
+
+    /* The dirty range is rounded to device blocks. */
+    bio_markdirty(bp, 1000, 30);
+    err = bwrite(bp);
+    ku_assert_equal("no error", err, 0);
+    ku_assert_equal("first block written", (int)biotest_wr_off, 64);
+    ku_assert_equal("two blocks written", biotest_wr_len, 2048);
+
+    bio_markdirty(bp, 3000, 10);
+    err = bwrite(bp);
+    ku_assert_equal("no error", err, 0);
+    ku_assert_equal("dirty block written", (int)biotest_wr_off, 66);
+    ku_assert_equal("one block written", biotest_wr_len, 1024);
+
+    brelse(bp);
+
+    return NULL;
+}
+
 static void all_tests(void)
 {
     ku_def_test(test_geteblk, KU_RUN);
     ku_def_test(test_getblk, KU_RUN);
     ku_def_test(test_bread, KU_SKIP);
+    ku_def_test(test_bread_readahead, KU_RUN);
+    ku_def_test(test_bread_readahead_blkdev, KU_RUN);
+    ku_def_test(test_markdirty, KU_RUN);
+    ku_def_test(test_bwrite_dirty_range, KU_RUN);
+    ku_def_test(test_bwrite_blkdev, KU_RUN);
 }
 
 TEST_MODULE(vm, bio);
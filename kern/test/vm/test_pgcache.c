@@ -0,0 +1,202 @@
+/**
+ * @file test_pgcache.c
+ * @brief Test the page cache.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <kunit.h>
+#include <kstring.h>
+#include <buf.h>
+#include <fs/fs.h>
+#include <proc.h>
+#include <uio.h>
+#include <vm/vm.h>
+#include <vm/vm_pgcache.h>
+
+#define FILE_NAME   "pgctest.dat"
+#define FILE_SIZE   (2 * MMU_PGSIZE_COARSE + 100)
+
+static vnode_t * vn;
+static file_t file;
+static struct vm_pgcache * pgc;
+static uint8_t in[FILE_SIZE];
+static uint8_t out[FILE_SIZE];
+
+static void setup(void)
+{
+    vnode_t * croot = curproc->croot;
+    struct uio uio;
+
+    vn = NULL;
+    pgc = NULL;
+
+    for (size_t i = 0; i < sizeof(in); i++) {
+        in[i] = (uint8_t)(i * 3);
+    }
+
+    if (croot->vnode_ops->create(croot, FILE_NAME, S_IRUSR | S_IWUSR, &vn))
+        return;
+    fs_fildes_set(&file, vn, O_RDWR);
+    file.seek_pos = 0;
+    file.stream = NULL;
+
+    uio_init_kbuf(&uio, in, sizeof(in));
+    if (vn->vnode_ops->write(&file, &uio, sizeof(in)) != sizeof(in))
+        return;
+
+    pgc = vm_pgcache_ref(vn, 1);
+}
+
+static void teardown(void)
+{
+    if (pgc)
+        vm_pgcache_unref(pgc);
+    if (vn) {
+        vrele(vn);
+        curproc->croot->vnode_ops->unlink(curproc->croot, FILE_NAME);
+    }
+}
+
+/**
+ * Read the file bypassing the page cache.
+ */
+static ssize_t file_read(off_t off, void * buf, size_t count)
+{
+    struct uio uio;
+
+    uio_init_kbuf(&uio, buf, count);
+    return fs_fildes_read_at(&file, &uio, count, &off);
+}
+
+static char * test_read(void)
+{
+    struct uio uio;
+    struct buf * pg;
+    const off_t off = MMU_PGSIZE_COARSE - 10;
+
+    ku_test_description("Test reading through the page cache.");
+
+    ku_assert("page cache created", pgc);
+
+    /* The read crosses a page boundary and is clipped to the file size. */
+    file.seek_pos = off;
+    uio_init_kbuf(&uio, out, sizeof(out));
+    ku_assert_equal("read",
+                    (int)vm_pgcache_read(pgc, &file, &uio, sizeof(out)),
+                    (int)(FILE_SIZE - off));
+    ku_assert("data ok", !memcmp(out, in + off, FILE_SIZE - off));
+    ku_assert_equal("seek pos", (int)file.seek_pos, FILE_SIZE);
+
+    ku_assert_equal("EOF", (int)vm_pgcache_read(pgc, &file, &uio, 1), 0);
+
+    /* The tail of the last page is zeroed. */
+    ku_assert_equal("getpage", vm_pgcache_getpage(pgc, 2, &pg), 0);
+    ku_assert("page data ok",
+              !memcmp((void *)pg->b_data, in + 2 * MMU_PGSIZE_COARSE, 100));
+    ku_assert_equal("zeroed", ((uint8_t *)pg->b_data)[100], 0);
+    pg->vm_ops->rfree(pg);
+
+    return NULL;
+}
+
+static char * test_write(void)
+{
+    struct uio uio;
+    struct buf * pg;
+    const size_t off = MMU_PGSIZE_COARSE - 2;
+
+    ku_test_description("Test that a write updates the cached pages.");
+
+    ku_assert("page cache created", pgc);
+
+    ku_assert_equal("getpage", vm_pgcache_getpage(pgc, 0, &pg), 0);
+
+    file.seek_pos = off;
+    uio_init_kbuf(&uio, "abcd", 4);
+    ku_assert_equal("write", (int)vm_pgcache_write(pgc, &file, &uio, 4), 4);
+    ku_assert("cached page updated",
+              !memcmp((void *)(pg->b_data + off), "ab", 2));
+    pg->vm_ops->rfree(pg);
+
+    ku_assert_equal("getpage", vm_pgcache_getpage(pgc, 1, &pg), 0);
+    ku_assert("next page ok", !memcmp((void *)pg->b_data, "cd", 2));
+    pg->vm_ops->rfree(pg);
+
+    ku_assert_equal("file read", (int)file_read(off, out, 4), 4);
+    ku_assert("written through", !memcmp(out, "abcd", 4));
+
+    return NULL;
+}
+
+static char * test_writeback(void)
+{
+    struct buf * pg;
+
+    ku_test_description("Test that dirty pages are written back.");
+
+    ku_assert("page cache created", pgc);
+
+    ku_assert_equal("getpage", vm_pgcache_getpage(pgc, 1, &pg), 0);
+    memcpy((void *)pg->b_data, "dirty", 5);
+    pg->b_flags |= B_DIRTY;
+    pg->vm_ops->rfree(pg);
+
+    ku_assert_equal("not synced", (int)file_read(MMU_PGSIZE_COARSE, out, 5),
+                    5);
+    ku_assert("old data", !memcmp(out, in + MMU_PGSIZE_COARSE, 5));
+
+    /* Releasing the last reference syncs the cache. */
+    vm_pgcache_unref(pgc);
+    pgc = NULL;
+
+    ku_assert_equal("synced", (int)file_read(MMU_PGSIZE_COARSE, out, 5), 5);
+    ku_assert("new data", !memcmp(out, "dirty", 5));
+    ku_assert_equal("size kept", (int)vn->vn_len, FILE_SIZE);
+
+    return NULL;
+}
+
+static char * test_priv(void)
+{
+    struct buf * region;
+    struct buf * pg;
+    struct buf * cpg;
+
+    ku_test_description("Test private demand paged regions.");
+
+    ku_assert("page cache created", pgc);
+
+    region = vm_pgcache_newpriv(pgc, 0, 2 * MMU_PGSIZE_COARSE,
+                                MMU_PGSIZE_COARSE + 10);
+    ku_assert("region created", region);
+    ku_assert("private", region->b_flags & B_PRIVATE);
+
+    /* The file data ends in the middle of the second page. */
+    ku_assert_equal("regionpage", vm_pgcache_regionpage(region, 1, &pg), 0);
+    ku_assert("file data", !memcmp((void *)pg->b_data,
+                                   in + MMU_PGSIZE_COARSE, 10));
+    ku_assert_equal("zero filled", ((uint8_t *)pg->b_data)[10], 0);
+
+    /* The page is a copy. */
+    ((uint8_t *)pg->b_data)[0] ^= 0xff;
+    ku_assert_equal("getpage", vm_pgcache_getpage(pgc, 1, &cpg), 0);
+    ku_assert("cache unchanged",
+              ((uint8_t *)cpg->b_data)[0] == in[MMU_PGSIZE_COARSE]);
+    cpg->vm_ops->rfree(cpg);
+    pg->vm_ops->rfree(pg);
+
+    region->vm_ops->rfree(region);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_read, KU_RUN);
+    ku_def_test(test_write, KU_RUN);
+    ku_def_test(test_writeback, KU_RUN);
+    ku_def_test(test_priv, KU_RUN);
+}
+
+TEST_MODULE(vm, pgcache);
@@ -0,0 +1,101 @@
+/**
+ * @file test_vralloc.c
+ * @brief Test vralloc page allocator.
+ */
+
+#include <buf.h>
+#include <kunit.h>
+#include <libkern.h>
+#include <hal/mmu.h>
+
+static void setup(void)
+{
+}
+
+static void teardown(void)
+{
+}
+
+static char * test_alloc_sizes(void)
+{
+    static const size_t sizes[] = { 1, 4096, 5000, 3 * 4096, 7 * 4096 };
+    struct buf * bp[num_elem(sizes)];
+    size_t i, j;
+
+    ku_test_description("Test that buffers are aligned and don't overlap.");
+
+    for (i = 0; i < num_elem(sizes); i++) {
+        bp[i] = geteblk(sizes[i]);
+        ku_assert("got a buffer", bp[i]);
+        ku_assert_equal("Page aligned",
+                        (bp[i]->b_data & (MMU_PGSIZE_COARSE - 1)), 0);
+        ku_assert("Buf size is correct", bp[i]->b_bufsize >= sizes[i]);
+    }
+
+    for (i = 0; i < num_elem(sizes); i++) {
+        for (j = i + 1; j < num_elem(sizes); j++) {
+            ku_assert("No overlap",
+                      bp[i]->b_data + bp[i]->b_bufsize <= bp[j]->b_data ||
+                      bp[j]->b_data + bp[j]->b_bufsize <= bp[i]->b_data);
+        }
+    }
+
+    for (i = 0; i < num_elem(sizes); i++) {
+        vrfree(bp[i]);
+    }
+
+    return NULL;
+}
+
+static char * test_reuse(void)
+{
+    struct buf * bp;
+    uintptr_t addr;
+
+    ku_test_description("Test that a freed block is reused.");
+
+    bp = geteblk(4 * 4096);
+    ku_assert("got a buffer", bp);
+    addr = bp->b_data;
+    vrfree(bp);
+
+    bp = geteblk(4 * 4096);
+    ku_assert("got a buffer", bp);
+    ku_assert_equal("Same block", bp->b_data, addr);
+    vrfree(bp);
+
+    return NULL;
+}
+
+static char * test_allocbuf(void)
+{
+    struct buf * bp;
+
+    ku_test_description("Test that allocbuf() keeps the data.");
+
+    bp = geteblk(4096);
+    ku_assert("got a buffer", bp);
+    ((uint8_t *)bp->b_data)[100] = 0xAA;
+
+    allocbuf(bp, 3 * 4096);
+    ku_assert_equal("Size grown", bp->b_bufsize, 3 * 4096);
+    ku_assert_equal("Data kept", ((uint8_t *)bp->b_data)[100], 0xAA);
+    ku_assert_equal("Tail cleared", ((uint8_t *)bp->b_data)[2 * 4096], 0);
+
+    allocbuf(bp, 4096);
+    ku_assert_equal("Size shrunk", bp->b_bufsize, 4096);
+    ku_assert_equal("Data kept", ((uint8_t *)bp->b_data)[100], 0xAA);
+
+    vrfree(bp);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_alloc_sizes, KU_RUN);
+    ku_def_test(test_reuse, KU_RUN);
+    ku_def_test(test_allocbuf, KU_RUN);
+}
+
+TEST_MODULE(vm, vralloc);
@@ -35,16 +35,25 @@
 /* TODO MP version, per CPU timers */
 
 #include <sys/linker_set.h>
-#include <machine/atomic.h>
+#include <bitmap.h>
 #include <hal/hw_timers.h>
 #include <kinit.h>
+#include <klocks.h>
 #include <ksched.h>
+#include <libkern.h>
 #include <thread.h>
 #include <timers.h>
 
+/*
+ * Enabled timers are kept in a binary min-heap ordered by the expiration
+ * time, so timers_run() only needs to look at the root of the heap, and
+ * adding or cancelling a timer is O(log n). Free timer slots are tracked
+ * in a bitmap.
+ */
+
 /** Timer allocation struct */
 struct timer_cb {
-    atomic_t flags;             /*!< Timer flags:
+    timers_flags_t flags;       /*!< Timer flags:
                                  * + 0 = Timer state
                                  *     + 0 = disabled
                                  *     + 1 = enabled
@@ -52,73 +61,192 @@ struct timer_cb {
                                  *     + 0 = one-shot
                                  *     + 1 = periodic
                                  */
+    int heap_index;             /*!< Index in the heap or -1. */
     void (*event_fn)(void *);   /*!< Event handler for the timer. */
     void * event_arg;           /*!< Argument for event handler. */
     uint64_t interval;          /*!< Timer interval. */
     uint64_t start;             /*!< Timer start value. */
+    uint64_t expires;           /*!< Expiration time while enabled. */
 };
 
-static struct timer_cb timers_array[configTIMERS_MAX] = {
-    [0 ... (configTIMERS_MAX - 1)] = {
-        .flags = ATOMIC_INIT(0),
-        .event_fn = NULL,
-        .interval = 0,
-        .start = 0,
-    }
-};
+static struct timer_cb timers_array[configTIMERS_MAX];
+static bitmap_t timers_map[E2BITMAP_SIZE(configTIMERS_MAX) + 1];
+static int timers_heap[configTIMERS_MAX];
+static size_t timers_heap_size;
+static mtx_t timers_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DINT);
+
 #define VALID_TIMER_ID(x) ((x) < configTIMERS_MAX && (x) >= 0)
 
+static inline uint64_t heap_key(size_t i)
+{
+    return timers_array[timers_heap[i]].expires;
+}
+
+static inline void heap_set(size_t i, int tim)
+{
+    timers_heap[i] = tim;
+    timers_array[tim].heap_index = i;
+}
+
+static void heap_sift_up(size_t i)
+{
+    const int tim = timers_heap[i];
+    const uint64_t key = timers_array[tim].expires;
+
+    while (i > 0) {
+        const size_t parent = (i - 1) / 2;
+
+        if (heap_key(parent) <= key)
+            break;
+        heap_set(i, timers_heap[parent]);
+        i = parent;
+    }
+    heap_set(i, tim);
+}
+
+static void heap_sift_down(size_t i)
+{
+    const int tim = timers_heap[i];
+    const uint64_t key = timers_array[tim].expires;
+
+    while (1) {
+        size_t child = 2 * i + 1;
+
+        if (child >= timers_heap_size)
+            break;
+        if (child + 1 < timers_heap_size &&
+            heap_key(child + 1) < heap_key(child))
+            child++;
+        if (key <= heap_key(child))
+            break;
+        heap_set(i, timers_heap[child]);
+        i = child;
+    }
+    heap_set(i, tim);
+}
+
+static void heap_insert(int tim)
+{
+    struct timer_cb * timer = &timers_array[tim];
+
+    timer->expires = timer->start + timer->interval;
+    heap_set(timers_heap_size++, tim);
+    heap_sift_up(timer->heap_index);
+}
+
+static void heap_remove(int tim)
+{
+    const int i = timers_array[tim].heap_index;
+    int last;
+
+    if (i < 0)
+        return;
+
+    timers_array[tim].heap_index = -1;
+    last = timers_heap[--timers_heap_size];
+    if (last == tim)
+        return;
+
+    heap_set(i, last);
+    if (i > 0 && heap_key((i - 1) / 2) > timers_array[last].expires)
+        heap_sift_up(i);
+    else
+        heap_sift_down(i);
+}
+
 void timers_run(void)
 {
-    size_t i = 0;
     uint64_t now = get_utime();
-    const int enflags = TIMERS_FLAG_INUSE | TIMERS_FLAG_ENABLED;
-
-    do {
-        struct timer_cb * const timer = &timers_array[i];
-        timers_flags_t flags = atomic_read(&timer->flags);
-
-        if ((flags & enflags) == enflags) {
-            if ((now - timer->start) >= timer->interval) {
-                timer->event_fn(timer->event_arg);
-
-                if (!(flags & TIMERS_FLAG_PERIODIC)) {
-                    /* Stop the timer */
-                    timer->flags &= ~TIMERS_FLAG_ENABLED;
-                } else {
-                    /* Repeating timer */
-                    timer->start = get_utime();
-                }
-            }
+
+    mtx_lock(&timers_lock);
+    while (timers_heap_size > 0 && heap_key(0) <= now) {
+        const int tim = timers_heap[0];
+        struct timer_cb * const timer = &timers_array[tim];
+        void (*event_fn)(void *) = timer->event_fn;
+        void * event_arg = timer->event_arg;
+
+        heap_remove(tim);
+        if (!(timer->flags & TIMERS_FLAG_PERIODIC)) {
+            /* Stop the timer */
+            timer->flags &= ~TIMERS_FLAG_ENABLED;
+        } else {
+            /* Repeating timer */
+            timer->start = now;
+            heap_insert(tim);
         }
-    } while (++i < configTIMERS_MAX);
+
+        /* The event handler is allowed to release the timer. */
+        mtx_unlock(&timers_lock);
+        event_fn(event_arg);
+        mtx_lock(&timers_lock);
+    }
+    mtx_unlock(&timers_lock);
 }
 SCHED_PRE_SCHED_TASK(timers_run);
 
+uint64_t timers_next_expiry(void)
+{
+    uint64_t next = TIMERS_NO_EXPIRY;
+
+    mtx_lock(&timers_lock);
+    if (timers_heap_size > 0)
+        next = heap_key(0);
+    mtx_unlock(&timers_lock);
+
+    return next;
+}
+
+/**
+ * Find and reserve a free timer slot.
+ * @return A timer index or TMNOVAL.
+ */
+static int timers_alloc(void)
+{
+    for (size_t i = 0; i < num_elem(timers_map); i++) {
+        const bitmap_t free_bits = ~timers_map[i];
+        int tim;
+
+        if (!free_bits)
+            continue;
+
+        tim = i * (8 * sizeof(bitmap_t)) + ffs(free_bits) - 1;
+        if (!VALID_TIMER_ID(tim))
+            break;
+        bitmap_set(timers_map, tim, sizeof(timers_map));
+
+        return tim;
+    }
+
+    return TMNOVAL;
+}
+
 int timers_add(void (*event_fn)(void *), void * event_arg,
                timers_flags_t flags, uint64_t usec)
 {
     struct timer_cb * timer;
-    size_t i = 0;
+    int tim;
 
     flags &= TIMERS_EXT_FLAGS; /* Allow only external flags to be set */
 
-    do { /* Locate first free timer */
-        timer = &timers_array[i];
-
-        if (atomic_cmpxchg(&timer->flags, 0, flags) == 0) {
-            timer->event_fn = event_fn;
-            timer->event_arg = event_arg;
-            timer->interval = usec;
-            timer->start = get_utime();
-            flags |= TIMERS_FLAG_INUSE;
-            atomic_set(&timer->flags, flags);
+    mtx_lock(&timers_lock);
+    tim = timers_alloc();
+    if (tim == TMNOVAL) {
+        mtx_unlock(&timers_lock);
+        return TMNOVAL;
+    }
 
-            return i;
-        }
-    } while (++i < configTIMERS_MAX);
+    timer = &timers_array[tim];
+    timer->flags = flags | TIMERS_FLAG_INUSE;
+    timer->heap_index = -1;
+    timer->event_fn = event_fn;
+    timer->event_arg = event_arg;
+    timer->interval = usec;
+    timer->start = get_utime();
+    if (flags & TIMERS_FLAG_ENABLED)
+        heap_insert(tim);
+    mtx_unlock(&timers_lock);
 
-    return TMNOVAL;
+    return tim;
 }
 
 int64_t timers_get_split(int tim)
@@ -137,24 +265,51 @@ int64_t timers_get_split(int tim)
 
 void timers_start(int tim)
 {
+    struct timer_cb * timer;
+
     if (!VALID_TIMER_ID(tim))
         return;
 
-    atomic_add(&timers_array[tim].flags, TIMERS_FLAG_ENABLED);
+    timer = &timers_array[tim];
+    mtx_lock(&timers_lock);
+    if ((timer->flags & (TIMERS_FLAG_INUSE | TIMERS_FLAG_ENABLED)) ==
+        TIMERS_FLAG_INUSE) {
+        timer->flags |= TIMERS_FLAG_ENABLED;
+        heap_insert(tim);
+    }
+    mtx_unlock(&timers_lock);
 }
 
 void timers_stop(int tim)
 {
+    struct timer_cb * timer;
+
     if (!VALID_TIMER_ID(tim))
         return;
 
-    atomic_sub(&timers_array[tim].flags, TIMERS_FLAG_ENABLED);
+    timer = &timers_array[tim];
+    mtx_lock(&timers_lock);
+    if (timer->flags & TIMERS_FLAG_ENABLED) {
+        timer->flags &= ~TIMERS_FLAG_ENABLED;
+        heap_remove(tim);
+    }
+    mtx_unlock(&timers_lock);
 }
 
 void timers_release(int tim)
 {
+    struct timer_cb * timer;
+
     if (!VALID_TIMER_ID(tim))
         return;
 
-    atomic_set(&timers_array[tim].flags, 0);
+    timer = &timers_array[tim];
+    mtx_lock(&timers_lock);
+    if (timer->flags & TIMERS_FLAG_INUSE) {
+        if (timer->flags & TIMERS_FLAG_ENABLED)
+            heap_remove(tim);
+        timer->flags = 0;
+        bitmap_clear(timers_map, tim, sizeof(timers_map));
+    }
+    mtx_unlock(&timers_lock);
 }
@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <buf.h>
 #include <kerror.h>
+#include <kmalloc.h>
 #include <kstring.h>
 #include <proc.h>
 #include <uio.h>
@@ -123,17 +124,56 @@ int uio_copyin(struct uio * uio, void * dst, size_t offset, size_t size)
     return retval;
 }
 
-int uio_get_kaddr(struct uio * uio, __kernel void ** addr)
+int uio_kmap(struct uio * uio, size_t size, int rw, __kernel void ** addr)
 {
-    int retval = 0;
+    void * kaddr;
+    int err;
+
+    if (size > uio->bufsize)
+        return -EIO;
 
     if (uio->kbuf) {
         *addr = uio->kbuf;
-    } else if (uio->ubuf) {
-        *addr = vm_uaddr2kaddr(uio->proc, uio->ubuf, uio->bufsize);
-    } else {
-        retval = -EINVAL;
+        return 0;
+    } else if (!uio->ubuf) {
+        return -EINVAL;
     }
 
-    return retval;
+    kaddr = vm_uaddr2kaddr_range(uio->proc, uio->ubuf, size,
+                                 rw & VM_PROT_WRITE);
+    if (kaddr) {
+        *addr = kaddr;
+        return 0;
+    }
+
+    /* Not contiguous in kernel space. */
+    kaddr = kmalloc(size);
+    if (!kaddr)
+        return -ENOMEM;
+    if (rw & VM_PROT_READ) {
+        err = uio_copyin(uio, kaddr, 0, size);
+        if (err) {
+            kfree(kaddr);
+            return err;
+        }
+    }
+
+    uio->bounce = kaddr;
+    *addr = kaddr;
+    return 0;
+}
+
+int uio_kunmap(struct uio * uio, __kernel void * addr, size_t len)
+{
+    int err = 0;
+
+    if (!uio->bounce || uio->bounce != addr)
+        return 0;
+
+    if (len > 0)
+        err = uio_copyout(addr, uio, 0, len);
+    kfree(uio->bounce);
+    uio->bounce = NULL;
+
+    return err;
 }
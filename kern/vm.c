@@ -43,6 +43,7 @@
 #include <proc.h>
 #include <ptmapper.h>
 #include <vm/vm.h>
+#include <vm/vm_pgcache.h>
 
 /*
  * TODO Add configHAVE_HW_PAGETABLES or similar config flag and implement
@@ -54,6 +55,10 @@
 
 extern mmu_region_t mmu_region_kernel;
 
+static int vm_cow_range(struct proc_info * proc, uintptr_t uaddr, size_t len);
+static int vm_copy_pages(struct proc_info * proc, uintptr_t uaddr,
+                         void * kaddr, size_t len, int out);
+
 __kernel void * vm_uaddr2kaddr(struct proc_info * proc,
                                __user const void * uaddr,
                                size_t acc_size)
@@ -70,6 +75,41 @@ __kernel void * vm_uaddr2kaddr(struct proc_info * proc,
     return phys_uaddr;
 }
 
+__kernel void * vm_uaddr2kaddr_range(struct proc_info * proc,
+                                     __user const void * uaddr, size_t len,
+                                     int write)
+{
+    const uintptr_t start = (uintptr_t)uaddr;
+    struct buf * region;
+    uint8_t * kaddr;
+
+    if (write && vm_cow_range(proc, start, len))
+        return NULL;
+    if (vm_page_fault_range(proc, start, len, write) < 0)
+        return NULL;
+
+    kaddr = vm_uaddr2kaddr(proc, uaddr, len);
+    if (!kaddr)
+        return NULL;
+
+    /* An ordinary region is contiguous. */
+    if (vm_find_reg(proc, start, &region) >= 0 && !region->b_pages &&
+        start + len <= region->b_mmu.vaddr + region->b_bufsize)
+        return kaddr;
+
+    for (uintptr_t addr = (start & ~(MMU_PGSIZE_COARSE - 1)) +
+                          MMU_PGSIZE_COARSE;
+         addr < start + len; addr += MMU_PGSIZE_COARSE) {
+        const size_t n = min(MMU_PGSIZE_COARSE, start + len - addr);
+
+        if (vm_uaddr2kaddr(proc, (__user void *)addr, n) !=
+            kaddr + (addr - start))
+            return NULL;
+    }
+
+    return kaddr;
+}
+
 int copyin(__user const void * uaddr, __kernel void * kaddr, size_t len)
 {
     return copyin_proc(curproc, uaddr, kaddr, len);
@@ -79,11 +119,19 @@ int copyin_proc(struct proc_info * proc, __user const void * uaddr,
                 __kernel void * kaddr, size_t len)
 {
     void * phys_uaddr;
+    int err;
 
     if (!useracc_proc(uaddr, len, proc, VM_PROT_READ)) {
         return -EFAULT;
     }
 
+    /* Demand paged pages aren't physically contiguous. */
+    err = vm_page_fault_range(proc, (uintptr_t)uaddr, len, 0);
+    if (err < 0)
+        return err;
+    if (err > 0)
+        return vm_copy_pages(proc, (uintptr_t)uaddr, kaddr, len, 0);
+
     phys_uaddr = vm_uaddr2kaddr(proc, uaddr, len);
     if (!phys_uaddr) {
         return -EFAULT;
@@ -101,13 +149,24 @@ int copyout(__kernel const void * kaddr, __user void * uaddr, size_t len)
 int copyout_proc(struct proc_info * proc, __kernel const void * kaddr,
                  __user void * uaddr, size_t len)
 {
-    /* TODO Handle possible cow flag? */
     void * phys_uaddr;
+    int err;
+
+    /* Don't write to pages shared with other processes. */
+    err = vm_cow_range(proc, (uintptr_t)uaddr, len);
+    if (err)
+        return err;
 
     if (!useracc_proc(uaddr, len, proc, VM_PROT_WRITE)) {
         return -EFAULT;
     }
 
+    err = vm_page_fault_range(proc, (uintptr_t)uaddr, len, 1);
+    if (err < 0)
+        return err;
+    if (err > 0)
+        return vm_copy_pages(proc, (uintptr_t)uaddr, (void *)kaddr, len, 1);
+
     phys_uaddr = vm_uaddr2kaddr(proc, uaddr, len);
     if (!phys_uaddr) {
         return -EFAULT;
@@ -117,41 +176,62 @@ int copyout_proc(struct proc_info * proc, __kernel const void * kaddr,
     return 0;
 }
 
+/**
+ * Get a kernel address of a user space string page.
+ * The page is faulted in and copy-on-write is broken if write is set.
+ * The address is valid until the end of the page.
+ */
+static char * str_uaddr2kaddr(uintptr_t uaddr, int write)
+{
+    struct proc_info * proc = curproc;
+
+    /* Don't write to pages shared with other processes. */
+    if (write && vm_cow_range(proc, uaddr, 1))
+        return NULL;
+
+    if (!useracc((__user void *)uaddr, 1,
+                 (write) ? VM_PROT_WRITE : VM_PROT_READ)) {
+        return NULL;
+    }
+
+    if (vm_page_fault_range(proc, uaddr, 1, write) < 0)
+        return NULL;
+
+    return vm_uaddr2kaddr(proc, (__user void *)uaddr, 1);
+}
+
 int copyinstr(__user const char * uaddr, __kernel char * kaddr, size_t len,
               size_t * done)
 {
-    uintptr_t last_prefix = UINTPTR_MAX;
-    char * phys_uaddr = NULL;
     size_t off = 0;
 
     KASSERT(uaddr != NULL, "uaddr shall be set");
     KASSERT(kaddr != NULL, "kaddr shall be set");
 
+    /* Demand paged pages aren't physically contiguous. */
     while (off < len) {
-        if (((uintptr_t)uaddr >> NBITS(MMU_PGSIZE_COARSE)) != last_prefix) {
-            if (!useracc(uaddr, 1, VM_PROT_READ)) {
-                return -EFAULT;
-            }
-
-            last_prefix = (uintptr_t)uaddr >> NBITS(MMU_PGSIZE_COARSE);
-
-            phys_uaddr = vm_uaddr2kaddr(curproc, uaddr, MMU_PGSIZE_COARSE);
-            if (!phys_uaddr) {
-                return -EFAULT;
-            }
+        const uintptr_t addr = (uintptr_t)uaddr + off;
+        const size_t n = min(len - off, MMU_PGSIZE_COARSE -
+                             (addr & (MMU_PGSIZE_COARSE - 1)));
+        const char * phys_uaddr;
+
+        phys_uaddr = str_uaddr2kaddr(addr, 0);
+        if (!phys_uaddr)
+            return -EFAULT;
+
+        for (size_t i = 0; i < n; i++) {
+            kaddr[off++] = phys_uaddr[i];
+            if (kaddr[off - 1] == '\0')
+                goto out;
         }
-        KASSERT(phys_uaddr != NULL, "phys_addr must be set");
-
-        kaddr[off] = *phys_uaddr++;
-        uaddr += ++off;
-
-        if (kaddr[off - 1] == '\0')
-            break;
     }
 
+out:
     if (done)
         *done = off;
 
+    if (off == 0)
+        return -ENAMETOOLONG;
     if (kaddr[off - 1] != '\0') {
         kaddr[off - 1] = '\0';
         return -ENAMETOOLONG;
@@ -163,38 +243,35 @@ int copyinstr(__user const char * uaddr, __kernel char * kaddr, size_t len,
 int copyoutstr(__kernel char * kaddr, __user const char * uaddr, size_t len,
                size_t * done)
 {
-    uintptr_t last_prefix = UINTPTR_MAX;
-    char * phys_uaddr = NULL; /* Make clang --analyze happy. */
     size_t off = 0;
 
     KASSERT(uaddr != NULL, "uaddr shall be set");
     KASSERT(kaddr != NULL, "kaddr shall be set");
 
+    /* Demand paged pages aren't physically contiguous. */
     while (off < len) {
-        if (((uintptr_t)uaddr >> NBITS(MMU_PGSIZE_COARSE)) != last_prefix) {
-            if (!useracc(uaddr, 1, VM_PROT_READ)) {
-                return -EFAULT;
-            }
-
-            last_prefix = (uintptr_t)uaddr >> NBITS(MMU_PGSIZE_COARSE);
-
-            phys_uaddr = vm_uaddr2kaddr(curproc, uaddr, MMU_PGSIZE_COARSE);
-            if (!phys_uaddr) {
-                return -EFAULT;
-            }
+        const uintptr_t addr = (uintptr_t)uaddr + off;
+        const size_t n = min(len - off, MMU_PGSIZE_COARSE -
+                             (addr & (MMU_PGSIZE_COARSE - 1)));
+        char * phys_uaddr;
+
+        phys_uaddr = str_uaddr2kaddr(addr, 1);
+        if (!phys_uaddr)
+            return -EFAULT;
+
+        for (size_t i = 0; i < n; i++) {
+            phys_uaddr[i] = kaddr[off++];
+            if (kaddr[off - 1] == '\0')
+                goto out;
         }
-
-        KASSERT(phys_uaddr != NULL, "phys_uaddr should be set");
-        *phys_uaddr++ = kaddr[off];
-        uaddr += ++off;
-
-        if (kaddr[off - 1] == '\0')
-            break;
     }
 
+out:
     if (done)
         *done = off;
 
+    if (off == 0)
+        return -ENAMETOOLONG;
     if (kaddr[off - 1] != '\0') {
         kaddr[off - 1] = '\0';
         return -ENAMETOOLONG;
@@ -650,6 +727,88 @@ int vm_replace_region(struct proc_info * proc, struct buf * region,
     return 0;
 }
 
+/**
+ * Map a partially copied copy-on-write region.
+ * Pages not yet copied are mapped read-only from the source region.
+ * @note region must be locked.
+ */
+static int bl_map_cow_region(struct buf * region,
+                             const mmu_region_t * mmu_region)
+{
+    const size_t npages = mmu_region->num_pages;
+    size_t i = 0;
+
+    while (i < npages) {
+        mmu_region_t run = *mmu_region;
+        size_t n = 1;
+        int err;
+
+        run.vaddr += i * MMU_PGSIZE_COARSE;
+        if (region->b_pages[i]) {
+            run.paddr = region->b_pages[i]->b_mmu.paddr;
+        } else {
+            /* The source region is contiguous. */
+            while (i + n < npages && !region->b_pages[i + n]) {
+                n++;
+            }
+            run.paddr = region->b_cowsrc->b_mmu.paddr + i * MMU_PGSIZE_COARSE;
+            run.ap = MMU_AP_RORO;
+        }
+        run.num_pages = n;
+
+        err = mmu_map_region(&run);
+        if (err)
+            return err;
+        i += n;
+    }
+
+    return 0;
+}
+
+/**
+ * Get the access permissions of a page of a demand paged region.
+ * Shared pages that are not in the writable map are mapped read-only.
+ * @note region must be locked.
+ */
+static uint32_t bl_page_ap(struct buf * region, size_t page)
+{
+    if (!(region->b_flags & B_PRIVATE) && region->b_mmu.ap == MMU_AP_RWRW &&
+        bitmap_status(region->b_pgwrmap, page,
+                      VM_PGCACHE_MAPSIZE(region)) != 1) {
+        return MMU_AP_RWRO;
+    }
+
+    return region->b_mmu.ap;
+}
+
+/**
+ * Map the pages of a demand paged region.
+ * Only the pages already faulted in are mapped.
+ * @note region must be locked.
+ */
+static int bl_map_paged_region(struct buf * region,
+                               const mmu_region_t * mmu_region)
+{
+    for (size_t i = 0; i < mmu_region->num_pages; i++) {
+        mmu_region_t page = *mmu_region;
+        int err;
+
+        if (!region->b_pages[i])
+            continue;
+
+        page.vaddr += i * MMU_PGSIZE_COARSE;
+        page.num_pages = 1;
+        page.paddr = region->b_pages[i]->b_mmu.paddr;
+        page.ap = bl_page_ap(region, i);
+
+        err = mmu_map_region(&page);
+        if (err)
+            return err;
+    }
+
+    return 0;
+}
+
 int vm_map_region(struct buf * region, struct vm_pt * pt)
 {
     mmu_region_t mmu_region;
@@ -662,6 +821,16 @@ int vm_map_region(struct buf * region, struct vm_pt * pt)
     mmu_region = region->b_mmu; /* Make a copy. */
     mmu_region.pt = &(pt->pt);
 
+    if (region->b_cowsrc || region->b_pages) {
+        int err;
+
+        err = (region->b_cowsrc) ? bl_map_cow_region(region, &mmu_region) :
+                                   bl_map_paged_region(region, &mmu_region);
+        mtx_unlock(&region->lock);
+
+        return err;
+    }
+
     mtx_unlock(&region->lock);
 
     return mmu_map_region(&mmu_region);
@@ -756,6 +925,391 @@ void vm_fixmemmap_proc(struct proc_info * proc)
     mtx_unlock(&mm->regions_lock);
 }
 
+/**
+ * Drop the source region of a partially copied region.
+ * @note region must be locked.
+ */
+static void bl_cow_detach(struct buf * region)
+{
+    struct buf * src = region->b_cowsrc;
+
+    region->b_cowsrc = NULL;
+    region->b_cowcount = 0;
+
+    if (src->vm_ops->rfree)
+        src->vm_ops->rfree(src);
+}
+
+/**
+ * Copy a page of a partially copied region from its source region.
+ * The source region is released once all pages have been copied.
+ */
+static int vm_cow_copy_page(struct buf * region, size_t page)
+{
+    const size_t off = page * MMU_PGSIZE_COARSE;
+    struct buf * pg;
+
+    mtx_lock(&region->lock);
+    if (!region->b_cowsrc || region->b_pages[page]) {
+        mtx_unlock(&region->lock);
+        return 0;
+    }
+    mtx_unlock(&region->lock);
+
+    pg = geteblk(MMU_PGSIZE_COARSE);
+    if (!pg)
+        return -ENOMEM;
+    pg->b_mmu.control = MMU_CTRL_MEMTYPE_WB;
+
+    mtx_lock(&region->lock);
+    if (!region->b_cowsrc || region->b_pages[page]) {
+        /* Someone else copied the same page. */
+        mtx_unlock(&region->lock);
+        pg->vm_ops->rfree(pg);
+        return 0;
+    }
+
+    memcpy((void *)pg->b_data, (void *)(region->b_cowsrc->b_data + off),
+           MMU_PGSIZE_COARSE);
+    pg->b_flags &= ~B_BUSY;
+    pg->b_flags |= B_DONE;
+    region->b_pages[page] = pg;
+    if (++region->b_cowcount == region->b_mmu.num_pages)
+        bl_cow_detach(region);
+    mtx_unlock(&region->lock);
+
+    return 0;
+}
+
+int vm_cow_finish(struct buf * region)
+{
+    for (size_t i = 0; i < region->b_mmu.num_pages; i++) {
+        int err;
+
+        err = vm_cow_copy_page(region, i);
+        if (err)
+            return err;
+    }
+
+    return 0;
+}
+
+void vm_cow_detach(struct buf * region)
+{
+    if (region->b_cowsrc)
+        bl_cow_detach(region);
+}
+
+/**
+ * Map a single page of a region to proc.
+ */
+static int vm_map_page(struct proc_info * proc, struct buf * region,
+                       size_t page)
+{
+    struct vm_pt * vpt;
+    mmu_region_t mmu_region;
+
+    vpt = ptlist_get_pt(&proc->mm, region->b_mmu.vaddr,
+                        region->b_bufsize, VM_PT_CREAT);
+    if (!vpt)
+        return -ENOMEM;
+
+    mtx_lock(&region->lock);
+    mmu_region = region->b_mmu;
+    if (region->b_pages) {
+        mmu_region.paddr = region->b_pages[page]->b_mmu.paddr;
+        mmu_region.ap = bl_page_ap(region, page);
+    } else {
+        mmu_region.paddr += page * MMU_PGSIZE_COARSE;
+    }
+    mtx_unlock(&region->lock);
+
+    mmu_region.pt = &(vpt->pt);
+    mmu_region.vaddr += page * MMU_PGSIZE_COARSE;
+    mmu_region.num_pages = 1;
+
+    return mmu_map_region(&mmu_region);
+}
+
+/**
+ * Create a private copy of a shared copy-on-write region.
+ * Only the given page is copied and the rest of the pages are copied on
+ * demand. The reference to the old region is inherited by the new region.
+ */
+static struct buf * vm_cow_clone(struct proc_info * proc, struct buf * region,
+                                 size_t page)
+{
+    const size_t npages = region->b_mmu.num_pages;
+    struct vm_pt * vpt;
+    struct buf * new_region;
+
+    /* Partial copying is only supported with small pages. */
+    vpt = ptlist_get_pt(&proc->mm, region->b_mmu.vaddr,
+                        region->b_bufsize, VM_PT_CREAT);
+    if (!vpt || vpt->pt.pt_type != MMU_PTT_COARSE ||
+        npages != region->b_bufsize / MMU_PGSIZE_COARSE) {
+        if (!region->vm_ops->rclone)
+            return NULL;
+
+        new_region = region->vm_ops->rclone(region);
+        if (new_region && region->vm_ops->rfree)
+            region->vm_ops->rfree(region);
+        return new_region;
+    }
+
+    /*
+     * The private copy is a demand paged region without backing file and
+     * its pages are allocated one by one as they are copied.
+     */
+    new_region = vm_pgcache_newpriv(NULL, 0, region->b_bufsize, 0);
+    if (!new_region)
+        return NULL;
+    new_region->b_cowsrc = region;
+
+    /* Copy attributes */
+    new_region->b_bcount = region->b_bcount;
+    new_region->b_uflags = ~VM_PROT_COW & region->b_uflags;
+    new_region->b_mmu.vaddr = region->b_mmu.vaddr;
+    new_region->b_mmu.ap = region->b_mmu.ap;
+    new_region->b_mmu.control = region->b_mmu.control;
+    new_region->b_mmu.pt = region->b_mmu.pt;
+    vm_updateusr_ap(new_region);
+
+    if (vm_cow_copy_page(new_region, page)) {
+        /* The caller still owns the reference to the old region. */
+        new_region->b_cowsrc = NULL;
+        new_region->vm_ops->rfree(new_region);
+        return NULL;
+    }
+
+    return new_region;
+}
+
+int vm_cow_fault(struct proc_info * proc, uintptr_t vaddr)
+{
+    struct vm_mm_struct * const mm = &proc->mm;
+    struct buf * region;
+    struct buf * new_region;
+    size_t page;
+    int region_nr, err;
+
+retry:
+    region_nr = vm_find_reg(proc, vaddr, &region);
+    if (region_nr < 0)
+        return -EFAULT;
+
+    mtx_lock(&mm->regions_lock);
+    if ((*mm->regions)[region_nr] != region) {
+        /* The region was replaced meanwhile. */
+        mtx_unlock(&mm->regions_lock);
+        goto retry;
+    }
+
+    page = (vaddr - region->b_mmu.vaddr) / MMU_PGSIZE_COARSE;
+
+    if (region->b_cowsrc) { /* Partially copied region. */
+        region->vm_ops->rref(region);
+        mtx_unlock(&mm->regions_lock);
+
+        err = vm_cow_copy_page(region, page);
+        if (!err)
+            err = vm_map_page(proc, region, page);
+        region->vm_ops->rfree(region);
+
+        return err;
+    }
+
+    if (!(region->b_uflags & VM_PROT_COW)) {
+        /* Already resolved. */
+        mtx_unlock(&mm->regions_lock);
+        return 0;
+    }
+
+    if (kobj_refcnt(&region->b_obj) == 1) {
+        /* This is the last user of the region, no need to copy anything. */
+        region->b_uflags &= ~VM_PROT_COW;
+        mtx_unlock(&mm->regions_lock);
+
+        return vm_mapproc_region(proc, region);
+    }
+
+    new_region = vm_cow_clone(proc, region, page);
+    mtx_unlock(&mm->regions_lock);
+    if (!new_region) {
+        KERROR_DBG("Can't clone region; COW failed\n");
+        return -ENOMEM;
+    }
+
+    /*
+     * The old region remains marked as COW as it would be racy to change
+     * its state.
+     */
+    err = vm_replace_region(proc, new_region, region_nr,
+                            VM_INSOP_MAP_REG | VM_INSOP_NOFREE);
+    KERROR_DBG("COW done (%d)\n", err);
+
+    return err;
+}
+
+/**
+ * Break copy-on-write sharing of a user space address range.
+ */
+static int vm_cow_range(struct proc_info * proc, uintptr_t uaddr, size_t len)
+{
+    uintptr_t addr = uaddr & ~(MMU_PGSIZE_COARSE - 1);
+    const uintptr_t end = uaddr + len;
+
+    while (addr < end) {
+        struct buf * region;
+
+        if (vm_find_reg(proc, addr, &region) >= 0 &&
+            ((region->b_uflags & VM_PROT_COW) || region->b_cowsrc)) {
+            int err;
+
+            err = vm_cow_fault(proc, addr);
+            if (err)
+                return err;
+        }
+        addr += MMU_PGSIZE_COARSE;
+    }
+
+    return 0;
+}
+
+int vm_page_fault(struct proc_info * proc, uintptr_t vaddr, int write)
+{
+    struct vm_mm_struct * const mm = &proc->mm;
+    struct buf * region;
+    struct buf * pg;
+    size_t page;
+    int region_nr, err;
+
+retry:
+    region_nr = vm_find_reg(proc, vaddr, &region);
+    if (region_nr < 0)
+        return -EFAULT;
+
+    mtx_lock(&mm->regions_lock);
+    if ((*mm->regions)[region_nr] != region) {
+        /* The region was replaced meanwhile. */
+        mtx_unlock(&mm->regions_lock);
+        goto retry;
+    }
+    if (!region->b_pages) {
+        mtx_unlock(&mm->regions_lock);
+        return -EFAULT;
+    }
+    region->vm_ops->rref(region);
+    mtx_unlock(&mm->regions_lock);
+
+    if (write && !(region->b_uflags & VM_PROT_WRITE)) {
+        err = -EACCES;
+        goto out;
+    }
+
+    page = (vaddr - region->b_mmu.vaddr) / MMU_PGSIZE_COARSE;
+
+    if (!region->b_pages[page]) {
+        err = vm_pgcache_regionpage(region, page, &pg);
+        if (err)
+            goto out;
+
+        mtx_lock(&region->lock);
+        if (!region->b_pages[page]) {
+            region->b_pages[page] = pg;
+            pg = NULL;
+        }
+        mtx_unlock(&region->lock);
+
+        /* Someone else faulted the same page in. */
+        if (pg)
+            pg->vm_ops->rfree(pg);
+    }
+
+    if (write && !(region->b_flags & B_PRIVATE)) {
+        mtx_lock(&region->lock);
+        bitmap_set(region->b_pgwrmap, page, VM_PGCACHE_MAPSIZE(region));
+        mtx_unlock(&region->lock);
+    }
+
+    err = vm_map_page(proc, region, page);
+out:
+    region->vm_ops->rfree(region);
+
+    return err;
+}
+
+int vm_page_fault_range(struct proc_info * proc, uintptr_t uaddr, size_t len,
+                        int write)
+{
+    uintptr_t addr = uaddr & ~(MMU_PGSIZE_COARSE - 1);
+    const uintptr_t end = uaddr + len;
+    int paged = 0;
+
+    while (addr < end) {
+        struct buf * region;
+
+        if (vm_find_reg(proc, addr, &region) >= 0 && region->b_pages) {
+            const size_t page = (addr - region->b_mmu.vaddr) /
+                                MMU_PGSIZE_COARSE;
+
+            /*
+             * Pages of a partially copied region that are not yet copied
+             * are mapped from the source region.
+             */
+            if (region->b_cowsrc) {
+                paged = 1;
+                addr += MMU_PGSIZE_COARSE;
+                continue;
+            }
+
+            if (!region->b_pages[page] ||
+                (write && !(region->b_flags & B_PRIVATE) &&
+                               bitmap_status(region->b_pgwrmap, page,
+                                        VM_PGCACHE_MAPSIZE(region)) != 1)) {
+                int err;
+
+                err = vm_page_fault(proc, addr, write);
+                if (err)
+                    return err;
+            }
+            paged = 1;
+        }
+        addr += MMU_PGSIZE_COARSE;
+    }
+
+    return paged;
+}
+
+/**
+ * Copy between kernel space and a user space range page by page.
+ * @param out tells the direction, copy from kaddr to uaddr if set.
+ */
+static int vm_copy_pages(struct proc_info * proc, uintptr_t uaddr,
+                         void * kaddr, size_t len, int out)
+{
+    while (len > 0) {
+        const size_t n = min(len, MMU_PGSIZE_COARSE -
+                                  (uaddr & (MMU_PGSIZE_COARSE - 1)));
+        void * phys_uaddr;
+
+        phys_uaddr = vm_uaddr2kaddr(proc, (__user void *)uaddr, n);
+        if (!phys_uaddr)
+            return -EFAULT;
+
+        if (out)
+            memcpy(phys_uaddr, kaddr, n);
+        else
+            memcpy(kaddr, phys_uaddr, n);
+
+        uaddr += n;
+        kaddr = (uint8_t *)kaddr + n;
+        len -= n;
+    }
+
+    return 0;
+}
+
 /**
  * Test for priv mode access permissions.
  *
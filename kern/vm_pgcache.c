@@ -0,0 +1,786 @@
+/**
+ *******************************************************************************
+ * @file    vm_pgcache.c
+ * @author  Olli Vanhoja
+ * @brief   Per-vnode page cache.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/queue.h>
+#include <buf.h>
+#include <fs/fs.h>
+#include <kerror.h>
+#include <kmalloc.h>
+#include <kobj.h>
+#include <kstring.h>
+#include <libkern.h>
+#include <proc.h>
+#include <uio.h>
+#include <vm/vm.h>
+#include <vm/vm_pgcache.h>
+
+/**
+ * Number of page hash buckets in a page cache.
+ * Must be a power of two.
+ */
+#define PGC_HASH_SIZE   32
+
+#define PGC_HASH(pgno) ((pgno) & (PGC_HASH_SIZE - 1))
+
+/**
+ * Page cache of a vnode.
+ */
+struct vm_pgcache {
+    vnode_t * pc_vnode;
+    int pc_refcnt;      /*!< Protected by pgcache_lock. */
+    int pc_closing;     /*!< Set while the last reference is being released,
+                         *   2 if it must be synced again.
+                         *   Protected by pgcache_lock. */
+    unsigned pc_gen;    /*!< Incremented on every write through the cache. */
+    /** Cached pages hashed by page number. */
+    LIST_HEAD(pgc_bucket, buf) pc_hash[PGC_HASH_SIZE];
+    /** Demand paged regions mapping this cache. */
+    LIST_HEAD(pgc_regions, buf) pc_regions;
+    LIST_ENTRY(vm_pgcache) pc_entry;
+    mtx_t pc_lock;
+};
+
+/**
+ * List of all page caches.
+ */
+static LIST_HEAD(pgcache_list, vm_pgcache) pgcache_list =
+    LIST_HEAD_INITIALIZER(pgcache_list);
+/**
+ * Protects pgcache_list, vn_pgcache pointers and the refcounts.
+ * A cache stays in the list while it's synced after the last reference is
+ * released, so a new cache can't be created for a vnode before the old one
+ * is synced. The lock is never held during I/O.
+ */
+static mtx_t pgcache_lock = MTX_INITIALIZER(MTX_TYPE_TICKET, MTX_OPT_SLEEP);
+
+static void pgc_region_ref(struct buf * region);
+static struct buf * pgc_region_clone(struct buf * old_region);
+static void pgc_region_unref(struct buf * region);
+
+/** vm ops of shared page cache regions. */
+static const vm_ops_t pgc_region_ops = {
+    .rref = pgc_region_ref,
+    .rfree = pgc_region_unref,
+};
+
+/** vm ops of private demand paged regions. */
+static const vm_ops_t pgc_priv_ops = {
+    .rref = pgc_region_ref,
+    .rclone = pgc_region_clone,
+    .rfree = pgc_region_unref,
+};
+
+struct vm_pgcache * vm_pgcache_ref(vnode_t * vnode, int creat)
+{
+    struct vm_pgcache * pgc;
+
+    mtx_lock(&pgcache_lock);
+    pgc = vnode->vn_pgcache;
+    if (pgc) {
+        pgc->pc_refcnt++;
+    } else if (creat && vref(vnode) == 0) {
+        pgc = kzalloc(sizeof(struct vm_pgcache));
+        if (pgc) {
+            pgc->pc_vnode = vnode;
+            pgc->pc_refcnt = 1;
+            for (size_t i = 0; i < PGC_HASH_SIZE; i++) {
+                LIST_INIT(&pgc->pc_hash[i]);
+            }
+            LIST_INIT(&pgc->pc_regions);
+            mtx_init(&pgc->pc_lock, MTX_TYPE_TICKET, MTX_OPT_SLEEP);
+
+            LIST_INSERT_HEAD(&pgcache_list, pgc, pc_entry);
+            vnode->vn_pgcache = pgc;
+        } else {
+            vrele(vnode);
+        }
+    }
+    mtx_unlock(&pgcache_lock);
+
+    return pgc;
+}
+
+/**
+ * Read or write a page of a file.
+ * A temporary file descriptor is used so concurrent I/O on the same vnode
+ * doesn't share the seek position.
+ */
+static ssize_t pgc_pageio(vnode_t * vnode, struct buf * pg, size_t len,
+                          int write)
+{
+    file_t file;
+    struct uio uio;
+    ssize_t retval;
+
+    fs_fildes_set(&file, vnode, O_RDWR);
+    file.seek_pos = (off_t)pg->b_blkno * MMU_PGSIZE_COARSE;
+    file.stream = NULL;
+
+    retval = uio_init_kbuf(&uio, (__kernel void *)pg->b_data, len);
+    if (retval)
+        return retval;
+
+    return (write) ? vnode->vnode_ops->write(&file, &uio, len) :
+                     vnode->vnode_ops->read(&file, &uio, len);
+}
+
+/**
+ * Get the number of bytes of the file covered by a page.
+ */
+static size_t pgc_pagelen(vnode_t * vnode, size_t pgno)
+{
+    const off_t off = (off_t)pgno * MMU_PGSIZE_COARSE;
+
+    if (off >= vnode->vn_len)
+        return 0;
+    return omin(vnode->vn_len - off, MMU_PGSIZE_COARSE);
+}
+
+/**
+ * Write back the dirty pages of a page cache.
+ */
+static void pgc_writeback(struct vm_pgcache * pgc)
+{
+    vnode_t * vnode = pgc->pc_vnode;
+    LIST_HEAD(pgc_wlist, buf) wlist = LIST_HEAD_INITIALIZER(wlist);
+    struct buf * pg;
+
+    /* Collect the dirty pages, the I/O is done without holding the lock. */
+    mtx_lock(&pgc->pc_lock);
+    for (size_t i = 0; i < PGC_HASH_SIZE; i++) {
+        LIST_FOREACH(pg, &pgc->pc_hash[i], hash_entry_) {
+            if (pg->b_flags & B_DIRTY) {
+                pg->b_flags &= ~B_DIRTY;
+                pg->vm_ops->rref(pg);
+                LIST_INSERT_HEAD(&wlist, pg, shmem_entry_);
+            }
+        }
+    }
+    mtx_unlock(&pgc->pc_lock);
+
+    while ((pg = LIST_FIRST(&wlist))) {
+        const size_t len = pgc_pagelen(vnode, pg->b_blkno);
+        ssize_t retval;
+
+        LIST_REMOVE(pg, shmem_entry_);
+
+        retval = (len > 0) ? pgc_pageio(vnode, pg, len, 1) : 0;
+        if (retval < 0) {
+            KERROR(KERROR_ERR, "Failed to sync page %u of %pV (%d)\n",
+                   (unsigned)pg->b_blkno, vnode, (int)retval);
+
+            mtx_lock(&pgc->pc_lock);
+            pg->b_flags |= B_DIRTY;
+            mtx_unlock(&pgc->pc_lock);
+        }
+        pg->vm_ops->rfree(pg);
+    }
+}
+
+void vm_pgcache_unref(struct vm_pgcache * pgc)
+{
+    vnode_t * vnode = pgc->pc_vnode;
+
+    mtx_lock(&pgcache_lock);
+    if (--pgc->pc_refcnt > 0) {
+        mtx_unlock(&pgcache_lock);
+        return;
+    }
+    if (pgc->pc_closing) {
+        /* Revived and released meanwhile, the closing thread syncs again. */
+        pgc->pc_closing = 2;
+        mtx_unlock(&pgcache_lock);
+        return;
+    }
+
+    do {
+        pgc->pc_closing = 1;
+        mtx_unlock(&pgcache_lock);
+        pgc_writeback(pgc);
+        mtx_lock(&pgcache_lock);
+
+        if (pgc->pc_refcnt > 0) {
+            /* Revived, the new last user will close the cache. */
+            pgc->pc_closing = 0;
+            mtx_unlock(&pgcache_lock);
+            return;
+        }
+    } while (pgc->pc_closing > 1);
+
+    LIST_REMOVE(pgc, pc_entry);
+    vnode->vn_pgcache = NULL;
+    mtx_unlock(&pgcache_lock);
+
+    for (size_t i = 0; i < PGC_HASH_SIZE; i++) {
+        struct buf * pg;
+
+        while ((pg = LIST_FIRST(&pgc->pc_hash[i]))) {
+            LIST_REMOVE(pg, hash_entry_);
+            pg->vm_ops->rfree(pg);
+        }
+    }
+    kfree(pgc);
+    vrele(vnode);
+}
+
+/**
+ * Find a page from a page cache and take a reference to it.
+ * @note pgc must be locked.
+ */
+static struct buf * pgc_lookup(struct vm_pgcache * pgc, size_t pgno)
+{
+    struct buf * pg;
+
+    LIST_FOREACH(pg, &pgc->pc_hash[PGC_HASH(pgno)], hash_entry_) {
+        if (pg->b_blkno == pgno) {
+            pg->vm_ops->rref(pg);
+            return pg;
+        }
+    }
+
+    return NULL;
+}
+
+int vm_pgcache_getpage(struct vm_pgcache * pgc, size_t pgno,
+                       struct buf ** bpp)
+{
+    vnode_t * vnode = pgc->pc_vnode;
+    struct buf * pg;
+    struct buf * old;
+    unsigned gen;
+
+    mtx_lock(&pgc->pc_lock);
+    old = pgc_lookup(pgc, pgno);
+    gen = pgc->pc_gen;
+    mtx_unlock(&pgc->pc_lock);
+    if (old) {
+        *bpp = old;
+        return 0;
+    }
+
+retry:
+    pg = geteblk(MMU_PGSIZE_COARSE);
+    if (!pg)
+        return -ENOMEM;
+
+    pg->b_blkno = pgno;
+    pg->b_mmu.control = MMU_CTRL_MEMTYPE_WB;
+
+    /* The part of the page beyond the end of file is left zeroed. */
+    if (pgc_pagelen(vnode, pgno) > 0) {
+        ssize_t retval;
+
+        retval = pgc_pageio(vnode, pg, pgc_pagelen(vnode, pgno), 0);
+        if (retval < 0) {
+            pg->vm_ops->rfree(pg);
+            return retval;
+        }
+    }
+    pg->b_flags &= ~B_BUSY;
+    pg->b_flags |= B_DONE;
+
+    mtx_lock(&pgc->pc_lock);
+    old = pgc_lookup(pgc, pgno);
+    if (old || gen != pgc->pc_gen) {
+        /*
+         * Someone else read the same page in or the file was written
+         * while we were reading it.
+         */
+        gen = pgc->pc_gen;
+        mtx_unlock(&pgc->pc_lock);
+        pg->vm_ops->rfree(pg);
+
+        if (!old)
+            goto retry;
+        *bpp = old;
+        return 0;
+    }
+
+    /* The cache owns the initial reference. */
+    pg->vm_ops->rref(pg);
+    LIST_INSERT_HEAD(&pgc->pc_hash[PGC_HASH(pgno)], pg, hash_entry_);
+    mtx_unlock(&pgc->pc_lock);
+
+    *bpp = pg;
+    return 0;
+}
+
+/**
+ * Mark the pages mapped writable by a region dirty.
+ * The writable map of the region is cleared and the region is marked with
+ * B_DIRTY if it should be remapped to make the pages read-only again.
+ * @note pgc must be locked.
+ * @return Returns the number of pages marked dirty.
+ */
+static int pgc_harvest(struct buf * region)
+{
+    const size_t mapsize = VM_PGCACHE_MAPSIZE(region);
+    int n = 0;
+
+    mtx_lock(&region->lock);
+    for (size_t i = 0; i < region->b_mmu.num_pages; i++) {
+        if (bitmap_status(region->b_pgwrmap, i, mapsize) == 1) {
+            bitmap_clear(region->b_pgwrmap, i, mapsize);
+            region->b_pages[i]->b_flags |= B_DIRTY;
+            n++;
+        }
+    }
+    if (n > 0)
+        region->b_flags |= B_DIRTY;
+    mtx_unlock(&region->lock);
+
+    return n;
+}
+
+static void pgc_region_free_callback(struct kobj * obj)
+{
+    struct buf * region = containerof(obj, struct buf, b_obj);
+    struct vm_pgcache * pgc = region->allocator_data;
+
+    if (!(region->b_flags & B_PRIVATE)) {
+        mtx_lock(&pgc->pc_lock);
+        LIST_REMOVE(region, vnode_entry_);
+        (void)pgc_harvest(region);
+        mtx_unlock(&pgc->pc_lock);
+    }
+
+    vm_cow_detach(region);
+    for (size_t i = 0; i < region->b_mmu.num_pages; i++) {
+        struct buf * pg = region->b_pages[i];
+
+        if (pg)
+            pg->vm_ops->rfree(pg);
+    }
+    kfree(region->b_pgwrmap);
+    kfree(region->b_pages);
+    kfree(region);
+
+    if (pgc)
+        vm_pgcache_unref(pgc);
+}
+
+static void pgc_region_ref(struct buf * region)
+{
+    if (kobj_ref(&region->b_obj))
+        panic("pgc_region_ref error");
+}
+
+static void pgc_region_unref(struct buf * region)
+{
+    kobj_unref(&region->b_obj);
+}
+
+/**
+ * Allocate a demand paged region struct.
+ * A reference to pgc is taken if pgc is set.
+ */
+static struct buf * pgc_allocregion(struct vm_pgcache * pgc, size_t pgno,
+                                    size_t size, const vm_ops_t * ops)
+{
+    const size_t npages = memalign_size(size, MMU_PGSIZE_COARSE) /
+                          MMU_PGSIZE_COARSE;
+    struct buf * region;
+
+    region = kzalloc(sizeof(struct buf));
+    if (!region)
+        return NULL;
+
+    region->b_mmu.num_pages = npages;
+    region->b_pages = kzalloc(npages * sizeof(struct buf *));
+    region->b_pgwrmap = kzalloc(VM_PGCACHE_MAPSIZE(region));
+    if (!region->b_pages || !region->b_pgwrmap) {
+        kfree(region->b_pages);
+        kfree(region->b_pgwrmap);
+        kfree(region);
+        return NULL;
+    }
+
+    mtx_init(&region->lock, MTX_TYPE_TICKET, 0);
+    region->b_bufsize = npages * MMU_PGSIZE_COARSE;
+    region->b_bcount = size;
+    region->b_blkno = pgno;
+    region->b_uflags = VM_PROT_READ | VM_PROT_WRITE;
+    region->b_mmu.ap = MMU_AP_RWRW;
+    region->b_mmu.control = MMU_CTRL_MEMTYPE_WB;
+    region->allocator_data = pgc;
+    region->vm_ops = ops;
+    kobj_init(&region->b_obj, pgc_region_free_callback);
+
+    if (pgc) {
+        mtx_lock(&pgcache_lock);
+        pgc->pc_refcnt++;
+        mtx_unlock(&pgcache_lock);
+    }
+
+    return region;
+}
+
+struct buf * vm_pgcache_newregion(struct vm_pgcache * pgc, size_t pgno,
+                                  size_t size)
+{
+    struct buf * region;
+
+    region = pgc_allocregion(pgc, pgno, size, &pgc_region_ops);
+    if (!region)
+        return NULL;
+
+    mtx_lock(&pgc->pc_lock);
+    LIST_INSERT_HEAD(&pgc->pc_regions, region, vnode_entry_);
+    mtx_unlock(&pgc->pc_lock);
+
+    return region;
+}
+
+/**
+ * Clone a private demand paged region.
+ * The pages already faulted in are copied and the rest of the pages are
+ * filled on demand like in the old region. The pages of a partially copied
+ * copy-on-write region that are not yet copied are shared with the same
+ * source region.
+ */
+static struct buf * pgc_region_clone(struct buf * old_region)
+{
+    struct buf * region;
+
+    region = pgc_allocregion(old_region->allocator_data, old_region->b_blkno,
+                             old_region->b_bcount, &pgc_priv_ops);
+    if (!region)
+        return NULL;
+
+    region->b_flags |= B_PRIVATE;
+    region->b_pgfill = old_region->b_pgfill;
+    region->b_uflags = ~VM_PROT_COW & old_region->b_uflags;
+    region->b_mmu.vaddr = old_region->b_mmu.vaddr;
+    region->b_mmu.ap = old_region->b_mmu.ap;
+    region->b_mmu.control = old_region->b_mmu.control;
+    region->b_mmu.pt = old_region->b_mmu.pt;
+
+    mtx_lock(&old_region->lock);
+    if (old_region->b_cowsrc) {
+        region->b_cowsrc = old_region->b_cowsrc;
+        region->b_cowsrc->vm_ops->rref(region->b_cowsrc);
+    }
+    mtx_unlock(&old_region->lock);
+
+    for (size_t i = 0; i < region->b_mmu.num_pages; i++) {
+        struct buf * src;
+        struct buf * pg;
+
+        mtx_lock(&old_region->lock);
+        src = old_region->b_pages[i];
+        if (src)
+            src->vm_ops->rref(src);
+        mtx_unlock(&old_region->lock);
+        if (!src)
+            continue;
+
+        pg = geteblk(MMU_PGSIZE_COARSE);
+        if (pg) {
+            memcpy((void *)pg->b_data, (void *)src->b_data,
+                   MMU_PGSIZE_COARSE);
+            pg->b_flags &= ~B_BUSY;
+            pg->b_flags |= B_DONE;
+            region->b_pages[i] = pg;
+            if (region->b_cowsrc)
+                region->b_cowcount++;
+        }
+        src->vm_ops->rfree(src);
+        if (!pg) {
+            region->vm_ops->rfree(region);
+            return NULL;
+        }
+    }
+
+    /* The old region may have copied the rest of the pages meanwhile. */
+    if (region->b_cowcount == region->b_mmu.num_pages)
+        vm_cow_detach(region);
+
+    return region;
+}
+
+struct buf * vm_pgcache_newpriv(struct vm_pgcache * pgc, size_t pgno,
+                                size_t size, size_t filelen)
+{
+    struct buf * region;
+
+    KASSERT(pgc || filelen == 0, "File data requires a page cache");
+
+    region = pgc_allocregion(pgc, pgno, size, &pgc_priv_ops);
+    if (!region)
+        return NULL;
+
+    region->b_flags |= B_PRIVATE;
+    region->b_pgfill = filelen;
+
+    return region;
+}
+
+/**
+ * Get a new private page for a private region.
+ * The file data is copied from the page cache if the page is cached,
+ * otherwise it's read directly from the file.
+ */
+static int pgc_privpage(struct buf * region, size_t page, struct buf ** bpp)
+{
+    struct vm_pgcache * pgc = region->allocator_data;
+    const size_t off = page * MMU_PGSIZE_COARSE;
+    const size_t pgno = region->b_blkno + page;
+    struct buf * pg;
+
+    pg = geteblk(MMU_PGSIZE_COARSE);
+    if (!pg)
+        return -ENOMEM;
+    pg->b_blkno = pgno;
+    pg->b_mmu.control = MMU_CTRL_MEMTYPE_WB;
+
+    if (off < region->b_pgfill) {
+        const size_t len = min(region->b_pgfill - off, MMU_PGSIZE_COARSE);
+        struct buf * src;
+
+        mtx_lock(&pgc->pc_lock);
+        src = pgc_lookup(pgc, pgno);
+        mtx_unlock(&pgc->pc_lock);
+
+        if (src) {
+            memcpy((void *)pg->b_data, (void *)src->b_data, len);
+            src->vm_ops->rfree(src);
+        } else {
+            const size_t iolen = min(len, pgc_pagelen(pgc->pc_vnode, pgno));
+            ssize_t retval;
+
+            retval = (iolen > 0) ? pgc_pageio(pgc->pc_vnode, pg, iolen, 0) : 0;
+            if (retval < 0) {
+                pg->vm_ops->rfree(pg);
+                return retval;
+            }
+        }
+    }
+    pg->b_flags &= ~B_BUSY;
+    pg->b_flags |= B_DONE;
+
+    *bpp = pg;
+    return 0;
+}
+
+int vm_pgcache_regionpage(struct buf * region, size_t page,
+                          struct buf ** bpp)
+{
+    if (region->b_flags & B_PRIVATE)
+        return pgc_privpage(region, page, bpp);
+
+    return vm_pgcache_getpage(region->allocator_data, region->b_blkno + page,
+                              bpp);
+}
+
+ssize_t vm_pgcache_read(struct vm_pgcache * pgc, file_t * file,
+                        struct uio * uio, size_t count)
+{
+    vnode_t * vnode = file->vnode;
+    const off_t off = file->seek_pos;
+    size_t done = 0;
+
+    if (off < 0)
+        return -EINVAL;
+    if (off >= vnode->vn_len)
+        return 0;
+    count = omin(count, vnode->vn_len - off);
+
+    while (done < count) {
+        const size_t pgoff = (off + done) & (MMU_PGSIZE_COARSE - 1);
+        const size_t n = min(count - done, MMU_PGSIZE_COARSE - pgoff);
+        struct buf * pg;
+        int err;
+
+        err = vm_pgcache_getpage(pgc, (off + done) / MMU_PGSIZE_COARSE, &pg);
+        if (!err) {
+            err = uio_copyout((void *)(pg->b_data + pgoff), uio, done, n);
+            pg->vm_ops->rfree(pg);
+        }
+        if (err) {
+            if (done == 0)
+                return err;
+            break;
+        }
+        done += n;
+    }
+
+    file->seek_pos += done;
+    return done;
+}
+
+ssize_t vm_pgcache_write(struct vm_pgcache * pgc, file_t * file,
+                         struct uio * uio, size_t count)
+{
+    vnode_t * vnode = file->vnode;
+    ssize_t retval;
+    off_t off;
+    size_t done = 0;
+
+    /*
+     * Fault in the source pages now as faulting on a mapping of this file
+     * while the file system is writing to it could deadlock.
+     */
+    if (uio->ubuf) {
+        int err;
+
+        err = vm_page_fault_range(uio->proc, (uintptr_t)uio->ubuf, count, 0);
+        if (err < 0)
+            return err;
+    }
+
+    retval = vnode->vnode_ops->write(file, uio, count);
+    if (retval <= 0)
+        return retval;
+    off = file->seek_pos - retval;
+
+    /* Any page read in before this point might be stale. */
+    mtx_lock(&pgc->pc_lock);
+    pgc->pc_gen++;
+    mtx_unlock(&pgc->pc_lock);
+
+    while (done < (size_t)retval) {
+        const size_t pgoff = (off + done) & (MMU_PGSIZE_COARSE - 1);
+        const size_t n = min((size_t)retval - done, MMU_PGSIZE_COARSE - pgoff);
+        struct buf * pg;
+
+        mtx_lock(&pgc->pc_lock);
+        pg = pgc_lookup(pgc, (off + done) / MMU_PGSIZE_COARSE);
+        mtx_unlock(&pgc->pc_lock);
+        if (pg) {
+            (void)uio_copyin(uio, (void *)(pg->b_data + pgoff), done, n);
+            pg->vm_ops->rfree(pg);
+        }
+        done += n;
+    }
+
+    return retval;
+}
+
+/**
+ * Remap the regions marked with B_DIRTY in all processes.
+ */
+static void pgc_remap_all(void)
+{
+    pid_t * pids = proc_get_pids_buffer();
+
+    PROC_LOCK();
+    proc_get_pids(pids);
+    PROC_UNLOCK();
+
+    for (pid_t * pid = pids; *pid; pid++) {
+        struct proc_info * proc = proc_ref(*pid);
+        struct vm_mm_struct * mm;
+
+        if (!proc)
+            continue;
+
+        mm = &proc->mm;
+        mtx_lock(&mm->regions_lock);
+        for (int i = 0; i < mm->nr_regions; i++) {
+            struct buf * region = (*mm->regions)[i];
+
+            if (!region || !region->b_pages ||
+                !(region->b_flags & B_DIRTY) || kobj_ref(&region->b_obj))
+                continue;
+
+            (void)vm_mapproc_region(proc, region);
+            kobj_unref(&region->b_obj);
+        }
+        mtx_unlock(&mm->regions_lock);
+        proc_unref(proc);
+    }
+
+    proc_release_pids_buffer(pids);
+}
+
+void vm_pgcache_sync_all(void)
+{
+    struct vm_pgcache * pgc;
+    struct buf * region;
+    int remap = 0;
+
+    mtx_lock(&pgcache_lock);
+    LIST_FOREACH(pgc, &pgcache_list, pc_entry) {
+        mtx_lock(&pgc->pc_lock);
+        LIST_FOREACH(region, &pgc->pc_regions, vnode_entry_) {
+            if (pgc_harvest(region))
+                remap = 1;
+        }
+        mtx_unlock(&pgc->pc_lock);
+    }
+    mtx_unlock(&pgcache_lock);
+
+    /*
+     * Revoke the write access to the harvested pages, so the next write
+     * faults and marks the page dirty again. A region might be freed while
+     * we are remapping it, therefore pgcache_lock can't be held here.
+     */
+    if (remap)
+        pgc_remap_all();
+
+    /*
+     * Write back each cache holding a reference to it, so pgcache_lock
+     * doesn't need to be held during the I/O.
+     */
+    mtx_lock(&pgcache_lock);
+    pgc = LIST_FIRST(&pgcache_list);
+    if (pgc)
+        pgc->pc_refcnt++;
+    mtx_unlock(&pgcache_lock);
+
+    while (pgc) {
+        struct vm_pgcache * next;
+
+        if (remap) {
+            mtx_lock(&pgc->pc_lock);
+            LIST_FOREACH(region, &pgc->pc_regions, vnode_entry_) {
+                mtx_lock(&region->lock);
+                region->b_flags &= ~B_DIRTY;
+                mtx_unlock(&region->lock);
+            }
+            mtx_unlock(&pgc->pc_lock);
+        }
+
+        pgc_writeback(pgc);
+
+        mtx_lock(&pgcache_lock);
+        next = LIST_NEXT(pgc, pc_entry);
+        if (next)
+            next->pc_refcnt++;
+        mtx_unlock(&pgcache_lock);
+
+        vm_pgcache_unref(pgc);
+        pgc = next;
+    }
+}
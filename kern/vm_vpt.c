@@ -35,6 +35,7 @@
 #include <kerror.h>
 #include <kmalloc.h>
 #include <kmem.h>
+#include <kmem_cache.h>
 #include <kstring.h>
 #include <libkern.h>
 #include <ptmapper.h>
@@ -42,6 +43,8 @@
 
 RB_GENERATE(ptlist, vm_pt, entry_, ptlist_compare);
 
+static KMEM_CACHE(vm_pt, sizeof(struct vm_pt), 0, NULL, NULL);
+
 static inline size_t bsize2nr_tables(size_t bsize)
 {
     return memalign_size(bsize, MMU_PGSIZE_SECTION) / MMU_PGSIZE_SECTION;
@@ -83,9 +86,10 @@ int ptlist_compare(struct vm_pt * a, struct vm_pt * b)
 
 static struct vm_pt * vm_pt_alloc(size_t nr_tables)
 {
-    struct vm_pt * vpt = kzalloc(sizeof(struct vm_pt));
+    struct vm_pt * vpt = kmem_cache_alloc(&kmem_cache_vm_pt);
     if (!vpt)
         return NULL;
+    memset(vpt, 0, sizeof(struct vm_pt));
 
     vpt->pt.nr_tables = nr_tables;
     vpt->pt.pt_type = MMU_PTT_COARSE;
@@ -93,7 +97,7 @@ static struct vm_pt * vm_pt_alloc(size_t nr_tables)
 
     /* Allocate the actual page table, this will also set pt_addr. */
     if (ptmapper_alloc(&vpt->pt)) {
-        kfree(vpt);
+        kmem_cache_free(&kmem_cache_vm_pt, vpt);
         return NULL;
     }
 
@@ -103,7 +107,7 @@ static struct vm_pt * vm_pt_alloc(size_t nr_tables)
 static void vm_pt_free(struct vm_pt * vpt)
 {
     ptmapper_free(&vpt->pt);
-    kfree(vpt);
+    kmem_cache_free(&kmem_cache_vm_pt, vpt);
 }
 
 struct vm_pt * ptlist_get_pt(struct vm_mm_struct * mm, uintptr_t vaddr,
@@ -34,18 +34,32 @@
 #include <errno.h>
 #include <sys/queue.h>
 #include <sys/sysctl.h>
-#include <bitmap.h>
 #include <buf.h>
 #include <dynmem.h>
+#include <hal/core.h>
 #include <errno.h>
 #include <kerror.h>
 #include <kmalloc.h>
+#include <kmem_cache.h>
+#include <ksched.h>
 #include <kstring.h>
 #include <libkern.h>
 #include <proc.h>
 #include <ptmapper.h>
 #include <vm/vm.h>
 
+/**
+ * Page descriptor of a vregion page.
+ */
+struct vr_page {
+    LIST_ENTRY(vr_page) free_entry_; /*!< Free list entry of a block head. */
+    struct vregion * vreg;  /*!< The region this page belongs to. */
+    uint8_t order;          /*!< Order of a free block starting here. */
+    uint8_t flags;          /*!< Page flags. */
+};
+
+#define VR_PAGE_FREE    0x01 /*!< Head of a free buddy block. */
+
 /**
  * vralloc region struct.
  * Struct describing a single dynmem alloc block of vrallocated memory.
@@ -57,18 +71,18 @@ struct vregion {
     LIST_ENTRY(vregion) _entry;
     uintptr_t kaddr;    /*!< Kernel address of the allocated dynmem block. */
     unsigned count;     /*!< Reserved pages count. */
+    unsigned npages;    /*!< Size of the region in pages. */
 #ifdef configVRALLOC_DEBUG
 #define VREG_MAGIC_VALUE 0x6C542D55
     unsigned magic;
 #endif
-    size_t size;        /*!< Size of allocation bitmap in bytes. */
-    bitmap_t map[0];    /*!< Bitmap of reserved pages. */
+    struct vr_page pages[0]; /*!< Page descriptors. */
 };
 
 #define DMEM_BLOCK_SIZE (DYNMEM_PAGE_SIZE / MMU_PGSIZE_COARSE)
 
 #define VREG_SIZE(count) \
-    (sizeof(struct vregion) + E2BITMAP_SIZE(count) * sizeof(bitmap_t))
+    (sizeof(struct vregion) + (count) * sizeof(struct vr_page))
 
 #define VREG_PCOUNT(byte_size_) \
     ((byte_size_) / MMU_PGSIZE_COARSE)
@@ -84,15 +98,44 @@ struct vregion {
 
 #define ROUND_UP(N, S) ((((N) + (S) - 1) / (S)) * (S))
 
+/**
+ * The largest buddy order.
+ * A block of the max order covers a single dynmem region.
+ */
+#define VR_MAX_ORDER    (NBITS(DMEM_BLOCK_SIZE) - 1)
+#define VR_MAX_BLOCK    (1u << VR_MAX_ORDER)
+
+/**
+ * Size of the per CPU single page cache.
+ */
+#define VR_PCACHE_SIZE  16
+
 static struct vregion * vreg_alloc_node(size_t count);
 static void vrref(struct buf * region);
 static struct buf * vr_rclone(struct buf * old_region);
 
+/** Cache for buffer headers of vralloc'd buffers. */
+static KMEM_CACHE(buf, sizeof(struct buf), 0, NULL, NULL);
+
 /** List of all allocations done by vralloc. */
 static LIST_HEAD(vrlisthead, vregion) vrlist_head =
     LIST_HEAD_INITIALIZER(vrlisthead);
+/** Protects the region list and the buddy free lists. */
 static mtx_t vr_big_lock = MTX_INITIALIZER(MTX_TYPE_TICKET, MTX_OPT_DINT);
 
+/** Free lists of buddy blocks per order. */
+static LIST_HEAD(vr_free_list, vr_page) vr_free_area[VR_MAX_ORDER + 1];
+static unsigned vr_nr_free[VR_MAX_ORDER + 1];
+
+/**
+ * Per CPU cache of single pages.
+ * Accessed with interrupts disabled and without taking vr_big_lock.
+ */
+static struct vr_pcache {
+    unsigned count;
+    struct vr_page * pages[VR_PCACHE_SIZE];
+} vr_pcache[KSCHED_CPU_COUNT];
+
 SYSCTL_DECL(_vm_vralloc);
 SYSCTL_NODE(_vm, OID_AUTO, vralloc, CTLFLAG_RW, 0,
             "vralloc stats");
@@ -101,9 +144,38 @@ static size_t vralloc_all;
 SYSCTL_UINT(_vm_vralloc, OID_AUTO, reserved, CTLFLAG_RD, &vralloc_all, 0,
             "Amount of memory currently allocated for vralloc");
 
-static size_t vralloc_used;
-SYSCTL_UINT(_vm_vralloc, OID_AUTO, used, CTLFLAG_RD, &vralloc_used, 0,
-            "Amount of vralloc memory used");
+static atomic_t vralloc_used;
+SYSCTL_INT(_vm_vralloc, OID_AUTO, used, CTLFLAG_RD, &vralloc_used, 0,
+           "Amount of vralloc memory used");
+
+SYSCTL_OPAQUE(_vm_vralloc, OID_AUTO, nr_free, CTLTYPE_OPAQUE | CTLFLAG_RD,
+              vr_nr_free, sizeof(vr_nr_free), "IU",
+              "Number of free blocks per order");
+
+static int sysctl_vralloc_frag(SYSCTL_HANDLER_ARGS)
+{
+    unsigned free_pages = 0;
+    unsigned largest = 0;
+    unsigned frag = 0;
+    int order;
+
+    mtx_lock(&vr_big_lock);
+    for (order = 0; order <= VR_MAX_ORDER; order++) {
+        free_pages += vr_nr_free[order] << order;
+        if (vr_nr_free[order])
+            largest = 1u << order;
+    }
+    mtx_unlock(&vr_big_lock);
+
+    if (free_pages > 0)
+        frag = 1000 - (1000 * largest) / free_pages;
+
+    return sysctl_handle_int(oidp, &frag, sizeof(frag), req);
+}
+
+SYSCTL_PROC(_vm_vralloc, OID_AUTO, fragmentation, CTLTYPE_UINT | CTLFLAG_RD,
+            NULL, 0, sysctl_vralloc_frag, "IU",
+            "Free memory not in the largest free block [permille]");
 
 /**
  * VRA specific operations for allocated vm regions.
@@ -115,6 +187,128 @@ static const vm_ops_t vra_ops = {
 };
 
 
+static void vr_link(struct vr_page * pg, unsigned order)
+{
+    pg->flags |= VR_PAGE_FREE;
+    pg->order = order;
+    LIST_INSERT_HEAD(&vr_free_area[order], pg, free_entry_);
+    vr_nr_free[order]++;
+}
+
+static void vr_unlink(struct vr_page * pg)
+{
+    LIST_REMOVE(pg, free_entry_);
+    pg->flags &= ~VR_PAGE_FREE;
+    vr_nr_free[pg->order]--;
+}
+
+/**
+ * Allocate a buddy block.
+ * @note needs vr_big_lock.
+ * @param order is the order of the block.
+ * @return Returns the head page of the block; Or NULL if there is no free
+ *         block large enough.
+ */
+static struct vr_page * vr_alloc_block(unsigned order)
+{
+    struct vr_page * pg = NULL;
+    unsigned o;
+
+    for (o = order; o <= VR_MAX_ORDER; o++) {
+        pg = LIST_FIRST(&vr_free_area[o]);
+        if (pg)
+            break;
+    }
+    if (!pg)
+        return NULL;
+
+    vr_unlink(pg);
+
+    /* Split the block and free the upper halves. */
+    while (o > order) {
+        o--;
+        vr_link(pg + (1u << o), o);
+    }
+
+    pg->vreg->count += 1u << order;
+
+    return pg;
+}
+
+/**
+ * Free a buddy block and merge it with its free buddies.
+ * @note needs vr_big_lock.
+ */
+static void vr_free_block(struct vregion * vreg, size_t iblock, unsigned order)
+{
+    vreg->count -= 1u << order;
+
+    while (order < VR_MAX_ORDER) {
+        const size_t ibuddy = iblock ^ (1u << order);
+        struct vr_page * buddy = &vreg->pages[ibuddy];
+
+        if (ibuddy >= vreg->npages ||
+            !(buddy->flags & VR_PAGE_FREE) || buddy->order != order)
+            break;
+
+        vr_unlink(buddy);
+        iblock &= ~(1u << order);
+        order++;
+    }
+
+    vr_link(&vreg->pages[iblock], order);
+}
+
+/**
+ * Free a range of pages.
+ * The range is split into the largest possible aligned blocks.
+ * @note needs vr_big_lock.
+ */
+static void vr_free_range(struct vregion * vreg, size_t iblock, size_t pcount)
+{
+    while (pcount > 0) {
+        unsigned order = 0;
+
+        while (order < VR_MAX_ORDER && !(iblock & ((2u << order) - 1)) &&
+               (2u << order) <= pcount) {
+            order++;
+        }
+
+        vr_free_block(vreg, iblock, order);
+        iblock += 1u << order;
+        pcount -= 1u << order;
+    }
+}
+
+/**
+ * Release a vregion if all of its pages are free.
+ * @note needs vr_big_lock, it's released by this function.
+ */
+static void vr_release_node(struct vregion * vreg)
+{
+    size_t i;
+
+    if (vreg->count != 0) {
+        mtx_unlock(&vr_big_lock);
+        return;
+    }
+
+    for (i = 0; i < vreg->npages; i += VR_MAX_BLOCK) {
+        struct vr_page * pg = &vreg->pages[i];
+
+        KASSERT((pg->flags & VR_PAGE_FREE) && pg->order == VR_MAX_ORDER,
+                "vregion should be fully coalesced");
+        vr_unlink(pg);
+    }
+    LIST_REMOVE(vreg, _entry);
+    vralloc_all -= VREG_BYTESIZE(vreg->npages);
+
+    mtx_unlock(&vr_big_lock);
+
+    dynmem_free_region((void *)vreg->kaddr);
+    kfree(vreg);
+}
+
 /**
  * Initializes vregion allocator data structures.
  * Called from kinit.c
@@ -129,6 +323,7 @@ void vralloc_init(void)
     if (!vreg) {
         panic("vralloc initialization failed");
     }
+    vr_free_range(vreg, 0, vreg->npages);
     mtx_unlock(&vr_big_lock);
 
     _bio_init();
@@ -136,6 +331,7 @@ void vralloc_init(void)
 
 /**
  * Allocate a new vregion node/chunk and memory for the region.
+ * All pages of the new region are reserved.
  * @param count is the page count (4kB pages). Should be a multiple of
  *              DMEM_BLOCK_SIZE; Otherwise it will be rounded up.
  * @return Rerturns a pointer to the newly allocated region; Otherwise NULL.
@@ -143,6 +339,7 @@ void vralloc_init(void)
 static struct vregion * vreg_alloc_node(size_t count)
 {
     struct vregion * vreg;
+    size_t i;
 
     KASSERT(mtx_test(&vr_big_lock), "vr_big_lock should be locked");
 
@@ -160,7 +357,11 @@ static struct vregion * vreg_alloc_node(size_t count)
         return NULL;
     }
 
-    vreg->size = E2BITMAP_SIZE(count) * sizeof(bitmap_t);
+    vreg->count = count;
+    vreg->npages = count;
+    for (i = 0; i < count; i++) {
+        vreg->pages[i].vreg = vreg;
+    }
 #ifdef configVRALLOC_DEBUG
     vreg->magic = VREG_MAGIC_VALUE;
 #endif
@@ -173,86 +374,201 @@ static struct vregion * vreg_alloc_node(size_t count)
     return vreg;
 }
 
+/**
+ * Get pcount number of contiguous pages from the buddy allocator.
+ * @note needs vr_big_lock.
+ */
+static struct vregion * bl_get_iblocks(size_t * iblock, size_t pcount)
+{
+    struct vregion * vreg;
+    struct vr_page * pg;
+    unsigned order = 0;
+
+    if (pcount > VR_MAX_BLOCK) {
+        /* Too large for the buddy allocator, give it a region of its own. */
+        vreg = vreg_alloc_node(pcount);
+        if (!vreg)
+            return NULL;
+
+        *iblock = 0;
+        vr_free_range(vreg, pcount, vreg->npages - pcount);
+        return vreg;
+    }
+
+    while ((1u << order) < pcount) {
+        order++;
+    }
+
+    pg = vr_alloc_block(order);
+    if (!pg) {
+        vreg = vreg_alloc_node(DMEM_BLOCK_SIZE);
+        if (!vreg)
+            return NULL;
+        vr_free_range(vreg, 0, vreg->npages);
+
+        pg = vr_alloc_block(order);
+        KASSERT(pg, "Must have a free block");
+    }
+
+    vreg = pg->vreg;
+    *iblock = pg - vreg->pages;
+
+    /* Return the unused tail of the block. */
+    if ((1u << order) > pcount)
+        vr_free_range(vreg, *iblock + pcount, (1u << order) - pcount);
+
+    return vreg;
+}
+
+/**
+ * Get a single page from the per CPU cache.
+ */
+static struct vr_page * vr_pcache_get(void)
+{
+    struct vr_pcache * pc;
+    struct vr_page * pg = NULL;
+    istate_t istate;
+
+    istate = get_interrupt_state();
+    disable_interrupt();
+    pc = &vr_pcache[get_cpu_index()];
+    if (pc->count > 0)
+        pg = pc->pages[--pc->count];
+    set_interrupt_state(istate);
+
+    return pg;
+}
+
 /**
  * Get pcount number of unallocated pages.
- * @note needs to get vr_big_lock.
+ * Single pages are served from a per CPU cache that is refilled from the
+ * buddy allocator in batches.
  * @param[out] iblock is the returned index of the allocation made.
  * @param pcount is the number of pages requested.
  * @return Returns a pointer to the allocated vreg.
  */
 static struct vregion * get_iblocks(size_t * iblock, size_t pcount)
 {
-    struct vregion * vreg_temp;
-    struct vregion * vreg = NULL;
-    int err;
+    struct vr_page * batch[VR_PCACHE_SIZE / 2];
+    struct vregion * vreg;
+    struct vr_pcache * pc;
+    istate_t istate;
+    size_t n = 0;
 
-    mtx_lock(&vr_big_lock);
+    if (pcount == 1) {
+        struct vr_page * pg = vr_pcache_get();
 
-retry:
-    LIST_FOREACH(vreg_temp, &vrlist_head, _entry) {
-        if (bitmap_block_search(iblock, pcount, vreg_temp->map,
-                                vreg_temp->size) == 0) {
-            vreg = vreg_temp;
-            break; /* Found a block */
+        if (pg) {
+            *iblock = pg - pg->vreg->pages;
+            return pg->vreg;
         }
     }
 
-    if (!vreg) { /* Not found */
-        vreg = vreg_alloc_node(pcount);
-        if (!vreg)
-            goto out;
-        goto retry;
+    mtx_lock(&vr_big_lock);
+    vreg = bl_get_iblocks(iblock, pcount);
+    if (pcount == 1 && vreg) {
+        /* Refill the page cache, but don't grow for it. */
+        while (n < num_elem(batch)) {
+            struct vr_page * pg = vr_alloc_block(0);
+
+            if (!pg)
+                break;
+            batch[n++] = pg;
+        }
     }
-
-    err = bitmap_block_update(vreg->map, 1, *iblock, pcount, vreg->size);
-    KASSERT(err == 0, "vreg map update OOB");
-    vreg->count += pcount;
-    vralloc_used += VREG_BYTESIZE(pcount);
-out:
     mtx_unlock(&vr_big_lock);
+
+    if (n == 0)
+        return vreg;
+
+    istate = get_interrupt_state();
+    disable_interrupt();
+    pc = &vr_pcache[get_cpu_index()];
+    while (n > 0 && pc->count < VR_PCACHE_SIZE) {
+        pc->pages[pc->count++] = batch[--n];
+    }
+    set_interrupt_state(istate);
+
+    if (n > 0) { /* The cache was refilled meanwhile. */
+        mtx_lock(&vr_big_lock);
+        while (n > 0) {
+            struct vr_page * pg = batch[--n];
+
+            vr_free_block(pg->vreg, pg - pg->vreg->pages, 0);
+        }
+        mtx_unlock(&vr_big_lock);
+    }
+
     return vreg;
 }
 
 /**
- * vregion free callback.
- * This function is called by kobj.
+ * Free pages allocated with get_iblocks().
+ * @param vreg is the region of the allocation.
+ * @param iblock is the index of the first page.
+ * @param pcount is the number of pages.
  */
-static void vreg_free_callback(struct kobj * obj)
+static void put_iblocks(struct vregion * vreg, size_t iblock, size_t pcount)
 {
-    struct buf * bp = containerof(obj, struct buf, b_obj);
-    struct vregion * vreg = (struct vregion *)(bp->allocator_data);
-    const size_t bcount = VREG_PCOUNT(bp->b_bufsize);
-    size_t iblock;
-    int err;
+    struct vr_page * batch[VR_PCACHE_SIZE / 2];
+    struct vr_pcache * pc;
+    istate_t istate;
+    size_t n = 0;
+
+    if (pcount == 1) {
+        istate = get_interrupt_state();
+        disable_interrupt();
+        pc = &vr_pcache[get_cpu_index()];
+        if (pc->count == VR_PCACHE_SIZE) {
+            /* Move a half of the cache back to the buddy allocator. */
+            while (n < num_elem(batch)) {
+                batch[n++] = pc->pages[--pc->count];
+            }
+        }
+        pc->pages[pc->count++] = &vreg->pages[iblock];
+        set_interrupt_state(istate);
 
-    mtx_lock(&vr_big_lock);
+        if (n == 0)
+            return;
+
+        mtx_lock(&vr_big_lock);
+        while (n > 1) {
+            struct vr_page * pg = batch[--n];
+
+            vr_free_block(pg->vreg, pg - pg->vreg->pages, 0);
+            if (pg->vreg->count == 0) {
+                vr_release_node(pg->vreg);
+                mtx_lock(&vr_big_lock);
+            }
+        }
+        vreg = batch[0]->vreg;
+        iblock = batch[0] - vreg->pages;
+    } else {
+        mtx_lock(&vr_big_lock);
+    }
 
 #ifdef configVRALLOC_DEBUG
     KASSERT(vreg->magic == VREG_MAGIC_VALUE, "magic is correct");
 #endif
 
-    /* Get the iblock no. */
-    iblock = VREG_ADDR2I(vreg, bp->b_data);
-
-    err = bitmap_block_update(vreg->map, 0, iblock, bcount, vreg->size);
-    KASSERT(err == 0, "vreg map update OOB");
-    vreg->count -= bcount;
-
-    vralloc_used -= bp->b_bufsize; /* Update stats */
-
-    if (vreg->count == 0) { /* Free the vregion node */
-        LIST_REMOVE(vreg, _entry);
-        vralloc_all -= vreg->size * (4 * 8) * MMU_PGSIZE_COARSE;
+    vr_free_range(vreg, iblock, pcount);
+    vr_release_node(vreg);
+}
 
-        mtx_unlock(&vr_big_lock);
+/**
+ * vregion free callback.
+ * This function is called by kobj.
+ */
+static void vreg_free_callback(struct kobj * obj)
+{
+    struct buf * bp = containerof(obj, struct buf, b_obj);
+    struct vregion * vreg = (struct vregion *)(bp->allocator_data);
 
-        dynmem_free_region((void *)vreg->kaddr);
-        kfree(vreg);
-    } else {
-        mtx_unlock(&vr_big_lock);
-    }
+    put_iblocks(vreg, VREG_ADDR2I(vreg, bp->b_data),
+                VREG_PCOUNT(bp->b_bufsize));
+    atomic_sub(&vralloc_used, bp->b_bufsize); /* Update stats */
 
-    kfree(bp);
+    kmem_cache_free(&kmem_cache_buf, bp);
 }
 
 struct buf * geteblk(size_t size)
@@ -264,19 +580,21 @@ struct buf * geteblk(size_t size)
     struct vregion * vreg;
     struct buf * bp;
 
-    bp = kzalloc(sizeof(struct buf));
+    bp = kmem_cache_alloc(&kmem_cache_buf);
     if (!bp) {
         KERROR_DBG("%s: Can't allocate vm_region struct\n", __func__);
         return NULL;
     }
+    memset(bp, 0, sizeof(struct buf));
 
     vreg = get_iblocks(&iblock, pcount);
     if (!vreg) {
         KERROR_DBG("%s: Can't get vregion for a new buffer\n",
                    __func__);
-        kfree(bp);
+        kmem_cache_free(&kmem_cache_buf, bp);
         return NULL;
     }
+    atomic_add(&vralloc_used, VREG_BYTESIZE(pcount));
 
     mtx_init(&bp->lock, MTX_TYPE_TICKET, 0);
 
@@ -354,77 +672,53 @@ void allocbuf(struct buf * bp, size_t size)
     const size_t orig_size = size;
     const size_t new_size = memalign_size(size, MMU_PGSIZE_COARSE);
     const size_t pcount = VREG_PCOUNT(new_size);
-    const size_t blockdiff = pcount - VREG_PCOUNT(bp->b_bufsize);
-    size_t iblock;
-    size_t bcount = VREG_PCOUNT(bp->b_bufsize);
+    const size_t bcount = VREG_PCOUNT(bp->b_bufsize);
     struct vregion * vreg = bp->allocator_data;
 
     KASSERT(vreg, "bp->allocator_data should be always set");
 
-    if (bp->b_bufsize == new_size)
-        return;
-
     mtx_lock(&bp->lock);
-    mtx_lock(&vr_big_lock);
 
-    if (blockdiff > 0) {
-        const size_t sblock = VREG_ADDR2I(vreg, bp->b_data) + bcount;
-
-        if (bitmap_block_search_s(sblock, &iblock, blockdiff, vreg->map,
-                    vreg->size) == 0) {
-            if (iblock == sblock + 1) {
-                int err;
-                err = bitmap_block_update(vreg->map, 1, sblock, blockdiff,
-                                          vreg->size);
-                KASSERT(err == 0, "vreg map update OOB");
-            } else { /* Must allocate a new region */
-                struct vregion * nvreg;
-                uintptr_t new_addr;
-                int err;
-
-                nvreg = get_iblocks(&iblock, pcount);
-                if (!nvreg) {
-                    /*
-                     * It's not nice to panic here but we don't have any
-                     * method to inform the caller about OOM.
-                     */
-                    /* TODO We should probably kill the caller */
-                    panic("OOM during allocbuf()");
-                }
-
-                new_addr = VREG_I2ADDR(nvreg, iblock);
-                memcpy((void *)(new_addr), (void *)(bp->b_data), bp->b_bufsize);
-
-                bp->b_mmu.paddr = new_addr;
-                bp->b_data = bp->b_mmu.paddr; /* Currently this way as
-                                               * kernel space is 1:1 */
-                bp->allocator_data = nvreg;
-
-                /* Free blocks from old vreg */
-                err = bitmap_block_update(vreg->map, 0, iblock, bcount,
-                                          vreg->size);
-                KASSERT(err == 0, "vreg map update OOB");
-            }
+    if (pcount > bcount) {
+        struct vregion * nvreg;
+        uintptr_t new_addr;
+        size_t iblock;
+
+        /* Must allocate a new region */
+        nvreg = get_iblocks(&iblock, pcount);
+        if (!nvreg) {
+            /*
+             * It's not nice to panic here but we don't have any
+             * method to inform the caller about OOM.
+             */
+            /* TODO We should probably kill the caller */
+            panic("OOM during allocbuf()");
         }
-    } else {
-#if 0 /*
-       * We don't usually want to shrunk because it's hard to get memory back.
-       */
-        const size_t sblock = VREG_ADDR2I(vreg, bp->b_data) + bcount +
-                              blockdiff;
-        int err;
-
-        err = bitmap_block_update(vreg->map, 0, sblock, -blockdiff, vreg->size);
-        KASSERT(err == 0, "vreg map update OOB");
-#endif
+
+        new_addr = VREG_I2ADDR(nvreg, iblock);
+        memcpy((void *)(new_addr), (void *)(bp->b_data), bp->b_bufsize);
+        memset((void *)(new_addr + bp->b_bufsize), 0,
+               new_size - bp->b_bufsize);
+
+        /* Free blocks from old vreg */
+        put_iblocks(vreg, VREG_ADDR2I(vreg, bp->b_data), bcount);
+
+        bp->b_mmu.paddr = new_addr;
+        bp->b_data = bp->b_mmu.paddr; /* Currently this way as
+                                       * kernel space is 1:1 */
+        bp->allocator_data = nvreg;
+    } else if (pcount < bcount) {
+        /* The buddy allocator merges the freed tail with its neighbours. */
+        put_iblocks(vreg, VREG_ADDR2I(vreg, bp->b_data) + pcount,
+                    bcount - pcount);
     }
+    atomic_add(&vralloc_used, (int)new_size - (int)bp->b_bufsize);
 
     bp->b_bufsize = new_size;
     bp->b_bcount = orig_size;
     bp->b_mmu.num_pages = pcount;
 
     mtx_unlock(&bp->lock);
-    mtx_unlock(&vr_big_lock);
 }
 
 void vrfree(struct buf * bp)
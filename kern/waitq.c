@@ -0,0 +1,151 @@
+/**
+ *******************************************************************************
+ * @file    waitq.c
+ * @author  Olli Vanhoja
+ * @brief   Kernel wait queues.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+#include <hal/core.h>
+#include <thread.h>
+#include <waitq.h>
+
+void waitq_init(struct waitq * wq)
+{
+    mtx_init(&wq->wq_lock, MTX_TYPE_SPIN, MTX_OPT_DINT);
+    STAILQ_INIT(&wq->wq_head);
+}
+
+/**
+ * Queue a waiter.
+ * @note wq_lock must be held.
+ */
+static void wq_insert(struct waitq * wq, struct waitq_entry * we)
+{
+    if (!we->queued) {
+        STAILQ_INSERT_TAIL(&wq->wq_head, we, entry_);
+        we->queued = 1;
+        we->woken = 0;
+    }
+}
+
+/**
+ * Block the current thread unless it has been woken up since it was queued.
+ * wq_lock keeps interrupts disabled, so a wakeup either sets woken before
+ * we test it or finds the thread already blocked and readies it.
+ */
+static void wq_block(struct waitq * wq, struct waitq_entry * we)
+{
+    mtx_lock(&wq->wq_lock);
+    if (we->woken) {
+        mtx_unlock(&wq->wq_lock);
+        return;
+    }
+    thread_state_set(current_thread, THREAD_STATE_BLOCKED);
+    mtx_unlock(&wq->wq_lock);
+
+    while (thread_state_get(current_thread) != THREAD_STATE_EXEC) {
+        idle_sleep();
+    }
+}
+
+void waitq_prepare(struct waitq * wq, struct waitq_entry * we)
+{
+    we->tid = current_thread->id;
+    we->queued = 0;
+    we->woken = 0;
+
+    mtx_lock(&wq->wq_lock);
+    wq_insert(wq, we);
+    mtx_unlock(&wq->wq_lock);
+}
+
+void waitq_sleep(struct waitq * wq, struct waitq_entry * we)
+{
+    wq_block(wq, we);
+
+    mtx_lock(&wq->wq_lock);
+    wq_insert(wq, we);
+    mtx_unlock(&wq->wq_lock);
+}
+
+void waitq_finish(struct waitq * wq, struct waitq_entry * we)
+{
+    mtx_lock(&wq->wq_lock);
+    if (we->queued) {
+        STAILQ_REMOVE(&wq->wq_head, we, waitq_entry, entry_);
+        we->queued = 0;
+    }
+    mtx_unlock(&wq->wq_lock);
+}
+
+void waitq_sleep_mtx(struct waitq * wq, mtx_t * mtx)
+{
+    struct waitq_entry we;
+
+    waitq_prepare(wq, &we);
+    mtx_unlock(mtx);
+
+    wq_block(wq, &we);
+
+    waitq_finish(wq, &we);
+    mtx_lock(mtx);
+}
+
+/**
+ * Dequeue and wakeup a waiter.
+ * @note wq_lock must be held.
+ */
+static void wq_wakeup(struct waitq * wq, struct waitq_entry * we)
+{
+    STAILQ_REMOVE_HEAD(&wq->wq_head, entry_);
+    we->queued = 0;
+    we->woken = 1;
+    thread_release(we->tid);
+}
+
+void waitq_wakeup_one(struct waitq * wq)
+{
+    struct waitq_entry * we;
+
+    mtx_lock(&wq->wq_lock);
+    we = STAILQ_FIRST(&wq->wq_head);
+    if (we)
+        wq_wakeup(wq, we);
+    mtx_unlock(&wq->wq_lock);
+}
+
+void waitq_wakeup_all(struct waitq * wq)
+{
+    struct waitq_entry * we;
+
+    mtx_lock(&wq->wq_lock);
+    while ((we = STAILQ_FIRST(&wq->wq_head))) {
+        wq_wakeup(wq, we);
+    }
+    mtx_unlock(&wq->wq_lock);
+}
@@ -0,0 +1,67 @@
+/**
+ *******************************************************************************
+ * @file    splice.c
+ * @author  Olli Vanhoja
+ * @brief   Splice data to/from a pipe.
+ * @section LICENSE
+ * Copyright (c) 2019 Olli Vanhoja <olli.vanhoja@cs.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+#define __SYSCALL_DEFS__
+#include <stddef.h>
+#include <syscall.h>
+#include <fcntl.h>
+
+ssize_t splice(int fd_in, off_t * off_in, int fd_out, off_t * off_out,
+               size_t len, unsigned flags)
+{
+    struct _fs_splice_args args = {
+        .fd_in = fd_in,
+        .fd_out = fd_out,
+        .len = len,
+        .flags = flags,
+    };
+    ssize_t retval;
+
+    if (off_in) {
+        args.off_in = *off_in;
+        args.flags |= _SPLICE_F_OFF_IN;
+    }
+    if (off_out) {
+        args.off_out = *off_out;
+        args.flags |= _SPLICE_F_OFF_OUT;
+    }
+
+    retval = (ssize_t)syscall(SYSCALL_FS_SPLICE, &args);
+    if (retval >= 0) {
+        if (off_in)
+            *off_in = args.off_in;
+        if (off_out)
+            *off_out = args.off_out;
+    }
+
+    return retval;
+}
@@ -34,6 +34,7 @@
 #include <stdarg.h>
 #include <sys/ioctl.h>
 #include <sys/fb.h>
+#include <sys/md.h>
 #include <syscall.h>
 #include <termios.h>
 
@@ -67,6 +68,14 @@ int ioctl(int fildes, int request, ... /* arg */)
         arg = va_arg(ap, struct fb_resolution *);
         arg_len = sizeof(struct fb_resolution);
         break;
+    case IOCTL_MD_CREAT:
+        arg = va_arg(ap, struct md_ioctl *);
+        arg_len = sizeof(struct md_ioctl);
+        break;
+    case IOCTL_MD_DESTROY:
+        arg = va_arg(ap, int *);
+        arg_len = sizeof(int);
+        break;
     case TIOCGWINSZ:
     case TIOCSWINSZ:
         arg = va_arg(ap, struct winsize *);